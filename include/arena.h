@@ -0,0 +1,100 @@
+#ifndef NEXER_ARENA_H_
+#define NEXER_ARENA_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include "non_copyable.h"
+
+namespace nexer {
+
+// A bump allocator released in bulk by Reset(). Chunks are kept across resets,
+// so once an arena has grown to fit a typical workload it no longer mallocs.
+class Arena : NonCopyable {
+  private:
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+
+    size_t chunk_size_;
+    Chunk* head_;
+    Chunk* current_;
+    size_t used_;
+
+    static char* base(Chunk* chunk) {
+        return (char*)chunk + sizeof(Chunk);
+    }
+
+    Chunk* NewChunk(size_t size, Chunk* next) {
+        Chunk* chunk = (Chunk*)malloc(sizeof(Chunk) + size);
+        chunk->next = next;
+        chunk->size = size;
+        return chunk;
+    }
+
+    inline bool IsLast(std::string_view view) const {
+        return current_ && view.data() + view.size() == base(current_) + used_;
+    }
+
+  public:
+    Arena(size_t chunk_size = 4096) : chunk_size_(chunk_size), head_(nullptr), current_(nullptr), used_(0) {}
+
+    ~Arena() {
+        while (head_) {
+            Chunk* next = head_->next;
+            free(head_);
+            head_ = next;
+        }
+    }
+
+    char* Allocate(size_t size) {
+        while (current_ == nullptr || current_->size - used_ < size) {
+            Chunk* next = current_ ? current_->next : head_;
+            if (next == nullptr || next->size < size) {
+                next = NewChunk(size > chunk_size_ ? size : chunk_size_, next);
+                if (current_) {
+                    current_->next = next;
+                } else {
+                    head_ = next;
+                }
+            }
+            current_ = next;
+            used_ = 0;
+        }
+        char* p = base(current_) + used_;
+        used_ += size;
+        return p;
+    }
+
+    std::string_view Copy(const char* s, size_t len) {
+        char* p = Allocate(len);
+        memcpy(p, s, len);
+        return {p, len};
+    }
+
+    // Returns a view of `view` followed by s[0..len). Grows in place when
+    // `view` is the most recent allocation, otherwise copies both parts.
+    std::string_view Append(std::string_view view, const char* s, size_t len) {
+        if (IsLast(view) && current_->size - used_ >= len) {
+            memcpy(base(current_) + used_, s, len);
+            used_ += len;
+            return {view.data(), view.size() + len};
+        }
+        char* p = Allocate(view.size() + len);
+        memcpy(p, view.data(), view.size());
+        memcpy(p + view.size(), s, len);
+        return {p, view.size() + len};
+    }
+
+    void Reset() {
+        current_ = head_;
+        used_ = 0;
+    }
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_ARENA_H_
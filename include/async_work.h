@@ -4,25 +4,30 @@
 #include <functional>
 
 #include "event_loop.h"
+#include "executor.h"
 #include "non_copyable.h"
 
 namespace nexer {
 
+// Runs a function off the loop on an executor, through the loop's own work
+// queue unless one is given, then calls on_end on the loop
 class AsyncWork : NonCopyable {
   private:
-    uv_work_t request_;
-    std::function<void()> work_;
+    WorkQueue &queue_;
+    Executor::Job job_;
     std::function<void(int)> on_end_;
 
-    static void Work(uv_work_t *work);
-    static void AfterWork(uv_work_t *work, int status);
-
   public:
-    AsyncWork(EventLoop &loop);
+    AsyncWork(EventLoop &loop, Executor::Priority priority = Executor::Priority::Normal);
+    AsyncWork(WorkQueue &queue, Executor::Priority priority = Executor::Priority::Normal);
     inline void OnEnd(std::function<void(int)> cb) {
         on_end_ = cb;
     }
     void Start(std::function<void()> work);
+
+    // Succeeds only if the work has not started yet, in which case on_end
+    // is called with UV_ECANCELED
+    bool Cancel();
 };
 
 }  // namespace nexer
@@ -24,25 +24,165 @@ struct Command {
     int timeout = 0;
 };
 
+// A command, or one of the checks nexer runs itself without spawning a
+// process. Native checks pass when a connection can be made (tcp, unix), or
+// when a GET returns a 2xx or 3xx status (http).
+struct Checker : Command {
+    enum class Type {
+        Command,
+        Tcp,
+        Http,
+        Unix,
+    };
+    Type type = Type::Command;
+    std::string host = "127.0.0.1";
+    int port = 0;
+    // Request path for http, socket path for unix
+    std::string path;
+};
+
 struct App {
     std::string name;
     Command command;
-    Command *checker = nullptr;
+    Checker *checker = nullptr;
     int max_start_time = 0;
+    // Milliseconds between background checks; 0 checks only on demand
+    int probe_interval = 0;
+    // Failed probes in a row after which the app is restarted
+    int probe_failures = 3;
+    // Bytes of recent output kept for the admin server; 0 keeps none
+    int log_size = 65536;
+    // Milliseconds without connections through proxies or UDP sessions
+    // after which the app's process is stopped, to be started again when
+    // next required; 0 leaves it running. An app started with none, such
+    // as a warm one, counts from when it became healthy.
+    int idle_stop_after = 0;
+    // Milliseconds a process stopped for being idle has to exit after
+    // SIGTERM before it is killed
+    int stop_timeout = 5000;
+    // Started when nexer starts rather than on first use. Warming is not a
+    // use: a warm app with idle_stop_after is stopped like any other if
+    // nothing uses it, and not warmed again after.
+    bool warm = false;
     std::vector<const App *> preamble;
     std::vector<std::string> tags;
 };
 
+// TLS towards clients (the proxy's certificate and key) or towards an
+// upstream (the CAs to verify it with)
+struct Tls {
+    bool enabled = false;
+    std::string cert;
+    std::string key;
+    // A file of CA certificates; the system's when empty
+    std::string ca;
+    bool verify = true;
+    // Sent as SNI and verified against the upstream's certificate; the
+    // upstream host when empty
+    std::string server_name;
+    // Hands the record layer to the kernel after the handshake if it can
+    bool ktls = true;
+};
+
+// A second upstream that gets a copy of what clients send, e.g. a replica
+// under test. What it sends back is discarded.
+struct Mirror {
+    std::string host = "127.0.0.1";
+    int port = 0;
+    std::string path;
+    // Percentage of connections mirrored
+    int sample = 100;
+    // Bytes a connection may have queued for the mirror. Past that its
+    // mirror connection is dropped, so the stream it sees is never cut short
+    // in the middle.
+    int max_pending = 1 << 20;
+
+    inline bool enabled() const {
+        return port > 0 || !path.empty();
+    }
+};
+
+// Recording of the sessions of a proxy, see Recorder
+struct Record {
+    std::string file;  // empty for none
+    // Ring the loop copies records into for the writer thread; records that
+    // do not fit are dropped
+    int buffer_size = 4 << 20;
+};
+
 struct Upstream {
     std::string host;
     int port = 0;
+    // Unix domain socket to connect to instead of host:port
+    std::string path;
+    // Ports from port on, one for each listening port of the proxy
+    int port_count = 1;
     int connect_timeout = 30000;
+    // Connect first and only check/start the app when that fails
+    bool optimistic = false;
+    // Connections taking longer than this (ms) to be established have their
+    // timeline logged; 0 disables it
+    int slow_connect = 5000;
+    // Connections at once, further ones are closed right away; 0 for no limit
+    int max_connections = 0;
+    // Connections waiting for the app to be checked or started. Once that
+    // many are waiting, new ones are closed right away; 0 for no limit
+    int max_waiting = 0;
+    // Milliseconds a connection may wait for the app; 0 for no limit
+    int wait_timeout = 0;
+    // Bytes per second each way through the proxy as a whole, and through
+    // each of its connections; 0 for no limit
+    int rate_limit = 0;
+    int connection_rate_limit = 0;
+    // Bytes let through at once after a quiet spell; 0 for a second's worth
+    int rate_burst = 0;
+    int connection_rate_burst = 0;
+    // PROXY protocol version (1 or 2) of the header telling the upstream
+    // the client's address; 0 for none
+    int proxy_protocol = 0;
+    Tls tls;
+    Mirror mirror;
+    // Set for upstreams reached through the tunnel listener of another
+    // nexer, given as host "nexer://name:port": port is then one on that
+    // nexer's side. Upstreams naming the same one with the same secret share
+    // its connection.
+    std::string tunnel_host;
+    int tunnel_port = 0;
+    // The secret of that nexer's tunnel listener, if it has one
+    std::string tunnel_secret;
+    // Of streams through the tunnel, 0 going first and 7 last
+    int priority = 4;
     const App *app;
     std::vector<std::string> tags;
 };
 
 struct Proxy {
+    enum class Protocol {
+        Tcp,
+        Udp,
+    };
+    Protocol protocol = Protocol::Tcp;
+    // Address to bind, IPv4 or IPv6
+    std::string host = "0.0.0.0";
     int port = 0;
+    // Unix domain socket to listen on instead of a port
+    std::string path;
+    // Listening on a range of ports, e.g. "10000-10999", each connected to
+    // the upstream port at the same offset
+    int port_count = 1;
+    // Connections start with a PROXY protocol header (either version), as
+    // sent by a load balancer in front
+    bool accept_proxy_protocol = false;
+    // Milliseconds a connection has to send that header before it is closed
+    int proxy_header_timeout = 5000;
+    // Terminates TLS from clients
+    Tls tls;
+    Record record;
+    // Milliseconds after which an inactive UDP session is dropped
+    int idle_timeout = 60000;
+    // The upstream app is started when nexer starts rather than by the
+    // first connection
+    bool warm = false;
     Upstream upstream;
 };
 
@@ -55,6 +195,28 @@ struct Logger {
     ::Logger::Level level = ::Logger::Level::INFO;
 };
 
+// Listener for tunnel connections from other nexers, see TunnelServer
+struct Tunnel {
+    std::string host = "127.0.0.1";
+    int port = 0;  // 0 for none
+    // Shared with the nexers connecting, which have to prove they know it;
+    // required to listen on anything but the loopback interface
+    std::string secret;
+    // Ports on the loopback interface streams may be connected to
+    std::vector<int> allow;
+    int connect_timeout = 5000;
+};
+
+// Forwarding of established TCP connections through io_uring rather than
+// libuv, see Uring
+struct Uring {
+    bool enabled = false;
+    int entries = 4096;  // of the submission queue
+    // Receive buffers provided to the kernel, shared by all connections
+    int buffers = 4096;
+    int buffer_size = 16384;
+};
+
 struct Dummy {
     enum class Type {
         Udp,
@@ -72,6 +234,12 @@ class Config {
   private:
     config::Admin admin_;
     config::Logger logger_;
+    config::Uring uring_;
+    config::Tunnel tunnel_;
+    // Apps started at once while warming up
+    int warm_concurrency_;
+    // Threads running blocking work off the event loop
+    int executor_threads_;
     std::vector<config::Proxy> proxies_;
     std::vector<config::App *> apps_;
     std::map<std::string, config::App *> app_map_;
@@ -102,6 +270,18 @@ class Config {
     inline auto& logger() {
         return logger_;
     }
+    inline auto& uring() {
+        return uring_;
+    }
+    inline auto& tunnel() {
+        return tunnel_;
+    }
+    inline int warm_concurrency() {
+        return warm_concurrency_;
+    }
+    inline int executor_threads() {
+        return executor_threads_;
+    }
 
     config::App *GetApp(const std::string &name);
 };
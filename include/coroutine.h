@@ -0,0 +1,172 @@
+#ifndef NEXER_COROUTINE_H_
+#define NEXER_COROUTINE_H_
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+
+#include "event_loop.h"
+#include "function_list.h"
+#include "process.h"
+#include "process_manager.h"
+#include "tcp_client.h"
+#include "timer.h"
+
+namespace nexer {
+
+// A coroutine that starts right away and is detached from its caller: it
+// runs until its first co_await, is resumed from loop callbacks and frees
+// its frame when it returns. Frames up to kFrameSize come from a pool, so
+// once warm a flow costs no malloc for the frame.
+struct Task {
+    static const size_t kFrameSize = 1024;
+
+    struct promise_type {
+        Task get_return_object() {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+
+        static void *operator new(size_t size);
+        static void operator delete(void *frame, size_t size);
+    };
+};
+
+// The awaitables below suspend until a loop callback fires. Whatever they
+// are waiting on must not go away without that callback being called, as
+// the coroutine would then never be resumed.
+
+// Resumes after ms milliseconds
+struct Sleep {
+    EventLoop &loop;
+    uint64_t ms;
+
+    bool await_ready() const {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>);
+    void await_resume() const {}
+};
+
+// Connects as TcpClient::Connect does, or to the Unix domain socket at path
+// when set, resuming with the connected client or null after timeout
+struct Connect {
+    EventLoop &loop;
+    const char *host;
+    int port;
+    uint64_t timeout;
+    std::function<void(TcpClient &)> on_try = {};
+    const char *path = nullptr;
+    // Tries right away rather than after the first retry interval
+    bool immediate = false;
+
+    TcpClient *client = nullptr;
+
+    bool await_ready() const {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>);
+    TcpClient *await_resume() const {
+        return client;
+    }
+};
+
+// Resumes with the next data read from client, empty once it is closed or
+// fails. Reading is stopped in between, so nothing is read while the
+// coroutine is not waiting.
+class Read {
+  private:
+    TcpClient &client_;
+    std::string data_;
+    FunctionList<void>::Remove remove_data_;
+    FunctionList<void>::Remove remove_error_;
+    FunctionList<void>::Remove remove_close_;
+
+  public:
+    Read(TcpClient &client) : client_(client) {}
+    ~Read();
+
+    bool await_ready() const {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>);
+    std::string await_resume() {
+        return std::move(data_);
+    }
+};
+
+// Writes len bytes to client, resuming with 0 once they are sent or with
+// the error. Other writes to client must not be in flight.
+class Write {
+  private:
+    TcpClient &client_;
+    const char *data_;
+    size_t len_;
+    int error_;
+    FunctionList<void>::Remove remove_send_;
+    FunctionList<void>::Remove remove_error_;
+    FunctionList<void>::Remove remove_close_;
+
+  public:
+    Write(TcpClient &client, const char *data, size_t len) : client_(client), data_(data), len_(len), error_(0) {}
+    ~Write();
+
+    bool await_ready() const {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>);
+    int await_resume() const {
+        return error_;
+    }
+};
+
+// ProcessManager::Require, resuming with its error
+struct Require {
+    ProcessManager &manager;
+    const config::App &app;
+
+    int error = 0;
+
+    bool await_ready() const {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>);
+    int await_resume() const {
+        return error;
+    }
+};
+
+// Resumes with the exit code once process exits, right away if it is not
+// running
+class WaitExit {
+  private:
+    Process &process_;
+    FunctionList<void>::Remove remove_exit_;
+
+  public:
+    WaitExit(Process &process) : process_(process) {}
+    ~WaitExit();
+
+    bool await_ready() const {
+        return !process_.IsRunning();
+    }
+    void await_suspend(std::coroutine_handle<>);
+    int64_t await_resume() const {
+        return process_.GetExitCode();
+    }
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_COROUTINE_H_
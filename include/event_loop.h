@@ -6,9 +6,15 @@
 
 namespace nexer {
 
+class Executor;
+class WorkQueue;
+
 class EventLoop {
   private:
     uv_loop_t loop_;
+    char *slab_;
+    Executor *executor_;
+    WorkQueue *work_queue_;
 
     void Close();
 
@@ -21,6 +27,20 @@ class EventLoop {
     }
 
     bool Run();
+
+    // A receive buffer shared by the handles of this loop. Its content is
+    // only valid until the read callback that filled it returns.
+    uv_buf_t slab();
+
+    // Runs the work queue on executor, which must outlive the loop. Only
+    // takes effect before the first call to work_queue().
+    void SetExecutor(Executor &executor);
+
+    // Where AsyncWork of this loop goes, on the executor set above or else
+    // one shared by all loops; created on first use and closed with the loop
+    WorkQueue &work_queue();
+
+    static const size_t kSlabSize = 16 * 64 * 1024;
 };
 
 }  // namespace nexer
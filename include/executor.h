@@ -0,0 +1,166 @@
+#ifndef NEXER_EXECUTOR_H_
+#define NEXER_EXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "event_loop.h"
+#include "handle.h"
+#include "json_writer.h"
+#include "non_copyable.h"
+
+namespace nexer {
+
+class WorkQueue;
+
+// A fixed set of threads running jobs off the event loop, apart from
+// libuv's pool which getaddrinfo and fs requests queue on. Each thread has
+// a queue per priority; a thread with nothing queued takes the oldest job
+// of another thread, higher priorities first. Jobs are submitted and
+// completed through a WorkQueue on the submitting loop.
+class Executor : NonCopyable {
+  public:
+    enum class Priority : uint8_t {
+        High,
+        Normal,
+        Low,
+    };
+
+    struct Job {
+        std::function<void()> work;
+        // Called on the loop once work has run, with UV_ECANCELED if it was
+        // cancelled before starting
+        std::function<void(int)> on_end;
+        Priority priority = Priority::Normal;
+
+        // Set when submitted
+        WorkQueue *queue = nullptr;
+        size_t worker = 0;
+        uint64_t queued_at = 0;
+        int status = 0;
+    };
+
+    // Times are in microseconds
+    struct Stats {
+        size_t threads;
+        uint64_t submitted;
+        uint64_t completed;
+        uint64_t cancelled;
+        uint64_t stolen;
+        size_t queued;
+        size_t running;
+        uint64_t wait_time;  // from submission to start, total
+        uint64_t max_wait;
+        uint64_t run_time;   // total
+        uint64_t max_run;
+    };
+
+    static const size_t kDefaultThreads = 4;
+
+  private:
+    static const size_t kPriorities = 3;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job *> queues[kPriorities];
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_;
+    std::atomic<size_t> next_;
+    std::atomic<size_t> queued_;
+    std::atomic<size_t> running_;
+
+    struct {
+        std::atomic<uint64_t> submitted;
+        std::atomic<uint64_t> completed;
+        std::atomic<uint64_t> cancelled;
+        std::atomic<uint64_t> stolen;
+        std::atomic<uint64_t> wait_time;
+        std::atomic<uint64_t> max_wait;
+        std::atomic<uint64_t> run_time;
+        std::atomic<uint64_t> max_run;
+    } stats_;
+
+    void Run(size_t index);
+    Job *Take(size_t index);
+    void Push(Job *, size_t worker);
+
+    void Submit(Job *);
+    void Submit(const std::vector<Job *> &);
+    bool Cancel(Job *);
+
+    friend class WorkQueue;
+
+  public:
+    Executor(size_t threads = kDefaultThreads);
+
+    // Runs what is still queued, then joins the threads
+    ~Executor();
+
+    inline size_t threads() const {
+        return workers_.size();
+    }
+
+    Stats GetStats();
+
+    // Writes the stats as a JSON object
+    void WriteStatus(JsonWriter &);
+};
+
+// Submits jobs to an executor on behalf of a loop and runs their on_end on
+// it. The async handle only keeps the loop alive while jobs are out; the
+// queue must not be closed until they have all ended.
+class WorkQueue : public Handle {
+  private:
+    uv_async_t async_;
+    Executor &executor_;
+    // Jobs done by the executor, not yet handed back to the loop
+    std::mutex mutex_;
+    std::vector<Executor::Job *> done_;
+    // Jobs submitted and not yet ended, only touched on the loop
+    size_t outstanding_;
+
+    inline uv_handle_t *handle() override {
+        return (uv_handle_t *)&async_;
+    }
+
+    static void OnAsync(uv_async_t *);
+
+    void Hold(size_t n);
+    void Deliver(Executor::Job *);
+
+    WorkQueue(EventLoop &, Executor &);
+
+    friend class Executor;
+
+  public:
+    static WorkQueue &Create(EventLoop &, Executor &);
+
+    inline Executor &executor() {
+        return executor_;
+    }
+
+    void Submit(Executor::Job &);
+
+    // Queues the jobs at once, waking as many threads as needed
+    void Submit(const std::vector<Executor::Job *> &);
+
+    // Takes the job off the queue if it has not started yet; its on_end is
+    // then called with UV_ECANCELED on the next loop iteration
+    bool Cancel(Executor::Job &);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_EXECUTOR_H_
@@ -9,6 +9,10 @@ namespace nexer {
 template <typename T, typename... U>
 class FunctionList {
     std::list<std::function<T(U...)>> fn_list_;
+    // Functions removed while the list is being invoked are only cleared
+    // then, and erased once it is done
+    int invoking_ = 0;
+    bool removed_ = false;
 
   public:
     typedef std::function<void()> Remove;
@@ -16,12 +20,32 @@ class FunctionList {
     Remove Add(std::function<T(U...)> fn) {
         fn_list_.push_back(fn);
         auto it = std::prev(fn_list_.end());
-        return [this, it] { fn_list_.erase(it); };
+        return [this, it] {
+            if (invoking_ > 0) {
+                *it = nullptr;
+                removed_ = true;
+            } else {
+                fn_list_.erase(it);
+            }
+        };
+    }
+
+    inline bool empty() const {
+        return fn_list_.empty();
     }
 
     void Invoke(U... args) {
+        invoking_++;
         for (auto& fn : fn_list_) {
-            fn(args...);
+            if (fn) {
+                fn(args...);
+            }
+        }
+        if (--invoking_ == 0 && removed_) {
+            removed_ = false;
+            fn_list_.remove_if([](const std::function<T(U...)>& fn) {
+                return !fn;
+            });
         }
     }
 };
@@ -0,0 +1,50 @@
+#ifndef NEXER_HEALTH_CHECK_H_
+#define NEXER_HEALTH_CHECK_H_
+
+#include "config.h"
+#include "llhttp.h"
+#include "tcp_client.h"
+#include "timer.h"
+
+namespace nexer {
+
+// Runs a native checker (tcp, http or unix) on the event loop. `then` gets
+// 0 when the check passed, the response status when an http check got a
+// status other than 2xx/3xx, or a negative error code; UV_ETIMEDOUT if the
+// checker's timeout expired first.
+class HealthCheck : NonCopyable {
+  private:
+    const config::Checker &config_;
+    Then<int> then_;
+
+    Timer *timer_;
+    TcpClient *client_;
+    uv_pipe_t *pipe_;
+    uv_connect_t connect_req_;
+
+    llhttp_t parser_;
+    int status_;
+    bool done_;
+
+    static llhttp_settings_t *parser_settings();
+    static int OnHeadersComplete(llhttp_t *);
+    static void OnPipeConnect(uv_connect_t *, int status);
+    static void OnPipeClose(uv_handle_t *);
+
+    void Start(EventLoop &);
+    void ConnectTcp(EventLoop &);
+    void ConnectUnix(EventLoop &);
+    void SendRequest();
+    void OnData(const char *, size_t);
+    void Finish(int result);
+    void Release();
+
+    HealthCheck(const config::Checker &, Then<int>);
+
+  public:
+    static void Run(EventLoop &, const config::Checker &, Then<int>);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_HEALTH_CHECK_H_
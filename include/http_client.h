@@ -3,7 +3,6 @@
 
 #include <curl/curl.h>
 
-#include "string_buffer.h"
 #include "http_message.h"
 
 namespace nexer {
@@ -3,7 +3,11 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "arena.h"
+#include "io_buffer.h"
 #include "llhttp.h"
 #include "non_copyable.h"
 #include "string_buffer.h"
@@ -14,21 +18,21 @@ namespace nexer {
 
 namespace http {
 
+// Key and value point into the read buffer while it is being parsed, and
+// into the message arena once the message is complete or Parse() returns.
 struct Header {
-    std::string key;
-    std::string value;
+    std::string_view key;
+    std::string_view value;
 
-    Header(const char *s, size_t len) {
-        key.append(s, len);
-    }
+    Header(const char *s, size_t len) : key(s, len) {}
 };
 
 class Response {
   protected:
     int status_;
 
-    StringBuffer head_;
-    StringBuffer body_;
+    IoBuffer head_;
+    IoBuffer body_;
 
     void Reset();
 
@@ -39,11 +43,11 @@ class Response {
         return status_;
     }
 
-    StringBuffer &head() {
+    IoBuffer &head() {
         return head_;
     }
 
-    StringBuffer &body() {
+    IoBuffer &body() {
         return body_;
     }
 
@@ -64,16 +68,29 @@ namespace outgoing {
 
 class Response : public nexer::http::Response {
   private:
-    StringBuffer start_line_;
     TcpClient* client_;
-    uv_buf_t buf_[3];
+    bool streaming_ = false;
 
     void Reset();
+    void WriteHead(const char *framing);
 
     friend class incoming::Request;
 
   public:
     void End(int status=0);
+
+    // Sends the head and the body written so far with chunked encoding.
+    // Later body content is sent by Flush() until End().
+    void Begin(int status=0);
+    void Flush();
+
+    inline bool IsStreaming() const {
+        return streaming_;
+    }
+
+    inline TcpClient& client() {
+        return *client_;
+    }
 };
 
 }  // namespace outgoing
@@ -89,6 +106,15 @@ class Message : NonCopyable {
         bool complete;
     } parser_state_;
 
+    // The buffer being parsed; views into it are moved to arena_ before the
+    // message is handed on as complete, or before Parse() returns, so that
+    // handlers may keep using them after the read buffer is reused.
+    struct {
+        const char *data;
+        size_t size;
+    } input_;
+
+    Arena arena_;
     std::vector<Header> headers_;
     StringBuffer body_;
 
@@ -101,6 +127,10 @@ class Message : NonCopyable {
     static int ParserOnBody(llhttp_t *parser, const char *s, size_t len);
     static int ParserOnMessageComplete(llhttp_t *parser);
 
+    std::string_view Extend(std::string_view, const char *, size_t);
+    bool Pin(std::string_view&);
+    virtual void Pin();
+
     void Reset();
 
   public:
@@ -122,11 +152,20 @@ class Message : NonCopyable {
     inline bool IsComplete() {
         return parser_state_.complete;
     }
+
+    inline const std::vector<Header>& headers() const {
+        return headers_;
+    }
+
+    // Case-insensitive lookup; returns an empty view if the header is absent
+    std::string_view GetHeader(std::string_view name) const;
 };
 
+// Headers, URL components and query parameters are views that stay valid until
+// the request is reset for the next message on the connection.
 class Request : public Message {
   private:
-    std::string url_string_;
+    std::string_view url_string_;
     Url url_;
 
     outgoing::Response response_;
@@ -136,8 +175,10 @@ class Request : public Message {
     TcpClient &client_;
 
     void Reset();
+    void Pin() override;
 
     friend class http::Server;
+    friend class Message;
 
   public:
     Request(Server&, TcpClient&);
@@ -150,7 +191,7 @@ class Request : public Message {
         return url_;
     }
 
-    std::string &url_string() {
+    std::string_view url_string() {
         return url_string_;
     }
 
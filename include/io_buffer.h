@@ -0,0 +1,111 @@
+#ifndef NEXER_IO_BUFFER_H_
+#define NEXER_IO_BUFFER_H_
+
+#include <deque>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "non_copyable.h"
+#include "uv.h"
+
+namespace nexer {
+
+// A chain of reference-counted segments for streaming I/O. Appending never
+// moves bytes already in the buffer, consuming only advances offsets, and
+// splitting or cloning shares segments instead of copying them.
+class IoBuffer : public std::ostream, NonCopyable {
+  public:
+    struct Segment {
+        int refs;
+        size_t capacity;
+        size_t used;
+
+        inline char *data() {
+            return (char *)(this + 1);
+        }
+    };
+
+    static const size_t kSegmentSize = 4096;
+
+  private:
+    struct Slice {
+        Segment *segment;
+        size_t offset;
+        size_t length;
+
+        inline char *data() const {
+            return segment->data() + offset;
+        }
+    };
+
+    class StreamBuf : public std::streambuf {
+      private:
+        IoBuffer *buffer_;
+
+      public:
+        StreamBuf(IoBuffer *buffer) : buffer_(buffer) {}
+
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char *s, std::streamsize n) override;
+    };
+
+    StreamBuf streambuf_;
+    std::deque<Slice> slices_;
+    size_t size_;
+    size_t segment_size_;
+
+    // An emptied segment kept back for the next append
+    Segment *spare_;
+
+    Segment *Acquire(size_t capacity);
+    void Release(Segment *);
+    Slice *WritableTail();
+
+  public:
+    IoBuffer(size_t segment_size = kSegmentSize);
+    ~IoBuffer();
+
+    inline size_t size() const {
+        return size_;
+    }
+
+    inline bool empty() const {
+        return size_ == 0;
+    }
+
+    // Number of slices, i.e. the number of uv_buf_t Export() may produce
+    inline size_t segments() const {
+        return slices_.size();
+    }
+
+    IoBuffer &Write(const char *s, size_t n);
+    IoBuffer &Prepend(const char *s, size_t n);
+
+    // Moves all of other's data to the end of this buffer
+    void Append(IoBuffer &other);
+
+    // Appends other's data by sharing its segments
+    void Clone(const IoBuffer &other);
+
+    // Moves the first n bytes to the end of head
+    void Split(size_t n, IoBuffer &head);
+
+    void Consume(size_t n);
+    void Clear();
+
+    // Exposes at least n writable bytes at the end; Commit() appends the
+    // part that was actually filled.
+    uv_buf_t Reserve(size_t n);
+    void Commit(size_t n);
+
+    size_t Export(uv_buf_t *bufs, size_t max) const;
+    size_t CopyTo(char *dst, size_t max) const;
+    std::string ToString() const;
+
+    bool operator==(const char *s) const;
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_IO_BUFFER_H_
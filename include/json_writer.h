@@ -0,0 +1,61 @@
+#ifndef NEXER_JSON_WRITER_H_
+#define NEXER_JSON_WRITER_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "non_copyable.h"
+
+namespace nexer {
+
+// Writes JSON to a stream token by token, keeping track of separators, so a
+// document can be produced a piece at a time, e.g. over several loop turns
+// with the stream drained in between.
+class JsonWriter : NonCopyable {
+  private:
+    std::ostream &os_;
+    // For each open object or array, whether it has members yet
+    std::vector<bool> members_;
+    bool after_key_;
+
+    void Separate();
+
+  public:
+    JsonWriter(std::ostream &os) : os_(os), after_key_(false) {}
+
+    inline size_t depth() const {
+        return members_.size();
+    }
+
+    JsonWriter &BeginObject();
+    JsonWriter &EndObject();
+    JsonWriter &BeginArray();
+    JsonWriter &EndArray();
+
+    JsonWriter &Key(std::string_view);
+
+    JsonWriter &Value(std::string_view);
+    JsonWriter &Value(const char *s) {
+        return Value(std::string_view(s));
+    }
+    JsonWriter &Value(int64_t);
+    JsonWriter &Value(uint64_t);
+    JsonWriter &Value(int n) {
+        return Value(int64_t(n));
+    }
+    JsonWriter &Value(bool);
+    JsonWriter &Null();
+
+    template <typename T>
+    inline JsonWriter &Field(std::string_view key, T value) {
+        return Key(key).Value(value);
+    }
+
+    static void WriteString(std::ostream &, std::string_view);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_JSON_WRITER_H_
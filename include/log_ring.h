@@ -0,0 +1,89 @@
+#ifndef NEXER_LOG_RING_H_
+#define NEXER_LOG_RING_H_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "function_list.h"
+#include "non_copyable.h"
+
+namespace nexer {
+
+// Keeps the latest output lines of an app in a fixed amount of memory.
+// Lines are stored back to back in a circular buffer, each one contiguous;
+// the oldest lines are dropped to make room for new ones.
+class LogRing : NonCopyable {
+  public:
+    struct Line {
+        uint64_t seq;
+        uint64_t time;
+        int fd;
+        // Valid until the next line is added
+        std::string_view text;
+    };
+
+  private:
+    struct Entry {
+        size_t offset;
+        size_t len;
+        uint64_t time;
+        int fd;
+    };
+
+    std::vector<char> data_;
+    std::deque<Entry> entries_;
+    size_t write_pos_;
+    uint64_t first_seq_;
+
+    // Incomplete last line of stdout and stderr
+    std::string partial_[2];
+
+    FunctionList<void, const Line &> on_line_;
+
+    void Add(int fd, const char *, size_t);
+
+  public:
+    LogRing(size_t capacity);
+
+    inline size_t capacity() const {
+        return data_.size();
+    }
+
+    inline size_t size() const {
+        return entries_.size();
+    }
+
+    // Lines dropped so far to make room
+    inline uint64_t dropped() const {
+        return first_seq_;
+    }
+
+    // Splits output of stdout (1) or stderr (2) into lines
+    void Write(int fd, const char *, size_t);
+
+    // Adds incomplete lines, e.g. when the process exits
+    void Flush();
+
+    void Clear();
+
+    // Calls fn for each of the last n lines, oldest first
+    template <typename Fn>
+    void Tail(size_t n, Fn fn) const {
+        size_t start = n < entries_.size() ? entries_.size() - n : 0;
+        for (size_t i = start; i < entries_.size(); i++) {
+            auto &entry = entries_[i];
+            fn(Line{first_seq_ + i, entry.time, entry.fd, {data_.data() + entry.offset, entry.len}});
+        }
+    }
+
+    inline auto OnLine(std::function<void(const Line &)> fn) {
+        return on_line_.Add(fn);
+    }
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_LOG_RING_H_
@@ -2,6 +2,7 @@
 #define NEXER_FREELIST_H_
 
 #include <cstddef>
+#include <cstdlib>
 #include <iostream>
 
 namespace nexer {
@@ -36,6 +37,7 @@ class FixedSizeMemoryPool {
         if (allocated_) {
             allocated_->prev = block;
         }
+        block->prev = nullptr;
         block->next = allocated_;
         allocated_ = block;
         size = max_size_ - sizeof(Block);
@@ -0,0 +1,40 @@
+#ifndef NEXER_MIRROR_H_
+#define NEXER_MIRROR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config.h"
+#include "json_writer.h"
+
+namespace nexer {
+
+// The mirror of a proxy, shared by its connections: which ones get
+// mirrored, and how that went.
+struct Mirror {
+    const config::Mirror &config;
+    // Percentage points carried over between connections
+    int credit;
+
+    struct {
+        uint64_t connections;       // mirrored
+        uint64_t connect_failures;
+        uint64_t bytes;             // handed to mirror connections
+        // Mirror connections dropped for falling max_pending behind, and
+        // the bytes they were still owed then
+        uint64_t overflows;
+        uint64_t dropped;
+    } stats;
+
+    Mirror(const config::Mirror &config) : config(config), credit(0), stats{} {}
+
+    // Whether the next connection is mirrored: sample of every 100 are,
+    // evenly spread
+    bool Sample();
+
+    void WriteStatus(JsonWriter &);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_MIRROR_H_
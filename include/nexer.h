@@ -2,21 +2,52 @@
 #define NEXER_H_
 
 #include "config.h"
+#include "executor.h"
 #include "tcp_proxy.h"
+#include "tunnel.h"
+#include "udp_proxy.h"
+#include "uring.h"
+#include <map>
+#include <set>
+#include <string_view>
 #include <vector>
 
 namespace nexer {
 
 class Nexer : NonCopyable {
   private:
+    // Runs the blocking work of the loop, so outlives it
+    Executor executor_;
     EventLoop loop_;
     Config& config_;
     ProcessManager *process_manager_;
     std::vector<TcpProxy*> proxies_;
+    std::vector<UdpProxy*> udp_proxies_;
+    // Null unless established connections are forwarded with io_uring
+    Uring *uring_;
+    // Tunnels of tunnel upstreams by "host:port secret", as upstreams naming
+    // the same nexer with different secrets must not share one, and the
+    // listener for those of other nexers if there is one
+    std::map<std::string, Tunnel*> tunnels_;
+    TunnelServer *tunnel_server_;
+
+    // Timelines of recently closed TCP connections
+    TimelineRing timelines_;
+    static const size_t kRecentConnections = 1024;
 
     http::Server *admin_server_;
+    // Admin connections with a streamed response in progress
+    std::set<TcpClient*> streams_;
+
+    // Connections written per chunk of /status
+    static const size_t kStatusBatch = 1000;
+
     bool StartAdminServer();
+    void ServeLogs(http::incoming::Request&, http::outgoing::Response&, std::string_view name);
+    void ServeStatus(http::outgoing::Response&);
+    void ServeConnections(http::incoming::Request&, http::outgoing::Response&);
     bool StartDummyServer(config::Dummy&);
+    bool Warm();
 
   public:
     Nexer(Config& config);
@@ -10,6 +10,10 @@
 #include <functional>
 
 namespace nexer {
+
+class SpawnHelper;
+class SpawnTemplate;
+
 // Represents a child process
 
 class Process {
@@ -23,6 +27,16 @@ class Process {
     std::vector<char *> args_;
     std::vector<char *> env_;
 
+    // Set when started from a shared template rather than args_/env_
+    const SpawnTemplate *template_;
+
+    // Launches through the spawn helper when set; pid_ is known once the
+    // helper reports the start.
+    SpawnHelper *helper_;
+    int helper_id_;
+    uv_pid_t pid_;
+    int pending_signal_;
+
     Timer* timer_;
     void *data_;
 
@@ -38,7 +52,9 @@ class Process {
 
     friend void OnProcessExit(uv_process_t *, int64_t, int);
     friend void OnProcessHandleClose(uv_handle_t *);
+    friend class SpawnHelper;
 
+    static void OnAlloc(uv_handle_t *, size_t, uv_buf_t *);
     static void OnRead(int fd, uv_stream_t* pipe, ssize_t nread, const uv_buf_t* rdbuf);
     static void OnReadStdout(uv_stream_t* pipe, ssize_t nread, const uv_buf_t* rdbuf);
     static void OnReadStderr(uv_stream_t* pipe, ssize_t nread, const uv_buf_t* rdbuf);
@@ -48,14 +64,22 @@ class Process {
     int InitStdio();
     void InitEnv();
     int Spawn();
+    int SpawnWithHelper();
+
+    void OnSpawned(uv_pid_t);
+    void OnSpawnFailed(int error);
+    void Exited(int64_t exit_code, int term_signal);
+    void Drain();
 
   protected:
     Process(EventLoop& loop, const char *file);
+    Process(EventLoop& loop, const SpawnTemplate&, SpawnHelper*);
     virtual ~Process();
 
   public:
     static Process& Create(EventLoop& loop, const char *file);
     static Process& Create(EventLoop& loop, const config::Command& cmd);
+    static Process& Create(EventLoop& loop, const SpawnTemplate&, SpawnHelper* = nullptr);
 
     void Init(const config::Command& cmd);
 
@@ -83,6 +107,9 @@ class Process {
     bool IsRunning() const {
         return status_.running;
     }
+    uv_pid_t GetPid() const {
+        return !status_.running ? 0 : helper_id_ > 0 ? pid_ : request_.pid;
+    }
     int64_t GetExitCode() const {
         return status_.exit_code;
     }
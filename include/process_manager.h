@@ -3,33 +3,110 @@
 
 #include "process.h"
 #include "config.h"
+#include "json_writer.h"
+#include "log_ring.h"
+#include "spawn_helper.h"
+#include <deque>
 #include <map>
+#include <memory>
 
 namespace nexer {
 
 typedef std::function<void(Process*, int)> AfterProcessCheck;
 class ProcessManager {
+  public:
+    enum class Health {
+        Unknown,
+        Starting,
+        Healthy,
+        Degraded,
+        Down,
+        Stopped,    // for being idle
+    };
+
+    static const char *HealthName(Health);
+
+    // Steps taken while requiring an app, reported to OnAppStep
+    enum class Step {
+        Preamble,
+        Start,
+    };
+
+  private:
+    struct Transition {
+        uint64_t time;
+        Health from;
+        Health to;
+        int result;
+    };
+
     struct App {
-        const config::App *config;
-        Process *process;
+        const config::App *config = nullptr;
+        Process *process = nullptr;
         std::vector<AfterProcessCheck> callbacks;
-        bool restart;
-        int pending_preamble;
-        int error_preamble;
-        uint64_t require_start_time;
-        Timer *checker_timer;
-        bool checking;
+        bool restart = false;
+        int pending_preamble = 0;
+        int error_preamble = 0;
+        uint64_t require_start_time = 0;
+        Timer *checker_timer = nullptr;
+        bool checking = false;
+
+        // Maintained for every app; kept fresh by probes when the app has
+        // a probe_interval
+        Health health = Health::Unknown;
+        int failures = 0;
+        uint64_t last_probe = 0;
+        int last_result = 0;
+        Timer *probe_timer = nullptr;
+        bool probing = false;
+        std::deque<Transition> transitions;
+
+        // Output of the app's processes, capped at log_size bytes
+        std::unique_ptr<LogRing> logs;
+
+        // Connections through proxies using the app, see Acquire; with an
+        // idle_stop_after, the process is stopped once there have been none
+        // for that long, counting from when it became healthy if it was
+        // never used
+        size_t connections = 0;
+        uint64_t last_used = 0;
+        Timer *idle_timer = nullptr;
+        // Kills the process if it has not exited stop_timeout after SIGTERM
+        Timer *stop_timer = nullptr;
+        bool stopping = false;
+        uint64_t idle_stops = 0;
+    };
+
+    static const size_t kMaxTransitions = 16;
+
+    // Apps being warmed up, each waiting for its preamble; see Warm
+    struct Warmup {
+        struct Node {
+            const config::App *app;
+            int pending;            // preamble apps not up yet
+            bool failed;            // one of them failed
+            std::vector<Node *> dependents;
+        };
+        std::map<const config::App*, Node> nodes;
+        std::deque<Node *> ready;
+        int running;
+        int concurrency;
+        size_t done;
+        size_t failed;
     };
 
   private:
     EventLoop& loop_;
     std::map<const config::App*, App> app_map_;
     std::map<const void*, std::shared_ptr<std::string>> str_map_;
+    std::map<const config::Command*, std::unique_ptr<SpawnTemplate>> templates_;
+    SpawnHelper *spawn_helper_;
 
     FunctionList<void, Process*> on_process_start_;
     FunctionList<void, Process*, int> on_process_error_;
     FunctionList<void, Process*, int, const char *, size_t> on_process_data_;
     FunctionList<void, Process*, int64_t, int> on_process_exit_;
+    FunctionList<void, const config::App&, Step> on_app_step_;
 
     App& GetApp(const config::App& config);
 
@@ -37,8 +114,19 @@ class ProcessManager {
     void CheckPreamble(App& app, Then<int> then);
     void Check(const config::App& app, Then<int> then);
     void ClearCallbacks(App&, int error);
+    void SetHealth(App&, Health, int result);
+    void Probe(App&);
+    void StartIdle(App&);
+    void StopIdle(App&);
+    void Stopped(App&);
+    bool AddWarm(Warmup&, const config::App&, std::vector<const config::App*>& path);
+    void PumpWarm(std::shared_ptr<Warmup>);
+    void Warmed(std::shared_ptr<Warmup>, Warmup::Node*, int error);
+
+    const SpawnTemplate& GetTemplate(const config::Command&);
 
     const char *str(const config::Command&);
+    const char *str(const config::Checker&);
     const char *str(const config::App&);
     const char *str(const App&);
 
@@ -46,8 +134,40 @@ class ProcessManager {
     ProcessManager(EventLoop& loop);
     ~ProcessManager();
 
+    // Calls back right away when background probes found the app healthy
     void Require(const config::App& config, AfterProcessCheck then);
 
+    // Starts background checks for apps with a checker and a probe_interval
+    void StartProbing(const std::vector<config::App *>& apps);
+    void StopProbing();
+
+    Health GetHealth(const config::App& config);
+
+    // Counts a connection using the app until it is released, so that the
+    // app is only stopped for being idle while nothing uses it
+    void Acquire(const config::App& config);
+    void Release(const config::App& config);
+
+    // Starts the apps ahead of their first use, along with their preambles,
+    // each once its preamble is up and at most concurrency at a time. Fails
+    // without starting any if preambles depend on each other in a cycle.
+    bool Warm(const std::vector<const config::App*>& apps, int concurrency);
+
+    // Stops probing and the idle and stop timers of the apps; processes keep
+    // running
+    void Close();
+
+    // Null if the app has not been started or keeps no output
+    LogRing *GetLogs(std::string_view name);
+
+    // Writes the health and process state of each app known so far as a
+    // JSON array
+    void WriteStatus(JsonWriter&);
+
+    // Forks the helper that apps and checkers are launched from. Best called
+    // early, while the process is still small.
+    bool StartSpawnHelper();
+
     inline auto OnProcessStart(std::function<void(const Process*)> fn) {
         return on_process_start_.Add(fn);
     }
@@ -63,6 +183,10 @@ class ProcessManager {
     inline auto OnProcessExit(std::function<void(const Process*, int64_t status, int signal)> fn) {
         return on_process_exit_.Add(fn);
     }
+
+    inline auto OnAppStep(std::function<void(const config::App&, Step)> fn) {
+        return on_app_step_.Add(fn);
+    }
 };
 
 }  // namespace nexer
@@ -0,0 +1,44 @@
+#ifndef NEXER_PROXY_HEADER_H_
+#define NEXER_PROXY_HEADER_H_
+
+#include <cstddef>
+
+#include "uv.h"
+
+namespace nexer {
+
+// The PROXY protocol header a proxy sends ahead of the connection's own
+// data so the server behind it sees the client's address: "PROXY TCP4
+// src dst sport dport\r\n" for v1, a 16 byte binary header followed by
+// the addresses for v2. Headers are built and parsed in place, without
+// allocating.
+class ProxyHeader {
+  public:
+    // An IPv4 or IPv6 address; AF_UNSPEC when a header carries none
+    union Address {
+        sockaddr sa;
+        sockaddr_in in;
+        sockaddr_in6 in6;
+    };
+
+    // Longest header Write produces, and the most of a received one Parse
+    // needs to see: the longest v1 line, which also covers the v2 header
+    // with IPv6 addresses
+    static const size_t kMaxSize = 108;
+
+    // Writes a header of version 1 or 2 into buf, which has room for
+    // kMaxSize, and returns its length. Unless src and dst are both IPv4 or
+    // both IPv6, the header says the addresses are unknown.
+    static size_t Write(char *buf, int version, const sockaddr *src, const sockaddr *dst);
+
+    // Parses the header data starts with. Returns its length, 0 if more
+    // data is needed to tell, or -1 if it is not a valid header. The length
+    // of a v2 header covers any TLVs after the addresses, so it may be more
+    // than len. src and dst are left AF_UNSPEC for LOCAL and UNKNOWN
+    // headers.
+    static int Parse(const char *data, size_t len, Address &src, Address &dst);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_PROXY_HEADER_H_
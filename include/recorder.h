@@ -0,0 +1,138 @@
+#ifndef NEXER_RECORDER_H_
+#define NEXER_RECORDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "io_buffer.h"
+#include "json_writer.h"
+#include "non_copyable.h"
+
+namespace nexer {
+
+// Records the sessions of a proxy, both directions with timestamps, to an
+// append-only file:
+//
+//   file   := magic record*
+//   magic  := "NEXREC" 0 1
+//   record := event:u8 session:varint time:varint [size:varint data]
+//
+// Start records (session 0) carry the wall clock in microseconds and begin
+// each run of the proxy; the time of every other record is in microseconds
+// since the last Start. Only data records have a size and data. Varints are
+// LEB128.
+//
+// The loop only copies records into a ring; a thread of the recorder's own
+// writes them out in batches. When the ring is full a record is dropped
+// and its session marked Lost, so that it is not replayed with a gap. A
+// batch that cannot be written is given up, the file cut back to the last
+// whole record written.
+class Recorder : NonCopyable {
+  public:
+    enum class Event : uint8_t {
+        Start,
+        Open,
+        ClientData,
+        UpstreamData,
+        Close,
+        Lost,
+    };
+
+    static const char kMagic[8];
+
+  private:
+    int fd_;
+    std::string file_;
+    uint64_t start_;
+
+    // Bytes in [tail_, head_) are waiting to be written; both only grow and
+    // are taken modulo the ring's size
+    std::vector<char> ring_;
+    size_t head_;
+    size_t tail_;
+    // Sessions to mark Lost once there is room
+    std::vector<uint64_t> lost_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_;
+    std::thread thread_;
+
+    struct {
+        uint64_t sessions;
+        uint64_t bytes;  // of data recorded
+        uint64_t dropped;
+        std::atomic<uint64_t> written;
+        std::atomic<uint64_t> write_errors;
+    } stats_;
+
+    // Batches are written once this much is waiting, or every
+    // kFlushInterval ms otherwise
+    static const size_t kBatchSize = 64 * 1024;
+    static const uint64_t kFlushInterval = 100;
+
+    Recorder(int fd, const std::string &file, size_t size);
+
+    void Run();
+    // Microseconds since start_
+    uint64_t Now() const;
+    bool Put(Event, uint64_t session, uint64_t time, const uv_buf_t *bufs, size_t count);
+    // How many of the len bytes in the ring from position from on make up
+    // whole records, which start there
+    size_t Whole(size_t from, size_t len) const;
+
+  public:
+    // Opens the file for appending; null, with the reason logged, if it
+    // cannot be
+    static std::shared_ptr<Recorder> Create(const config::Record &);
+
+    // Writes out what is still in the ring and marks the sessions still to
+    // be marked Lost
+    ~Recorder();
+
+    // Return false if the record was dropped, in which case the session is
+    // to be given up with Lose
+    bool Open(uint64_t session);
+    bool Write(uint64_t session, bool from_client, const char *data, size_t len);
+    bool Write(uint64_t session, bool from_client, const IoBuffer &data);
+    void Close(uint64_t session);
+    void Lose(uint64_t session);
+
+    // Writes the sessions, bytes and records dropped, and what reached the
+    // file as a JSON object
+    void WriteStatus(JsonWriter &);
+};
+
+// A recording read back, for replaying it
+struct Recording {
+    struct Chunk {
+        uint64_t time;  // since the session was opened, in microseconds
+        bool from_client;
+        std::string data;
+    };
+
+    struct Session {
+        uint64_t id;
+        uint64_t start;     // wall clock, in microseconds
+        uint64_t duration;  // until closed, or the last chunk if it was not
+        std::vector<Chunk> chunks;
+    };
+
+    // Ordered by start; Lost sessions are left out
+    std::vector<Session> sessions;
+
+    // False, with the reason logged, if the file cannot be read or is not a
+    // recording. A record cut short at the end is ignored.
+    static bool Load(const char *file, Recording &);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_RECORDER_H_
@@ -0,0 +1,69 @@
+#ifndef NEXER_SHAPER_H_
+#define NEXER_SHAPER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config.h"
+
+namespace nexer {
+
+// Lets through rate bytes per second on average and up to burst bytes at
+// once. Tokens are refilled lazily from a millisecond clock and may go
+// negative, since bytes already read cannot be given back; the debt is
+// paid off before more get through.
+class TokenBucket {
+  private:
+    // Per second, 0 for no limit
+    uint64_t rate_;
+    // Tokens are kept in thousandths of a byte so that refills over a few
+    // milliseconds at low rates are not rounded away
+    int64_t burst_;
+    int64_t tokens_;
+    uint64_t last_;
+
+  public:
+    TokenBucket(uint64_t rate = 0, uint64_t burst = 0, uint64_t now = 0);
+
+    inline bool enabled() const {
+        return rate_ > 0;
+    }
+
+    void Refill(uint64_t now);
+
+    inline void Take(size_t n) {
+        if (rate_ > 0) {
+            tokens_ -= int64_t(n) * 1000;
+        }
+    }
+
+    // Less than a byte's worth left
+    inline bool IsEmpty() const {
+        return rate_ > 0 && tokens_ < 1000;
+    }
+
+    // Milliseconds until the bucket is no longer empty
+    uint64_t GetDelay() const;
+};
+
+// Rate limits of a proxy, for each direction: a bucket shared by all its
+// connections, and the rate and burst of the one each connection gets.
+struct Shaper {
+    enum Direction {
+        kUp,    // from the client
+        kDown,  // from the upstream
+    };
+
+    TokenBucket shared[2];
+    uint64_t rate;
+    uint64_t burst;
+
+    Shaper(const config::Upstream&, uint64_t now);
+
+    // Whether the upstream has any limit set
+    static bool IsNeeded(const config::Upstream&);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_SHAPER_H_
@@ -0,0 +1,112 @@
+#ifndef NEXER_SPAWN_HELPER_H_
+#define NEXER_SPAWN_HELPER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "handle.h"
+#include "io_buffer.h"
+
+namespace nexer {
+
+class Process;
+
+// The argument and environment vectors of a command, built once and shared
+// by every process started from it. Entries of the command's env override
+// variables of the same name inherited from nexer.
+class SpawnTemplate : NonCopyable {
+  private:
+    // "file\0cwd\0args...\0env...\0", the same layout sent to the helper
+    std::vector<char> strings_;
+    std::vector<char *> args_;
+    std::vector<char *> env_;
+    int timeout_;
+
+  public:
+    SpawnTemplate(const config::Command &);
+
+    inline const char *file() const {
+        return strings_.data();
+    }
+
+    inline const char *cwd() const {
+        return strings_.data() + strlen(strings_.data()) + 1;
+    }
+
+    // Null terminated
+    inline char **args() const {
+        return const_cast<char **>(args_.data());
+    }
+
+    inline char **env() const {
+        return const_cast<char **>(env_.data());
+    }
+
+    inline int timeout() const {
+        return timeout_;
+    }
+
+    inline const std::vector<char> &strings() const {
+        return strings_;
+    }
+
+    inline size_t argc() const {
+        return args_.size() - 1;
+    }
+
+    inline size_t envc() const {
+        return env_.size() - 1;
+    }
+};
+
+// A process forked while nexer is still small, which forks and execs
+// commands on our behalf so that spawning does not copy the page tables of
+// a large proxy. Requests carry the child's stdio as SCM_RIGHTS; the helper
+// reports the pid, spawn errors and exit status back over a second socket.
+class SpawnHelper : public Handle {
+  private:
+    uv_pipe_t events_;
+    int request_fd_;
+    uv_pid_t pid_;
+    uint32_t next_id_;
+    IoBuffer input_;
+    std::map<uint32_t, Process *> processes_;
+
+    inline uv_handle_t *handle() override {
+        return (uv_handle_t *)&events_;
+    }
+
+    static void OnAlloc(uv_handle_t *, size_t, uv_buf_t *);
+    static void OnRead(uv_stream_t *, ssize_t nread, const uv_buf_t *);
+    static void Run(int request_fd, int event_fd);
+
+    void Dispatch();
+    void Fail(int error);
+    void UpdateRef();
+
+    SpawnHelper(uv_loop_t *);
+    ~SpawnHelper();
+
+  public:
+    static SpawnHelper &Create(EventLoop &);
+
+    bool Start();
+
+    inline bool IsRunning() const {
+        return pid_ > 0;
+    }
+
+    inline uv_pid_t pid() const {
+        return pid_;
+    }
+
+    // Returns an id for Forget(), or a negative error code
+    int Spawn(const SpawnTemplate &, int stdio[3], Process *);
+    void Forget(uint32_t id);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_SPAWN_HELPER_H_
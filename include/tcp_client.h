@@ -4,23 +4,37 @@
 #include "event_loop.h"
 #include "function_list.h"
 #include "handle.h"
+#include "io_buffer.h"
+
+#include <string>
 
 namespace nexer {
 
 class TcpClient: public Handle {
   private:
-    uv_tcp_t tcp_;
+    // A TCP connection, or a Unix domain socket one; both are streams to
+    // libuv and only differ in how they connect and name their peer
+    union {
+        uv_tcp_t tcp_;
+        uv_pipe_t pipe_;
+    };
+    bool unix_;
 
     inline uv_handle_t *handle() override {
         return (uv_handle_t*) &tcp_;
     }
 
+    inline uv_stream_t *stream() {
+        return (uv_stream_t*) &tcp_;
+    }
+
     static void OnAddrInfo(uv_getaddrinfo_t *resolver, int status, struct addrinfo *res);
     static void OnConnect(uv_connect_t *, int status);
     static void OnAlloc(uv_handle_t *, size_t, uv_buf_t *);
     static void OnRead(uv_stream_t *, ssize_t nread, const uv_buf_t *);
     static void OnWrite(uv_write_t*, int status);
     static void OnWrite2(uv_write_t*, int status);
+    static void OnWriteBuffer(uv_write_t*, int status);
 
     void GetAddrInfo(const char *node, const char *service);
     void ConnectAddr(const sockaddr *addr);
@@ -34,15 +48,16 @@ class TcpClient: public Handle {
         unsigned name_resolving : 1;
     } flags_;
 
-    void ReadStart();
+    TcpClient(uv_loop_t*, bool unix);
 
-    TcpClient(uv_loop_t*);
+    static void Connect(EventLoop& loop, const char *host, int port, const char *path, uint64_t timeout,
+                        std::function<void(TcpClient*)>, std::function<void(TcpClient&)>, bool immediate);
 
     friend class TcpServer;
 
   public:
     static TcpClient& Create(EventLoop&);
-    static TcpClient& Create(uv_loop_t*);
+    static TcpClient& Create(uv_loop_t*, bool unix = false);
 
     inline auto OnConnect(std::function<void()> fn) {
         return on_connect_.Add(fn);
@@ -56,11 +71,23 @@ class TcpClient: public Handle {
         return on_send_.Add(fn);
     }
 
+    // host may be a name, an IPv4 or an IPv6 address. Names resolving to
+    // both are connected to over IPv4.
     void Connect(const char *host, int port);
     void Connect(int port);
+    // For clients created as unix
+    void ConnectUnix(const char *path);
+
+    // Reading starts by itself once connected; these pause and resume it
+    void ReadStart();
+    void ReadStop();
+
     void Write(const char *, size_t);
     void Write(uv_buf_t*, size_t);
 
+    // Takes over the content of the buffer, which is left empty
+    void Write(IoBuffer&);
+
     inline bool IsWritable() const {
         return uv_is_writable((const uv_stream_t *)&tcp_);
     }
@@ -69,9 +96,31 @@ class TcpClient: public Handle {
         return flags_.connecting || flags_.name_resolving;
     }
 
+    // Address of the other end as "ip:port", "[ip6]:port" or "unix:path",
+    // empty when not connected
+    std::string GetPeerName();
+
+    // Addresses of the other end and of this one, for TCP connections;
+    // return 0 or the error, UV_ENOTSUP for Unix domain sockets
+    int GetPeerAddress(sockaddr_storage &);
+    int GetSockAddress(sockaddr_storage &);
+
+    // The socket's descriptor, or -1 before there is one
+    int GetFd();
+
+    // Bytes passed to Write the kernel has not taken yet
+    size_t GetWriteQueueSize();
+
+    // Tries to connect every 500ms until timeout. The first attempt comes
+    // after one interval unless immediate.
     static void Connect(EventLoop& loop, const char *host, int port, uint64_t timeout,
                         std::function<void(TcpClient*)>,
-                        std::function<void(TcpClient&)> = {});
+                        std::function<void(TcpClient&)> = {}, bool immediate = false);
+
+    // Connects to a Unix domain socket, retrying as the above
+    static void ConnectUnix(EventLoop& loop, const char *path, uint64_t timeout,
+                            std::function<void(TcpClient*)>,
+                            std::function<void(TcpClient&)> = {}, bool immediate = false);
 };
 
 }  // namespace nexer
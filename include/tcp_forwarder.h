@@ -1,31 +1,91 @@
 #ifndef NEXER_TCP_FORWARDER_H_
 #define NEXER_TCP_FORWARDER_H_
 
+#include <memory>
+
 #include "function_list.h"
+#include "io_buffer.h"
+#include "json_writer.h"
+#include "mirror.h"
+#include "proxy_header.h"
+#include "recorder.h"
+#include "shaper.h"
 #include "tcp_client.h"
+#include "timeline.h"
+#include "timer.h"
+#include "tls.h"
+#include "uring.h"
 
 namespace nexer {
 
 class TcpForwarder {
     struct Client {
         TcpClient *tcp;
-        std::string data[2];
-        std::string *data_out;
-        std::string *data_in;
-        Client(TcpClient *tcp = nullptr) : tcp(tcp), data_in(&data[0]), data_out(&data[1]) {}
+        IoBuffer pending;  // read from tcp, not yet handed to the peer
+        bool sending;      // a write of this client's data is in flight
+        uint64_t received; // bytes read from tcp so far
+        TokenBucket bucket;
+        bool throttled;    // reading paused until the buckets refill
+        // TLS with this side; pending holds what it decrypted
+        std::unique_ptr<TlsSession> tls;
+        size_t controls;   // writes of TLS handshake data or alerts in flight
+        Client(TcpClient *tcp = nullptr)
+            : tcp(tcp), sending(false), received(0), throttled(false), controls(0) {}
     };
 
   private:
     Client incoming_;
     Client outgoing_;
+    Timeline timeline_;
     FunctionList<void> on_close_;
+    std::shared_ptr<Shaper> shaper_;
+    // Ticks while a side is throttled
+    Timer *shape_timer_;
+    // PROXY protocol header version to send upstream, 0 if none is to be
+    int proxy_version_;
+    // Incoming data is held back until its PROXY protocol header is in,
+    // which the timer, set meanwhile, waits for
+    bool expecting_header_;
+    Timer *header_timer_;
+    // The client's addresses as told by that header
+    ProxyHeader::Address source_;
+    ProxyHeader::Address destination_;
+    // Whatever goes to the upstream ahead of the client's data has been
+    bool upstream_started_;
+    // Set while what the client sends is copied to a mirror, whose
+    // connection is null until it is established. Copies are queued in
+    // mirror_pending_ until then.
+    std::shared_ptr<Mirror> mirror_;
+    TcpClient *mirror_tcp_;
+    IoBuffer mirror_pending_;
+    FunctionList<void>::Remove unsubscribe_mirror_;
+    // Null unless the session is being recorded
+    std::shared_ptr<Recorder> recorder_;
+    // Set if the connection may be handed to io_uring once established;
+    // spliced_ while it is
+    Uring *uring_;
+    bool spliced_;
+
+    // How often throttled sides are checked for tokens
+    static const uint64_t kShapeInterval = 10;
 
     void Init(Client *client);
-    void Swap(Client *client);
+    void Flush(Client *client);
+    void Closing(Client *client, int error);
+    void Shape(Client *client, size_t len);
+    void Unthrottle();
+    TokenBucket &GetSharedBucket(Client *client);
+    void ReadProxyHeader();
+    void StartUpstream();
+    bool Decrypt(Client *client, const char *data, size_t len);
+    void WriteControl(Client *client, IoBuffer &data);
+    void Fail(Client *client, int error);
+    void Tee(const IoBuffer &data);
+    void Record(Client *client, const char *data, size_t len);
+    void Record(Client *client, const IoBuffer &data);
+    void Splice();
 
-    TcpForwarder(TcpClient &incoming) : incoming_(&incoming) {
-        Init(&incoming_);
-    }
+    TcpForwarder(TcpClient &incoming);
 
   public:
     static TcpForwarder &Create(TcpClient &client) {
@@ -41,10 +101,70 @@ class TcpForwarder {
 
     void SetOutgoing(TcpClient &client);
 
+    // Limits the rate data is read from either side, see Shaper
+    void SetShaper(std::shared_ptr<Shaper>);
+
+    // Sends the upstream a PROXY protocol header of version 1 or 2 with the
+    // client's address ahead of its data
+    inline void SendProxyHeader(int version) {
+        proxy_version_ = version;
+    }
+
+    // The incoming connection must start with a PROXY protocol header, as
+    // sent by a load balancer, and is closed if it does not or the header is
+    // not all in within timeout ms. The addresses in it are those passed on
+    // upstream.
+    void ExpectProxyHeader(uint64_t timeout);
+
+    // Copies what the client sends to the mirror, which is connected to
+    // separately. The mirror is written to as fast as it takes it without
+    // ever holding the connection up: once max_pending bytes are queued for
+    // it, it is dropped.
+    inline void StartMirror(std::shared_ptr<Mirror> mirror) {
+        mirror_ = mirror;
+    }
+
+    // Hands over the mirror connection once established
+    void SetMirror(TcpClient &);
+
+    // Stops mirroring and closes the mirror connection if there is one,
+    // after it has taken what is queued for it if drain is set
+    void StopMirror(bool drain = false);
+
+    // Records what each side sends, as the other side gets it: decrypted
+    // and without PROXY headers. Call once the timeline has its id.
+    void StartRecording(std::shared_ptr<Recorder>);
+
+    // Hands the connection over to uring as soon as nothing is left that
+    // needs libuv or userspace: the upstream is connected, what was read is
+    // all sent, and there is no rate limit, mirror, recording or TLS other
+    // than kernel TLS both ways
+    inline void UseUring(Uring *uring) {
+        uring_ = uring;
+    }
+
+    // Decrypts what the client sends and encrypts what goes back to it
+    inline void TerminateTls(std::shared_ptr<TlsContext> context) {
+        incoming_.tls = std::make_unique<TlsSession>(context);
+    }
+
+    // Speaks TLS to the upstream, starting as soon as it is connected
+    inline void OriginateTls(std::shared_ptr<TlsContext> context) {
+        outgoing_.tls = std::make_unique<TlsSession>(context);
+    }
+
     inline auto OnClose(std::function<void()> fn) {
         return on_close_.Add(fn);
     }
 
+    inline Timeline &timeline() {
+        return timeline_;
+    }
+
+    // Writes the peers, bytes forwarded each way, age and whether reading is
+    // throttled as a JSON object
+    void WriteStatus(JsonWriter&);
+
     inline bool IsClosed(TcpClient *tcp) {
         return tcp && incoming_.tcp != tcp && outgoing_.tcp != tcp;
     }
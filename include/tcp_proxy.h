@@ -2,10 +2,14 @@
 #define NEXER_TCP_PROXY_H_
 
 #include "config.h"
+#include "coroutine.h"
 #include "tcp_server.h"
 #include "tcp_forwarder.h"
 #include "http_server.h"
 #include "process_manager.h"
+#include "tunnel.h"
+#include <deque>
+#include <map>
 #include <set>
 
 namespace nexer {
@@ -16,17 +20,132 @@ class TcpProxy : public TcpServer {
     config::Upstream& upstream_;
     ProcessManager *process_manager_;
     std::set<TcpForwarder*> forwarders_;
+    TimelineRing *timelines_;
+    // Incoming connections start with a PROXY protocol header, which has to
+    // be in within proxy_header_timeout_ ms
+    bool accept_proxy_header_;
+    uint64_t proxy_header_timeout_;
+    // Null when the upstream has no rate limits
+    std::shared_ptr<Shaper> shaper_;
+    // Null when the upstream has no mirror
+    std::shared_ptr<Mirror> mirror_;
+    // Null unless sessions are recorded
+    std::shared_ptr<Recorder> recorder_;
+    // For TLS with clients and with the upstream; null without
+    std::shared_ptr<TlsContext> tls_;
+    std::shared_ptr<TlsContext> upstream_tls_;
+    // Established connections are handed to it where they can be, if set
+    Uring *uring_;
+    // Set for upstreams reached through a tunnel, which carries the
+    // connections instead of forwarders
+    Tunnel *tunnel_;
+    std::map<TcpClient*, FunctionList<void>::Remove> tunnel_clients_;
+
+    // Suspends the setup of a connection until the upstream app has been
+    // checked, and started if need be, resuming with the error if any
+    struct WaitForApp {
+        TcpProxy *proxy;
+        TcpForwarder *forwarder;
+        uint64_t since = 0;
+        int error = 0;
+        std::coroutine_handle<> handle = {};
+
+        bool await_ready() const {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<>);
+        int await_resume() const {
+            return error;
+        }
+    };
+
+    // Connections waiting for the upstream app, oldest first. A single
+    // Require is made for all of them.
+    std::deque<WaitForApp *> waiting_;
+    bool requiring_;
+    Timer *wait_timer_;
+
+    struct {
+        uint64_t accepted;
+        uint64_t rejected;       // over max_connections
+        uint64_t queue_full;     // over max_waiting
+        uint64_t wait_timeouts;
+        uint64_t waited;
+        uint64_t wait_time;      // total, in ms
+        uint64_t max_wait;
+        size_t max_waiting;      // deepest the queue has been
+    } stats_;
+
+    // How often waiting connections are checked for wait_timeout
+    static const uint64_t kWaitCheckInterval = 100;
+
+    // TcpClient::Connect retries every 500ms, so this allows one attempt
+    static const uint64_t kOptimisticTimeout = 500;
 
     void Init();
+    Task Serve(TcpForwarder*, TcpClient*, int port);
+    Task ServeMirror(TcpForwarder*);
+    void Forward(TcpForwarder*, TcpClient*, TcpClient*);
 
-    void CheckUpstreamProcess(std::function<void(int)>);
+    bool Wait(WaitForApp*);
+    void StopWaiting(int error);
+    void ExpireWaiting();
+    void TryConnect(TcpForwarder*, TcpClient&);
+    void CheckSlow(TcpForwarder&);
     bool Has(TcpForwarder&);
 
-    TcpProxy(EventLoop&, config::Upstream&, ProcessManager*);
+    TcpProxy(EventLoop&, config::Upstream&, ProcessManager*, bool unix);
 
   public:
-    static TcpProxy &Create(EventLoop &, config::Upstream&, ProcessManager*);
+    // unix for listening on a Unix domain socket rather than ports; the
+    // upstream may be either regardless
+    static TcpProxy &Create(EventLoop &, config::Upstream&, ProcessManager*, bool unix = false);
     void Remove(TcpForwarder&);
+
+    // Where timelines of closed connections are kept, if anywhere
+    inline void SetTimelineRing(TimelineRing *timelines) {
+        timelines_ = timelines;
+    }
+
+    // Forwards established connections with io_uring where it can, see
+    // TcpForwarder::UseUring
+    inline void SetUring(Uring *uring) {
+        uring_ = uring;
+    }
+
+    // Carries connections through the tunnel to the upstream port on the
+    // other end's side
+    inline void SetTunnel(Tunnel *tunnel) {
+        tunnel_ = tunnel;
+    }
+
+    // For proxies behind a load balancer sending PROXY protocol headers
+    inline void AcceptProxyHeaders(bool accept, uint64_t timeout = 5000) {
+        accept_proxy_header_ = accept;
+        proxy_header_timeout_ = timeout;
+    }
+
+    // Terminates TLS from clients as configured for the listener, and
+    // originates it to the upstream as configured for that. False, with the
+    // reason logged, if certificates cannot be loaded.
+    bool InitTls(const config::Tls &listen);
+
+    // Records every session from now on to the file configured. False, with
+    // the reason logged, if it cannot be opened.
+    bool StartRecording(const config::Record &);
+
+    // Timeline of an open connection, null if there is none with the id
+    const Timeline *FindTimeline(uint64_t id);
+
+    // Writes the (first) listening port, upstream, number of connections,
+    // admission stats and TLS, mirror and recording stats as fields of the enclosing JSON object
+    void WriteStatus(JsonWriter&);
+
+    // Writes connections following `after` in address order while `budget`
+    // lasts, taking one from it for each, and returns the last one written
+    // or null when none are left. The position stays valid when connections
+    // close in between.
+    TcpForwarder *WriteConnections(JsonWriter&, TcpForwarder *after, size_t& budget);
 };
 
 }  // namespace nexer
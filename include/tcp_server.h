@@ -1,6 +1,9 @@
 #ifndef NEXER_TCP_SERVER_H_
 #define NEXER_TCP_SERVER_H_
 
+#include <memory>
+#include <string>
+
 #include "event_loop.h"
 #include "handle.h"
 #include "tcp_client.h"
@@ -9,28 +12,65 @@ namespace nexer {
 
 class TcpServer : public Handle {
   protected:
-    uv_tcp_t tcp_;
+    // Listening on TCP ports, or on a Unix domain socket
+    union {
+        uv_tcp_t tcp_;
+        uv_pipe_t pipe_;
+    };
+    bool unix_;
+    // Socket file to remove on close
+    std::string path_;
 
     inline uv_handle_t *handle() override {
         return (uv_handle_t*) &tcp_;
     }
 
-    virtual int Accept(TcpClient&);
+    // Listeners of the ports after the first of a range, in one block. It
+    // is freed once they have all closed, which may be after the server.
+    struct Range {
+        size_t open;
+        std::unique_ptr<uv_tcp_t[]> listeners;
+    };
+    Range *range_;
+    // Offset in the range of the listener that accepted the connection
+    // being handled
+    int listener_;
+
+    virtual int Accept(uv_stream_t *listener, TcpClient&);
 
     static void OnConnection(uv_stream_t *stream, int status);
+    static void OnRangeClose(uv_handle_t *);
     std::function<void(TcpClient&)> on_connection_;
     std::function<void()> on_listening_;
 
-    TcpServer(uv_loop_t*);
+    bool Listen(uv_tcp_t *, const char *host, int port);
+    bool ListenRange(const char *host, int port, int count);
+    void CloseRange();
+
+    TcpServer(uv_loop_t*, bool unix = false);
 
   public:
-    static TcpServer& Create(EventLoop&);
+    static TcpServer& Create(EventLoop&, bool unix = false);
 
     inline void OnConnection(std::function<void(TcpClient&)> fn) {
         on_connection_ = fn;
     }
 
-    bool Listen(int port);
+    // Listens on count ports from port on, giving up at the first that
+    // cannot be bound. host is the address to bind, IPv4 or IPv6.
+    bool Listen(int port, int count = 1);
+    bool Listen(const char *host, int port, int count = 1);
+
+    // For servers created as unix. A socket left at path by an earlier run
+    // is replaced; it is removed when the server closes.
+    bool ListenUnix(const char *path);
+
+    // "host:port", "[host]:port" or "unix:path" of the first listener
+    std::string GetSockName();
+
+    inline int listener() const {
+        return listener_;
+    }
 };
 
 }  // namespace nexer
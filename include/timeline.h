@@ -0,0 +1,99 @@
+#ifndef NEXER_TIMELINE_H_
+#define NEXER_TIMELINE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "json_writer.h"
+#include "non_copyable.h"
+
+namespace nexer {
+
+// What happened to a proxied connection, from accept to close, in a fixed
+// amount of memory. Times are milliseconds since the connection was accepted.
+struct Timeline {
+    enum class Event : uint8_t {
+        Accept,
+        CheckStart,
+        Preamble,
+        AppStart,
+        CheckEnd,
+        Connect,
+        ConnectFailed,
+        Established,
+        ClientData,
+        UpstreamData,
+        ClientClose,
+        UpstreamClose,
+        Abort,
+    };
+
+    struct Entry {
+        uint32_t time;
+        int32_t value;
+        Event event;
+    };
+
+    static const size_t kMaxEvents = 16;
+
+    uint64_t id;
+    uint64_t start;
+    uint8_t size;
+    // Events were dropped to keep the last one
+    bool truncated;
+    Entry entries[kMaxEvents];
+
+    Timeline(uint64_t id = 0);
+
+    // When full, the last entry is replaced so the close is always kept
+    void Add(Event, int value = 0);
+
+    bool Has(Event) const;
+
+    bool IsClosed() const;
+
+    // Milliseconds from accept to the latest event
+    uint64_t duration() const {
+        return size > 0 ? entries[size - 1].time : 0;
+    }
+
+    void Write(JsonWriter&) const;
+
+    // One line for the log, e.g. "accept +0, connect +1, established +3"
+    std::string ToString() const;
+
+    static const char *EventName(Event);
+};
+
+// Timelines of the most recently closed connections
+class TimelineRing : NonCopyable {
+  private:
+    std::vector<Timeline> ring_;
+    size_t next_;
+    size_t size_;
+
+  public:
+    TimelineRing(size_t capacity);
+
+    inline size_t size() const {
+        return size_;
+    }
+
+    void Add(const Timeline&);
+
+    // Null if the connection is not among the recent ones
+    const Timeline *Find(uint64_t id) const;
+
+    // Calls fn for up to n timelines, newest first
+    template <typename Fn>
+    void ForEach(size_t n, Fn fn) const {
+        for (size_t i = 0; i < n && i < size_; i++) {
+            fn(ring_[(next_ + ring_.size() - 1 - i) % ring_.size()]);
+        }
+    }
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_TIMELINE_H_
@@ -0,0 +1,138 @@
+#ifndef NEXER_TLS_H_
+#define NEXER_TLS_H_
+
+#include <openssl/ssl.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "config.h"
+#include "io_buffer.h"
+#include "json_writer.h"
+#include "non_copyable.h"
+
+namespace nexer {
+
+// Certificates and settings shared by the TLS sessions of one side of a
+// proxy, with their counters
+class TlsContext : NonCopyable {
+  public:
+    // Handshake times are in microseconds
+    struct Stats {
+        uint64_t handshakes = 0;
+        uint64_t failures = 0;
+        uint64_t handshake_time = 0;  // total
+        uint64_t max_handshake_time = 0;
+        // Sessions whose sending or receiving was handed to the kernel
+        uint64_t ktls_tx = 0;
+        uint64_t ktls_rx = 0;
+        // Sessions that stayed in userspace in a direction kTLS could have
+        // taken, because of the kernel, the protocol version or the cipher
+        uint64_t ktls_fallbacks = 0;
+    };
+
+  private:
+    SSL_CTX *ctx_;
+    bool server_;
+    bool ktls_;
+    std::string server_name_;
+    Stats stats_;
+
+    TlsContext(SSL_CTX *, const config::Tls &, bool server);
+
+    friend class TlsSession;
+
+  public:
+    // As a server (terminating TLS from clients) or a client (originating
+    // it to an upstream). Null, with the reason logged, if the
+    // certificates cannot be loaded.
+    static std::shared_ptr<TlsContext> Create(const config::Tls &, bool server);
+
+    ~TlsContext();
+
+    inline const Stats &stats() const {
+        return stats_;
+    }
+
+    void WriteStatus(JsonWriter &);
+};
+
+// TLS over one connection, with OpenSSL working on memory buffers so that
+// libuv keeps doing the I/O. Once the handshake is done the record layer
+// can be handed to the kernel (kTLS), after which plaintext is read from and
+// written to the socket as for any other connection.
+//
+// Only TLS 1.3 with AES-GCM or ChaCha20-Poly1305 is offloaded. Servers send
+// no session tickets when offloading, so their first application record is
+// the first one the kernel encrypts. Clients only offload sending, since the
+// tickets and key updates servers send still need OpenSSL. A session whose
+// sending was offloaded is closed once the peer asks for its key to be
+// updated, since OpenSSL's reply would be encrypted twice.
+class TlsSession : NonCopyable {
+  private:
+    std::shared_ptr<TlsContext> context_;
+    SSL *ssl_;
+    BIO *rbio_;
+    BIO *wbio_;
+    bool established_;
+    bool ktls_tx_;
+    bool ktls_rx_;
+    bool read_data_;
+    uint64_t started_;
+
+    // Application traffic secrets, caught from the key log and wiped once
+    // offloading has been tried
+    struct Secret {
+        unsigned char data[48];
+        size_t size = 0;
+    };
+    Secret client_secret_;
+    Secret server_secret_;
+
+    static void OnKeyLog(const SSL *, const char *line);
+
+    friend class TlsContext;
+
+    void Drain(IoBuffer &wire);
+    int Fail(IoBuffer &wire);
+    bool SetKey(int fd, int direction, const Secret &);
+
+  public:
+    TlsSession(std::shared_ptr<TlsContext>);
+    ~TlsSession();
+
+    inline bool IsEstablished() const {
+        return established_;
+    }
+
+    // Whether sending or receiving has been handed to the kernel
+    inline bool ktls_tx() const {
+        return ktls_tx_;
+    }
+    inline bool ktls_rx() const {
+        return ktls_rx_;
+    }
+
+    // Starts the handshake as a client, with the ClientHello going to wire
+    void Start(IoBuffer &wire);
+
+    // Takes bytes read from the connection. Decrypted data goes to plain,
+    // handshake messages and alerts to send back to wire. Returns 0,
+    // UV_EOF once the peer has closed the session or UV_EPROTO, which it
+    // also does if OpenSSL has something to send once sending has been
+    // offloaded (such as a KeyUpdate), as it cannot be sent then.
+    int Read(const char *data, size_t len, IoBuffer &plain, IoBuffer &wire);
+
+    // Encrypts all of plain into wire
+    int Write(IoBuffer &plain, IoBuffer &wire);
+
+    // Once established, hands the record layer to the kernel for whichever
+    // directions it can take. Sending is only offloaded when idle is set,
+    // i.e. nothing OpenSSL produced is still waiting to be written.
+    void Offload(int fd, bool idle);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_TLS_H_
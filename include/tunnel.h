@@ -0,0 +1,193 @@
+#ifndef NEXER_TUNNEL_H_
+#define NEXER_TUNNEL_H_
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "config.h"
+#include "function_list.h"
+#include "io_buffer.h"
+#include "json_writer.h"
+#include "tcp_client.h"
+#include "tcp_server.h"
+
+namespace nexer {
+
+// A connection between two nexers carrying many proxied connections, its
+// streams, each a connection on both ends. The connecting end opens a
+// stream for each client of its tunnel proxies; the accepting end (see
+// TunnelServer) connects it to a port on its own side.
+//
+// Frames are an 8 byte header, the stream id (32 bits), type, flags and
+// payload length (16 bits), all big-endian, and the payload:
+//
+//   Hello   stream 0, "NEXR", the version and a random nonce (16 bytes);
+//           first each way
+//   Auth    stream 0, HMAC-SHA256 with the secret of the sender's role
+//           ("C" connecting, "A" accepting) and the receiver's nonce; next
+//           each way if the tunnel has a secret, before anything else
+//   Open    flags the priority, payload the port to connect to (16 bits)
+//   Data    what the stream's connection sent
+//   Window  bytes (32 bits) of Data the receiver has passed on since
+//   Close   the error (32 bits, 0 for none) the sender's connection closed
+//           with; nothing follows it on the stream
+//
+// Each end may send a stream up to kWindow bytes more than the other has
+// confirmed with Window frames, so a slow connection holds up its own
+// stream and nothing else; a stream the other end sends more is reset. Streams with data to send take turns a frame at
+// a time, those of a lower priority number first, and only as long as
+// the tunnel connection takes it, so the order is decided here rather than
+// by what happens to be queued in the kernel.
+class Tunnel : NonCopyable {
+  private:
+    struct Stream {
+        uint32_t id;
+        uint8_t priority;
+        // Null once closed, and on the accepting end until connected
+        TcpClient *tcp;
+        // Read from tcp, to go out as Data; reading stops while it holds a
+        // window's worth
+        IoBuffer out;
+        // Received before tcp was connected
+        IoBuffer in;
+        uint32_t window;    // bytes the peer takes before its next Window
+        uint64_t received;  // of Data
+        uint64_t written;   // to tcp
+        uint64_t credited;  // of those, confirmed to the peer
+        bool connecting;    // tcp is being connected
+        bool closed;        // tcp is gone, or never will be
+        int error;          // it closed with
+        bool close_sent;
+        bool close_received;
+        bool queued;        // in ready_
+        bool paused;        // reading from tcp stopped
+    };
+
+    EventLoop &loop_;
+    // Of the other end; the connecting end connects to host_:port_
+    std::string host_;
+    int port_;
+    std::string name_;  // for logs and status
+    bool accepting_;
+    // Ports on its side the accepting end may connect streams to
+    const config::Tunnel *config_;
+    // Both ends prove they know it, if not empty
+    std::string secret_;
+    char nonce_[16];
+
+    TcpClient *tcp_;
+    bool connecting_;
+    bool hello_received_;
+    bool authenticated_;  // or no secret needed, once hello_received_
+    bool closing_;
+    IoBuffer input_;    // received, short of a whole frame
+    IoBuffer control_;  // frames other than Data, sent ahead of them
+
+    uint32_t next_id_;
+    std::unordered_map<uint32_t, Stream *> streams_;
+    // Streams with something to send, by priority, taking turns
+    std::deque<Stream *> ready_[8];
+
+    FunctionList<void> on_close_;
+
+    struct {
+        uint64_t connects;
+        uint64_t streams;    // opened
+        uint64_t refused;    // by the accepting end
+        uint64_t bytes_in;   // of Data frames
+        uint64_t bytes_out;
+    } stats_;
+
+    enum class Type : uint8_t {
+        Hello,
+        Open,
+        Data,
+        Window,
+        Close,
+        Auth,
+    };
+
+    static const size_t kHeaderSize = 8;
+    static const size_t kMacSize = 32;
+    static const size_t kFrameSize = 16384;
+    static const uint32_t kWindow = 256 * 1024;
+    // Bytes of frames libuv may have queued for the tunnel connection before
+    // no more are handed to it
+    static const size_t kHighWater = 64 * 1024;
+    static const uint8_t kVersion = 1;
+    static const uint64_t kConnectTimeout = 5000;
+
+    Tunnel(EventLoop &, const std::string &host, int port, const std::string &secret, const config::Tunnel *);
+    ~Tunnel();
+
+    void Connect();
+    void Attach(TcpClient &);
+    void Drop(int error);
+    void Read(const char *, size_t);
+    bool Dispatch(uint32_t id, Type, uint8_t flags, IoBuffer &payload);
+    void Forward(uint32_t id, uint8_t priority, int port);
+    void Bind(Stream *, TcpClient &);
+    void Sign(bool accepting, const char *nonce, char *mac);
+    void Receive(Stream *, IoBuffer &data);
+    void Reset(Stream *, int error);
+    void Credit(Stream *);
+    void Closed(Stream *, int error);
+    void Ready(Stream *);
+    bool IsReady(Stream *);
+    void Pump();
+    static void Frame(IoBuffer &, uint32_t id, Type, uint8_t flags, const char *payload, size_t len);
+    void Release(Stream *);
+    void Dispose();
+
+  public:
+    // The connecting end of a tunnel to the nexer listening at host:port,
+    // connected to right away and again for the first stream opened after
+    // the connection is lost; secret is that nexer's, if it has one
+    static Tunnel &Create(EventLoop &, const std::string &host, int port, const std::string &secret = {});
+
+    // The accepting end of a tunnel connection, which streams may only be
+    // connected through to the ports config allows, once the other end
+    // proved it knows config's secret if there is one. It is deleted once
+    // the connection closes.
+    static Tunnel &Accept(TcpClient &, const config::Tunnel &config);
+
+    // Carries the client's connection to port on the other end's side, at
+    // the priority given (0 first, 7 last). The client is closed if that
+    // cannot be connected, and once it is closed there.
+    void Open(TcpClient &client, int port, int priority);
+
+    // Closes the tunnel connection and every stream; it is deleted once
+    // they are all gone
+    void Close();
+
+    inline auto OnClose(std::function<void()> fn) {
+        return on_close_.Add(fn);
+    }
+
+    // Writes the other end, whether connected, streams open and bytes
+    // carried each way as a JSON object
+    void WriteStatus(JsonWriter &);
+};
+
+// Listens for tunnel connections from other nexers, see Tunnel
+class TunnelServer : public TcpServer {
+  private:
+    const config::Tunnel &config_;
+    std::map<Tunnel *, FunctionList<void>::Remove> tunnels_;
+
+    TunnelServer(EventLoop &, const config::Tunnel &);
+
+  public:
+    static TunnelServer &Create(EventLoop &, const config::Tunnel &);
+
+    // Writes the listening address and the status of each tunnel
+    // connection as a JSON object
+    void WriteStatus(JsonWriter &);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_TUNNEL_H_
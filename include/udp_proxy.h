@@ -0,0 +1,87 @@
+#ifndef NEXER_UDP_PROXY_H_
+#define NEXER_UDP_PROXY_H_
+
+#include "config.h"
+#include "json_writer.h"
+#include "process_manager.h"
+#include "timer.h"
+#include "udp_server.h"
+#include "udp_session_table.h"
+
+namespace nexer {
+
+// Relays datagrams between each client address and a dedicated upstream
+// socket, so that replies can be routed back to the right client.
+class UdpProxy : public UdpServer {
+  private:
+    std::string name_;
+    config::Proxy& config_;
+    ProcessManager *process_manager_;
+
+    UdpSessionTable sessions_;
+    uint64_t next_session_id_;
+    Timer *sweeper_;
+
+    sockaddr_storage upstream_addr_;
+    bool resolved_;
+
+    // The upstream host is looked up when the first session opens, and again
+    // no sooner than resolve_backoff_ ms after a failure. Sessions opened
+    // meanwhile queue their datagrams.
+    struct Lookup {
+        uv_getaddrinfo_t req;
+        UdpProxy *proxy;    // null once the proxy is closed
+    };
+    Lookup *lookup_;
+    uint64_t resolve_after_;
+    uint64_t resolve_backoff_;
+
+    // Of sessions closed so far, and datagrams no session took
+    struct {
+        uint64_t sessions;
+        uint64_t packets_in;
+        uint64_t bytes_in;
+        uint64_t packets_out;
+        uint64_t bytes_out;
+        uint64_t dropped;
+        uint64_t lookup_failures;
+    } stats_;
+
+    // Bytes of datagrams a session queues before dropping them
+    static const size_t kMaxPending = 64 * 1024;
+    static const uint64_t kMinResolveBackoff = 1000;
+    static const uint64_t kMaxResolveBackoff = 60000;
+
+    // Scratch list for forwarding a received batch
+    std::vector<Datagram> run_;
+
+    void Init();
+    bool Resolve();
+    static void OnResolved(uv_getaddrinfo_t *, int status, struct addrinfo *);
+    void Resolved(int status, const struct addrinfo *);
+
+    UdpSession *Track(const char *, size_t, const struct sockaddr *);
+    void OnClientRecv(const Datagram *, size_t);
+    void Connect(UdpSession &);
+    void Remove(UdpSession *);
+    void Expire();
+
+    void CheckUpstreamProcess(std::function<void(int)>);
+
+    UdpProxy(EventLoop&, config::Proxy&, ProcessManager*);
+
+  public:
+    static UdpProxy &Create(EventLoop &, config::Proxy&, ProcessManager*);
+
+    inline const UdpSessionTable &sessions() const {
+        return sessions_;
+    }
+
+    // Writes the upstream, totals and each session's counters as JSON
+    // fields of the object being written
+    void WriteStatus(JsonWriter &);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_UDP_PROXY_H_
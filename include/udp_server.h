@@ -5,18 +5,33 @@
 #include "function_list.h"
 #include "handle.h"
 
+#include <vector>
+
 namespace nexer {
 
 class UdpServer : public Handle {
+  public:
+    struct Datagram {
+        const char* data;
+        size_t len;
+        const struct sockaddr* addr;
+    };
+
   protected:
     uv_udp_t udp_;
-    char slab_[16 * 64 * 1024];
+
+    // Datagrams of the recvmmsg batch being received
+    std::vector<Datagram> batch_;
 
     static void OnAlloc(uv_handle_t*, size_t, uv_buf_t*);
+    static void OnSend(uv_udp_send_t*, int status);
     static void OnRecv(uv_udp_t* handle, ssize_t nread, const uv_buf_t* rcvbuf, const struct sockaddr* addr,
                        unsigned flags);
 
+    void FlushBatch();
+
     FunctionList<void, const char*, size_t, const struct sockaddr*> on_recv_;
+    FunctionList<void, const Datagram*, size_t> on_recv_batch_;
 
     UdpServer(uv_loop_t*);
 
@@ -30,7 +45,27 @@ class UdpServer : public Handle {
     inline auto OnRecv(std::function<void(const char*, size_t, const struct sockaddr*)> fn) {
         return on_recv_.Add(fn);
     }
+
+    // Receives all datagrams read by one recvmmsg call at once; they point
+    // into the loop's slab and are only valid during the call.
+    inline auto OnRecvBatch(std::function<void(const Datagram*, size_t)> fn) {
+        return on_recv_batch_.Add(fn);
+    }
+
     bool Listen(int port);
+    // host is the address to bind, IPv4 or IPv6
+    bool Listen(const char *host, int port);
+
+    // Sets the default peer and starts receiving from it
+    bool Connect(const struct sockaddr*);
+
+    // Sends a datagram to addr, or to the connected peer if addr is null.
+    // The data is copied if it cannot be sent right away.
+    int Send(const char*, size_t, const struct sockaddr* addr = nullptr);
+
+    // Sends a batch with as few sendmmsg calls as possible; datagrams with
+    // a null addr go to the connected peer.
+    int Send(const Datagram*, size_t count);
 };
 
 }  // namespace nexer
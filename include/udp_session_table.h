@@ -0,0 +1,213 @@
+#ifndef NEXER_UDP_SESSION_TABLE_H_
+#define NEXER_UDP_SESSION_TABLE_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "io_buffer.h"
+#include "non_copyable.h"
+#include "uv.h"
+
+namespace nexer {
+
+class UdpServer;
+
+struct UdpSession {
+    sockaddr_storage addr;
+    uint64_t id;
+
+    // Null while the upstream app is being started or its address looked up
+    UdpServer *upstream;
+    // The upstream app is up; the session connects once the address is known
+    bool ready;
+
+    uint64_t last_active;
+    // Datagrams received before the upstream was connected, each after its
+    // length (16 bits, host order)
+    IoBuffer pending;
+
+    struct {
+        uint64_t packets_in;
+        uint64_t bytes_in;
+        uint64_t packets_out;
+        uint64_t bytes_out;
+        uint64_t dropped;
+    } stats;
+
+    UdpSession() : id(0), upstream(nullptr), ready(false), last_active(0), stats{} {}
+};
+
+// Maps client addresses to sessions with open addressing and linear probing.
+// Erased slots are left as tombstones until the next rehash.
+class UdpSessionTable : NonCopyable {
+  private:
+    struct Slot {
+        uint32_t hash;
+        UdpSession *session;
+    };
+
+    Slot *slots_;
+    size_t capacity_;
+    size_t size_;
+    size_t used_;
+
+    static UdpSession *deleted() {
+        return reinterpret_cast<UdpSession *>(1);
+    }
+
+    static bool IsLive(const Slot &slot) {
+        return slot.session != nullptr && slot.session != deleted();
+    }
+
+    static uint32_t Hash(const sockaddr *addr) {
+        const uint8_t *p;
+        size_t len;
+        uint16_t port;
+        if (addr->sa_family == AF_INET6) {
+            auto in6 = (const sockaddr_in6 *)addr;
+            p = (const uint8_t *)&in6->sin6_addr;
+            len = sizeof(in6->sin6_addr);
+            port = in6->sin6_port;
+        } else {
+            auto in = (const sockaddr_in *)addr;
+            p = (const uint8_t *)&in->sin_addr;
+            len = sizeof(in->sin_addr);
+            port = in->sin_port;
+        }
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < len; i++) {
+            h = (h ^ p[i]) * 16777619u;
+        }
+        h = (h ^ (port & 0xff)) * 16777619u;
+        h = (h ^ (port >> 8)) * 16777619u;
+        return h;
+    }
+
+    static bool Equal(const sockaddr *a, const sockaddr *b) {
+        if (a->sa_family != b->sa_family) {
+            return false;
+        }
+        if (a->sa_family == AF_INET6) {
+            auto x = (const sockaddr_in6 *)a;
+            auto y = (const sockaddr_in6 *)b;
+            return x->sin6_port == y->sin6_port && x->sin6_scope_id == y->sin6_scope_id &&
+                   memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+        }
+        auto x = (const sockaddr_in *)a;
+        auto y = (const sockaddr_in *)b;
+        return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+    }
+
+    static size_t AddrLen(const sockaddr *addr) {
+        return addr->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    }
+
+    Slot *Probe(const sockaddr *addr, uint32_t hash) const {
+        size_t mask = capacity_ - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot &slot = slots_[i];
+            if (slot.session == nullptr) {
+                return nullptr;
+            }
+            if (slot.session != deleted() && slot.hash == hash &&
+                Equal(addr, (const sockaddr *)&slot.session->addr)) {
+                return &slot;
+            }
+        }
+    }
+
+    void Rehash(size_t capacity) {
+        Slot *old = slots_;
+        size_t old_capacity = capacity_;
+        slots_ = (Slot *)calloc(capacity, sizeof(Slot));
+        capacity_ = capacity;
+        used_ = size_;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (IsLive(old[i])) {
+                size_t mask = capacity_ - 1;
+                size_t j = old[i].hash & mask;
+                while (slots_[j].session != nullptr) {
+                    j = (j + 1) & mask;
+                }
+                slots_[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+  public:
+    UdpSessionTable(size_t capacity = 64) : capacity_(capacity), size_(0), used_(0) {
+        slots_ = (Slot *)calloc(capacity_, sizeof(Slot));
+    }
+
+    ~UdpSessionTable() {
+        Clear();
+        free(slots_);
+    }
+
+    inline size_t size() const {
+        return size_;
+    }
+
+    UdpSession *Find(const sockaddr *addr) const {
+        Slot *slot = Probe(addr, Hash(addr));
+        return slot ? slot->session : nullptr;
+    }
+
+    // Creates a session for addr, which must not be in the table yet
+    UdpSession *Insert(const sockaddr *addr) {
+        // Keep at least a quarter of the slots empty so probes terminate fast
+        if ((used_ + 1) * 4 > capacity_ * 3) {
+            Rehash((size_ + 1) * 2 > capacity_ / 2 ? capacity_ * 2 : capacity_);
+        }
+        uint32_t hash = Hash(addr);
+        size_t mask = capacity_ - 1;
+        size_t i = hash & mask;
+        while (IsLive(slots_[i])) {
+            i = (i + 1) & mask;
+        }
+        if (slots_[i].session == nullptr) {
+            used_++;
+        }
+        auto session = new UdpSession();
+        memcpy(&session->addr, addr, AddrLen(addr));
+        slots_[i] = {hash, session};
+        size_++;
+        return session;
+    }
+
+    void Erase(UdpSession *session) {
+        Slot *slot = Probe((const sockaddr *)&session->addr, Hash((const sockaddr *)&session->addr));
+        if (slot) {
+            slot->session = deleted();
+            size_--;
+            delete session;
+        }
+    }
+
+    template <typename Fn>
+    void ForEach(Fn fn) const {
+        for (size_t i = 0; i < capacity_; i++) {
+            if (IsLive(slots_[i])) {
+                fn(*slots_[i].session);
+            }
+        }
+    }
+
+    void Clear() {
+        for (size_t i = 0; i < capacity_; i++) {
+            if (IsLive(slots_[i])) {
+                delete slots_[i].session;
+            }
+            slots_[i].session = nullptr;
+        }
+        size_ = used_ = 0;
+    }
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_UDP_SESSION_TABLE_H_
@@ -0,0 +1,154 @@
+#ifndef NEXER_URING_H_
+#define NEXER_URING_H_
+
+#include <linux/io_uring.h>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+
+#include "config.h"
+#include "handle.h"
+#include "json_writer.h"
+
+namespace nexer {
+
+// Forwards between the sockets of established connections with io_uring,
+// taking them over from libuv, which is left with everything else. Receives
+// go into buffers the kernel picks from a ring shared by all connections;
+// what each direction has received is sent on as a chain of linked sends,
+// so that it goes out in order without waiting for one send per buffer.
+// Whatever the completions of a round lead to is submitted at once at the
+// end of it. The ring's descriptor is polled by the loop.
+class Uring : public Handle {
+  public:
+    // side is 0 for the first socket given to Adopt, 1 for the second
+    using DataCallback = std::function<void(int side, size_t len)>;
+    using DoneCallback = std::function<void(int side, int error)>;
+
+  private:
+    struct Pair;
+
+    // A buffer, or what is left of it to send
+    struct Chunk {
+        uint16_t id;
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    // One direction of a pair
+    struct Flow {
+        Pair *pair;
+        int from;
+        int to;
+        bool reading;  // a receive is in flight
+        bool eof;      // from has nothing more to send
+        // Received and not all sent yet, oldest first from head; the first
+        // sending of them are in flight
+        Chunk chunks[8];
+        uint8_t head;
+        uint8_t count;
+        uint8_t sending;
+    };
+
+    struct Pair {
+        Flow flows[2];
+        int ops;  // in flight
+        bool done;
+        int side;
+        int error;
+        DataCallback on_data;
+        DoneCallback on_done;
+    };
+
+    uv_poll_t poll_;
+    int fd_;
+
+    struct {
+        unsigned *head;
+        unsigned *tail;
+        unsigned *flags;
+        unsigned mask;
+        unsigned entries;
+        io_uring_sqe *sqes;
+        unsigned local_tail;  // SQEs up to here are filled in
+        unsigned submitted;   // and up to here handed to the kernel
+        size_t ring_size;
+        void *ring;
+    } sq_;
+
+    struct {
+        unsigned *head;
+        unsigned *tail;
+        unsigned mask;
+        io_uring_cqe *cqes;
+        size_t ring_size;
+        void *ring;
+    } cq_;
+
+    // Receive buffers: the ring the kernel takes them from and their memory
+    io_uring_buf_ring *buf_ring_;
+    size_t buf_ring_size_;
+    char *buffers_;
+    unsigned buffer_count_;
+    unsigned buffer_size_;
+    uint16_t buf_tail_;
+
+    std::unordered_set<Pair *> pairs_;
+    // Flows whose receive failed for want of buffers, retried once some
+    // are given back
+    std::unordered_set<Flow *> starved_;
+
+    struct {
+        uint64_t adopted;
+        uint64_t bytes;
+        uint64_t receives;
+        uint64_t sends;
+        uint64_t submits;     // io_uring_enter calls
+        uint64_t no_buffers;  // receives that found none
+    } stats_;
+
+    static const uint16_t kBufferGroup = 0;
+    static const unsigned kChainSize = sizeof Flow::chunks / sizeof(Chunk);
+
+    inline uv_handle_t *handle() override {
+        return (uv_handle_t *)&poll_;
+    }
+
+    static void OnPoll(uv_poll_t *, int status, int);
+
+    Uring();
+    ~Uring();
+
+    bool Init(const config::Uring &);
+    io_uring_sqe *GetSqe();
+    void Submit();
+    void Reap();
+    void Receive(Flow *);
+    void Send(Flow *);
+    void Complete(Flow *, bool send, const io_uring_cqe &);
+    void GiveBack(uint16_t id);
+    void Finish(Pair *, int side, int error);
+    void Release(Pair *);
+
+  public:
+    // Null, with the reason logged, if the kernel does not support what
+    // this needs (5.19 or later) or io_uring is not allowed
+    static Uring *Create(EventLoop &, const config::Uring &);
+
+    // Forwards between the two connected sockets from now on, until either
+    // is closed or fails. Neither may be read from or written to otherwise
+    // meanwhile. on_data is called with what is received from either,
+    // on_done once with the side that went first and why (UV_EOF or the
+    // error), after which the sockets are the caller's to close. Pairs still
+    // open when this is closed are done with UV_ECANCELED.
+    void Adopt(int first, int second, DataCallback on_data, DoneCallback on_done);
+
+    // Writes the pairs open, bytes forwarded, operations and submissions as
+    // a JSON object
+    void WriteStatus(JsonWriter &);
+};
+
+}  // namespace nexer
+
+#endif  // NEXER_URING_H_
@@ -2,20 +2,22 @@
 #define _NEXER_URL_H
 
 #include <functional>
-#include <string>
+#include <string_view>
 
+// Components are views into the string passed to ParseUrl and share its
+// lifetime. A relative path is kept as given, without a leading '/'.
 struct Url {
-    std::string scheme;
-    std::string host;
-    std::string port;
-    std::string path;
-    std::string query;
-    std::string fragment;
+    std::string_view scheme;
+    std::string_view host;
+    std::string_view port;
+    std::string_view path;
+    std::string_view query;
+    std::string_view fragment;
 };
 
-void ParseUrl(Url&, const char *);
+void ParseUrl(Url&, std::string_view);
 
-void ParseQueryString(const std::string&, std::function<int(const std::string&, const std::string&)>);
+void ParseQueryString(std::string_view, std::function<int(std::string_view, std::string_view)>);
 
 size_t DecodeUrlComponent(const char *src, char *dst);
 
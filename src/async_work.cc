@@ -1,26 +1,24 @@
 #include "async_work.h"
 
 namespace nexer {
-AsyncWork::AsyncWork(EventLoop& loop) {
-    request_.loop = loop;
-    request_.data = this;
-}
+AsyncWork::AsyncWork(EventLoop& loop, Executor::Priority priority) : AsyncWork(loop.work_queue(), priority) {}
 
-void AsyncWork::Work(uv_work_t *work) {
-    auto data = reinterpret_cast<AsyncWork*>(work->data);
-    data->work_();
+AsyncWork::AsyncWork(WorkQueue& queue, Executor::Priority priority) : queue_(queue) {
+    job_.priority = priority;
+    job_.on_end = [this](int status) {
+        if (on_end_) {
+            on_end_(status);
+        }
+    };
 }
 
-void AsyncWork::AfterWork(uv_work_t *work, int status) {
-    auto data = reinterpret_cast<AsyncWork*>(work->data);
-    if (data->on_end_) {
-        data->on_end_(status);
-    }
+void AsyncWork::Start(std::function<void()> work) {
+    job_.work = work;
+    queue_.Submit(job_);
 }
 
-void AsyncWork::Start(std::function<void()> work) {
-    work_ = work;
-    uv_queue_work(request_.loop, &request_, Work, AfterWork);
+bool AsyncWork::Cancel() {
+    return queue_.Cancel(job_);
 }
 
-}  // namespace nexer
\ No newline at end of file
+}  // namespace nexer
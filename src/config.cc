@@ -3,11 +3,13 @@
 
 #include <fstream>
 #include <sstream>
+#include <arpa/inet.h>
 #include <assert.h>
+#include <stdio.h>
 
 namespace nexer {
 
-Config::Config() {
+Config::Config() : warm_concurrency_(4), executor_threads_(4) {
     logger_.level = Logger::Level::INFO;
     admin_.port = DEFAULT_ADMIN_PORT;
 }
@@ -62,6 +64,90 @@ class ConfigParser {
         return false;
     }
 
+    // A port, or a range of them as "first-last"
+    bool Parse(jsini::Value &src, int &port, int &count) {
+        if (Parse(src, port)) {
+            count = 1;
+            return true;
+        }
+        return src.type() == JSINI_TSTRING && ParsePorts(src, port, count);
+    }
+
+    // "port" or "first-last"
+    bool ParsePorts(const char *src, int &port, int &count) {
+        int first, last;
+        char end;
+        int n = sscanf(src, "%d-%d%c", &first, &last, &end);
+        if (n == 1 && sscanf(src, "%d%c", &first, &end) == 1) {
+            last = first;
+        } else if (n != 2) {
+            return false;
+        }
+        if (first <= 0 || last < first || last >= 65536) {
+            return false;
+        }
+        port = first;
+        count = last - first + 1;
+        return true;
+    }
+
+    // A port or range as above, "host:port", "[ipv6]:port" (both with a
+    // range too) or "unix:/path"; host and path are left as they are when
+    // not given
+    bool ParseAddress(jsini::Value &src, std::string &host, int &port, int &count, std::string &path) {
+        if (Parse(src, port, count)) {
+            return true;
+        }
+        if (src.type() != JSINI_TSTRING) {
+            return false;
+        }
+        std::string address = (const char *)src;
+        if (address.compare(0, 5, "unix:") == 0) {
+            if (address.size() == 5) {
+                return false;
+            }
+            path = address.substr(5);
+            port = 0;
+            count = 1;
+            return true;
+        }
+        return ParseHostPort(address, host, port, count);
+    }
+
+    // As above, with a numeric host as listening addresses are not resolved
+    bool ParseListenAddress(jsini::Value &src, std::string &host, int &port, int &count, std::string &path) {
+        return ParseAddress(src, host, port, count, path) && (host.empty() || IsNumeric(host));
+    }
+
+    // "host:port" or "[ipv6]:port", with a range of ports or not
+    bool ParseHostPort(const std::string &address, std::string &host, int &port, int &count) {
+        size_t colon;
+        std::string name;
+        if (address[0] == '[') {
+            auto end = address.find(']');
+            if (end == std::string::npos || end + 1 >= address.size() || address[end + 1] != ':') {
+                return false;
+            }
+            name = address.substr(1, end - 1);
+            colon = end + 1;
+        } else {
+            colon = address.rfind(':');
+            if (colon == std::string::npos || address.find(':') != colon) {
+                return false;
+            }
+            name = address.substr(0, colon);
+        }
+        if (name.empty()) {
+            return false;
+        }
+
+        if (!ParsePorts(address.c_str() + colon + 1, port, count)) {
+            return false;
+        }
+        host = name;
+        return true;
+    }
+
     inline bool Parse(jsini::Value &src, bool &dst) {
         if (src.type() == JSINI_TBOOL) {
             dst = (bool)src;
@@ -126,6 +212,18 @@ class ConfigParser {
                 ok = Parse(value, config_.apps_);
             } else if (key == "dummy") {
                 ok = Parse(value, config_.dummies_);
+            } else if (key == "io_uring") {
+                ok = Parse(value, config_.uring_);
+            } else if (key == "tunnel") {
+                ok = Parse(value, config_.tunnel_);
+            } else if (key == "warm_concurrency") {
+                if (!(ok = Parse(value, config_.warm_concurrency_) && config_.warm_concurrency_ > 0)) {
+                    Error(value, "warm concurrency", JSINI_TINTEGER);
+                }
+            } else if (key == "executor_threads") {
+                if (!(ok = Parse(value, config_.executor_threads_) && config_.executor_threads_ > 0)) {
+                    Error(value, "executor threads", JSINI_TINTEGER);
+                }
             } else {
                 log_error("Unknown config entry: %s (line %u)", (const char *)key, key.lineno());
             }
@@ -169,6 +267,98 @@ class ConfigParser {
         });
     }
 
+    bool Parse(jsini::Value &value, config::Tunnel &tunnel) {
+        bool ok = Parse(value, "tunnel", [&](ConfigKey &key, jsini::Value &value) {
+            bool ok = false;
+            if (key == "listen") {
+                int count = 1;
+                std::string path;
+                if (!(ok = ParseListenAddress(value, tunnel.host, tunnel.port, count, path) && count == 1 && path.empty())) {
+                    Error(value, "tunnel listening address", JSINI_UNDEFINED);
+                }
+            } else if (key == "allow") {
+                ok = Parse(value, "tunnel allow", [&](jsini::Value &value) {
+                    int port;
+                    if (!Parse(value, port) || port <= 0 || port >= 65536) {
+                        Error(value, "tunnel allowed port", JSINI_TINTEGER);
+                        return false;
+                    }
+                    tunnel.allow.push_back(port);
+                    return true;
+                });
+            } else if (key == "connect_timeout") {
+                if (!(ok = Parse(value, tunnel.connect_timeout))) {
+                    Error(value, "tunnel connect timeout", JSINI_TINTEGER);
+                }
+            } else if (key == "secret") {
+                if (!(ok = Parse(value, tunnel.secret) && !tunnel.secret.empty())) {
+                    Error(value, "tunnel secret", JSINI_TSTRING);
+                }
+            } else {
+                Error(key, "tunnel");
+            }
+            return ok;
+        });
+        if (ok && (tunnel.port == 0 || tunnel.allow.empty())) {
+            log_error("Tunnel needs a port to listen on and the ports it may connect to (line %u)", value.lineno());
+            return false;
+        }
+        // Anyone who can reach it could otherwise connect to the ports allowed
+        if (ok && tunnel.secret.empty() && !IsLoopback(tunnel.host)) {
+            log_error("Tunnel needs a secret to listen on %s (line %u)", tunnel.host.data(), value.lineno());
+            return false;
+        }
+        return ok;
+    }
+
+    static bool IsLoopback(const std::string &host) {
+        in_addr addr;
+        in6_addr addr6;
+        if (inet_pton(AF_INET, host.data(), &addr) == 1) {
+            return (ntohl(addr.s_addr) >> 24) == 127;
+        }
+        if (inet_pton(AF_INET6, host.data(), &addr6) == 1) {
+            return IN6_IS_ADDR_LOOPBACK(&addr6);
+        }
+        return false;
+    }
+
+    static bool IsNumeric(const std::string &host) {
+        in_addr addr;
+        in6_addr addr6;
+        return inet_pton(AF_INET, host.data(), &addr) == 1 || inet_pton(AF_INET6, host.data(), &addr6) == 1;
+    }
+
+    // true for the defaults, or an object
+    bool Parse(jsini::Value &value, config::Uring &uring) {
+        if (value.type() == JSINI_TBOOL) {
+            uring.enabled = (bool)value;
+            return true;
+        }
+        uring.enabled = true;
+        return Parse(value, "io_uring", [&](ConfigKey &key, jsini::Value &value) {
+            bool ok = false;
+            if (key == "entries") {
+                if (!(ok = Parse(value, uring.entries) && uring.entries > 0 && uring.entries <= 32768)) {
+                    Error(value, "io_uring entries", JSINI_TINTEGER);
+                }
+            } else if (key == "buffers") {
+                // Buffer ids are 16 bits and the ring's size a power of 2
+                int &n = uring.buffers;
+                if (!(ok = Parse(value, n) && n > 0 && n <= 32768 && (n & (n - 1)) == 0)) {
+                    Error(value, "io_uring buffers", JSINI_TINTEGER);
+                }
+            } else if (key == "buffer_size") {
+                if (!(ok = Parse(value, uring.buffer_size) && uring.buffer_size >= 1024)) {
+                    Error(value, "io_uring buffer size", JSINI_TINTEGER);
+                }
+            } else {
+                Error(key, "io_uring");
+            }
+            return ok;
+        });
+    }
+
     bool Parse(jsini::Value& value, std::vector<config::Proxy> &proxies) {
         return Parse(value, "proxies", [&](jsini::Value& value) {
             proxies.emplace_back();
@@ -177,36 +367,214 @@ class ConfigParser {
     }
 
     bool Parse(jsini::Value &value, config::Proxy &proxy) {
-        return Parse(value, "proxy", [&](ConfigKey &key, jsini::Value& value) {
+        bool ok = Parse(value, "proxy", [&](ConfigKey &key, jsini::Value& value) {
             bool ok = false;
             if (key == "upstream") {
                 ok = Parse(value, proxy.upstream);
             } else if (key == "listen") {
-                if (!(ok = Parse(value, proxy.port))) {
-                    Error(value, "forward listening port", JSINI_TINTEGER);
+                if (!(ok = ParseListenAddress(value, proxy.host, proxy.port, proxy.port_count, proxy.path))) {
+                    Error(value, "forward listening address", JSINI_UNDEFINED);
+                }
+            } else if (key == "protocol") {
+                ok = Parse(value, proxy.protocol);
+            } else if (key == "tls") {
+                ok = Parse(value, proxy.tls);
+            } else if (key == "accept_proxy_protocol") {
+                if (!(ok = Parse(value, proxy.accept_proxy_protocol))) {
+                    Error(value, "accept proxy protocol", JSINI_TBOOL);
+                }
+            } else if (key == "proxy_header_timeout") {
+                if (!(ok = Parse(value, proxy.proxy_header_timeout) && proxy.proxy_header_timeout > 0)) {
+                    Error(value, "proxy header timeout", JSINI_TNUMBER);
+                }
+            } else if (key == "record") {
+                ok = Parse(value, proxy.record);
+            } else if (key == "idle_timeout") {
+                if (!(ok = Parse(value, proxy.idle_timeout))) {
+                    Error(value, "proxy idle timeout", JSINI_TINTEGER);
+                }
+            } else if (key == "warm") {
+                if (!(ok = Parse(value, proxy.warm))) {
+                    Error(value, "proxy warm", JSINI_TBOOL);
                 }
             } else {
                 Error(key, "proxy");
             }
             return ok;
         });
+        if (!ok) {
+            return false;
+        }
+
+        auto &upstream = proxy.upstream;
+        if (proxy.protocol != config::Proxy::Protocol::Tcp && (!proxy.path.empty() || !upstream.path.empty())) {
+            log_error("Unix domain sockets are only supported by tcp proxies (line %u)", value.lineno());
+            return false;
+        }
+        if (upstream.port_count > 1 && !proxy.path.empty()) {
+            log_error("Upstream port range needs a listening one (line %u)", value.lineno());
+            return false;
+        }
+        if (proxy.port_count > 1 && !upstream.path.empty()) {
+            log_error("Listening port range needs an upstream one (line %u)", value.lineno());
+            return false;
+        }
+        if (proxy.protocol != config::Proxy::Protocol::Tcp && (proxy.accept_proxy_protocol || upstream.proxy_protocol)) {
+            log_error("The PROXY protocol is only supported by tcp proxies (line %u)", value.lineno());
+            return false;
+        }
+        if (proxy.protocol != config::Proxy::Protocol::Tcp && !proxy.record.file.empty()) {
+            log_error("Recording is only supported by tcp proxies (line %u)", value.lineno());
+            return false;
+        }
+        if (proxy.protocol != config::Proxy::Protocol::Tcp && upstream.mirror.enabled()) {
+            log_error("Mirroring is only supported by tcp proxies (line %u)", value.lineno());
+            return false;
+        }
+        if (proxy.protocol != config::Proxy::Protocol::Tcp && (proxy.tls.enabled || upstream.tls.enabled)) {
+            log_error("TLS is only supported by tcp proxies (line %u)", value.lineno());
+            return false;
+        }
+        if (!upstream.tunnel_secret.empty() && upstream.tunnel_port == 0) {
+            log_error("A tunnel secret needs a nexer:// upstream (line %u)", value.lineno());
+            return false;
+        }
+        if (upstream.tunnel_port > 0) {
+            if (proxy.protocol != config::Proxy::Protocol::Tcp || !upstream.path.empty()) {
+                log_error("Tunnels are only supported by tcp proxies with upstream ports (line %u)", value.lineno());
+                return false;
+            }
+            if (proxy.tls.enabled || upstream.tls.enabled || proxy.accept_proxy_protocol || upstream.proxy_protocol ||
+                upstream.mirror.enabled() || !proxy.record.file.empty() || upstream.rate_limit > 0 ||
+                upstream.connection_rate_limit > 0 || upstream.app) {
+                log_error("Tunnel upstreams do not support TLS, the PROXY protocol, mirroring, recording, rate "
+                          "limits or apps (line %u)",
+                          value.lineno());
+                return false;
+            }
+        }
+        if (proxy.warm && !upstream.app) {
+            log_error("Warming a proxy needs an upstream app (line %u)", value.lineno());
+            return false;
+        }
+        if (proxy.tls.enabled && (proxy.tls.cert.empty() || proxy.tls.key.empty())) {
+            log_error("TLS needs a certificate and key to listen with (line %u)", value.lineno());
+            return false;
+        }
+        if (upstream.tls.enabled && upstream.tls.server_name.empty() && upstream.path.empty()) {
+            upstream.tls.server_name = upstream.host;
+        }
+        if (proxy.port_count > 1 && proxy.protocol != config::Proxy::Protocol::Tcp) {
+            log_error("Port ranges are only supported by tcp proxies (line %u)", value.lineno());
+            return false;
+        }
+        if (upstream.port_count > 1 && upstream.port_count != proxy.port_count) {
+            log_error("Upstream port range does not match the listening one (line %u)", value.lineno());
+            return false;
+        }
+        // A single upstream port starts a range as long as the listening one
+        if (upstream.port + proxy.port_count > 65536) {
+            log_error("Upstream port range out of bounds (line %u)", value.lineno());
+            return false;
+        }
+        upstream.port_count = proxy.port_count;
+        return true;
+    }
+
+    bool Parse(jsini::Value &value, config::Proxy::Protocol &protocol) {
+        if (!value.is_string()) {
+            Error(value, "proxy protocol", JSINI_TSTRING);
+            return false;
+        }
+        if (value == "tcp") {
+            protocol = config::Proxy::Protocol::Tcp;
+            return true;
+        }
+        if (value == "udp") {
+            protocol = config::Proxy::Protocol::Udp;
+            return true;
+        }
+        log_error("Unknown proxy protocol: %s (line %u)", (const char *)value, value.lineno());
+        return false;
     }
 
     bool Parse(jsini::Value &value, config::Upstream &upstream) {
         return Parse(value, "upstream", [&](ConfigKey &key, jsini::Value &value) {
             bool ok = false;
             if (key == "host") {
+                int count = 1;
                 if (!(ok = Parse(value, upstream.host))) {
                     Error(value, "upstream host", JSINI_TSTRING);
+                } else if (upstream.host.compare(0, 8, "nexer://") == 0 &&
+                           !(ok = ParseHostPort(upstream.host.substr(8), upstream.tunnel_host, upstream.tunnel_port,
+                                                count) && count == 1)) {
+                    Error(value, "upstream tunnel address", JSINI_UNDEFINED);
+                }
+            } else if (key == "address") {
+                if (!(ok = ParseAddress(value, upstream.host, upstream.port, upstream.port_count, upstream.path))) {
+                    Error(value, "upstream address", JSINI_UNDEFINED);
                 }
             } else if (key == "port") {
-                if (!(ok = Parse(value, upstream.port))) {
-                    Error(value, "upstream port", JSINI_TINTEGER);
+                if (!(ok = Parse(value, upstream.port, upstream.port_count))) {
+                    Error(value, "upstream port", JSINI_UNDEFINED);
                 }
             } else if (key == "connect_timeout") {
                 if (!(ok = Parse(value, upstream.connect_timeout))) {
                     Error(value, "upstream connect timeout", JSINI_TINTEGER);
                 }
+            } else if (key == "optimistic") {
+                if (!(ok = Parse(value, upstream.optimistic))) {
+                    Error(value, "upstream optimistic", JSINI_TBOOL);
+                }
+            } else if (key == "slow_connect") {
+                if (!(ok = Parse(value, upstream.slow_connect))) {
+                    Error(value, "upstream slow connect", JSINI_TINTEGER);
+                }
+            } else if (key == "max_connections") {
+                if (!(ok = Parse(value, upstream.max_connections))) {
+                    Error(value, "upstream max connections", JSINI_TINTEGER);
+                }
+            } else if (key == "max_waiting") {
+                if (!(ok = Parse(value, upstream.max_waiting))) {
+                    Error(value, "upstream max waiting", JSINI_TINTEGER);
+                }
+            } else if (key == "wait_timeout") {
+                if (!(ok = Parse(value, upstream.wait_timeout))) {
+                    Error(value, "upstream wait timeout", JSINI_TINTEGER);
+                }
+            } else if (key == "rate_limit") {
+                if (!(ok = Parse(value, upstream.rate_limit))) {
+                    Error(value, "upstream rate limit", JSINI_TINTEGER);
+                }
+            } else if (key == "rate_burst") {
+                if (!(ok = Parse(value, upstream.rate_burst))) {
+                    Error(value, "upstream rate burst", JSINI_TINTEGER);
+                }
+            } else if (key == "connection_rate_limit") {
+                if (!(ok = Parse(value, upstream.connection_rate_limit))) {
+                    Error(value, "upstream connection rate limit", JSINI_TINTEGER);
+                }
+            } else if (key == "connection_rate_burst") {
+                if (!(ok = Parse(value, upstream.connection_rate_burst))) {
+                    Error(value, "upstream connection rate burst", JSINI_TINTEGER);
+                }
+            } else if (key == "tls") {
+                ok = Parse(value, upstream.tls);
+            } else if (key == "mirror") {
+                ok = Parse(value, upstream.mirror);
+            } else if (key == "proxy_protocol") {
+                if (!(ok = Parse(value, upstream.proxy_protocol) &&
+                           (upstream.proxy_protocol == 1 || upstream.proxy_protocol == 2))) {
+                    Error(value, "upstream proxy protocol version", JSINI_TINTEGER);
+                }
+            } else if (key == "priority") {
+                if (!(ok = Parse(value, upstream.priority) && upstream.priority >= 0 && upstream.priority <= 7)) {
+                    Error(value, "upstream priority", JSINI_TINTEGER);
+                }
+            } else if (key == "tunnel_secret") {
+                if (!(ok = Parse(value, upstream.tunnel_secret) && !upstream.tunnel_secret.empty())) {
+                    Error(value, "upstream tunnel secret", JSINI_TSTRING);
+                }
             } else if (key == "app") {
                 if (!(ok = ((upstream.app = ParseApp(value)) != nullptr))) {
                     Error(value, "upstream app", JSINI_UNDEFINED);
@@ -244,28 +612,221 @@ class ConfigParser {
 
     bool Parse(jsini::Value &value, config::Command &cmd) {
         return Parse(value, "command", [&](ConfigKey &key, jsini::Value &value) {
+            return Parse(key, value, cmd, "command");
+        });
+    }
+
+    bool Parse(ConfigKey &key, jsini::Value &value, config::Command &cmd, const char *name) {
+        bool ok = false;
+        if (key == "file") {
+            if (!(ok = Parse(value, cmd.file))) {
+                Error(value, "command file", JSINI_TSTRING);
+            }
+        } else if (key == "args") {
+            ok = Parse(value, "command args", cmd.args);
+        } else if (key == "env") {
+            ok = Parse(value, "command env", cmd.env);
+        } else if (key == "cwd") {
+            if (!(ok = Parse(value, cmd.cwd))) {
+                Error(value, "command cwd", JSINI_TSTRING);
+            }
+        } else if (key == "timeout") {
+            if (!(ok = Parse(value, cmd.timeout))) {
+                Error(value, "command timeout", JSINI_TINTEGER);
+            }
+        } else {
+            Error(key, name);
+        }
+        return ok;
+    }
+
+    // An address as for upstreams, or an object
+    bool Parse(jsini::Value &value, config::Mirror &mirror) {
+        int count = 1;
+        bool ok = false;
+        if (value.type() != JSINI_TOBJECT) {
+            if (!(ok = ParseAddress(value, mirror.host, mirror.port, count, mirror.path))) {
+                Error(value, "mirror address", JSINI_UNDEFINED);
+            }
+        } else {
+            ok = Parse(value, "mirror", [&](ConfigKey &key, jsini::Value &value) {
+                bool ok = false;
+                if (key == "host") {
+                    if (!(ok = Parse(value, mirror.host))) {
+                        Error(value, "mirror host", JSINI_TSTRING);
+                    }
+                } else if (key == "port") {
+                    if (!(ok = Parse(value, mirror.port))) {
+                        Error(value, "mirror port", JSINI_TINTEGER);
+                    }
+                } else if (key == "address") {
+                    if (!(ok = ParseAddress(value, mirror.host, mirror.port, count, mirror.path))) {
+                        Error(value, "mirror address", JSINI_UNDEFINED);
+                    }
+                } else if (key == "sample") {
+                    if (!(ok = Parse(value, mirror.sample) && mirror.sample >= 0 && mirror.sample <= 100)) {
+                        Error(value, "mirror sample percentage", JSINI_TINTEGER);
+                    }
+                } else if (key == "max_pending") {
+                    if (!(ok = Parse(value, mirror.max_pending) && mirror.max_pending > 0)) {
+                        Error(value, "mirror max pending", JSINI_TINTEGER);
+                    }
+                } else {
+                    Error(key, "mirror");
+                }
+                return ok;
+            });
+        }
+        if (ok && (count != 1 || !mirror.enabled())) {
+            log_error("Mirror needs a single port or a socket path (line %u)", value.lineno());
+            return false;
+        }
+        return ok;
+    }
+
+    // A file name, or an object
+    bool Parse(jsini::Value &value, config::Record &record) {
+        if (value.type() == JSINI_TSTRING) {
+            return Parse(value, record.file);
+        }
+        bool ok = Parse(value, "record", [&](ConfigKey &key, jsini::Value &value) {
             bool ok = false;
             if (key == "file") {
-                if (!(ok = Parse(value, cmd.file))) {
-                    Error(value, "command file", JSINI_TSTRING);
-                }
-            } else if (key == "args") {
-                ok = Parse(value, "command args", cmd.args);
-            } else if (key == "env") {
-                ok = Parse(value, "command env", cmd.env);
-            } else if (key == "cwd") {
-                ok = Parse(value, "command env", cmd.env);
-            } else if (key == "timeout") {
-                if (!(ok = Parse(value, cmd.timeout))) {
-                    Error(value, "command timeout", JSINI_TINTEGER);
+                if (!(ok = Parse(value, record.file))) {
+                    Error(value, "record file", JSINI_TSTRING);
+                }
+            } else if (key == "buffer_size") {
+                if (!(ok = Parse(value, record.buffer_size) && record.buffer_size >= 4096)) {
+                    Error(value, "record buffer size", JSINI_TINTEGER);
+                }
+            } else {
+                Error(key, "record");
+            }
+            return ok;
+        });
+        if (ok && record.file.empty()) {
+            log_error("Recording needs a file (line %u)", value.lineno());
+            return false;
+        }
+        return ok;
+    }
+
+    // true for the defaults, or an object
+    bool Parse(jsini::Value &value, config::Tls &tls) {
+        if (value.type() == JSINI_TBOOL) {
+            tls.enabled = (bool)value;
+            return true;
+        }
+        tls.enabled = true;
+        return Parse(value, "tls", [&](ConfigKey &key, jsini::Value &value) {
+            bool ok = false;
+            if (key == "cert") {
+                if (!(ok = Parse(value, tls.cert))) {
+                    Error(value, "tls cert", JSINI_TSTRING);
+                }
+            } else if (key == "key") {
+                if (!(ok = Parse(value, tls.key))) {
+                    Error(value, "tls key", JSINI_TSTRING);
+                }
+            } else if (key == "ca") {
+                if (!(ok = Parse(value, tls.ca))) {
+                    Error(value, "tls ca", JSINI_TSTRING);
+                }
+            } else if (key == "verify") {
+                if (!(ok = Parse(value, tls.verify))) {
+                    Error(value, "tls verify", JSINI_TBOOL);
+                }
+            } else if (key == "server_name") {
+                if (!(ok = Parse(value, tls.server_name))) {
+                    Error(value, "tls server name", JSINI_TSTRING);
+                }
+            } else if (key == "ktls") {
+                if (!(ok = Parse(value, tls.ktls))) {
+                    Error(value, "tls ktls", JSINI_TBOOL);
                 }
             } else {
-                Error(key, "command");
+                Error(key, "tls");
             }
             return ok;
         });
     }
 
+    bool Parse(jsini::Value &value, config::Checker &checker) {
+        bool ok = Parse(value, "checker", [&](ConfigKey &key, jsini::Value &value) {
+            bool ok = false;
+            if (key == "type") {
+                ok = Parse(value, checker.type);
+            } else if (key == "host") {
+                if (!(ok = Parse(value, checker.host))) {
+                    Error(value, "checker host", JSINI_TSTRING);
+                }
+            } else if (key == "port") {
+                if (!(ok = Parse(value, checker.port))) {
+                    Error(value, "checker port", JSINI_TINTEGER);
+                }
+            } else if (key == "path") {
+                if (!(ok = Parse(value, checker.path))) {
+                    Error(value, "checker path", JSINI_TSTRING);
+                }
+            } else {
+                ok = Parse(key, value, checker, "checker");
+            }
+            return ok;
+        });
+
+        if (!ok) {
+            return false;
+        }
+
+        switch (checker.type) {
+        case config::Checker::Type::Tcp:
+        case config::Checker::Type::Http:
+            if (checker.port <= 0) {
+                Error(value, "checker port", JSINI_UNDEFINED);
+                return false;
+            }
+            if (checker.type == config::Checker::Type::Http && checker.path.empty()) {
+                checker.path = "/";
+            }
+            break;
+        case config::Checker::Type::Unix:
+            if (checker.path.empty()) {
+                Error(value, "checker path", JSINI_UNDEFINED);
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+
+        return true;
+    }
+
+    bool Parse(jsini::Value &value, config::Checker::Type &type) {
+        if (!value.is_string()) {
+            Error(value, "checker type", JSINI_TSTRING);
+            return false;
+        }
+        if (value == "command") {
+            type = config::Checker::Type::Command;
+            return true;
+        }
+        if (value == "tcp") {
+            type = config::Checker::Type::Tcp;
+            return true;
+        }
+        if (value == "http") {
+            type = config::Checker::Type::Http;
+            return true;
+        }
+        if (value == "unix") {
+            type = config::Checker::Type::Unix;
+            return true;
+        }
+        log_error("Unknown checker type: %s (line %u)", (const char *)value, value.lineno());
+        return false;
+    }
+
     bool Parse(jsini::Value &value, std::vector<config::App *> &apps) {
         return Parse(value, "apps", [&](jsini::Value &value) {
             auto app = ParseApp(value);
@@ -287,13 +848,37 @@ class ConfigParser {
             } else if (key == "command") {
                 ok = Parse(value, app.command);
             } else if (key == "checker") {
-                app.checker = new config::Command();
+                app.checker = new config::Checker();
                 app.checker->timeout = 10000;
                 ok = Parse(value, *app.checker);
             } else if (key == "max_start_time") {
                 if (!(ok = Parse(value, app.max_start_time))) {
                     Error(value, "app max_start_time", JSINI_TINTEGER);
                 }
+            } else if (key == "probe_interval") {
+                if (!(ok = Parse(value, app.probe_interval))) {
+                    Error(value, "app probe_interval", JSINI_TINTEGER);
+                }
+            } else if (key == "probe_failures") {
+                if (!(ok = Parse(value, app.probe_failures))) {
+                    Error(value, "app probe_failures", JSINI_TINTEGER);
+                }
+            } else if (key == "log_size") {
+                if (!(ok = Parse(value, app.log_size))) {
+                    Error(value, "app log_size", JSINI_TINTEGER);
+                }
+            } else if (key == "idle_stop_after") {
+                if (!(ok = Parse(value, app.idle_stop_after))) {
+                    Error(value, "app idle_stop_after", JSINI_TINTEGER);
+                }
+            } else if (key == "stop_timeout") {
+                if (!(ok = Parse(value, app.stop_timeout))) {
+                    Error(value, "app stop_timeout", JSINI_TINTEGER);
+                }
+            } else if (key == "warm") {
+                if (!(ok = Parse(value, app.warm))) {
+                    Error(value, "app warm", JSINI_TBOOL);
+                }
             } else if (key == "preamble") {
                 return Parse(value, "app preamble", [&](jsini::Value &value) {
                     auto preamble = ParseApp(value);
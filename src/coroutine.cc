@@ -0,0 +1,111 @@
+#include "coroutine.h"
+
+#include "memory_pool.h"
+
+namespace nexer {
+
+static thread_local FixedSizeMemoryPool frames(Task::kFrameSize + sizeof(void *) * 2);
+
+void *Task::promise_type::operator new(size_t size) {
+    if (size > kFrameSize) {
+        return ::operator new(size);
+    }
+    size_t capacity;
+    return frames.Allocate(capacity);
+}
+
+void Task::promise_type::operator delete(void *frame, size_t size) {
+    if (size > kFrameSize) {
+        ::operator delete(frame);
+    } else {
+        frames.Free(frame);
+    }
+}
+
+void Sleep::await_suspend(std::coroutine_handle<> handle) {
+    auto &timer = Timer::Create(loop, ms);
+    timer.OnTick([&timer, handle] {
+        timer.Close();
+        handle.resume();
+    });
+    timer.Start();
+}
+
+void Connect::await_suspend(std::coroutine_handle<> handle) {
+    auto then = [this, handle](TcpClient *connected) {
+        client = connected;
+        handle.resume();
+    };
+    if (path) {
+        TcpClient::ConnectUnix(loop, path, timeout, then, on_try, immediate);
+    } else {
+        TcpClient::Connect(loop, host, port, timeout, then, on_try, immediate);
+    }
+}
+
+Read::~Read() {
+    if (remove_data_) {
+        remove_data_();
+        remove_error_();
+        remove_close_();
+    }
+}
+
+void Read::await_suspend(std::coroutine_handle<> handle) {
+    remove_data_ = client_.OnData([this, handle](const char *s, size_t len) {
+        client_.ReadStop();
+        data_.assign(s, len);
+        handle.resume();
+    });
+    remove_error_ = client_.OnError([handle](int, const char *) {
+        handle.resume();
+    });
+    remove_close_ = client_.OnClose([handle] {
+        handle.resume();
+    });
+    client_.ReadStart();
+}
+
+Write::~Write() {
+    if (remove_send_) {
+        remove_send_();
+        remove_error_();
+        remove_close_();
+    }
+}
+
+void Write::await_suspend(std::coroutine_handle<> handle) {
+    remove_send_ = client_.OnSend([handle] {
+        handle.resume();
+    });
+    remove_error_ = client_.OnError([this, handle](int error, const char *) {
+        error_ = error;
+        handle.resume();
+    });
+    remove_close_ = client_.OnClose([this, handle] {
+        error_ = UV_ECANCELED;
+        handle.resume();
+    });
+    client_.Write(data_, len_);
+}
+
+void Require::await_suspend(std::coroutine_handle<> handle) {
+    manager.Require(app, [this, handle](Process *, int result) {
+        error = result;
+        handle.resume();
+    });
+}
+
+WaitExit::~WaitExit() {
+    if (remove_exit_) {
+        remove_exit_();
+    }
+}
+
+void WaitExit::await_suspend(std::coroutine_handle<> handle) {
+    remove_exit_ = process_.OnExit([handle](int64_t, int) {
+        handle.resume();
+    });
+}
+
+}  // namespace nexer
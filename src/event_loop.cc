@@ -1,10 +1,11 @@
 #include "event_loop.h"
 
+#include "executor.h"
 #include "logger.h"
 
 namespace nexer {
 
-EventLoop::EventLoop() {
+EventLoop::EventLoop() : slab_(nullptr), executor_(nullptr), work_queue_(nullptr) {
     if (int status = uv_loop_init(&loop_)) {
         log_fatal("uv_loop_init: %s", uv_strerror(status));
         exit(1);
@@ -14,6 +15,7 @@ EventLoop::EventLoop() {
 
 EventLoop::~EventLoop() {
     Close();
+    free(slab_);
 }
 
 static void close_walk_cb(uv_handle_t* handle, void* arg) {
@@ -24,6 +26,12 @@ static void close_walk_cb(uv_handle_t* handle, void* arg) {
 }
 
 void EventLoop::Close() {
+    if (work_queue_) {
+        work_queue_->Close();
+        work_queue_ = nullptr;
+        // Runs the close callback
+        uv_run(&loop_, UV_RUN_NOWAIT);
+    }
     if (int status = uv_loop_close(&loop_)) {
         log_warn("uv_loop_close: %s", uv_strerror(status));
         uv_walk(&loop_, close_walk_cb, nullptr);
@@ -33,6 +41,28 @@ void EventLoop::Close() {
     }
 }
 
+uv_buf_t EventLoop::slab() {
+    if (slab_ == nullptr) {
+        slab_ = (char *)malloc(kSlabSize);
+    }
+    return uv_buf_init(slab_, kSlabSize);
+}
+
+void EventLoop::SetExecutor(Executor &executor) {
+    executor_ = &executor;
+}
+
+WorkQueue &EventLoop::work_queue() {
+    if (work_queue_ == nullptr) {
+        if (executor_ == nullptr) {
+            static Executor executor;
+            executor_ = &executor;
+        }
+        work_queue_ = &WorkQueue::Create(*this, *executor_);
+    }
+    return *work_queue_;
+}
+
 bool EventLoop::Run() {
     if (int status = uv_run(&loop_, UV_RUN_DEFAULT)) {
         log_error("uv_run: %s", uv_strerror(status));
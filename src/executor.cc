@@ -0,0 +1,246 @@
+#include "executor.h"
+
+#include "logger.h"
+
+namespace nexer {
+
+static void update_max(std::atomic<uint64_t> &max, uint64_t value) {
+    auto current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+Executor::Executor(size_t threads) : stopping_(false), next_(0), queued_(0), running_(0), stats_{} {
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers_.emplace_back(new Worker());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers_[i]->thread = std::thread([this, i] {
+            Run(i);
+        });
+    }
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto &worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void Executor::Push(Job *job, size_t worker) {
+    job->worker = worker;
+    job->queued_at = uv_hrtime();
+    job->status = 0;
+    std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+    workers_[worker]->queues[size_t(job->priority)].push_back(job);
+    // Only counted once it can be taken, or a woken thread would find
+    // nothing and wait on a count that says otherwise
+    queued_++;
+}
+
+void Executor::Submit(Job *job) {
+    stats_.submitted++;
+    Push(job, next_++ % workers_.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    ready_.notify_one();
+}
+
+void Executor::Submit(const std::vector<Job *> &jobs) {
+    stats_.submitted += jobs.size();
+    auto first = next_.fetch_add(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        Push(jobs[i], (first + i) % workers_.size());
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    if (jobs.size() == 1) {
+        ready_.notify_one();
+    } else {
+        ready_.notify_all();
+    }
+}
+
+bool Executor::Cancel(Job *job) {
+    auto &worker = *workers_[job->worker];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    auto &queue = worker.queues[size_t(job->priority)];
+    for (auto it = queue.begin(); it != queue.end(); ++it) {
+        if (*it == job) {
+            queue.erase(it);
+            queued_--;
+            stats_.cancelled++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The oldest job of the highest priority, from the thread's own queues if
+// there is one there, otherwise from the others'
+Executor::Job *Executor::Take(size_t index) {
+    for (size_t priority = 0; priority < kPriorities; priority++) {
+        for (size_t i = 0; i < workers_.size(); i++) {
+            auto &worker = *workers_[(index + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            auto &queue = worker.queues[priority];
+            if (!queue.empty()) {
+                auto job = queue.front();
+                queue.pop_front();
+                queued_--;
+                running_++;
+                if (i > 0) {
+                    stats_.stolen++;
+                }
+                return job;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void Executor::Run(size_t index) {
+    for (;;) {
+        auto job = Take(index);
+        if (job == nullptr) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] {
+                return stopping_ || queued_ > 0;
+            });
+            if (stopping_ && queued_ == 0) {
+                return;
+            }
+            continue;
+        }
+
+        auto start = uv_hrtime();
+        uint64_t wait = (start - job->queued_at) / 1000;
+        stats_.wait_time += wait;
+        update_max(stats_.max_wait, wait);
+
+        job->work();
+
+        uint64_t run = (uv_hrtime() - start) / 1000;
+        stats_.run_time += run;
+        update_max(stats_.max_run, run);
+        stats_.completed++;
+        running_--;
+
+        job->queue->Deliver(job);
+    }
+}
+
+Executor::Stats Executor::GetStats() {
+    Stats stats;
+    stats.threads = workers_.size();
+    stats.submitted = stats_.submitted;
+    stats.completed = stats_.completed;
+    stats.cancelled = stats_.cancelled;
+    stats.stolen = stats_.stolen;
+    stats.queued = queued_;
+    stats.running = running_;
+    stats.wait_time = stats_.wait_time;
+    stats.max_wait = stats_.max_wait;
+    stats.run_time = stats_.run_time;
+    stats.max_run = stats_.max_run;
+    return stats;
+}
+
+void Executor::WriteStatus(JsonWriter &json) {
+    auto stats = GetStats();
+    json.BeginObject();
+    json.Field("threads", uint64_t(stats.threads));
+    json.Field("queued", uint64_t(stats.queued));
+    json.Field("running", uint64_t(stats.running));
+    json.Field("submitted", stats.submitted);
+    json.Field("completed", stats.completed);
+    json.Field("cancelled", stats.cancelled);
+    json.Field("stolen", stats.stolen);
+    json.Field("wait_time", stats.wait_time);
+    json.Field("max_wait", stats.max_wait);
+    json.Field("run_time", stats.run_time);
+    json.Field("max_run", stats.max_run);
+    json.EndObject();
+}
+
+WorkQueue::WorkQueue(EventLoop &loop, Executor &executor) : executor_(executor), outstanding_(0) {
+    if (int status = uv_async_init(loop, &async_, OnAsync)) {
+        log_fatal("uv_async_init: %s", uv_strerror(status));
+    }
+    async_.data = this;
+    uv_unref((uv_handle_t *)&async_);
+}
+
+WorkQueue &WorkQueue::Create(EventLoop &loop, Executor &executor) {
+    auto queue = new WorkQueue(loop, executor);
+    return *queue;
+}
+
+void WorkQueue::Hold(size_t n) {
+    if (outstanding_ == 0 && n > 0) {
+        uv_ref((uv_handle_t *)&async_);
+    }
+    outstanding_ += n;
+}
+
+void WorkQueue::Submit(Executor::Job &job) {
+    job.queue = this;
+    Hold(1);
+    executor_.Submit(&job);
+}
+
+void WorkQueue::Submit(const std::vector<Executor::Job *> &jobs) {
+    for (auto job : jobs) {
+        job->queue = this;
+    }
+    Hold(jobs.size());
+    executor_.Submit(jobs);
+}
+
+bool WorkQueue::Cancel(Executor::Job &job) {
+    if (job.queue != this || !executor_.Cancel(&job)) {
+        return false;
+    }
+    job.status = UV_ECANCELED;
+    Deliver(&job);
+    return true;
+}
+
+// Called on executor threads
+void WorkQueue::Deliver(Executor::Job *job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_.push_back(job);
+    }
+    uv_async_send(&async_);
+}
+
+void WorkQueue::OnAsync(uv_async_t *async) {
+    auto self = reinterpret_cast<WorkQueue *>(async->data);
+    std::vector<Executor::Job *> done;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        done.swap(self->done_);
+    }
+    for (auto job : done) {
+        self->outstanding_--;
+        if (job->on_end) {
+            job->on_end(job->status);
+        }
+    }
+    if (self->outstanding_ == 0) {
+        uv_unref((uv_handle_t *)async);
+    }
+}
+
+}  // namespace nexer
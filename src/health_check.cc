@@ -0,0 +1,180 @@
+#include "health_check.h"
+
+#include "logger.h"
+
+namespace nexer {
+
+llhttp_settings_t *HealthCheck::parser_settings() {
+    static llhttp_settings_t settings;
+    static bool initialized = false;
+    if (!initialized) {
+        llhttp_settings_init(&settings);
+        settings.on_headers_complete = OnHeadersComplete;
+        initialized = true;
+    }
+    return &settings;
+}
+
+void HealthCheck::Run(EventLoop &loop, const config::Checker &config, Then<int> then) {
+    auto check = new HealthCheck(config, then);
+    check->Start(loop);
+}
+
+HealthCheck::HealthCheck(const config::Checker &config, Then<int> then)
+    : config_(config), then_(then), timer_(nullptr), client_(nullptr), pipe_(nullptr), status_(0),
+      done_(false) {}
+
+void HealthCheck::Start(EventLoop &loop) {
+    if (config_.timeout > 0) {
+        // The first tick comes one timeout after Start
+        timer_ = &Timer::Create(loop, config_.timeout);
+        timer_->OnTick([this] {
+            if (timer_->GetElapsedTime() >= (uint64_t)config_.timeout) {
+                Finish(UV_ETIMEDOUT);
+            }
+        });
+        timer_->OnClose([this] {
+            timer_ = nullptr;
+            Release();
+        });
+        timer_->Start();
+    }
+
+    switch (config_.type) {
+    case config::Checker::Type::Tcp:
+    case config::Checker::Type::Http:
+        ConnectTcp(loop);
+        break;
+    case config::Checker::Type::Unix:
+        ConnectUnix(loop);
+        break;
+    default:
+        Finish(UV_EINVAL);
+        break;
+    }
+}
+
+void HealthCheck::ConnectTcp(EventLoop &loop) {
+    client_ = &TcpClient::Create(loop);
+
+    client_->OnConnect([this] {
+        if (config_.type == config::Checker::Type::Http) {
+            SendRequest();
+        } else {
+            Finish(0);
+        }
+    });
+
+    client_->OnData([this](const char *s, size_t len) {
+        OnData(s, len);
+    });
+
+    client_->OnError([this](int error, const char *) {
+        Finish(error);
+    });
+
+    // The server closed the connection before a status line was read
+    client_->OnClose([this] {
+        client_ = nullptr;
+        if (!done_) {
+            Finish(UV_EOF);
+        } else {
+            Release();
+        }
+    });
+
+    client_->Connect(config_.host.data(), config_.port);
+}
+
+void HealthCheck::SendRequest() {
+    llhttp_init(&parser_, HTTP_RESPONSE, parser_settings());
+    parser_.data = this;
+
+    IoBuffer request;
+    request << "GET " << config_.path << " HTTP/1.1\r\n"
+            << "Host: " << config_.host << ':' << config_.port << "\r\n"
+            << "User-Agent: Nexer/1.0\r\n"
+            << "Connection: close\r\n\r\n";
+    client_->Write(request);
+}
+
+int HealthCheck::OnHeadersComplete(llhttp_t *parser) {
+    auto self = static_cast<HealthCheck *>(parser->data);
+    self->status_ = parser->status_code;
+    return HPE_PAUSED;
+}
+
+void HealthCheck::OnData(const char *s, size_t len) {
+    if (done_) {
+        return;
+    }
+
+    auto error = llhttp_execute(&parser_, s, len);
+
+    if (status_ > 0) {
+        Finish(status_ >= 200 && status_ < 400 ? 0 : status_);
+    } else if (error != HPE_OK) {
+        log_debug("Bad response from http checker %s:%d (%s)", config_.host.data(), config_.port,
+                  llhttp_errno_name(error));
+        Finish(UV_EPROTO);
+    }
+}
+
+void HealthCheck::ConnectUnix(EventLoop &loop) {
+    pipe_ = new uv_pipe_t;
+
+    if (int error = uv_pipe_init(loop, pipe_, 0)) {
+        delete pipe_;
+        pipe_ = nullptr;
+        Finish(error);
+        return;
+    }
+
+    pipe_->data = this;
+    connect_req_.data = this;
+    uv_pipe_connect(&connect_req_, pipe_, config_.path.data(), OnPipeConnect);
+}
+
+void HealthCheck::OnPipeConnect(uv_connect_t *req, int status) {
+    auto self = static_cast<HealthCheck *>(req->data);
+    // A missing socket means the app is not up yet rather than a missing
+    // checker, which is what ProcessManager takes UV_ENOENT for
+    self->Finish(status == UV_ENOENT ? UV_ECONNREFUSED : status);
+}
+
+void HealthCheck::OnPipeClose(uv_handle_t *handle) {
+    auto self = static_cast<HealthCheck *>(handle->data);
+    delete self->pipe_;
+    self->pipe_ = nullptr;
+    self->Release();
+}
+
+void HealthCheck::Finish(int result) {
+    if (done_) {
+        return;
+    }
+
+    done_ = true;
+    then_(result);
+
+    if (timer_) {
+        timer_->Close();
+    }
+    if (client_) {
+        client_->Close();
+    }
+    if (pipe_ && !uv_is_closing((uv_handle_t *)pipe_)) {
+        uv_close((uv_handle_t *)pipe_, OnPipeClose);
+    }
+
+    Release();
+}
+
+// Deleted once finished and all handles are closed
+void HealthCheck::Release() {
+    if (done_ && !timer_ && !client_ && !pipe_) {
+        delete this;
+    }
+}
+
+}  // namespace nexer
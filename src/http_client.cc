@@ -1,25 +1,24 @@
 #include "http_client.h"
-#include "string_buffer.h"
 
 namespace nexer {
 
 static size_t http_content_callback(char *data, size_t size, size_t nmesb, void *p) {
-    StringBuffer *sb = (StringBuffer *)p;
+    IoBuffer *buffer = (IoBuffer *)p;
     size_t n = size * nmesb;
-    sb->Write(data, n);
+    buffer->Write(data, n);
     return n;
 }
 
 static size_t http_header_callback(char *data, size_t size, size_t nmesb, void *p) {
-    StringBuffer *sb = (StringBuffer *)p;
+    IoBuffer *buffer = (IoBuffer *)p;
     size_t n = size * nmesb;
 
     if (n > 4 && data[0] == 'H' && data[1] == 'T' && data[2] == 'T' && data[3] == 'P' && data[4] == '/') {
-        sb->clear();
+        buffer->Clear();
     }
 
     // The empty line that separates header and body will be appended too
-    sb->Write(data, n);
+    buffer->Write(data, n);
 
     return n;
 }
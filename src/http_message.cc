@@ -1,6 +1,9 @@
 #include "http_message.h"
 #include "http_server.h"
 
+#include <stdio.h>
+#include <strings.h>
+
 namespace nexer {
 
 namespace http {
@@ -9,7 +12,7 @@ namespace incoming {
 int Message::ParserOnUrl(llhttp_t *parser, const char *s, size_t len) {
     if (len) {
         auto request = reinterpret_cast<Request *>(parser->data);
-        request->url_string().append(s, len);
+        request->url_string_ = request->Extend(request->url_string_, s, len);
     }
     return 0;
 }
@@ -18,7 +21,8 @@ int Message::ParserOnHeaderField(llhttp_t *parser, const char *s, size_t len) {
     if (len > 0) {
         auto *message = reinterpret_cast<Message *>(parser->data);
         if (message->parser_state_.header_field) {
-            message->headers_.back().key.append(s, len);
+            auto &header = message->headers_.back();
+            header.key = message->Extend(header.key, s, len);
         } else {
             message->headers_.emplace_back(s, len);
             message->parser_state_.header_field = true;
@@ -30,7 +34,8 @@ int Message::ParserOnHeaderField(llhttp_t *parser, const char *s, size_t len) {
 int Message::ParserOnHeaderValue(llhttp_t *parser, const char *s, size_t len) {
     if (len > 0) {
         auto *message = reinterpret_cast<Message *>(parser->data);
-        message->headers_.back().value.append(s, len);
+        auto &header = message->headers_.back();
+        header.value = message->Extend(header.value, s, len);
         message->parser_state_.header_field = false;
     }
     return 0;
@@ -38,7 +43,7 @@ int Message::ParserOnHeaderValue(llhttp_t *parser, const char *s, size_t len) {
 
 int Message::ParserOnHeadersComplete(llhttp_t *parser) {
     auto request = reinterpret_cast<Request *>(parser->data);
-    ParseUrl(request->url(), request->url_string().data());
+    ParseUrl(request->url(), request->url_string());
     return 0;
 }
 
@@ -53,6 +58,7 @@ int Message::ParserOnBody(llhttp_t *parser, const char *s, size_t len) {
 int Message::ParserOnMessageComplete(llhttp_t *parser) {
     auto message = reinterpret_cast<Message*>(parser->data);
     message->parser_state_.complete = true;
+    message->Pin();
     if (message->on_complete_) {
         message->on_complete_(message);
     }
@@ -72,16 +78,57 @@ void Message::InitParserSettings() {
     settings->on_message_complete = ParserOnMessageComplete;
 }
 
+// Tokens normally arrive in one piece and are kept as views into the input.
+// Only a token continued from a previous read needs to be joined in the arena.
+std::string_view Message::Extend(std::string_view view, const char *s, size_t len) {
+    if (view.empty()) {
+        return {s, len};
+    }
+    if (view.data() + view.size() == s) {
+        return {view.data(), view.size() + len};
+    }
+    return arena_.Append(view, s, len);
+}
+
+bool Message::Pin(std::string_view &view) {
+    if (view.data() >= input_.data && view.data() < input_.data + input_.size) {
+        view = arena_.Copy(view.data(), view.size());
+        return true;
+    }
+    return false;
+}
+
+void Message::Pin() {
+    for (auto &header : headers_) {
+        Pin(header.key);
+        Pin(header.value);
+    }
+}
+
 llhttp_errno_t Message::Parse(const char *s, size_t len) {
+    input_ = {s, len};
     parser_state_.error = llhttp_execute(&parser_, s, len);
+    Pin();
+    input_ = {nullptr, 0};
     return parser_state_.error;
 }
 
+std::string_view Message::GetHeader(std::string_view name) const {
+    for (auto &header : headers_) {
+        if (header.key.size() == name.size() && strncasecmp(header.key.data(), name.data(), name.size()) == 0) {
+            return header.value;
+        }
+    }
+    return {};
+}
+
 void Message::Reset() {
     llhttp_init(&parser_, HTTP_BOTH, &parser_settings);
     parser_.data = this;
     parser_state_ = {false, HPE_OK, false};
+    input_ = {nullptr, 0};
     headers_.clear();
+    arena_.Reset();
     body_.Clear();
 }
 
@@ -93,11 +140,19 @@ Request::Request(Server &server, TcpClient& client) : server_(server), client_(c
 
 void Request::Reset() {
     Message::Reset();
-    url_string_.clear();
+    url_string_ = {};
     url_ = {};
     response_.Reset();
 }
 
+void Request::Pin() {
+    Message::Pin();
+    // Url components are views into url_string_ and move along with it
+    if (Message::Pin(url_string_) && url_.path.data()) {
+        ParseUrl(url_, url_string_);
+    }
+}
+
 // llhttp_status_name
 
 }  // namespace incoming
@@ -110,28 +165,63 @@ namespace outgoing {
 
 extern "C" const char* llhttp_method_name(llhttp_method_t method);
 
+void Response::WriteHead(const char *framing) {
+    head_ << framing;
+
+    char start_line[128];
+    int n = snprintf(start_line, sizeof(start_line), "HTTP/1.1 %d %s\r\n", status_,
+                     llhttp_status_name((llhttp_status)status_));
+    head_.Prepend(start_line, n);
+}
+
 void Response::End(int status) {
+    if (streaming_) {
+        Flush();
+        streaming_ = false;
+        head_.Write("0\r\n\r\n", 5);
+        client_->Write(head_);
+        return;
+    }
+
     if (status > 0) {
         status_ = status;
     }
 
-    StringBuffer &sb = start_line_;
-
-    sb << "HTTP/1.1 " << status_ << " " << llhttp_status_name((llhttp_status)status_) << "\r\n";
-
     head_ << "Connection: Keep-Alive\r\n";
     head_ << "Content-Length: " << body_.size() << "\r\n\r\n";
+    WriteHead("");
+    head_.Append(body_);
 
-    buf_[0] = uv_buf_init(sb.data(), sb.size());
-    buf_[1] = uv_buf_init(head_.data(), head_.size());
-    buf_[2] = uv_buf_init(body_.data(), body_.size());
+    client_->Write(head_);
+}
+
+void Response::Begin(int status) {
+    if (status > 0) {
+        status_ = status;
+    }
+
+    WriteHead("Transfer-Encoding: chunked\r\n\r\n");
+    client_->Write(head_);
+    streaming_ = true;
+    Flush();
+}
+
+void Response::Flush() {
+    if (!streaming_ || body_.empty()) {
+        return;
+    }
 
-    client_->Write(buf_, 3);
+    char size[32];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", body_.size());
+    head_.Write(size, n);
+    head_.Append(body_);
+    head_.Write("\r\n", 2);
+    client_->Write(head_);
 }
 
 void Response::Reset() {
     status_ = 501;
-    start_line_.Clear();
+    streaming_ = false;
     head_.Clear();
     body_.Clear();
 }
@@ -26,6 +26,12 @@ void Server::Init() {
 
         client.OnData([&client, request](const char* s, size_t len) {
             if (request->IsComplete()) {
+                // A streamed response lasts as long as the connection, so the
+                // handler may still be writing to it
+                if (request->response_.IsStreaming()) {
+                    client.Close();
+                    return;
+                }
                 request->Reset();
             }
             if (request->Parse(s, len)) {
@@ -0,0 +1,255 @@
+#include "io_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace nexer {
+
+IoBuffer::StreamBuf::int_type IoBuffer::StreamBuf::overflow(int_type c) {
+    if (c != EOF) {
+        char ch = (char)c;
+        buffer_->Write(&ch, 1);
+    }
+    return c;
+}
+
+std::streamsize IoBuffer::StreamBuf::xsputn(const char *s, std::streamsize n) {
+    buffer_->Write(s, (size_t)n);
+    return n;
+}
+
+IoBuffer::IoBuffer(size_t segment_size)
+    : std::ostream(nullptr), streambuf_(this), size_(0), segment_size_(segment_size), spare_(nullptr) {
+    rdbuf(&streambuf_);
+}
+
+IoBuffer::~IoBuffer() {
+    Clear();
+    free(spare_);
+}
+
+IoBuffer::Segment *IoBuffer::Acquire(size_t capacity) {
+    Segment *segment;
+    if (spare_ && spare_->capacity >= capacity) {
+        segment = spare_;
+        spare_ = nullptr;
+    } else {
+        if (capacity < segment_size_) {
+            capacity = segment_size_;
+        }
+        segment = (Segment *)malloc(sizeof(Segment) + capacity);
+        segment->capacity = capacity;
+    }
+    segment->refs = 1;
+    segment->used = 0;
+    return segment;
+}
+
+void IoBuffer::Release(Segment *segment) {
+    if (--segment->refs > 0) {
+        return;
+    }
+    if (spare_ == nullptr && segment->capacity == segment_size_) {
+        spare_ = segment;
+    } else {
+        free(segment);
+    }
+}
+
+// The tail slice can be extended in place only if nobody else refers to its
+// segment and it ends where the segment's written bytes end.
+IoBuffer::Slice *IoBuffer::WritableTail() {
+    if (slices_.empty()) {
+        return nullptr;
+    }
+    auto &tail = slices_.back();
+    auto segment = tail.segment;
+    if (segment->refs == 1 && tail.offset + tail.length == segment->used && segment->used < segment->capacity) {
+        return &tail;
+    }
+    return nullptr;
+}
+
+IoBuffer &IoBuffer::Write(const char *s, size_t n) {
+    size_ += n;
+    while (n > 0) {
+        auto tail = WritableTail();
+        if (tail == nullptr) {
+            auto segment = Acquire(n);
+            slices_.push_back({segment, 0, 0});
+            tail = &slices_.back();
+        }
+        auto segment = tail->segment;
+        size_t len = segment->capacity - segment->used;
+        if (len > n) {
+            len = n;
+        }
+        memcpy(segment->data() + segment->used, s, len);
+        segment->used += len;
+        tail->length += len;
+        s += len;
+        n -= len;
+    }
+    return *this;
+}
+
+IoBuffer &IoBuffer::Prepend(const char *s, size_t n) {
+    if (n == 0) {
+        return *this;
+    }
+    if (!slices_.empty()) {
+        auto &head = slices_.front();
+        if (head.segment->refs == 1 && head.offset >= n) {
+            head.offset -= n;
+            head.length += n;
+            memcpy(head.data(), s, n);
+            size_ += n;
+            return *this;
+        }
+    }
+    // Data goes at the end of a fresh segment so that later prepends can
+    // reuse the room in front of it.
+    auto segment = Acquire(n);
+    segment->used = segment->capacity;
+    slices_.push_front({segment, segment->capacity - n, n});
+    memcpy(slices_.front().data(), s, n);
+    size_ += n;
+    return *this;
+}
+
+void IoBuffer::Append(IoBuffer &other) {
+    if (&other == this) {
+        return;
+    }
+    for (auto &slice : other.slices_) {
+        slices_.push_back(slice);
+    }
+    size_ += other.size_;
+    other.slices_.clear();
+    other.size_ = 0;
+}
+
+void IoBuffer::Clone(const IoBuffer &other) {
+    for (auto &slice : other.slices_) {
+        if (slice.length > 0) {
+            slice.segment->refs++;
+            slices_.push_back(slice);
+        }
+    }
+    size_ += other.size_;
+}
+
+void IoBuffer::Split(size_t n, IoBuffer &head) {
+    if (n > size_) {
+        n = size_;
+    }
+    size_ -= n;
+    head.size_ += n;
+    while (n > 0) {
+        auto &slice = slices_.front();
+        if (slice.length <= n) {
+            n -= slice.length;
+            head.slices_.push_back(slice);
+            slices_.pop_front();
+        } else {
+            slice.segment->refs++;
+            head.slices_.push_back({slice.segment, slice.offset, n});
+            slice.offset += n;
+            slice.length -= n;
+            n = 0;
+        }
+    }
+}
+
+void IoBuffer::Consume(size_t n) {
+    if (n > size_) {
+        n = size_;
+    }
+    size_ -= n;
+    while (!slices_.empty()) {
+        auto &slice = slices_.front();
+        if (slice.length > n) {
+            slice.offset += n;
+            slice.length -= n;
+            break;
+        }
+        n -= slice.length;
+        Release(slice.segment);
+        slices_.pop_front();
+    }
+}
+
+void IoBuffer::Clear() {
+    for (auto &slice : slices_) {
+        Release(slice.segment);
+    }
+    slices_.clear();
+    size_ = 0;
+}
+
+uv_buf_t IoBuffer::Reserve(size_t n) {
+    auto tail = WritableTail();
+    if (tail == nullptr || tail->segment->capacity - tail->segment->used < n) {
+        slices_.push_back({Acquire(n), 0, 0});
+        tail = &slices_.back();
+    }
+    auto segment = tail->segment;
+    return uv_buf_init(segment->data() + segment->used, segment->capacity - segment->used);
+}
+
+void IoBuffer::Commit(size_t n) {
+    auto &tail = slices_.back();
+    tail.segment->used += n;
+    tail.length += n;
+    size_ += n;
+}
+
+size_t IoBuffer::Export(uv_buf_t *bufs, size_t max) const {
+    size_t count = 0;
+    for (auto &slice : slices_) {
+        if (count == max) {
+            break;
+        }
+        if (slice.length > 0) {
+            bufs[count++] = uv_buf_init(slice.data(), slice.length);
+        }
+    }
+    return count;
+}
+
+size_t IoBuffer::CopyTo(char *dst, size_t max) const {
+    size_t copied = 0;
+    for (auto &slice : slices_) {
+        size_t len = slice.length < max - copied ? slice.length : max - copied;
+        memcpy(dst + copied, slice.data(), len);
+        copied += len;
+        if (copied == max) {
+            break;
+        }
+    }
+    return copied;
+}
+
+std::string IoBuffer::ToString() const {
+    std::string s;
+    s.reserve(size_);
+    for (auto &slice : slices_) {
+        s.append(slice.data(), slice.length);
+    }
+    return s;
+}
+
+bool IoBuffer::operator==(const char *s) const {
+    if (s == nullptr || strlen(s) != size_) {
+        return false;
+    }
+    for (auto &slice : slices_) {
+        if (memcmp(s, slice.data(), slice.length) != 0) {
+            return false;
+        }
+        s += slice.length;
+    }
+    return true;
+}
+
+}  // namespace nexer
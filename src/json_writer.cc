@@ -0,0 +1,98 @@
+#include "json_writer.h"
+
+#include <cstdio>
+
+namespace nexer {
+
+void JsonWriter::Separate() {
+    if (after_key_) {
+        after_key_ = false;
+    } else if (!members_.empty()) {
+        if (members_.back()) {
+            os_ << ',';
+        }
+        members_.back() = true;
+    }
+}
+
+JsonWriter &JsonWriter::BeginObject() {
+    Separate();
+    os_ << '{';
+    members_.push_back(false);
+    return *this;
+}
+
+JsonWriter &JsonWriter::EndObject() {
+    members_.pop_back();
+    os_ << '}';
+    return *this;
+}
+
+JsonWriter &JsonWriter::BeginArray() {
+    Separate();
+    os_ << '[';
+    members_.push_back(false);
+    return *this;
+}
+
+JsonWriter &JsonWriter::EndArray() {
+    members_.pop_back();
+    os_ << ']';
+    return *this;
+}
+
+JsonWriter &JsonWriter::Key(std::string_view key) {
+    Separate();
+    WriteString(os_, key);
+    os_ << ':';
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::Value(std::string_view s) {
+    Separate();
+    WriteString(os_, s);
+    return *this;
+}
+
+JsonWriter &JsonWriter::Value(int64_t n) {
+    Separate();
+    os_ << n;
+    return *this;
+}
+
+JsonWriter &JsonWriter::Value(uint64_t n) {
+    Separate();
+    os_ << n;
+    return *this;
+}
+
+JsonWriter &JsonWriter::Value(bool b) {
+    Separate();
+    os_ << (b ? "true" : "false");
+    return *this;
+}
+
+JsonWriter &JsonWriter::Null() {
+    Separate();
+    os_ << "null";
+    return *this;
+}
+
+void JsonWriter::WriteString(std::ostream &os, std::string_view s) {
+    os << '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof buf, "\\u%04x", c);
+            os << buf;
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+}  // namespace nexer
@@ -0,0 +1,107 @@
+#include "log_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "timer.h"
+
+namespace nexer {
+
+LogRing::LogRing(size_t capacity) : data_(capacity), write_pos_(0), first_seq_(0) {}
+
+void LogRing::Write(int fd, const char *s, size_t len) {
+    auto &partial = partial_[fd == 2 ? 1 : 0];
+
+    while (len > 0) {
+        auto nl = (const char *)memchr(s, '\n', len);
+        if (nl == nullptr) {
+            partial.append(s, len);
+            break;
+        }
+        size_t n = nl - s;
+        if (partial.empty()) {
+            Add(fd, s, n);
+        } else {
+            partial.append(s, n);
+            Add(fd, partial.data(), partial.size());
+            partial.clear();
+        }
+        s += n + 1;
+        len -= n + 1;
+    }
+
+    // A line that never ends is stored in pieces
+    size_t max_line = std::max<size_t>(data_.size() / 4, 1);
+    if (partial.size() >= max_line) {
+        Add(fd, partial.data(), partial.size());
+        partial.clear();
+    }
+}
+
+void LogRing::Flush() {
+    for (int i = 0; i < 2; i++) {
+        if (!partial_[i].empty()) {
+            Add(i + 1, partial_[i].data(), partial_[i].size());
+            partial_[i].clear();
+        }
+    }
+}
+
+void LogRing::Clear() {
+    first_seq_ += entries_.size();
+    entries_.clear();
+    write_pos_ = 0;
+    partial_[0].clear();
+    partial_[1].clear();
+}
+
+// Each line takes its length plus a newline, so lines stay contiguous and
+// the number of entries is bounded by the capacity.
+void LogRing::Add(int fd, const char *s, size_t len) {
+    if (len > 0 && s[len - 1] == '\r') {
+        len--;
+    }
+
+    size_t max_line = std::max<size_t>(data_.size() / 4, 1);
+    if (len > max_line) {
+        Add(fd, s, max_line);
+        Add(fd, s + max_line, len - max_line);
+        return;
+    }
+
+    size_t need = len + 1;
+    if (need > data_.size()) {
+        return;
+    }
+
+    size_t pos = write_pos_;
+    bool wrapped = pos + need > data_.size();
+    if (wrapped) {
+        pos = 0;
+    }
+
+    // Oldest lines come first: those past the write position, then those
+    // from the start of the buffer
+    while (!entries_.empty()) {
+        auto &front = entries_.front();
+        bool skipped = wrapped && front.offset >= write_pos_;
+        bool overlaps = front.offset < pos + need && front.offset + front.len + 1 > pos;
+        if (!skipped && !overlaps) {
+            break;
+        }
+        entries_.pop_front();
+        first_seq_++;
+    }
+
+    memcpy(data_.data() + pos, s, len);
+    data_[pos + len] = '\n';
+    write_pos_ = pos + need;
+
+    entries_.push_back({pos, len, Timer::Now(), fd});
+
+    if (!on_line_.empty()) {
+        on_line_.Invoke(Line{first_seq_ + entries_.size() - 1, entries_.back().time, fd, {data_.data() + pos, len}});
+    }
+}
+
+}  // namespace nexer
@@ -0,0 +1,25 @@
+#include "mirror.h"
+
+namespace nexer {
+
+bool Mirror::Sample() {
+    credit += config.sample;
+    if (credit < 100) {
+        return false;
+    }
+    credit -= 100;
+    stats.connections++;
+    return true;
+}
+
+void Mirror::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("connections", stats.connections);
+    json.Field("connect_failures", stats.connect_failures);
+    json.Field("bytes", stats.bytes);
+    json.Field("overflows", stats.overflows);
+    json.Field("dropped", stats.dropped);
+    json.EndObject();
+}
+
+}  // namespace nexer
@@ -1,15 +1,17 @@
 #include "nexer.h"
 #include "tcp_forwarder.h"
+#include "timer.h"
 #include "udp_server.h"
 #include <assert.h>
+#include <memory>
 
 namespace nexer {
 
-Nexer::Nexer(Config& config) : config_(config), admin_server_(nullptr) {
+Nexer::Nexer(Config& config)
+    : executor_(config.executor_threads()), config_(config), uring_(nullptr), tunnel_server_(nullptr),
+      timelines_(kRecentConnections), admin_server_(nullptr) {
+    loop_.SetExecutor(executor_);
     process_manager_ = new ProcessManager(loop_);
-    process_manager_->OnProcessData([](const Process*, int, const char *s, size_t len) {
-        printf("%.*s", (int)len, s);
-    });
 }
 
 Nexer::~Nexer() {
@@ -22,6 +24,25 @@ bool Nexer::StartAdminServer() {
     server.OnRequest([this](http::incoming::Request& req, http::outgoing::Response& res) {
         if (req.url().path == "/shutdown") {
             Close();
+        } else if (req.url().path == "/apps") {
+            res.SetHeader("Content-Type", "application/json");
+            JsonWriter json(res.body());
+            process_manager_->WriteStatus(json);
+        } else if (req.url().path == "/status") {
+            ServeStatus(res);
+            return;
+        } else if (req.url().path == "/connections") {
+            ServeConnections(req, res);
+            return;
+        } else {
+            auto path = req.url().path;
+            std::string_view prefix("/apps/"), suffix("/logs");
+            if (path.size() > prefix.size() + suffix.size() && path.substr(0, prefix.size()) == prefix &&
+                path.substr(path.size() - suffix.size()) == suffix) {
+                auto name = path.substr(prefix.size(), path.size() - prefix.size() - suffix.size());
+                ServeLogs(req, res, name);
+                return;
+            }
         }
         res.End(200);
     });
@@ -29,13 +50,242 @@ bool Nexer::StartAdminServer() {
     return server.Listen(config_.admin().port);
 }
 
+// Query: tail=<lines> (default 100), follow=1 to keep receiving new lines
+void Nexer::ServeLogs(http::incoming::Request& req, http::outgoing::Response& res, std::string_view name) {
+    auto logs = process_manager_->GetLogs(name);
+    if (logs == nullptr) {
+        res.body() << "No logs for " << name << '\n';
+        res.End(404);
+        return;
+    }
+
+    size_t tail = 100;
+    bool follow = false;
+    ParseQueryString(req.url().query, [&](std::string_view key, std::string_view value) {
+        if (key == "tail") {
+            tail = strtoul(std::string(value).c_str(), nullptr, 10);
+        } else if (key == "follow") {
+            follow = value != "0" && value != "false";
+        }
+        return 0;
+    });
+
+    res.SetHeader("Content-Type", "text/plain; charset=utf-8");
+    logs->Tail(tail, [&](const LogRing::Line& line) {
+        res.body() << line.text << '\n';
+    });
+
+    if (!follow) {
+        res.End(200);
+        return;
+    }
+
+    // Lines go on until the client closes; nothing else is served on the
+    // connection, which the subscription's &res relies on
+    res.SetHeader("Connection", "close");
+    res.Begin(200);
+
+    auto& client = res.client();
+    auto unsubscribe = logs->OnLine([&res](const LogRing::Line& line) {
+        res.body() << line.text << '\n';
+        res.Flush();
+    });
+    streams_.insert(&client);
+    client.OnClose([this, &client, unsubscribe] {
+        unsubscribe();
+        streams_.erase(&client);
+    });
+}
+
+// Query: id=<connection> for a single timeline, or limit=<n> (default 100)
+// for those of recently closed connections, newest first
+void Nexer::ServeConnections(http::incoming::Request& req, http::outgoing::Response& res) {
+    uint64_t id = 0;
+    size_t limit = 100;
+    ParseQueryString(req.url().query, [&](std::string_view key, std::string_view value) {
+        if (key == "id") {
+            id = strtoull(std::string(value).c_str(), nullptr, 10);
+        } else if (key == "limit") {
+            limit = strtoul(std::string(value).c_str(), nullptr, 10);
+        }
+        return 0;
+    });
+
+    JsonWriter json(res.body());
+
+    if (id > 0) {
+        const Timeline *timeline = timelines_.Find(id);
+        for (size_t i = 0; timeline == nullptr && i < proxies_.size(); i++) {
+            timeline = proxies_[i]->FindTimeline(id);
+        }
+        if (timeline == nullptr) {
+            res.body() << "No connection " << id << '\n';
+            res.End(404);
+            return;
+        }
+        res.SetHeader("Content-Type", "application/json");
+        timeline->Write(json);
+        res.End(200);
+        return;
+    }
+
+    res.SetHeader("Content-Type", "application/json");
+    json.BeginArray();
+    timelines_.ForEach(limit, [&](const Timeline& timeline) {
+        timeline.Write(json);
+    });
+    json.EndArray();
+    res.End(200);
+}
+
+// Dumps apps, proxies and their connections as one JSON object. Each chunk
+// holds up to kStatusBatch connections and the next one is generated only
+// once the previous one has been sent, so the loop keeps running during a
+// large dump and a slow reader holds back a single chunk.
+void Nexer::ServeStatus(http::outgoing::Response& res) {
+    struct Dump {
+        JsonWriter json;
+        size_t proxy;
+        TcpForwarder *last;
+        int sending;
+        bool done;
+        Dump(std::ostream& os) : json(os), proxy(0), last(nullptr), sending(0), done(false) {}
+    };
+
+    auto dump = std::make_shared<Dump>(res.body());
+    auto& client = res.client();
+
+    res.SetHeader("Content-Type", "application/json");
+    res.Begin(200);
+    dump->sending++;
+
+    auto& json = dump->json;
+    json.BeginObject();
+    json.Field("time", Timer::Now());
+    json.Key("apps");
+    process_manager_->WriteStatus(json);
+    if (uring_) {
+        json.Key("io_uring");
+        uring_->WriteStatus(json);
+    }
+    json.Key("executor");
+    executor_.WriteStatus(json);
+    if (!tunnels_.empty()) {
+        json.Key("tunnels").BeginArray();
+        for (auto& it : tunnels_) {
+            it.second->WriteStatus(json);
+        }
+        json.EndArray();
+    }
+    if (tunnel_server_) {
+        json.Key("tunnel_server");
+        tunnel_server_->WriteStatus(json);
+    }
+    if (!udp_proxies_.empty()) {
+        json.Key("udp_proxies").BeginArray();
+        for (auto proxy : udp_proxies_) {
+            json.BeginObject();
+            proxy->WriteStatus(json);
+            json.EndObject();
+        }
+        json.EndArray();
+    }
+    json.Key("proxies").BeginArray();
+
+    auto next = [this, dump, &res] {
+        auto& json = dump->json;
+        size_t budget = kStatusBatch;
+        while (budget > 0 && dump->proxy < proxies_.size()) {
+            auto proxy = proxies_[dump->proxy];
+            if (dump->last == nullptr) {
+                json.BeginObject();
+                proxy->WriteStatus(json);
+                json.Key("connections").BeginArray();
+            }
+            dump->last = proxy->WriteConnections(json, dump->last, budget);
+            if (dump->last == nullptr) {
+                json.EndArray().EndObject();
+                dump->proxy++;
+            }
+        }
+        if (dump->proxy < proxies_.size()) {
+            dump->sending++;
+            res.Flush();
+        } else {
+            json.EndArray().EndObject();
+            dump->done = true;
+            res.End();
+        }
+    };
+    next();
+
+    if (dump->done) {
+        return;
+    }
+
+    // Later responses on the connection leave the subscription idle
+    auto unsubscribe = client.OnSend([dump, next] {
+        if (!dump->done && --dump->sending == 0) {
+            next();
+        }
+    });
+    streams_.insert(&client);
+    client.OnClose([this, &client, unsubscribe] {
+        unsubscribe();
+        streams_.erase(&client);
+    });
+}
+
 bool Nexer::Start() {
+    if (!process_manager_->StartSpawnHelper()) {
+        log_warn("Spawn helper not available, starting processes directly");
+    }
     if (!StartAdminServer()) {
         return false;
     }
+    process_manager_->StartProbing(config_.apps());
+    if (config_.uring().enabled && !(uring_ = Uring::Create(loop_, config_.uring()))) {
+        log_warn("io_uring not available, forwarding with libuv");
+    }
+    auto& tunnel = config_.tunnel();
+    if (tunnel.port > 0) {
+        tunnel_server_ = &TunnelServer::Create(loop_, tunnel);
+        if (!tunnel_server_->Listen(tunnel.host.data(), tunnel.port)) {
+            return false;
+        }
+    }
     for (auto& config: config_.proxies()) {
-        TcpProxy& proxy = TcpProxy::Create(loop_, config.upstream, process_manager_);
-        if (!proxy.Listen(config.port)) {
+        if (config.protocol == config::Proxy::Protocol::Udp) {
+            UdpProxy& proxy = UdpProxy::Create(loop_, config, process_manager_);
+            if (!proxy.Listen(config.host.data(), config.port)) {
+                return false;
+            }
+            udp_proxies_.push_back(&proxy);
+            continue;
+        }
+        TcpProxy& proxy = TcpProxy::Create(loop_, config.upstream, process_manager_, !config.path.empty());
+        proxy.SetTimelineRing(&timelines_);
+        proxy.SetUring(uring_);
+        if (config.upstream.tunnel_port > 0) {
+            auto& upstream = config.upstream;
+            auto key = upstream.tunnel_host + ':' + std::to_string(upstream.tunnel_port) + ' ' + upstream.tunnel_secret;
+            auto it = tunnels_.find(key);
+            if (it == tunnels_.end()) {
+                auto& tunnel = Tunnel::Create(loop_, upstream.tunnel_host, upstream.tunnel_port, upstream.tunnel_secret);
+                it = tunnels_.emplace(key, &tunnel).first;
+            }
+            proxy.SetTunnel(it->second);
+        }
+        proxy.AcceptProxyHeaders(config.accept_proxy_protocol, config.proxy_header_timeout);
+        if (!proxy.InitTls(config.tls)) {
+            return false;
+        }
+        if (!config.record.file.empty() && !proxy.StartRecording(config.record)) {
+            return false;
+        }
+        bool listening = config.path.empty() ? proxy.Listen(config.host.data(), config.port, config.port_count)
+                                             : proxy.ListenUnix(config.path.data());
+        if (!listening) {
             return false;
         }
         proxies_.push_back(&proxy);
@@ -46,15 +296,55 @@ bool Nexer::Start() {
             return false;
         }
     }
+    if (!Warm()) {
+        return false;
+    }
     loop_.Run();
     return true;
 }
 
+// Starts the apps marked warm and those of the proxies marked so, which
+// listen already
+bool Nexer::Warm() {
+    std::vector<const config::App*> apps;
+    for (auto app : config_.apps()) {
+        if (app->warm) {
+            apps.push_back(app);
+        }
+    }
+    for (auto& config : config_.proxies()) {
+        if (config.warm) {
+            apps.push_back(config.upstream.app);
+        }
+    }
+    return apps.empty() || process_manager_->Warm(apps, config_.warm_concurrency());
+}
+
 void Nexer::Close() {
     for (auto proxy: proxies_) {
         proxy->Close();
     }
     proxies_.clear();
+    for (auto proxy: udp_proxies_) {
+        proxy->Close();
+    }
+    udp_proxies_.clear();
+    process_manager_->Close();
+    for (auto& it : tunnels_) {
+        it.second->Close();
+    }
+    tunnels_.clear();
+    if (tunnel_server_) {
+        tunnel_server_->Close();
+        tunnel_server_ = nullptr;
+    }
+    if (uring_) {
+        uring_->Close();
+        uring_ = nullptr;
+    }
+    for (auto client: streams_) {
+        client->Close();
+    }
     if (admin_server_) {
         admin_server_->Close();
         admin_server_ = nullptr;
@@ -73,8 +363,11 @@ bool StartDummyTcpServer(EventLoop& loop, int port, bool echo) {
 
 bool StartDummyUdpServer(EventLoop& loop, int port, bool echo) {
     auto& server = UdpServer::Create(loop);
-    server.OnRecv([&](const char* s, size_t len, const struct sockaddr*) {
+    server.OnRecv([&server, echo](const char* s, size_t len, const struct sockaddr* addr) {
         log_debug("DD: %.*s", (int)len, s);
+        if (echo && addr) {
+            server.Send(s, len, addr);
+        }
     });
     return server.Listen(port);
 }
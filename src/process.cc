@@ -1,10 +1,17 @@
 #include "process.h"
+#include "memory_pool.h"
+#include "spawn_helper.h"
 #include "string_buffer.h"
 #include <assert.h>
+#include <unistd.h>
 #include <sstream>
 
 namespace nexer {
 
+// Output is handed on before a read callback returns, so reads from all
+// processes can share a few blocks instead of allocating one each time.
+static thread_local FixedSizeMemoryPool read_buffers(65536);
+
 Process &Process::Create(EventLoop &loop, const char *file) {
     auto process = new Process(loop, file);
     return *process;
@@ -16,6 +23,14 @@ Process &Process::Create(EventLoop &loop, const config::Command &cmd) {
     return process;
 }
 
+Process &Process::Create(EventLoop &loop, const SpawnTemplate &tmpl, SpawnHelper *helper) {
+    auto process = new Process(loop, tmpl, helper);
+    if (tmpl.timeout() > 0) {
+        process->SetTimeout(tmpl.timeout());
+    }
+    return *process;
+}
+
 void Process::Init(const config::Command& cmd) {
     for (auto &arg : cmd.args) {
         PushArg(arg.data());
@@ -30,7 +45,9 @@ void Process::Init(const config::Command& cmd) {
     }
 }
 
-Process::Process(EventLoop &loop, const char *file) : loop_(loop), status_{0}, timer_(nullptr), data_(nullptr) {
+Process::Process(EventLoop &loop, const char *file)
+    : loop_(loop), template_(nullptr), helper_(nullptr), helper_id_(0), pid_(0), pending_signal_(0),
+      timer_(nullptr), data_(nullptr), status_{} {
     args_.push_back(strdup(file));
     memset(pipes_, 0, sizeof(pipes_));
     memset(&request_, 0, sizeof request_);
@@ -38,6 +55,15 @@ Process::Process(EventLoop &loop, const char *file) : loop_(loop), status_{0}, t
     InitEnv();
 }
 
+// Arguments and environment come from the template, so nothing is copied
+Process::Process(EventLoop &loop, const SpawnTemplate &tmpl, SpawnHelper *helper)
+    : loop_(loop), template_(&tmpl), helper_(helper), helper_id_(0), pid_(0), pending_signal_(0),
+      timer_(nullptr), data_(nullptr), status_{} {
+    memset(pipes_, 0, sizeof(pipes_));
+    memset(&request_, 0, sizeof request_);
+    request_.data = this;
+}
+
 Process::~Process() {
     for (auto arg : args_) {
         if (arg) {
@@ -52,6 +78,9 @@ Process::~Process() {
     if (timer_) {
         timer_->Close();
     }
+    if (helper_ && helper_id_ > 0) {
+        helper_->Forget(helper_id_);
+    }
 }
 
 void OnProcessHandleClose(uv_handle_t *handle) {
@@ -62,20 +91,61 @@ void OnProcessHandleClose(uv_handle_t *handle) {
 
 void OnProcessExit(uv_process_t *req, int64_t exit_code, int term_signal) {
     Process *process = (Process *)(req->data);
-    process->status_ = {false, exit_code, term_signal};
+    process->Exited(exit_code, term_signal);
+}
+
+void Process::Exited(int64_t exit_code, int term_signal) {
+    status_ = {false, exit_code, term_signal};
+
+    if (helper_id_ > 0) {
+        Drain();
+    }
+
+    // The process is deleted by the last close callback so that no handle
+    // outlives it
+    uv_handle_t *last = nullptr;
     for (int i = 0; i < 3; i++) {
-        if (process->pipes_[i].data) {
-            uv_close((uv_handle_t*)&process->pipes_[i], nullptr);
+        if (pipes_[i].data) {
+            if (last) {
+                uv_close(last, nullptr);
+            }
+            last = (uv_handle_t *)&pipes_[i];
         }
     }
-    if (req->loop) {
-        uv_close((uv_handle_t *)req, OnProcessHandleClose);
+    if (request_.loop) {
+        if (last) {
+            uv_close(last, nullptr);
+        }
+        uv_close((uv_handle_t *)&request_, OnProcessHandleClose);
+    } else if (last) {
+        uv_close(last, OnProcessHandleClose);
     } else {
         // Start() wasn't called but timer set
-        OnProcessHandleClose((uv_handle_t *)req);
+        OnProcessHandleClose((uv_handle_t *)&request_);
     }
 }
 
+// The exit event from the helper may overtake the child's last output, which
+// is still buffered in the pipes.
+void Process::Drain() {
+    size_t size;
+    char *buf = (char *)read_buffers.Allocate(size);
+    for (int fd = 1; fd < 3; fd++) {
+        uv_os_fd_t pipe_fd;
+        if (pipes_[fd].data == nullptr || uv_fileno((uv_handle_t *)&pipes_[fd], &pipe_fd)) {
+            continue;
+        }
+        for (;;) {
+            ssize_t n = read(pipe_fd, buf, size);
+            if (n <= 0) {
+                break;
+            }
+            on_data_.Invoke(fd, buf, n);
+        }
+    }
+    read_buffers.Free(buf);
+}
+
 void Process::PushArg(const char *key, const char *value) {
     args_.push_back(strdup(key));
     if (value) {
@@ -136,9 +206,10 @@ void Process::InitEnv() {
     uv_os_free_environ(items, count);
 }
 
-static void OnAlloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
-    buf->base = (char *)malloc(suggested_size);
-    buf->len = suggested_size;
+void Process::OnAlloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+    size_t size;
+    buf->base = (char *)read_buffers.Allocate(size);
+    buf->len = size;
 }
 
 void Process::OnRead(int fd, uv_stream_t *pipe, ssize_t nread, const uv_buf_t *rdbuf) {
@@ -148,7 +219,7 @@ void Process::OnRead(int fd, uv_stream_t *pipe, ssize_t nread, const uv_buf_t *r
     } else if (nread > 0) {
         process->on_data_.Invoke(fd, rdbuf->base, nread);
     }
-    free(rdbuf->base);
+    read_buffers.Free(rdbuf->base);
 }
 
 void Process::OnReadStdout(uv_stream_t *pipe, ssize_t nread, const uv_buf_t *rdbuf) {
@@ -158,19 +229,94 @@ void Process::OnReadStderr(uv_stream_t *pipe, ssize_t nread, const uv_buf_t *rdb
     OnRead(2, pipe, nread, rdbuf);
 }
 
+int Process::SpawnWithHelper() {
+    uv_file fds[3][2];
+    int err;
+
+    for (int i = 0; i < 3; i++) {
+        if ((err = uv_pipe(fds[i], 0, 0))) {
+            while (i-- > 0) {
+                close(fds[i][0]);
+                close(fds[i][1]);
+            }
+            return err;
+        }
+    }
+
+    // The child reads stdin and writes stdout/stderr
+    int child[3] = {fds[0][0], fds[1][1], fds[2][1]};
+    int parent[3] = {fds[0][1], fds[1][0], fds[2][0]};
+
+    for (int i = 0; i < 3; i++) {
+        uv_pipe_init(loop_, &pipes_[i], 0);
+        uv_pipe_open(&pipes_[i], parent[i]);
+        pipes_[i].data = this;
+    }
+
+    int id = helper_->Spawn(*template_, child, this);
+
+    for (int i = 0; i < 3; i++) {
+        close(child[i]);
+    }
+
+    if (id < 0) {
+        return id;
+    }
+
+    helper_id_ = id;
+    status_.running = true;
+
+    if ((err = uv_read_start((uv_stream_t *)&pipes_[1], OnAlloc, OnReadStdout))) {
+        return err;
+    }
+
+    if ((err = uv_read_start((uv_stream_t *)&pipes_[2], OnAlloc, OnReadStderr))) {
+        return err;
+    }
+
+    return 0;
+}
+
+void Process::OnSpawned(uv_pid_t pid) {
+    pid_ = pid;
+    if (pending_signal_) {
+        Kill(pending_signal_);
+        pending_signal_ = 0;
+    }
+}
+
+void Process::OnSpawnFailed(int error) {
+    helper_id_ = 0;
+    on_error_.Invoke(error);
+    Exited(-1, -1);
+}
+
 int Process::Spawn() {
     int err;
 
-    args_.push_back(nullptr);
-    env_.push_back(nullptr);
+    if (template_ && helper_ && helper_->IsRunning()) {
+        return SpawnWithHelper();
+    }
 
     memset(&options_, 0, sizeof options_);
 
-    options_.file = args_[0];
-    options_.args = args_.data();
+    if (template_) {
+        options_.file = template_->file();
+        options_.args = template_->args();
+        options_.env = template_->env();
+        if (*template_->cwd()) {
+            options_.cwd = template_->cwd();
+        }
+    } else {
+        args_.push_back(nullptr);
+        env_.push_back(nullptr);
+
+        options_.file = args_[0];
+        options_.args = args_.data();
 
-    if (env_.size() > 1) {
-        options_.env = env_.data();
+        if (env_.size() > 1) {
+            options_.env = env_.data();
+        }
     }
 
     if ((err = InitStdio())) {
@@ -209,13 +355,20 @@ bool Process::Start() {
     if (status_.running) {
         Kill();
     } else {
-        OnProcessExit(&request_, -1, -1);
+        Exited(-1, -1);
     }
 
     return false;
 }
 
 int Process::Kill(int signal) {
+    if (helper_id_ > 0) {
+        if (pid_ <= 0) {
+            pending_signal_ = signal;
+            return 0;
+        }
+        return uv_kill(pid_, signal);
+    }
     return uv_process_kill(&request_, signal);
 }
 
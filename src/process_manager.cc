@@ -1,11 +1,34 @@
 #include "process_manager.h"
+#include "health_check.h"
+#include <assert.h>
+#include <algorithm>
 #include <sstream>
 
 namespace nexer {
 
-ProcessManager::ProcessManager(EventLoop& loop) : loop_(loop) {}
+ProcessManager::ProcessManager(EventLoop& loop) : loop_(loop), spawn_helper_(nullptr) {}
 
-ProcessManager::~ProcessManager() {}
+ProcessManager::~ProcessManager() {
+    Close();
+    if (spawn_helper_) {
+        spawn_helper_->Close();
+    }
+}
+
+bool ProcessManager::StartSpawnHelper() {
+    if (spawn_helper_ == nullptr) {
+        spawn_helper_ = &SpawnHelper::Create(loop_);
+    }
+    return spawn_helper_->IsRunning() || spawn_helper_->Start();
+}
+
+const SpawnTemplate& ProcessManager::GetTemplate(const config::Command& cmd) {
+    auto& tmpl = templates_[&cmd];
+    if (!tmpl) {
+        tmpl = std::make_unique<SpawnTemplate>(cmd);
+    }
+    return *tmpl;
+}
 
 static inline const char *ToString(int64_t status, int signal) {
     static char buf[128];
@@ -25,9 +48,13 @@ void ProcessManager::Start(App& app) {
             return;
         }
 
-        auto& process = Process::Create(loop_, app.config->command);
+        auto& process = Process::Create(loop_, GetTemplate(app.config->command), spawn_helper_);
+        SetHealth(app, Health::Starting, 0);
 
         process.OnData([&](int fd, const char* s, size_t len) {
+            if (app.logs) {
+                app.logs->Write(fd, s, len);
+            }
             on_process_data_.Invoke(&process, fd, s, len);
         });
 
@@ -40,10 +67,20 @@ void ProcessManager::Start(App& app) {
 
         process.OnExit([&](int64_t status, int signal) {
             log_debug("Exited %s %s (restart: %d)", str(app), ToString(status, signal), (int) app.restart);
+            if (app.logs) {
+                app.logs->Flush();
+            }
             status = status ? status : signal;
             on_process_exit_.Invoke(&process, status, signal);
             app.process = nullptr;
+            if (app.stopping) {
+                Stopped(app);
+                return;
+            }
             if (status != 0) {
+                if (!app.restart) {
+                    SetHealth(app, Health::Down, int(status));
+                }
                 if (app.restart) {
                     app.restart = false;
                     Start(app);
@@ -74,8 +111,9 @@ void ProcessManager::Start(App& app) {
                 timer.Close();
             } else if (!app.checking) {
                 log_debug("Checking %s after start", str(app));
-                Check(*app.config, then);
+                // Checks without a checker complete right away
                 app.checking = true;
+                Check(*app.config, then);
             }
         });
         app.process = &process;
@@ -83,6 +121,7 @@ void ProcessManager::Start(App& app) {
         app.checking = false;
         timer.Start();
         log_debug("Starting process %s", str(app));
+        on_app_step_.Invoke(*app.config, Step::Start);
         process.Start();
         on_process_start_.Invoke(&process);
     });
@@ -91,21 +130,34 @@ void ProcessManager::Start(App& app) {
 }
 
 void ProcessManager::ClearCallbacks(App& app, int error) {
-    for (auto then : app.callbacks) {
+    SetHealth(app, error == 0 ? Health::Healthy : Health::Down, error);
+    // Callbacks may require the app again
+    std::vector<AfterProcessCheck> callbacks;
+    callbacks.swap(app.callbacks);
+    for (auto& then : callbacks) {
         then(app.process, error);
     }
-    app.callbacks.clear();
 }
 
 void ProcessManager::Require(const config::App& config, AfterProcessCheck then) {
     auto& app = GetApp(config);
 
+    if (app.probe_timer && app.health == Health::Healthy && app.callbacks.empty()) {
+        then(app.process, 0);
+        return;
+    }
+
     app.callbacks.push_back(then);
     log_debug("Requiring %s (waiting %zu)", str(config), app.callbacks.size());
     if (app.callbacks.size() > 1) {
         return;
     }
 
+    if (app.stopping) {
+        log_debug("Starting %s once it has stopped", str(config));
+        return;
+    }
+
     Check(config, Then<int>([&](int error) {
         if (error == 0) {
             if (config.checker || app.process != nullptr) {
@@ -140,6 +192,8 @@ void ProcessManager::CheckPreamble(App& app, Then<int> then) {
         return;
     }
 
+    on_app_step_.Invoke(*app.config, Step::Preamble);
+
     for (auto& config: preamble) {
         log_debug("Requiring %s for %s", str(*config), str(app));
         Require(*config, [&, then](Process* process, int error) {
@@ -163,7 +217,15 @@ void ProcessManager::Check(const config::App& app, Then<int> then) {
 
     log_debug("Running checker for %s (%s)", str(app), str(*app.checker));
 
-    auto& process = Process::Create(loop_, *app.checker);
+    if (app.checker->type != config::Checker::Type::Command) {
+        HealthCheck::Run(loop_, *app.checker, Then<int>([&, then](int error) {
+            log_debug("Checker for %s (%s) completed (%d)", str(app), str(*app.checker), error);
+            then(error);
+        }));
+        return;
+    }
+
+    auto& process = Process::Create(loop_, GetTemplate(*app.checker), spawn_helper_);
 
     process.OnData([&](int fd, const char* s, size_t len) {
         on_process_data_.Invoke(&process, fd, s, len);
@@ -187,19 +249,353 @@ void ProcessManager::Check(const config::App& app, Then<int> then) {
     on_process_start_.Invoke(&process);
 }
 
+void ProcessManager::StartProbing(const std::vector<config::App *>& apps) {
+    for (auto config : apps) {
+        if (!config->checker || config->probe_interval <= 0) {
+            continue;
+        }
+        auto& app = GetApp(*config);
+        if (app.probe_timer) {
+            continue;
+        }
+        log_debug("Probing %s every %d ms", str(app), config->probe_interval);
+        app.probe_timer = &Timer::Create(loop_, config->probe_interval);
+        app.probe_timer->OnTick([&] {
+            Probe(app);
+        });
+        app.probe_timer->Start();
+    }
+}
+
+void ProcessManager::StopProbing() {
+    for (auto& it : app_map_) {
+        auto& app = it.second;
+        if (app.probe_timer) {
+            app.probe_timer->Close();
+            app.probe_timer = nullptr;
+        }
+    }
+}
+
+void ProcessManager::Probe(App& app) {
+    // A pending Require is checking or starting the app already, or the app
+    // was stopped on purpose
+    if (app.probing || app.callbacks.size() > 0 || app.health == Health::Stopped) {
+        return;
+    }
+
+    app.probing = true;
+    Check(*app.config, Then<int>([&](int error) {
+        app.probing = false;
+        app.last_probe = Timer::Now();
+        app.last_result = error;
+
+        if (error == 0) {
+            app.failures = 0;
+            SetHealth(app, Health::Healthy, 0);
+            return;
+        }
+
+        if (++app.failures < app.config->probe_failures) {
+            SetHealth(app, Health::Degraded, error);
+            return;
+        }
+
+        SetHealth(app, Health::Down, error);
+
+        if (app.probe_timer && app.callbacks.empty()) {
+            log_info("Restarting %s after %d failed probe(s)", str(app), app.failures);
+            app.failures = 0;
+            Require(*app.config, [&](Process*, int error) {
+                log_debug("Restarted %s (error %d)", str(app), error);
+            });
+        }
+    }));
+}
+
+void ProcessManager::Acquire(const config::App& config) {
+    auto& app = GetApp(config);
+    app.connections++;
+    if (app.idle_timer) {
+        app.idle_timer->Stop();
+    }
+}
+
+void ProcessManager::Release(const config::App& config) {
+    auto& app = GetApp(config);
+    assert(app.connections > 0);
+    app.last_used = Timer::Now();
+    if (--app.connections == 0) {
+        StartIdle(app);
+    }
+}
+
+// Counts idle_stop_after from now while nothing uses the app's process
+void ProcessManager::StartIdle(App& app) {
+    if (app.connections > 0 || app.config->idle_stop_after <= 0 || !app.process) {
+        return;
+    }
+
+    if (!app.idle_timer) {
+        app.idle_timer = &Timer::Create(loop_, app.config->idle_stop_after);
+        app.idle_timer->OnTick([&] {
+            app.idle_timer->Stop();
+            if (app.connections == 0 && app.callbacks.empty() && app.process && !app.stopping) {
+                StopIdle(app);
+            }
+        });
+    }
+    app.idle_timer->Start();
+}
+
+// Asks the process to exit, killing it if it takes longer than stop_timeout.
+// Requiring the app meanwhile starts it again once it has exited.
+void ProcessManager::StopIdle(App& app) {
+    log_info("Stopping %s after %d ms idle", str(app), app.config->idle_stop_after);
+    app.stopping = true;
+    app.idle_stops++;
+    SetHealth(app, Health::Stopped, 0);
+    app.process->Kill(SIGTERM);
+
+    if (app.config->stop_timeout > 0) {
+        app.stop_timer = &Timer::Create(loop_, app.config->stop_timeout);
+        app.stop_timer->OnTick([&] {
+            app.stop_timer->Close();
+            app.stop_timer = nullptr;
+            if (app.process) {
+                log_warn("Killing %s as it did not stop in %d ms", str(app), app.config->stop_timeout);
+                app.process->Kill(SIGKILL);
+            }
+        });
+        app.stop_timer->Start();
+    }
+}
+
+void ProcessManager::Stopped(App& app) {
+    app.stopping = false;
+    if (app.stop_timer) {
+        app.stop_timer->Close();
+        app.stop_timer = nullptr;
+    }
+    SetHealth(app, Health::Stopped, 0);
+
+    if (!app.callbacks.empty()) {
+        log_debug("Starting %s again after stopping it", str(app));
+        app.require_start_time = Timer::Now();
+        Start(app);
+    }
+}
+
+void ProcessManager::Close() {
+    StopProbing();
+    for (auto& it : app_map_) {
+        auto& app = it.second;
+        if (app.idle_timer) {
+            app.idle_timer->Close();
+            app.idle_timer = nullptr;
+        }
+        if (app.stop_timer) {
+            app.stop_timer->Close();
+            app.stop_timer = nullptr;
+        }
+    }
+}
+
+bool ProcessManager::Warm(const std::vector<const config::App*>& apps, int concurrency) {
+    auto warmup = std::make_shared<Warmup>();
+    warmup->concurrency = std::max(concurrency, 1);
+
+    std::vector<const config::App*> path;
+    for (auto app : apps) {
+        if (!AddWarm(*warmup, *app, path)) {
+            return false;
+        }
+    }
+
+    for (auto& it : warmup->nodes) {
+        if (it.second.pending == 0) {
+            warmup->ready.push_back(&it.second);
+        }
+    }
+
+    log_info("Warming up %zu app(s), %d at a time", warmup->nodes.size(), warmup->concurrency);
+    PumpWarm(warmup);
+    return true;
+}
+
+// Adds the app after its preamble, depth first; path holds the apps whose
+// preamble is being added, so finding one of them again is a cycle
+bool ProcessManager::AddWarm(Warmup& warmup, const config::App& app, std::vector<const config::App*>& path) {
+    auto cycle = std::find(path.begin(), path.end(), &app);
+    if (cycle != path.end()) {
+        std::stringstream ss;
+        for (; cycle != path.end(); ++cycle) {
+            ss << str(**cycle) << " -> ";
+        }
+        ss << str(app);
+        log_error("Preamble cycle: %s", ss.str().c_str());
+        return false;
+    }
+
+    if (warmup.nodes.count(&app)) {
+        return true;
+    }
+
+    path.push_back(&app);
+    for (auto preamble : app.preamble) {
+        if (!AddWarm(warmup, *preamble, path)) {
+            return false;
+        }
+    }
+    path.pop_back();
+
+    auto& node = warmup.nodes[&app];
+    node.app = &app;
+    for (auto preamble : app.preamble) {
+        warmup.nodes[preamble].dependents.push_back(&node);
+        node.pending++;
+    }
+    return true;
+}
+
+void ProcessManager::PumpWarm(std::shared_ptr<Warmup> warmup) {
+    while (warmup->running < warmup->concurrency && !warmup->ready.empty()) {
+        auto node = warmup->ready.front();
+        warmup->ready.pop_front();
+        warmup->running++;
+        log_debug("Warming up %s", str(*node->app));
+        Require(*node->app, [this, warmup, node](Process*, int error) {
+            warmup->running--;
+            Warmed(warmup, node, error);
+            PumpWarm(warmup);
+        });
+    }
+}
+
+// Readies the apps waiting for this one, or gives up on them if it failed
+void ProcessManager::Warmed(std::shared_ptr<Warmup> warmup, Warmup::Node* node, int error) {
+    if (error != 0) {
+        log_warn("Failed to warm up %s (error %d)", str(*node->app), error);
+        warmup->failed++;
+    }
+
+    for (auto dependent : node->dependents) {
+        dependent->failed |= error != 0;
+        if (--dependent->pending > 0) {
+            continue;
+        }
+        if (dependent->failed) {
+            log_warn("Not warming up %s as its preamble failed", str(*dependent->app));
+            Warmed(warmup, dependent, UV_ECANCELED);
+        } else {
+            warmup->ready.push_back(dependent);
+        }
+    }
+
+    if (++warmup->done == warmup->nodes.size()) {
+        log_info("Warmed up %zu app(s), %zu failed", warmup->done, warmup->failed);
+    }
+}
+
+void ProcessManager::SetHealth(App& app, Health health, int result) {
+    if (app.health == health) {
+        return;
+    }
+
+    log_info("%s is %s (was %s, result %d)", str(app), HealthName(health), HealthName(app.health), result);
+
+    app.transitions.push_back({Timer::Now(), app.health, health, result});
+    if (app.transitions.size() > kMaxTransitions) {
+        app.transitions.pop_front();
+    }
+    app.health = health;
+
+    // Started by a probe or warm-up, or used and released while starting
+    if (health == Health::Healthy) {
+        StartIdle(app);
+    }
+}
+
+LogRing *ProcessManager::GetLogs(std::string_view name) {
+    for (auto& it : app_map_) {
+        auto& app = it.second;
+        if (app.logs && (app.config->name == name || (app.config->name.empty() && name == str(app)))) {
+            return app.logs.get();
+        }
+    }
+    return nullptr;
+}
+
+ProcessManager::Health ProcessManager::GetHealth(const config::App& config) {
+    auto it = app_map_.find(&config);
+    return it != app_map_.end() ? it->second.health : Health::Unknown;
+}
+
+const char *ProcessManager::HealthName(Health health) {
+    switch (health) {
+    case Health::Starting:
+        return "starting";
+    case Health::Healthy:
+        return "healthy";
+    case Health::Degraded:
+        return "degraded";
+    case Health::Down:
+        return "down";
+    case Health::Stopped:
+        return "stopped";
+    default:
+        return "unknown";
+    }
+}
+
+void ProcessManager::WriteStatus(JsonWriter& json) {
+    json.BeginArray();
+    for (auto& it : app_map_) {
+        auto& app = it.second;
+        json.BeginObject();
+        json.Field("name", str(app));
+        json.Field("health", HealthName(app.health));
+        json.Field("pid", app.process ? app.process->GetPid() : 0);
+        json.Field("callbacks", app.callbacks.size());
+        json.Field("restart", app.restart);
+        json.Field("checking", app.checking);
+        json.Field("probe_interval", app.config->probe_interval);
+        json.Field("failures", app.failures);
+        json.Field("last_probe", app.last_probe);
+        json.Field("last_result", app.last_result);
+        json.Field("connections", app.connections);
+        json.Field("idle_stop_after", app.config->idle_stop_after);
+        json.Field("last_used", app.last_used);
+        json.Field("idle_stops", app.idle_stops);
+        json.Key("transitions").BeginArray();
+        for (auto& transition : app.transitions) {
+            json.BeginObject();
+            json.Field("time", transition.time);
+            json.Field("from", HealthName(transition.from));
+            json.Field("to", HealthName(transition.to));
+            json.Field("result", transition.result);
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+    }
+    json.EndArray();
+}
+
 ProcessManager::App& ProcessManager::GetApp(const config::App& config) {
     auto it = app_map_.find(&config);
     if (it != app_map_.end()) {
         return it->second;
     }
 
-    app_map_.emplace(&config, App({
-        .config = &config,
-        .process = nullptr,
-        .pending_preamble = 0,
-    }));
+    auto& app = app_map_.try_emplace(&config).first->second;
+    app.config = &config;
 
-    return app_map_[&config];
+    if (config.log_size > 0) {
+        app.logs = std::make_unique<LogRing>(config.log_size);
+    }
+
+    return app;
 }
 
 const char *ProcessManager::str(const config::Command& cmd) {
@@ -236,6 +632,36 @@ const char *ProcessManager::str(const config::Command& cmd) {
 
 }
 
+const char *ProcessManager::str(const config::Checker& checker) {
+    if (checker.type == config::Checker::Type::Command) {
+        return str((const config::Command&)checker);
+    }
+
+    auto it = str_map_.find(&checker);
+    if (it != str_map_.end()) {
+        return it->second->c_str();
+    }
+
+    std::stringstream ss;
+
+    switch (checker.type) {
+    case config::Checker::Type::Tcp:
+        ss << "tcp " << checker.host << ':' << checker.port;
+        break;
+    case config::Checker::Type::Http:
+        ss << "http " << checker.host << ':' << checker.port << checker.path;
+        break;
+    default:
+        ss << "unix " << checker.path;
+        break;
+    }
+
+    auto str_ptr = std::make_shared<std::string>(ss.str());
+    str_map_.emplace(&checker, str_ptr);
+
+    return str_ptr->c_str();
+}
+
 const char *ProcessManager::str(const config::App& app) {
     if (app.name.size() > 0) {
         return app.name.c_str();
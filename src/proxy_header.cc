@@ -0,0 +1,186 @@
+#include "proxy_header.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace nexer {
+
+static const char kSignature[12] = {'\r', '\n', '\r', '\n', '\0', '\r', '\n', 'Q', 'U', 'I', 'T', '\n'};
+
+// Lengths of the v2 address blocks, which start right after the header
+static const size_t kInetSize = 12;
+static const size_t kInet6Size = 36;
+
+static size_t WriteV1(char *buf, int family, const sockaddr *src, const sockaddr *dst) {
+    if (family == AF_UNSPEC) {
+        static const char unknown[] = "PROXY UNKNOWN\r\n";
+        memcpy(buf, unknown, sizeof unknown - 1);
+        return sizeof unknown - 1;
+    }
+
+    char src_ip[INET6_ADDRSTRLEN], dst_ip[INET6_ADDRSTRLEN];
+    int src_port, dst_port;
+    if (family == AF_INET) {
+        auto s = (const sockaddr_in *)src, d = (const sockaddr_in *)dst;
+        uv_ip4_name(s, src_ip, sizeof src_ip);
+        uv_ip4_name(d, dst_ip, sizeof dst_ip);
+        src_port = ntohs(s->sin_port);
+        dst_port = ntohs(d->sin_port);
+    } else {
+        auto s = (const sockaddr_in6 *)src, d = (const sockaddr_in6 *)dst;
+        uv_ip6_name(s, src_ip, sizeof src_ip);
+        uv_ip6_name(d, dst_ip, sizeof dst_ip);
+        src_port = ntohs(s->sin6_port);
+        dst_port = ntohs(d->sin6_port);
+    }
+    int len = snprintf(buf, ProxyHeader::kMaxSize, "PROXY %s %s %s %d %d\r\n", family == AF_INET ? "TCP4" : "TCP6",
+                       src_ip, dst_ip, src_port, dst_port);
+    return std::min(size_t(len), ProxyHeader::kMaxSize - 1);
+}
+
+static size_t WriteV2(char *buf, int family, const sockaddr *src, const sockaddr *dst) {
+    auto p = (uint8_t *)buf;
+    memcpy(p, kSignature, sizeof kSignature);
+    p[12] = 0x21;  // version 2, PROXY command
+    size_t len = 0;
+    if (family == AF_INET) {
+        auto s = (const sockaddr_in *)src, d = (const sockaddr_in *)dst;
+        p[13] = 0x11;  // TCP over IPv4
+        memcpy(p + 16, &s->sin_addr, 4);
+        memcpy(p + 20, &d->sin_addr, 4);
+        memcpy(p + 24, &s->sin_port, 2);
+        memcpy(p + 26, &d->sin_port, 2);
+        len = kInetSize;
+    } else if (family == AF_INET6) {
+        auto s = (const sockaddr_in6 *)src, d = (const sockaddr_in6 *)dst;
+        p[13] = 0x21;  // TCP over IPv6
+        memcpy(p + 16, &s->sin6_addr, 16);
+        memcpy(p + 32, &d->sin6_addr, 16);
+        memcpy(p + 48, &s->sin6_port, 2);
+        memcpy(p + 50, &d->sin6_port, 2);
+        len = kInet6Size;
+    } else {
+        p[13] = 0x00;
+    }
+    p[14] = len >> 8;
+    p[15] = len & 0xff;
+    return 16 + len;
+}
+
+size_t ProxyHeader::Write(char *buf, int version, const sockaddr *src, const sockaddr *dst) {
+    int family = src && dst && src->sa_family == dst->sa_family ? src->sa_family : AF_UNSPEC;
+    if (family != AF_INET && family != AF_INET6) {
+        family = AF_UNSPEC;
+    }
+    return version == 1 ? WriteV1(buf, family, src, dst) : WriteV2(buf, family, src, dst);
+}
+
+static int ParseV1(const char *data, size_t len, ProxyHeader::Address &src, ProxyHeader::Address &dst) {
+    static const char prefix[] = "PROXY ";
+    if (memcmp(data, prefix, std::min(len, sizeof prefix - 1)) != 0) {
+        return -1;
+    }
+    // The line is at most kMaxSize - 1 bytes, CRLF included
+    auto end = (const char *)memchr(data, '\n', std::min(len, ProxyHeader::kMaxSize - 1));
+    if (end == nullptr) {
+        return len >= ProxyHeader::kMaxSize - 1 ? -1 : 0;
+    }
+    if (end == data || end[-1] != '\r') {
+        return -1;
+    }
+    int length = end + 1 - data;
+
+    char line[ProxyHeader::kMaxSize];
+    size_t n = end - 1 - data;
+    memcpy(line, data, n);
+    line[n] = '\0';
+    // Whatever follows UNKNOWN is to be ignored
+    if (strncmp(line, "PROXY UNKNOWN", 13) == 0 && (line[13] == '\0' || line[13] == ' ')) {
+        return length;
+    }
+
+    char proto[5], src_ip[INET6_ADDRSTRLEN], dst_ip[INET6_ADDRSTRLEN], extra;
+    unsigned src_port, dst_port;
+    if (sscanf(line, "PROXY %4s %45s %45s %5u %5u%c", proto, src_ip, dst_ip, &src_port, &dst_port, &extra) != 5 ||
+        src_port > 65535 || dst_port > 65535) {
+        return -1;
+    }
+    if (strcmp(proto, "TCP4") == 0) {
+        if (uv_ip4_addr(src_ip, src_port, &src.in) || uv_ip4_addr(dst_ip, dst_port, &dst.in)) {
+            return -1;
+        }
+    } else if (strcmp(proto, "TCP6") == 0) {
+        if (uv_ip6_addr(src_ip, src_port, &src.in6) || uv_ip6_addr(dst_ip, dst_port, &dst.in6)) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    return length;
+}
+
+static int ParseV2(const char *data, size_t len, ProxyHeader::Address &src, ProxyHeader::Address &dst) {
+    if (memcmp(data, kSignature, std::min(len, sizeof kSignature)) != 0) {
+        return -1;
+    }
+    if (len < 16) {
+        return 0;
+    }
+
+    auto p = (const uint8_t *)data;
+    int command = p[12] & 0x0f;
+    if ((p[12] >> 4) != 2 || command > 1) {
+        return -1;
+    }
+    size_t addr_len = (p[14] << 8) | p[15];
+    int length = 16 + addr_len;
+    int family = p[13] >> 4;
+    size_t need = family == 1 ? kInetSize : family == 2 ? kInet6Size : 0;
+    if (addr_len < need) {
+        return -1;
+    }
+    // LOCAL connections (health checks by the proxy itself) and anything
+    // but TCP keep their own addresses
+    if (command == 0 || need == 0 || (p[13] & 0x0f) != 1) {
+        return length;
+    }
+    if (len < 16 + need) {
+        return 0;
+    }
+
+    if (family == 1) {
+        memset(&src, 0, sizeof src);
+        memset(&dst, 0, sizeof dst);
+        src.in.sin_family = dst.in.sin_family = AF_INET;
+        memcpy(&src.in.sin_addr, p + 16, 4);
+        memcpy(&dst.in.sin_addr, p + 20, 4);
+        memcpy(&src.in.sin_port, p + 24, 2);
+        memcpy(&dst.in.sin_port, p + 26, 2);
+    } else {
+        memset(&src, 0, sizeof src);
+        memset(&dst, 0, sizeof dst);
+        src.in6.sin6_family = dst.in6.sin6_family = AF_INET6;
+        memcpy(&src.in6.sin6_addr, p + 16, 16);
+        memcpy(&dst.in6.sin6_addr, p + 32, 16);
+        memcpy(&src.in6.sin6_port, p + 48, 2);
+        memcpy(&dst.in6.sin6_port, p + 50, 2);
+    }
+    return length;
+}
+
+int ProxyHeader::Parse(const char *data, size_t len, Address &src, Address &dst) {
+    src.sa.sa_family = dst.sa.sa_family = AF_UNSPEC;
+    if (len == 0) {
+        return 0;
+    }
+    int length = data[0] == 'P' ? ParseV1(data, len, src, dst) : data[0] == '\r' ? ParseV2(data, len, src, dst) : -1;
+    if (length <= 0) {
+        src.sa.sa_family = dst.sa.sa_family = AF_UNSPEC;
+    }
+    return length;
+}
+
+}  // namespace nexer
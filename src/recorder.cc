@@ -0,0 +1,391 @@
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "logger.h"
+
+namespace nexer {
+
+const char Recorder::kMagic[8] = {'N', 'E', 'X', 'R', 'E', 'C', 0, 1};
+
+static size_t PutVarint(char *buf, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = char(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = char(value);
+    return n;
+}
+
+static bool GetVarint(const char *&p, const char *end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool IsData(Recorder::Event event) {
+    return event == Recorder::Event::ClientData || event == Recorder::Event::UpstreamData;
+}
+
+static size_t PutLost(char *buf, uint64_t session, uint64_t time) {
+    size_t n = 0;
+    buf[n++] = char(Recorder::Event::Lost);
+    n += PutVarint(buf + n, session);
+    n += PutVarint(buf + n, time);
+    return n;
+}
+
+Recorder::Recorder(int fd, const std::string &file, size_t size)
+    : fd_(fd), file_(file), start_(uv_hrtime()), ring_(size), head_(0), tail_(0), stopping_(false), stats_{} {
+    thread_ = std::thread([this] {
+        Run();
+    });
+}
+
+Recorder::~Recorder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_one();
+    thread_.join();
+
+    // Sessions lost after the last record that found room, marked behind
+    // everything the thread wrote
+    std::string markers;
+    uint64_t time = Now();
+    for (auto session : lost_) {
+        char marker[1 + 2 * 10];
+        markers.append(marker, PutLost(marker, session, time));
+    }
+    if (!markers.empty()) {
+        off_t offset = lseek(fd_, 0, SEEK_END);
+        if (write(fd_, markers.data(), markers.size()) != ssize_t(markers.size())) {
+            stats_.write_errors++;
+            if (offset >= 0 && ftruncate(fd_, offset) != 0) {
+                log_error("Cannot truncate recording %s: %s", file_.data(), strerror(errno));
+            }
+        }
+    }
+    close(fd_);
+}
+
+std::shared_ptr<Recorder> Recorder::Create(const config::Record &config) {
+    int fd = open(config.file.data(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error("Cannot open recording %s: %s", config.file.data(), strerror(errno));
+        return nullptr;
+    }
+
+    // Appending to an existing recording, or starting a new one
+    char magic[sizeof kMagic];
+    ssize_t n = pread(fd, magic, sizeof magic, 0);
+    if (n == 0) {
+        n = write(fd, kMagic, sizeof kMagic) == sizeof kMagic ? sizeof kMagic : -1;
+    } else if (n != sizeof magic || memcmp(magic, kMagic, sizeof magic) != 0) {
+        log_error("Cannot record to %s: not a recording", config.file.data());
+        close(fd);
+        return nullptr;
+    }
+    if (n < 0) {
+        log_error("Cannot write recording %s: %s", config.file.data(), strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    std::shared_ptr<Recorder> recorder(new Recorder(fd, config.file, config.buffer_size));
+    uv_timeval64_t now;
+    uv_gettimeofday(&now);
+    recorder->Put(Event::Start, 0, now.tv_sec * 1000000 + now.tv_usec, nullptr, 0);
+    return recorder;
+}
+
+uint64_t Recorder::Now() const {
+    return (uv_hrtime() - start_) / 1000;
+}
+
+// The loop's side: copies a record into the ring
+bool Recorder::Put(Event event, uint64_t session, uint64_t time, const uv_buf_t *bufs, size_t count) {
+    char header[1 + 3 * 10];
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += bufs[i].len;
+    }
+    size_t n = 0;
+    header[n++] = char(event);
+    n += PutVarint(header + n, session);
+    n += PutVarint(header + n, time);
+    if (IsData(event)) {
+        n += PutVarint(header + n, size);
+    }
+
+    auto copy = [this](const char *data, size_t len) {
+        size_t pos = head_ % ring_.size();
+        size_t first = std::min(len, ring_.size() - pos);
+        memcpy(ring_.data() + pos, data, first);
+        memcpy(ring_.data(), data + first, len - first);
+        head_ += len;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t before = head_ - tail_;
+    while (!lost_.empty()) {
+        char marker[1 + 2 * 10];
+        size_t len = PutLost(marker, lost_.back(), time);
+        if (head_ - tail_ + len > ring_.size()) {
+            break;
+        }
+        copy(marker, len);
+        lost_.pop_back();
+    }
+    if (head_ - tail_ + n + size > ring_.size()) {
+        stats_.dropped++;
+        return false;
+    }
+    copy(header, n);
+    for (size_t i = 0; i < count; i++) {
+        copy(bufs[i].base, bufs[i].len);
+    }
+    bool notify = before < kBatchSize && head_ - tail_ >= kBatchSize;
+    lock.unlock();
+
+    if (notify) {
+        ready_.notify_one();
+    }
+    stats_.bytes += size;
+    return true;
+}
+
+// The writer's side: writes out whatever is waiting once there is a batch
+// of it or a while has passed, without holding the lock meanwhile
+void Recorder::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        ready_.wait_for(lock, std::chrono::milliseconds(uint64_t(kFlushInterval)), [this] {
+            return stopping_ || head_ - tail_ >= kBatchSize;
+        });
+        size_t head = head_, tail = tail_;
+        if (head == tail) {
+            if (stopping_) {
+                break;
+            }
+            continue;
+        }
+        lock.unlock();
+
+        size_t pos = tail % ring_.size(), len = head - tail, done = 0;
+        size_t first = std::min(len, ring_.size() - pos);
+        iovec iov[2] = {{ring_.data() + pos, first}, {ring_.data(), len - first}};
+        int iovcnt = first < len ? 2 : 1;
+        off_t offset = lseek(fd_, 0, SEEK_END);
+        while (done < len) {
+            ssize_t n = writev(fd_, iov, iovcnt);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                // Given up on. What made it to the file is cut back to its
+                // last whole record, so that the next batch does not follow
+                // half of one.
+                stats_.write_errors++;
+                size_t whole = Whole(tail, done);
+                if (whole < done && offset >= 0 && ftruncate(fd_, offset + whole) == 0) {
+                    stats_.written -= done - whole;
+                }
+                break;
+            }
+            stats_.written += n;
+            done += n;
+            for (int i = 0; i < iovcnt && n > 0; i++) {
+                size_t taken = std::min(size_t(n), iov[i].iov_len);
+                iov[i].iov_base = (char *)iov[i].iov_base + taken;
+                iov[i].iov_len -= taken;
+                n -= taken;
+            }
+        }
+
+        lock.lock();
+        tail_ = head;
+    }
+}
+
+size_t Recorder::Whole(size_t from, size_t len) const {
+    auto at = [this](size_t i) {
+        return uint8_t(ring_[i % ring_.size()]);
+    };
+    size_t whole = 0;
+    while (whole < len) {
+        size_t p = from + whole;
+        auto event = Event(at(p++));
+        // Session, time and, for data, size
+        uint64_t value = 0;
+        for (int i = 0; i < (IsData(event) ? 3 : 2); i++) {
+            value = 0;
+            for (int shift = 0;; shift += 7) {
+                uint8_t byte = at(p++);
+                value |= uint64_t(byte & 0x7f) << shift;
+                if (byte < 0x80) {
+                    break;
+                }
+            }
+        }
+        size_t end = p - from + (IsData(event) ? value : 0);
+        if (end > len) {
+            break;
+        }
+        whole = end;
+    }
+    return whole;
+}
+
+bool Recorder::Open(uint64_t session) {
+    if (!Put(Event::Open, session, Now(), nullptr, 0)) {
+        return false;
+    }
+    stats_.sessions++;
+    return true;
+}
+
+bool Recorder::Write(uint64_t session, bool from_client, const char *data, size_t len) {
+    uv_buf_t buf = uv_buf_init((char *)data, len);
+    return Put(from_client ? Event::ClientData : Event::UpstreamData, session, Now(), &buf, 1);
+}
+
+bool Recorder::Write(uint64_t session, bool from_client, const IoBuffer &data) {
+    uv_buf_t bufs[16];
+    std::vector<uv_buf_t> more;
+    uv_buf_t *iov = bufs;
+    size_t count = data.segments();
+    if (count > sizeof bufs / sizeof bufs[0]) {
+        more.resize(count);
+        iov = more.data();
+    }
+    count = data.Export(iov, count);
+    return Put(from_client ? Event::ClientData : Event::UpstreamData, session, Now(), iov, count);
+}
+
+void Recorder::Close(uint64_t session) {
+    if (!Put(Event::Close, session, Now(), nullptr, 0)) {
+        Lose(session);
+    }
+}
+
+void Recorder::Lose(uint64_t session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lost_.push_back(session);
+}
+
+void Recorder::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("file", file_);
+    json.Field("sessions", stats_.sessions);
+    json.Field("bytes", stats_.bytes);
+    json.Field("dropped", stats_.dropped);
+    json.Field("written", stats_.written.load());
+    json.Field("write_errors", stats_.write_errors.load());
+    json.EndObject();
+}
+
+bool Recording::Load(const char *file, Recording &recording) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        log_error("Cannot open recording %s: %s", file, strerror(errno));
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    auto content = ss.str();
+    if (content.size() < sizeof Recorder::kMagic ||
+        memcmp(content.data(), Recorder::kMagic, sizeof Recorder::kMagic) != 0) {
+        log_error("%s is not a recording", file);
+        return false;
+    }
+
+    std::vector<Session> sessions;
+    std::vector<bool> lost;
+    // Sessions open in the current run, by id
+    std::map<uint64_t, size_t> open;
+    uint64_t start = 0;
+
+    const char *p = content.data() + sizeof Recorder::kMagic, *end = content.data() + content.size();
+    while (p < end) {
+        auto event = Recorder::Event(*p++);
+        uint64_t id, time, size = 0;
+        if (!GetVarint(p, end, id) || !GetVarint(p, end, time) ||
+            (IsData(event) && (!GetVarint(p, end, size) || size > uint64_t(end - p)))) {
+            break;
+        }
+        const char *data = p;
+        p += size;
+
+        auto it = open.find(id);
+        switch (event) {
+        case Recorder::Event::Start:
+            start = time;
+            open.clear();
+            break;
+        case Recorder::Event::Open:
+            open[id] = sessions.size();
+            sessions.push_back({id, start + time, 0, {}});
+            lost.push_back(false);
+            break;
+        case Recorder::Event::ClientData:
+        case Recorder::Event::UpstreamData:
+        case Recorder::Event::Close:
+        case Recorder::Event::Lost:
+            if (it == open.end()) {
+                break;
+            }
+            {
+                auto &session = sessions[it->second];
+                uint64_t offset = start + time - session.start;
+                if (IsData(event)) {
+                    session.chunks.push_back({offset, event == Recorder::Event::ClientData, std::string(data, size)});
+                } else {
+                    session.duration = offset;
+                    lost[it->second] = event == Recorder::Event::Lost;
+                    open.erase(it);
+                }
+            }
+            break;
+        default:
+            log_error("Bad record in %s at offset %zu", file, size_t(p - content.data()));
+            return false;
+        }
+    }
+
+    recording.sessions.clear();
+    for (size_t i = 0; i < sessions.size(); i++) {
+        if (lost[i]) {
+            continue;
+        }
+        auto &session = sessions[i];
+        if (session.duration == 0 && !session.chunks.empty()) {
+            session.duration = session.chunks.back().time;
+        }
+        recording.sessions.push_back(std::move(session));
+    }
+    std::stable_sort(recording.sessions.begin(), recording.sessions.end(), [](auto &a, auto &b) {
+        return a.start < b.start;
+    });
+    return true;
+}
+
+}  // namespace nexer
@@ -0,0 +1,255 @@
+// Replays the sessions of a recording (see Recorder) against an upstream,
+// for load testing it with real traffic:
+//
+//   nexer-replay [-s speed] [-c concurrency] [-t timeout] [-w wait] file address
+//
+// Sessions start at the offsets they were recorded at and what each client
+// sent goes out at the time it was, both divided by speed. What the upstream
+// sends back is only counted, against what it sent when recorded. address
+// is host:port, a port on 127.0.0.1 or unix:path.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "coroutine.h"
+#include "logger.h"
+#include "recorder.h"
+
+using namespace nexer;
+
+struct Options {
+    double speed = 1;
+    size_t concurrency = 0;  // unlimited
+    uint64_t timeout = 5000;
+    // How long a session is kept open past its recorded end for what the
+    // upstream still owes
+    uint64_t wait = 1000;
+    std::string host = "127.0.0.1";
+    int port = 0;
+    std::string path;
+};
+
+class Replayer {
+  private:
+    EventLoop &loop_;
+    const Options &options_;
+    size_t active_ = 0;
+    std::deque<std::coroutine_handle<>> waiting_;
+
+    // Resumes once fewer than the allowed number of sessions are active
+    struct Slot {
+        Replayer &replayer;
+
+        bool await_ready() const {
+            auto &r = replayer;
+            return r.options_.concurrency == 0 || r.active_ < r.options_.concurrency;
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            replayer.waiting_.push_back(handle);
+        }
+        void await_resume() const {
+            replayer.active_++;
+        }
+    };
+
+    void Release() {
+        active_--;
+        if (!waiting_.empty()) {
+            auto handle = waiting_.front();
+            waiting_.pop_front();
+            handle.resume();
+        }
+    }
+
+    // Milliseconds into the replay that something recorded at time, in
+    // microseconds, is due
+    uint64_t Scale(uint64_t time) const {
+        return uint64_t(time / 1000.0 / options_.speed);
+    }
+
+  public:
+    struct {
+        uint64_t sessions;
+        uint64_t failed;  // to connect
+        uint64_t reset;   // closed by the upstream before the end
+        uint64_t sent;
+        uint64_t received;
+        uint64_t expected;
+        uint64_t max_lag;  // ms a write went out late by
+    } stats = {};
+
+    Replayer(EventLoop &loop, const Options &options) : loop_(loop), options_(options) {}
+
+    Task Play(const Recording::Session &session, uint64_t begin, uint64_t offset);
+};
+
+Task Replayer::Play(const Recording::Session &session, uint64_t begin, uint64_t offset) {
+    uint64_t due = begin + Scale(offset);
+    uint64_t now = uv_now(loop_);
+    if (due > now) {
+        co_await Sleep{loop_, due - now};
+    }
+    co_await Slot{*this};
+
+    stats.sessions++;
+    auto client = co_await Connect{loop_, options_.host.data(), options_.port, options_.timeout, {},
+                                   options_.path.empty() ? nullptr : options_.path.data(), true};
+    if (!client) {
+        stats.failed++;
+        Release();
+        co_return;
+    }
+
+    // Outlives the coroutine should the client be closed after it returns
+    struct State {
+        bool closed = false;
+        uint64_t received = 0;
+    };
+    auto state = std::make_shared<State>();
+    client->OnData([state](const char *, size_t len) {
+        state->received += len;
+    });
+    client->OnError([client](int, const char *) {
+        client->Close();
+    });
+    client->OnClose([state] {
+        state->closed = true;
+    });
+
+    uint64_t start = uv_now(loop_), expected = 0;
+    for (auto &chunk : session.chunks) {
+        if (!chunk.from_client) {
+            expected += chunk.data.size();
+            continue;
+        }
+        due = start + Scale(chunk.time);
+        now = uv_now(loop_);
+        if (due > now) {
+            co_await Sleep{loop_, due - now};
+        } else {
+            stats.max_lag = std::max(stats.max_lag, now - due);
+        }
+        if (state->closed || co_await Write{*client, chunk.data.data(), chunk.data.size()} != 0) {
+            break;
+        }
+        stats.sent += chunk.data.size();
+    }
+
+    due = start + Scale(session.duration);
+    now = uv_now(loop_);
+    if (due > now && !state->closed) {
+        co_await Sleep{loop_, due - now};
+    }
+    for (uint64_t deadline = std::max(due, now) + options_.wait;
+         !state->closed && state->received < expected && uv_now(loop_) < deadline;) {
+        co_await Sleep{loop_, 10};
+    }
+
+    if (state->closed) {
+        stats.reset++;
+    } else {
+        client->Close();
+    }
+    stats.received += state->received;
+    stats.expected += expected;
+    Release();
+}
+
+static bool ParseAddress(const char *s, Options &options) {
+    if (strncmp(s, "unix:", 5) == 0) {
+        options.path = s + 5;
+        return !options.path.empty();
+    }
+    const char *colon = strrchr(s, ':');
+    if (colon) {
+        options.host.assign(s, colon - s);
+        // [::1]:80
+        if (options.host.size() > 1 && options.host.front() == '[' && options.host.back() == ']') {
+            options.host = options.host.substr(1, options.host.size() - 2);
+        }
+        s = colon + 1;
+    }
+    char *end;
+    long port = strtol(s, &end, 10);
+    options.port = int(port);
+    return *s && !*end && port > 0 && port < 65536 && !options.host.empty();
+}
+
+static void Usage() {
+    fprintf(stderr,
+            "Usage: nexer-replay [-s speed] [-c concurrency] [-t timeout] [-w wait] file address\n"
+            "  -s  multiplies the recorded rate (default 1)\n"
+            "  -c  sessions open at once at most (default unlimited)\n"
+            "  -t  ms to connect in (default 5000)\n"
+            "  -w  ms a session is kept open past its end for replies (default 1000)\n"
+            "  address is host:port, port or unix:path\n");
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    int c;
+    while ((c = getopt(argc, argv, "s:c:t:w:h")) != -1) {
+        switch (c) {
+        case 's':
+            options.speed = atof(optarg);
+            break;
+        case 'c':
+            options.concurrency = strtoul(optarg, nullptr, 10);
+            break;
+        case 't':
+            options.timeout = strtoull(optarg, nullptr, 10);
+            break;
+        case 'w':
+            options.wait = strtoull(optarg, nullptr, 10);
+            break;
+        default:
+            Usage();
+            return 2;
+        }
+    }
+    if (argc - optind != 2 || options.speed <= 0 || !ParseAddress(argv[optind + 1], options)) {
+        Usage();
+        return 2;
+    }
+
+    Recording recording;
+    if (!Recording::Load(argv[optind], recording)) {
+        return 1;
+    }
+    if (recording.sessions.empty()) {
+        fprintf(stderr, "No sessions in %s\n", argv[optind]);
+        return 1;
+    }
+
+    log_set_level(Logger::Level::WARN);
+
+    EventLoop loop;
+    Replayer replayer(loop, options);
+    uint64_t first = recording.sessions.front().start, last = first;
+    uint64_t begin = uv_now(loop);
+    for (auto &session : recording.sessions) {
+        last = std::max(last, session.start + session.duration);
+        replayer.Play(session, begin, session.start - first);
+    }
+    loop.Run();
+
+    uv_update_time(loop);
+    auto &stats = replayer.stats;
+    printf("sessions: %llu, failed to connect: %llu, closed early: %llu\n", (unsigned long long)stats.sessions,
+           (unsigned long long)stats.failed, (unsigned long long)stats.reset);
+    printf("sent: %llu bytes, received: %llu of %llu bytes\n", (unsigned long long)stats.sent,
+           (unsigned long long)stats.received, (unsigned long long)stats.expected);
+    printf("elapsed: %llu ms, recorded: %llu ms, max lag: %llu ms\n", (unsigned long long)(uv_now(loop) - begin),
+           (unsigned long long)((last - first) / 1000), (unsigned long long)stats.max_lag);
+    // Before the default logger closes stdout on exit
+    fflush(stdout);
+
+    return stats.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+#include "shaper.h"
+
+namespace nexer {
+
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst, uint64_t now)
+    : rate_(rate), burst_(int64_t(burst > 0 ? burst : rate) * 1000), tokens_(burst_), last_(now) {}
+
+void TokenBucket::Refill(uint64_t now) {
+    if (rate_ == 0 || now <= last_) {
+        return;
+    }
+    uint64_t elapsed = now - last_;
+    last_ = now;
+    if (tokens_ + int64_t(elapsed * rate_) >= burst_) {
+        tokens_ = burst_;
+    } else {
+        tokens_ += elapsed * rate_;
+    }
+}
+
+uint64_t TokenBucket::GetDelay() const {
+    if (!IsEmpty()) {
+        return 0;
+    }
+    return (uint64_t(1000 - tokens_) + rate_ - 1) / rate_;
+}
+
+Shaper::Shaper(const config::Upstream &upstream, uint64_t now)
+    : shared{{uint64_t(upstream.rate_limit), uint64_t(upstream.rate_burst), now},
+             {uint64_t(upstream.rate_limit), uint64_t(upstream.rate_burst), now}},
+      rate(upstream.connection_rate_limit),
+      burst(upstream.connection_rate_burst) {}
+
+bool Shaper::IsNeeded(const config::Upstream &upstream) {
+    return upstream.rate_limit > 0 || upstream.connection_rate_limit > 0;
+}
+
+}  // namespace nexer
@@ -0,0 +1,593 @@
+#include "spawn_helper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <set>
+
+#include "logger.h"
+#include "process.h"
+#include "timer.h"
+
+extern char **environ;
+
+namespace nexer {
+
+SpawnTemplate::SpawnTemplate(const config::Command &cmd) : timeout_(cmd.timeout) {
+    std::set<std::string> overrides;
+    for (auto &item : cmd.env) {
+        overrides.insert(item.substr(0, item.find('=')));
+    }
+
+    std::vector<std::string> env;
+    uv_env_item_t *items;
+    int count;
+    if (uv_os_environ(&items, &count) == 0) {
+        for (int i = 0; i < count; i++) {
+            if (overrides.find(items[i].name) == overrides.end()) {
+                env.push_back(std::string(items[i].name) + '=' + items[i].value);
+            }
+        }
+        uv_os_free_environ(items, count);
+    }
+    env.insert(env.end(), cmd.env.begin(), cmd.env.end());
+
+    auto append = [this](const std::string &s) {
+        strings_.insert(strings_.end(), s.begin(), s.end());
+        strings_.push_back('\0');
+    };
+
+    append(cmd.file);
+    append(cmd.cwd);
+    append(cmd.file);
+    for (auto &arg : cmd.args) {
+        append(arg);
+    }
+    for (auto &item : env) {
+        append(item);
+    }
+
+    // Pointers are taken once strings_ no longer grows
+    char *p = strings_.data();
+    p += strlen(p) + 1;
+    p += strlen(p) + 1;
+    for (size_t i = 0; i < cmd.args.size() + 1; i++) {
+        args_.push_back(p);
+        p += strlen(p) + 1;
+    }
+    for (size_t i = 0; i < env.size(); i++) {
+        env_.push_back(p);
+        p += strlen(p) + 1;
+    }
+    args_.push_back(nullptr);
+    env_.push_back(nullptr);
+}
+
+// Wire format
+
+struct SpawnRequest {
+    uint32_t id;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t size;
+};
+
+struct SpawnEvent {
+    enum Type : int32_t {
+        Started,
+        Failed,
+        Exited,
+    };
+    uint32_t id;
+    Type type;
+    int64_t value;  // pid, error or exit status
+    int32_t signal;
+    int32_t reserved;
+};
+
+static bool WriteAll(int fd, const void *data, size_t len) {
+    auto p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t len) {
+    auto p = (char *)data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void SetCloseOnExec(int fd) {
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+// Helper process side. Nothing here may touch libuv, whose loop belongs to
+// the parent.
+
+static int sigchld_pipe[2];
+
+static void OnSigChld(int) {
+    int saved = errno;
+    char c = 0;
+    (void)!write(sigchld_pipe[1], &c, 1);
+    errno = saved;
+}
+
+static void Launch(int event_fd, uint32_t id, std::vector<char> &payload, const SpawnRequest &req, int stdio[3],
+                   std::map<pid_t, uint32_t> &children) {
+    std::vector<char *> args, env;
+    char *p = payload.data();
+    char *file = p;
+    p += strlen(p) + 1;
+    char *cwd = p;
+    p += strlen(p) + 1;
+    for (uint32_t i = 0; i < req.argc; i++) {
+        args.push_back(p);
+        p += strlen(p) + 1;
+    }
+    for (uint32_t i = 0; i < req.envc; i++) {
+        env.push_back(p);
+        p += strlen(p) + 1;
+    }
+    args.push_back(nullptr);
+    env.push_back(nullptr);
+
+    // Reports exec failures; closed by a successful exec
+    int errpipe[2];
+    SpawnEvent event = {id, SpawnEvent::Failed, 0, 0, 0};
+
+    if (pipe(errpipe)) {
+        event.value = -errno;
+        WriteAll(event_fd, &event, sizeof event);
+        return;
+    }
+    SetCloseOnExec(errpipe[0]);
+    SetCloseOnExec(errpipe[1]);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        int err = 0;
+        for (int i = 0; i < 3 && err == 0; i++) {
+            if (dup2(stdio[i], i) < 0) {
+                err = errno;
+            }
+        }
+        if (err == 0 && *cwd && chdir(cwd)) {
+            err = errno;
+        }
+        if (err == 0) {
+            environ = env.data();
+            execvp(file, args.data());
+            err = errno;
+        }
+        (void)!write(errpipe[1], &err, sizeof err);
+        _exit(127);
+    }
+
+    close(errpipe[1]);
+
+    int err = 0;
+    ssize_t n;
+    do {
+        n = read(errpipe[0], &err, sizeof err);
+    } while (n < 0 && errno == EINTR);
+    close(errpipe[0]);
+
+    if (pid < 0) {
+        event.value = -errno;
+    } else if (n == sizeof err) {
+        // The failed child is reaped without being reported
+        event.value = -err;
+    } else {
+        children[pid] = id;
+        event.type = SpawnEvent::Started;
+        event.value = pid;
+    }
+
+    WriteAll(event_fd, &event, sizeof event);
+}
+
+static bool HandleRequest(int request_fd, int event_fd, std::map<pid_t, uint32_t> &children) {
+    SpawnRequest req;
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec iov = {&req, sizeof req};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    ssize_t n;
+    do {
+        n = recvmsg(request_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return false;
+    }
+
+    if ((size_t)n < sizeof req && !ReadAll(request_fd, (char *)&req + n, sizeof req - n)) {
+        return false;
+    }
+
+    int stdio[3] = {-1, -1, -1};
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(stdio, CMSG_DATA(cmsg), sizeof stdio);
+    }
+
+    std::vector<char> payload(req.size);
+    if (!ReadAll(request_fd, payload.data(), req.size)) {
+        return false;
+    }
+
+    Launch(event_fd, req.id, payload, req, stdio, children);
+
+    for (int i = 0; i < 3; i++) {
+        if (stdio[i] >= 0) {
+            close(stdio[i]);
+        }
+    }
+
+    return true;
+}
+
+void SpawnHelper::Run(int request_fd, int event_fd) {
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0 || max_fd > 4096) {
+        max_fd = 4096;
+    }
+    // Inherited descriptors are pointed at /dev/null rather than closed.
+    // libuv's fork handler closes and recreates its own pipes in every child
+    // forked from here, so their numbers must not be reused for an app's stdio.
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int fd = 3; fd < max_fd; fd++) {
+        if (fd == request_fd || fd == event_fd || fd == null_fd || fcntl(fd, F_GETFD) < 0) {
+            continue;
+        }
+        if (null_fd < 0 || dup3(null_fd, fd, O_CLOEXEC) < 0) {
+            close(fd);
+        }
+    }
+    if (null_fd >= 0) {
+        close(null_fd);
+    }
+
+    if (pipe(sigchld_pipe)) {
+        _exit(1);
+    }
+    for (int i = 0; i < 2; i++) {
+        SetCloseOnExec(sigchld_pipe[i]);
+        fcntl(sigchld_pipe[i], F_SETFL, fcntl(sigchld_pipe[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = OnSigChld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+    std::map<pid_t, uint32_t> children;
+
+    for (;;) {
+        struct pollfd fds[2] = {{request_fd, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}};
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _exit(1);
+        }
+
+        if (fds[1].revents) {
+            char buf[64];
+            while (read(sigchld_pipe[0], buf, sizeof buf) > 0) {
+            }
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                auto it = children.find(pid);
+                if (it == children.end()) {
+                    continue;
+                }
+                SpawnEvent event = {it->second, SpawnEvent::Exited, 0, 0, 0};
+                if (WIFEXITED(status)) {
+                    event.value = WEXITSTATUS(status);
+                } else if (WIFSIGNALED(status)) {
+                    event.signal = WTERMSIG(status);
+                }
+                WriteAll(event_fd, &event, sizeof event);
+                children.erase(it);
+            }
+        }
+
+        // Exits once nexer closes its end; running children are left alone
+        if (fds[0].revents && !HandleRequest(request_fd, event_fd, children)) {
+            _exit(0);
+        }
+    }
+}
+
+// Nexer side
+
+SpawnHelper::SpawnHelper(uv_loop_t *loop) : request_fd_(-1), pid_(0), next_id_(0), input_(sizeof(SpawnEvent) * 64) {
+    if (int status = uv_pipe_init(loop, &events_, 0)) {
+        log_fatal("uv_pipe_init: %s", uv_strerror(status));
+    }
+    events_.data = this;
+}
+
+SpawnHelper::~SpawnHelper() {
+    Fail(UV_ECANCELED);
+}
+
+SpawnHelper &SpawnHelper::Create(EventLoop &loop) {
+    auto helper = new SpawnHelper(loop);
+    return *helper;
+}
+
+bool SpawnHelper::Start() {
+    int requests[2], events[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, requests)) {
+        log_error("spawn helper socketpair: %s", strerror(errno));
+        return false;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, events)) {
+        log_error("spawn helper socketpair: %s", strerror(errno));
+        close(requests[0]);
+        close(requests[1]);
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        SetCloseOnExec(requests[i]);
+        SetCloseOnExec(events[i]);
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        log_error("spawn helper fork: %s", strerror(errno));
+        for (int i = 0; i < 2; i++) {
+            close(requests[i]);
+            close(events[i]);
+        }
+        return false;
+    }
+
+    if (pid == 0) {
+        close(requests[0]);
+        close(events[0]);
+        Run(requests[1], events[1]);
+        _exit(0);
+    }
+
+    close(requests[1]);
+    close(events[1]);
+
+    request_fd_ = requests[0];
+    pid_ = pid;
+
+    int err;
+    if ((err = uv_pipe_open(&events_, events[0])) || (err = uv_read_start((uv_stream_t *)&events_, OnAlloc, OnRead))) {
+        log_error("spawn helper events: %s", uv_strerror(err));
+        Fail(err);
+        return false;
+    }
+
+    // Only referenced while there are processes to hear about
+    uv_unref((uv_handle_t *)&events_);
+
+    log_debug("spawn helper started (pid %d)", (int)pid_);
+
+    return true;
+}
+
+int SpawnHelper::Spawn(const SpawnTemplate &tmpl, int stdio[3], Process *process) {
+    if (pid_ <= 0) {
+        return UV_ENOTCONN;
+    }
+
+    auto &strings = tmpl.strings();
+    next_id_ = next_id_ % INT32_MAX + 1;
+
+    SpawnRequest req = {next_id_, (uint32_t)tmpl.argc(), (uint32_t)tmpl.envc(), (uint32_t)strings.size()};
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec iov[2] = {{&req, sizeof req}, {(void *)strings.data(), strings.size()}};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof msg);
+    memset(control, 0, sizeof control);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+    memcpy(CMSG_DATA(cmsg), stdio, sizeof(int) * 3);
+
+    ssize_t n;
+    do {
+        n = sendmsg(request_fd_, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return -errno;
+    }
+
+    // The descriptors went with the first byte; the rest is plain data
+    size_t total = sizeof req + strings.size();
+    if ((size_t)n < total) {
+        size_t head = (size_t)n < sizeof req ? sizeof req - n : 0;
+        if ((head && !WriteAll(request_fd_, (char *)&req + n, head)) ||
+            !WriteAll(request_fd_, strings.data() + (n + head - sizeof req), total - n - head)) {
+            return -errno;
+        }
+    }
+
+    processes_[next_id_] = process;
+    UpdateRef();
+
+    return (int)next_id_;
+}
+
+void SpawnHelper::Forget(uint32_t id) {
+    processes_.erase(id);
+    UpdateRef();
+}
+
+void SpawnHelper::UpdateRef() {
+    if (processes_.empty()) {
+        uv_unref((uv_handle_t *)&events_);
+    } else {
+        uv_ref((uv_handle_t *)&events_);
+    }
+}
+
+void SpawnHelper::OnAlloc(uv_handle_t *handle, size_t, uv_buf_t *buf) {
+    auto helper = (SpawnHelper *)handle->data;
+    *buf = helper->input_.Reserve(sizeof(SpawnEvent));
+}
+
+void SpawnHelper::OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *) {
+    auto helper = (SpawnHelper *)stream->data;
+
+    if (nread > 0) {
+        helper->input_.Commit(nread);
+        helper->Dispatch();
+    } else if (nread < 0) {
+        log_error("spawn helper exited: %s", uv_strerror(nread));
+        helper->Fail(nread);
+    }
+}
+
+void SpawnHelper::Dispatch() {
+    SpawnEvent event;
+
+    while (input_.size() >= sizeof event) {
+        input_.CopyTo((char *)&event, sizeof event);
+        input_.Consume(sizeof event);
+
+        auto it = processes_.find(event.id);
+        if (it == processes_.end()) {
+            continue;
+        }
+
+        auto process = it->second;
+        switch (event.type) {
+        case SpawnEvent::Started:
+            process->OnSpawned((uv_pid_t)event.value);
+            break;
+        case SpawnEvent::Failed:
+            processes_.erase(it);
+            UpdateRef();
+            process->OnSpawnFailed((int)event.value);
+            break;
+        case SpawnEvent::Exited:
+            processes_.erase(it);
+            UpdateRef();
+            process->Exited(event.value, event.signal);
+            break;
+        }
+    }
+}
+
+// The helper exits as soon as it sees the request socket closed, but is
+// not waited for on the loop: it is reaped from a timer, and killed if it
+// is still there after kReapTimeout.
+static void Reap(uv_loop_t *loop, pid_t pid) {
+    const uint64_t kReapInterval = 10;
+    const uint64_t kReapTimeout = 1000;
+
+    if (waitpid(pid, nullptr, WNOHANG) != 0) {
+        return;
+    }
+
+    auto &timer = Timer::Create(loop, kReapInterval);
+    timer.OnTick([&timer, pid, waited = uint64_t(0)]() mutable {
+        if (waitpid(pid, nullptr, WNOHANG) != 0) {
+            timer.Close();
+            return;
+        }
+        waited += kReapInterval;
+        if (waited == kReapTimeout) {
+            log_warn("spawn helper %d did not exit, killing it", (int)pid);
+            kill(pid, SIGKILL);
+        }
+    });
+    timer.Start();
+}
+
+// Processes still waiting for an event can no longer be tracked, so those
+// already started are killed before being reported failed; later spawns
+// fall back to uv_spawn.
+void SpawnHelper::Fail(int error) {
+    uv_read_stop((uv_stream_t *)&events_);
+
+    if (request_fd_ >= 0) {
+        close(request_fd_);
+        request_fd_ = -1;
+    }
+
+    if (pid_ > 0) {
+        Reap(events_.loop, pid_);
+        pid_ = 0;
+    }
+
+    auto processes = std::move(processes_);
+    processes_.clear();
+    for (auto &it : processes) {
+        auto process = it.second;
+        if (process->pid_ > 0) {
+            kill(process->pid_, SIGKILL);
+        }
+        process->helper_ = nullptr;
+        process->OnSpawnFailed(error);
+    }
+}
+
+}  // namespace nexer
@@ -1,13 +1,16 @@
 #include "tcp_client.h"
 
+#include <vector>
+
 #include "logger.h"
 #include "timer.h"
 
 namespace nexer {
 
-TcpClient::TcpClient(uv_loop_t *loop) : flags_{0} {
-    if (int status = uv_tcp_init(loop, &tcp_)) {
-        log_fatal("uv_tcp_init: %s", uv_strerror(status));
+TcpClient::TcpClient(uv_loop_t *loop, bool unix) : unix_(unix), flags_{} {
+    int status = unix ? uv_pipe_init(loop, &pipe_, 0) : uv_tcp_init(loop, &tcp_);
+    if (status) {
+        log_fatal("%s: %s", unix ? "uv_pipe_init" : "uv_tcp_init", uv_strerror(status));
         exit(1);
     }
 
@@ -15,12 +18,12 @@ TcpClient::TcpClient(uv_loop_t *loop) : flags_{0} {
 }
 
 TcpClient &TcpClient::Create(EventLoop &loop) {
-    auto client = new TcpClient(loop);
+    auto client = new TcpClient(loop, false);
     return *client;
 }
 
-TcpClient &TcpClient::Create(uv_loop_t *loop) {
-    auto client = new TcpClient(loop);
+TcpClient &TcpClient::Create(uv_loop_t *loop, bool unix) {
+    auto client = new TcpClient(loop, unix);
     return *client;
 }
 
@@ -30,9 +33,18 @@ struct WriteRequest {
     uv_buf_t buf;
 };
 
+// Owns the written data until libuv is done with it
+struct BufferWriteRequest {
+    TcpClient *client;
+    uv_write_t req;
+    IoBuffer data;
+};
+
+// The client is cleared if it closes before the lookup completes
 struct GetAddrInfoRequest {
     TcpClient *client;
     uv_getaddrinfo_t req;
+    FunctionList<void>::Remove unsub_onclose;
 };
 
 // Internal callbacks
@@ -41,7 +53,18 @@ void TcpClient::OnAddrInfo(uv_getaddrinfo_t *resolver, int status, struct addrin
     auto req = reinterpret_cast<GetAddrInfoRequest *>(resolver->data);
     auto client = req->client;
 
-    client->flags_.name_resolving = 0;
+    if (client) {
+        req->unsub_onclose();
+        client->flags_.name_resolving = 0;
+    }
+
+    if (client == nullptr || client->IsClosing()) {
+        if (status == 0) {
+            uv_freeaddrinfo(res);
+        }
+        delete req;
+        return;
+    }
 
     if (status < 0) {
         client->OnError("getaddrinfo", status);
@@ -49,7 +72,12 @@ void TcpClient::OnAddrInfo(uv_getaddrinfo_t *resolver, int status, struct addrin
         return;
     }
 
-    client->ConnectAddr((const struct sockaddr *)res->ai_addr);
+    // Dual-stack names keep going over IPv4 as they always have
+    auto ai = res;
+    while (ai && ai->ai_family != AF_INET) {
+        ai = ai->ai_next;
+    }
+    client->ConnectAddr((ai ? ai : res)->ai_addr);
 
     uv_freeaddrinfo(res);
 
@@ -57,11 +85,18 @@ void TcpClient::OnAddrInfo(uv_getaddrinfo_t *resolver, int status, struct addrin
 }
 
 void TcpClient::ReadStart() {
-    if (int status = uv_read_start((uv_stream_t *)&tcp_, OnAlloc, OnRead)) {
+    int status = uv_read_start(stream(), OnAlloc, OnRead);
+    if (status && status != UV_EALREADY) {
         OnError("uv_read_start", status);
     }
 }
 
+void TcpClient::ReadStop() {
+    if (int status = uv_read_stop(stream())) {
+        OnError("uv_read_stop", status);
+    }
+}
+
 void TcpClient::OnConnect(uv_connect_t *req, int status) {
     auto client = reinterpret_cast<TcpClient *>(req->data);
     client->flags_.connecting = 0;
@@ -104,6 +139,17 @@ void TcpClient::OnWrite(uv_write_t *req, int status) {
     }
 }
 
+void TcpClient::OnWriteBuffer(uv_write_t *req, int status) {
+    auto request = reinterpret_cast<BufferWriteRequest *>(req->data);
+    auto client = request->client;
+    delete request;
+    if (status) {
+        client->OnError("write", status);
+    } else {
+        client->on_send_.Invoke();
+    }
+}
+
 void TcpClient::OnWrite2(uv_write_t *req, int status) {
     auto client = reinterpret_cast<TcpClient *>(req->data);
     free(req);
@@ -114,6 +160,59 @@ void TcpClient::OnWrite2(uv_write_t *req, int status) {
     }
 }
 
+std::string TcpClient::GetPeerName() {
+    if (unix_) {
+        // Clients connecting to a socket are unnamed, so accepted ones go
+        // by the socket they came in on
+        char path[256];
+        size_t size = sizeof path;
+        if (uv_pipe_getpeername(&pipe_, path, &size) || size == 0) {
+            size = sizeof path;
+            if (uv_pipe_getsockname(&pipe_, path, &size)) {
+                return {};
+            }
+        }
+        return "unix:" + std::string(path, size);
+    }
+
+    sockaddr_storage addr;
+    if (GetPeerAddress(addr)) {
+        return {};
+    }
+
+    char ip[INET6_ADDRSTRLEN];
+    int port;
+    if (addr.ss_family == AF_INET6) {
+        auto in6 = (const sockaddr_in6 *)&addr;
+        uv_ip6_name(in6, ip, sizeof ip);
+        port = ntohs(in6->sin6_port);
+        return '[' + std::string(ip) + "]:" + std::to_string(port);
+    }
+    auto in = (const sockaddr_in *)&addr;
+    uv_ip4_name(in, ip, sizeof ip);
+    port = ntohs(in->sin_port);
+    return std::string(ip) + ':' + std::to_string(port);
+}
+
+int TcpClient::GetPeerAddress(sockaddr_storage &addr) {
+    int len = sizeof addr;
+    return unix_ ? UV_ENOTSUP : uv_tcp_getpeername(&tcp_, (sockaddr *)&addr, &len);
+}
+
+int TcpClient::GetSockAddress(sockaddr_storage &addr) {
+    int len = sizeof addr;
+    return unix_ ? UV_ENOTSUP : uv_tcp_getsockname(&tcp_, (sockaddr *)&addr, &len);
+}
+
+int TcpClient::GetFd() {
+    uv_os_fd_t fd;
+    return uv_fileno((uv_handle_t *)stream(), &fd) ? -1 : fd;
+}
+
+size_t TcpClient::GetWriteQueueSize() {
+    return uv_stream_get_write_queue_size(stream());
+}
+
 // Private methods:
 
 void TcpClient::GetAddrInfo(const char *node, const char *service) {
@@ -121,7 +220,7 @@ void TcpClient::GetAddrInfo(const char *node, const char *service) {
 
     memset(&hints, 0, sizeof(hints));
 
-    hints.ai_family = AF_INET;
+    hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
     hints.ai_flags = 0;
@@ -136,7 +235,12 @@ void TcpClient::GetAddrInfo(const char *node, const char *service) {
         OnError("getaddrinfo", status);
         flags_.name_resolving = 0;
         delete req;
+        return;
     }
+
+    req->unsub_onclose = on_close_.Add([req] {
+        req->client = nullptr;
+    });
 }
 
 void TcpClient::ConnectAddr(const struct sockaddr *addr) {
@@ -162,6 +266,13 @@ void TcpClient::Connect(int port) {
     Connect("127.0.0.1", port);
 }
 
+void TcpClient::ConnectUnix(const char *path) {
+    uv_connect_t *req = (uv_connect_t *)malloc(sizeof *req);
+    req->data = this;
+    flags_.connecting = 1;
+    uv_pipe_connect(req, &pipe_, path, OnConnect);
+}
+
 void TcpClient::Write(const char *data, size_t len) {
     WriteRequest *req = new WriteRequest();
     int status;
@@ -170,7 +281,7 @@ void TcpClient::Write(const char *data, size_t len) {
     req->req.data = req;
     req->buf = uv_buf_init((char *)data, len);
 
-    if ((status = uv_write(&req->req, (uv_stream_t *)&tcp_, &req->buf, 1, OnWrite)) != 0) {
+    if ((status = uv_write(&req->req, stream(), &req->buf, 1, OnWrite)) != 0) {
         delete req;
         OnError("write", status);
     }
@@ -181,12 +292,38 @@ void TcpClient::Write(uv_buf_t *buf, size_t len) {
 
     req->data = this;
 
-    if (int status = uv_write(req, (uv_stream_t *)&tcp_, buf, len, OnWrite2)) {
+    if (int status = uv_write(req, stream(), buf, len, OnWrite2)) {
         free(req);
         OnError("write", status);
     }
 }
 
+void TcpClient::Write(IoBuffer &data) {
+    if (data.empty()) {
+        return;
+    }
+
+    auto req = new BufferWriteRequest();
+    req->client = this;
+    req->req.data = req;
+    req->data.Append(data);
+
+    uv_buf_t bufs[16];
+    std::vector<uv_buf_t> more;
+    uv_buf_t *iov = bufs;
+    size_t count = req->data.segments();
+    if (count > sizeof(bufs) / sizeof(bufs[0])) {
+        more.resize(count);
+        iov = more.data();
+    }
+    count = req->data.Export(iov, count);
+
+    if (int status = uv_write(&req->req, stream(), iov, count, OnWriteBuffer)) {
+        delete req;
+        OnError("write", status);
+    }
+}
+
 struct TryConnectData {
     TcpClient *client;
     FunctionList<void>::Remove unsub_onconnect;
@@ -202,12 +339,26 @@ struct TryConnectData {
 };
 
 void TcpClient::Connect(EventLoop &loop, const char *host, int port, uint64_t timeout,
-                        std::function<void(TcpClient *)> then, std::function<void(TcpClient &)> on_try) {
+                        std::function<void(TcpClient *)> then, std::function<void(TcpClient &)> on_try,
+                        bool immediate) {
+    Connect(loop, host, port, nullptr, timeout, then, on_try, immediate);
+}
+
+void TcpClient::ConnectUnix(EventLoop &loop, const char *path, uint64_t timeout,
+                            std::function<void(TcpClient *)> then, std::function<void(TcpClient &)> on_try,
+                            bool immediate) {
+    Connect(loop, path, 0, path, timeout, then, on_try, immediate);
+}
+
+// Connects to host:port, or path when set
+void TcpClient::Connect(EventLoop &loop, const char *host, int port, const char *path, uint64_t timeout,
+                        std::function<void(TcpClient *)> then, std::function<void(TcpClient &)> on_try,
+                        bool immediate) {
     nexer::Timer &timer = nexer::Timer::Create(loop, 500);
     timer.SetData(new TryConnectData(), [&] { delete (TryConnectData *)timer.data(); });
-    auto connect = [&loop, &timer, host, port, then, on_try] {
+    auto connect = [&loop, &timer, host, port, path, then, on_try] {
         auto data = reinterpret_cast<TryConnectData *>(timer.data());
-        auto &client = TcpClient::Create(loop);
+        auto &client = TcpClient::Create(loop, path != nullptr);
         data->unsub_onconnect = client.OnConnect([&timer, host, port, then] {
             log_debug("tcp_client: connected to %s:%d", host, port);
             auto data = reinterpret_cast<TryConnectData *>(timer.data());
@@ -226,7 +377,11 @@ void TcpClient::Connect(EventLoop &loop, const char *host, int port, uint64_t ti
         if (on_try) {
             on_try(client);
         }
-        client.Connect(host, port);
+        if (path) {
+            client.ConnectUnix(path);
+        } else {
+            client.Connect(host, port);
+        }
         data->client = &client;
     };
 
@@ -249,6 +404,10 @@ void TcpClient::Connect(EventLoop &loop, const char *host, int port, uint64_t ti
         }
     });
 
+    // The first tick only comes after an interval
+    if (immediate) {
+        connect();
+    }
     timer.Start();
 }
 
@@ -1,13 +1,239 @@
 #include "tcp_forwarder.h"
 #include "logger.h"
+#include "timer.h"
 
 namespace nexer {
 
-void TcpForwarder::Swap(Client *client) {
-    std::swap(client->data_in, client->data_out);
-    if (incoming_.tcp == outgoing_.tcp) {
-        auto peer = client == &incoming_ ? &outgoing_ : &incoming_;
-        std::swap(peer->data_in, peer->data_out);
+TcpForwarder::TcpForwarder(TcpClient &incoming)
+    : incoming_(&incoming), shape_timer_(nullptr), proxy_version_(0), expecting_header_(false),
+      header_timer_(nullptr), upstream_started_(false), mirror_tcp_(nullptr), uring_(nullptr), spliced_(false) {
+    source_.sa.sa_family = destination_.sa.sa_family = AF_UNSPEC;
+    Init(&incoming_);
+}
+
+// Hands everything read from client so far to the peer in a single write,
+// keeping at most one write per direction in flight. Nothing goes to a peer
+// speaking TLS before its handshake is done.
+void TcpForwarder::Flush(Client *client) {
+    auto peer = client == &incoming_ ? &outgoing_ : &incoming_;
+    if (client == &incoming_ && expecting_header_) {
+        return;
+    }
+    if (!peer->tcp || client->sending || client->pending.empty() || !peer->tcp->IsWritable()) {
+        return;
+    }
+    // The mirror gets the data only as it goes to the peer, as it stays
+    // pending while an upstream handshake runs
+    bool tee = mirror_ && client == &incoming_;
+    if (!peer->tls || peer->tls->ktls_tx()) {
+        if (tee) {
+            Tee(client->pending);
+        }
+        client->sending = true;
+        peer->tcp->Write(client->pending);
+    } else if (peer->tls->IsEstablished()) {
+        if (tee) {
+            Tee(client->pending);
+        }
+        IoBuffer wire;
+        if (int error = peer->tls->Write(client->pending, wire)) {
+            Fail(peer, error);
+            return;
+        }
+        client->sending = true;
+        peer->tcp->Write(wire);
+    }
+}
+
+// Queues a copy of data for the mirror, sharing its segments, unless that
+// would put the mirror more than max_pending behind
+void TcpForwarder::Tee(const IoBuffer &data) {
+    size_t queued = mirror_tcp_ ? mirror_tcp_->GetWriteQueueSize() : mirror_pending_.size();
+    if (queued + data.size() > size_t(mirror_->config.max_pending)) {
+        log_debug("Mirror of connection #%llu fell behind, dropping it", (unsigned long long)timeline_.id);
+        mirror_->stats.overflows++;
+        mirror_->stats.dropped += queued + data.size();
+        StopMirror();
+        return;
+    }
+    IoBuffer copy;
+    copy.Clone(data);
+    if (mirror_tcp_) {
+        mirror_->stats.bytes += copy.size();
+        mirror_tcp_->Write(copy);
+    } else {
+        mirror_pending_.Append(copy);
+    }
+}
+
+void TcpForwarder::SetMirror(TcpClient &tcp) {
+    if (!mirror_) {
+        tcp.Close();
+        return;
+    }
+    mirror_tcp_ = &tcp;
+    // What it sends back is read and thrown away, and it failing only ends
+    // the mirroring
+    tcp.OnData([](const char *, size_t) {});
+    tcp.OnError([&tcp](int, const char *) {
+        tcp.Close();
+    });
+    unsubscribe_mirror_ = tcp.OnClose([this] {
+        mirror_tcp_ = nullptr;
+        mirror_.reset();
+    });
+    mirror_->stats.bytes += mirror_pending_.size();
+    tcp.Write(mirror_pending_);
+}
+
+void TcpForwarder::StopMirror(bool drain) {
+    mirror_.reset();
+    mirror_pending_.Clear();
+    if (!mirror_tcp_) {
+        return;
+    }
+    auto tcp = mirror_tcp_;
+    mirror_tcp_ = nullptr;
+    unsubscribe_mirror_();
+    if (tcp->IsClosing()) {
+        return;
+    }
+    if (drain && tcp->GetWriteQueueSize() > 0) {
+        tcp->OnSend([tcp] {
+            if (tcp->GetWriteQueueSize() == 0 && !tcp->IsClosing()) {
+                tcp->Close();
+            }
+        });
+    } else {
+        tcp->Close();
+    }
+}
+
+void TcpForwarder::StartRecording(std::shared_ptr<Recorder> recorder) {
+    if (recorder->Open(timeline_.id)) {
+        recorder_ = recorder;
+    }
+}
+
+// Gives the recording of the session up once a record does not fit, rather
+// than leave a gap in it
+void TcpForwarder::Record(Client *client, const char *data, size_t len) {
+    if (recorder_ && len > 0 && !recorder_->Write(timeline_.id, client == &incoming_, data, len)) {
+        recorder_->Lose(timeline_.id);
+        recorder_.reset();
+    }
+}
+
+void TcpForwarder::Record(Client *client, const IoBuffer &data) {
+    if (recorder_ && !data.empty() && !recorder_->Write(timeline_.id, client == &incoming_, data)) {
+        recorder_->Lose(timeline_.id);
+        recorder_.reset();
+    }
+}
+
+// Writes data of the client's own TLS session, which the OnSend handler
+// does not take for forwarded data
+void TcpForwarder::WriteControl(Client *client, IoBuffer &data) {
+    if (!data.empty() && client->tcp->IsWritable()) {
+        client->controls++;
+        client->tcp->Write(data);
+    }
+}
+
+// Closes the connection after a protocol error on the client's side
+void TcpForwarder::Fail(Client *client, int error) {
+    timeline_.Add(Timeline::Event::Abort, error);
+    if (!client->tcp->IsClosing()) {
+        client->tcp->Close();
+    }
+}
+
+// Feeds what was read from a side speaking TLS to its session. Returns
+// false if the connection is closing because of it.
+bool TcpForwarder::Decrypt(Client *client, const char *data, size_t len) {
+    auto peer = client == &incoming_ ? &outgoing_ : &incoming_;
+    bool established = client->tls->IsEstablished();
+    IoBuffer plain, wire;
+    int error = client->tls->Read(data, len, plain, wire);
+    Record(client, plain);
+    client->pending.Append(plain);
+    WriteControl(client, wire);
+    if (error == UV_EOF) {
+        Closing(client, UV_EOF);
+        client->tcp->Close();
+        return false;
+    }
+    if (error) {
+        log_info("Closing %s %s (TLS handshake or record error)", client == &incoming_ ? "incoming from" : "upstream",
+                 client->tcp->GetPeerName().data());
+        Fail(client, error);
+        return false;
+    }
+    if (!established && client->tls->IsEstablished()) {
+        client->tls->Offload(client->tcp->GetFd(), client->tcp->GetWriteQueueSize() == 0);
+        Flush(peer);
+    }
+    return true;
+}
+
+// Records which side went first and why, unless the proxy already did
+void TcpForwarder::Closing(Client *client, int error) {
+    if (!timeline_.IsClosed()) {
+        timeline_.Add(client == &incoming_ ? Timeline::Event::ClientClose : Timeline::Event::UpstreamClose, error);
+    }
+}
+
+TokenBucket &TcpForwarder::GetSharedBucket(Client *client) {
+    return shaper_->shared[client == &incoming_ ? Shaper::kUp : Shaper::kDown];
+}
+
+// Charges what was just read to the buckets, and stops reading from the
+// client once either runs dry. Nothing is scheduled unless that happens.
+void TcpForwarder::Shape(Client *client, size_t len) {
+    if (!shaper_) {
+        return;
+    }
+    auto now = uv_now(client->tcp->loop());
+    auto &shared = GetSharedBucket(client);
+    shared.Refill(now);
+    shared.Take(len);
+    client->bucket.Refill(now);
+    client->bucket.Take(len);
+    if (!shared.IsEmpty() && !client->bucket.IsEmpty()) {
+        return;
+    }
+
+    client->throttled = true;
+    client->tcp->ReadStop();
+    if (shape_timer_ == nullptr) {
+        shape_timer_ = &Timer::Create(client->tcp->loop(), kShapeInterval);
+        shape_timer_->OnTick([this] {
+            Unthrottle();
+        });
+    }
+    shape_timer_->Start();
+}
+
+// Resumes reading from the throttled sides whose buckets have refilled
+void TcpForwarder::Unthrottle() {
+    bool throttled = false;
+    for (auto client : {&incoming_, &outgoing_}) {
+        if (!client->throttled || !client->tcp || client->tcp->IsClosing()) {
+            continue;
+        }
+        auto now = uv_now(client->tcp->loop());
+        auto &shared = GetSharedBucket(client);
+        shared.Refill(now);
+        client->bucket.Refill(now);
+        if (shared.IsEmpty() || client->bucket.IsEmpty()) {
+            throttled = true;
+        } else {
+            client->throttled = false;
+            client->tcp->ReadStart();
+        }
+    }
+    if (!throttled) {
+        shape_timer_->Stop();
     }
 }
 
@@ -16,23 +242,41 @@ void TcpForwarder::Init(Client *client) {
     log_debug("forwarder initialised");
     client->tcp->OnData([=](const char *s, size_t len) {
         if (len > 0) {
-            client->data_in->append(s, len);
-            if (peer->tcp && peer->tcp->IsWritable() && client->data_out->size() == 0) {
-                Swap(client);
-                peer->tcp->Write(client->data_out->data(), client->data_out->size());
+            if (client->received == 0) {
+                timeline_.Add(client == &incoming_ ? Timeline::Event::ClientData : Timeline::Event::UpstreamData);
             }
+            client->received += len;
+            if (client == &incoming_ && expecting_header_) {
+                client->pending.Write(s, len);
+                ReadProxyHeader();
+            } else if (client->tls && !client->tls->ktls_rx()) {
+                if (!Decrypt(client, s, len)) {
+                    return;
+                }
+            } else {
+                client->pending.Write(s, len);
+                Record(client, s, len);
+            }
+            Flush(client);
+            Shape(client, len);
+            Splice();
         }
     });
 
     client->tcp->OnSend([=] {
-        peer->data_out->clear();
-        if (peer->data_in->size() > 0) {
-            Swap(peer);
-            client->tcp->Write(peer->data_out->data(), peer->data_out->size());
+        if (client->controls > 0) {
+            client->controls--;
+            return;
         }
+        // When echoing, writes to this connection carry its own data
+        auto source = peer->tcp == client->tcp ? client : peer;
+        source->sending = false;
+        Flush(source);
+        Splice();
     });
 
     client->tcp->OnError([=](int err, const char *msg) {
+        Closing(client, err);
         client->tcp->Close();
         if (peer->tcp && !peer->tcp->IsClosing()) {
             peer->tcp->Close();
@@ -40,11 +284,22 @@ void TcpForwarder::Init(Client *client) {
     });
 
     client->tcp->OnClose([=]() {
+        Closing(client, 0);
         if (peer->tcp == client->tcp) {
             peer->tcp = nullptr;
         }
         client->tcp = nullptr;
         if (peer->tcp == nullptr) {
+            if (shape_timer_) {
+                shape_timer_->Close();
+            }
+            if (header_timer_) {
+                header_timer_->Close();
+            }
+            StopMirror(true);
+            if (recorder_) {
+                recorder_->Close(timeline_.id);
+            }
             on_close_.Invoke();
             log_debug("forwarder destroyed");
             delete this;
@@ -59,14 +314,157 @@ void TcpForwarder::SetOutgoing(TcpClient &client) {
     outgoing_.tcp = &client;
     if (outgoing_.tcp != incoming_.tcp) {
         Init(&outgoing_);
-    } else {
-        outgoing_.data_in = incoming_.data_in;
-        outgoing_.data_out = incoming_.data_out;
     }
-    if (incoming_.data_in->size() > 0 && incoming_.data_out->size() == 0) {
-        Swap(&incoming_);
-        outgoing_.tcp->Write(incoming_.data_out->data(), incoming_.data_out->size());
+    StartUpstream();
+    Flush(&incoming_);
+    Splice();
+}
+
+// Moves forwarding to uring once the connection is in a state where both
+// sockets can simply be read from and written to as they are
+void TcpForwarder::Splice() {
+    if (!uring_ || spliced_ || !outgoing_.tcp || outgoing_.tcp == incoming_.tcp || !upstream_started_) {
+        return;
+    }
+    if (shaper_ || mirror_ || recorder_) {
+        return;
+    }
+    for (auto client : {&incoming_, &outgoing_}) {
+        if (client->sending || client->controls > 0 || !client->pending.empty() || client->tcp->IsClosing() ||
+            client->tcp->GetWriteQueueSize() > 0 || client->tcp->GetFd() < 0) {
+            return;
+        }
+        if (client->tls && !(client->tls->ktls_tx() && client->tls->ktls_rx())) {
+            return;
+        }
+    }
+
+    spliced_ = true;
+    incoming_.tcp->ReadStop();
+    outgoing_.tcp->ReadStop();
+    log_debug("Connection #%llu handed to io_uring", (unsigned long long)timeline_.id);
+    auto on_data = [this](int side, size_t len) {
+        auto client = side == 0 ? &incoming_ : &outgoing_;
+        if (client->received == 0) {
+            timeline_.Add(client == &incoming_ ? Timeline::Event::ClientData : Timeline::Event::UpstreamData);
+        }
+        client->received += len;
+    };
+    auto on_done = [this](int side, int error) {
+        spliced_ = false;
+        Closing(side == 0 ? &incoming_ : &outgoing_, error == UV_EOF ? 0 : error);
+        incoming_.tcp->Close();
+    };
+    uring_->Adopt(incoming_.tcp->GetFd(), outgoing_.tcp->GetFd(), on_data, on_done);
+}
+
+void TcpForwarder::ExpectProxyHeader(uint64_t timeout) {
+    expecting_header_ = true;
+    header_timer_ = &Timer::Create(incoming_.tcp->loop(), timeout);
+    header_timer_->OnTick([this] {
+        header_timer_->Close();
+        header_timer_ = nullptr;
+        if (incoming_.tcp == nullptr) {
+            return;
+        }
+        log_info("Closing incoming from %s (no PROXY header in time)", incoming_.tcp->GetPeerName().data());
+        Fail(&incoming_, UV_ETIMEDOUT);
+    });
+    header_timer_->Start();
+}
+
+// Takes the header off the incoming data once it is all in. Only the
+// start of it is copied out; any TLVs past the addresses are skipped.
+void TcpForwarder::ReadProxyHeader() {
+    char buf[ProxyHeader::kMaxSize];
+    size_t len = incoming_.pending.CopyTo(buf, sizeof buf);
+    int length = ProxyHeader::Parse(buf, len, source_, destination_);
+    if (length < 0) {
+        log_info("Closing incoming from %s (no valid PROXY header)", incoming_.tcp->GetPeerName().data());
+        Fail(&incoming_, UV_EPROTO);
+        return;
+    }
+    if (length == 0 || incoming_.pending.size() < size_t(length)) {
+        return;
+    }
+    incoming_.pending.Consume(length);
+    expecting_header_ = false;
+    header_timer_->Close();
+    header_timer_ = nullptr;
+    if (!incoming_.tls) {
+        Record(&incoming_, incoming_.pending);
+    }
+    StartUpstream();
+
+    // The TLS handshake follows the header
+    if (incoming_.tls && !incoming_.pending.empty()) {
+        auto rest = incoming_.pending.ToString();
+        incoming_.pending.Clear();
+        Decrypt(&incoming_, rest.data(), rest.size());
+    }
+}
+
+// Sends the upstream what goes ahead of the client's data, once it is
+// connected and the client's own PROXY header, if any, has been read: our
+// PROXY header, then the start of the TLS handshake. Without TLS the header
+// is put in front of the client's data, normally in the room left by the
+// header read.
+void TcpForwarder::StartUpstream() {
+    if (!outgoing_.tcp || expecting_header_ || upstream_started_) {
+        return;
+    }
+    upstream_started_ = true;
+
+    IoBuffer wire;
+    if (proxy_version_ != 0) {
+        sockaddr_storage peer, local;
+        const sockaddr *src = &source_.sa, *dst = &destination_.sa;
+        if (source_.sa.sa_family == AF_UNSPEC) {
+            src = incoming_.tcp->GetPeerAddress(peer) ? nullptr : (const sockaddr *)&peer;
+            dst = incoming_.tcp->GetSockAddress(local) ? nullptr : (const sockaddr *)&local;
+        }
+
+        char header[ProxyHeader::kMaxSize];
+        size_t len = ProxyHeader::Write(header, proxy_version_, src, dst);
+        if (outgoing_.tls) {
+            wire.Write(header, len);
+        } else {
+            incoming_.pending.Prepend(header, len);
+        }
+    }
+    if (outgoing_.tls) {
+        outgoing_.tls->Start(wire);
+        WriteControl(&outgoing_, wire);
+    }
+}
+
+void TcpForwarder::SetShaper(std::shared_ptr<Shaper> shaper) {
+    shaper_ = shaper;
+    auto now = uv_now(incoming_.tcp->loop());
+    for (auto client : {&incoming_, &outgoing_}) {
+        client->bucket = TokenBucket(shaper_->rate, shaper_->burst, now);
+    }
+}
+
+void TcpForwarder::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("id", timeline_.id);
+    if (incoming_.tcp) {
+        json.Field("client", incoming_.tcp->GetPeerName());
+    }
+    if (outgoing_.tcp && outgoing_.tcp != incoming_.tcp) {
+        json.Field("upstream", outgoing_.tcp->GetPeerName());
+    }
+    json.Field("bytes_in", incoming_.received);
+    json.Field("bytes_out", outgoing_.received);
+    json.Field("age", Timer::Now() - timeline_.start);
+    if (incoming_.throttled || outgoing_.throttled) {
+        json.Field("throttled", true);
+    }
+    if (spliced_) {
+        json.Field("io_uring", true);
     }
+    json.EndObject();
 }
 
 }  // namespace nexer
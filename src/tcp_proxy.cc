@@ -3,71 +3,323 @@
 #include "logger.h"
 #include "string_buffer.h"
 #include "tcp_proxy.h"
+#include <algorithm>
 #include <assert.h>
 #include <sstream>
 
 namespace nexer {
 
-TcpProxy &TcpProxy::Create(EventLoop &loop,config::Upstream &upstream, ProcessManager *pm) {
-    auto proxy = new TcpProxy(loop, upstream, pm);
+static uint64_t next_connection_id = 0;
+
+TcpProxy &TcpProxy::Create(EventLoop &loop,config::Upstream &upstream, ProcessManager *pm, bool unix) {
+    auto proxy = new TcpProxy(loop, upstream, pm, unix);
     return *proxy;
 }
 
-TcpProxy::TcpProxy(EventLoop& loop, config::Upstream& upstream, ProcessManager *pm)
-    :TcpServer(loop), upstream_(upstream), process_manager_(pm) {
+TcpProxy::TcpProxy(EventLoop& loop, config::Upstream& upstream, ProcessManager *pm, bool unix)
+    :TcpServer(loop, unix), upstream_(upstream), process_manager_(pm), timelines_(nullptr), accept_proxy_header_(false),
+     proxy_header_timeout_(0), uring_(nullptr), tunnel_(nullptr), requiring_(false),
+     wait_timer_(nullptr), stats_{} {
     std::stringstream ss;
-    ss << upstream_.host << ':' << upstream_.port;
+    if (upstream_.tunnel_port > 0) {
+        ss << upstream_.host << '/' << upstream_.port;
+    } else if (!upstream_.path.empty()) {
+        ss << "unix:" << upstream_.path;
+    } else if (upstream_.host.find(':') != std::string::npos) {
+        ss << '[' << upstream_.host << "]:" << upstream_.port;
+    } else {
+        ss << upstream_.host << ':' << upstream_.port;
+    }
+    if (upstream_.port_count > 1) {
+        ss << '-' << upstream_.port + upstream_.port_count - 1;
+    }
     name_ = ss.str();
+    if (Shaper::IsNeeded(upstream_)) {
+        shaper_ = std::make_shared<Shaper>(upstream_, uv_now(loop));
+    }
+    if (upstream_.mirror.enabled()) {
+        mirror_ = std::make_shared<Mirror>(upstream_.mirror);
+    }
     Init();
 }
 
 void TcpProxy::Init() {
     TcpServer::OnConnection([&](TcpClient &incoming) {
+        size_t open = forwarders_.size() + tunnel_clients_.size();
+        if (upstream_.max_connections > 0 && open >= size_t(upstream_.max_connections)) {
+            log_debug("Rejecting connection to %s (%zu open)", name_.data(), open);
+            stats_.rejected++;
+            incoming.Close();
+            return;
+        }
+        stats_.accepted++;
+
+        if (tunnel_) {
+            tunnel_clients_[&incoming] = incoming.OnClose([this, &incoming] {
+                tunnel_clients_.erase(&incoming);
+            });
+            tunnel_->Open(incoming, upstream_.port + listener(), upstream_.priority);
+            return;
+        }
+
         auto& forwarder = TcpForwarder::Create(incoming);
+        forwarder.timeline().id = ++next_connection_id;
+        forwarder.timeline().Add(Timeline::Event::Accept);
+        if (shaper_) {
+            forwarder.SetShaper(shaper_);
+        }
+        if (recorder_) {
+            forwarder.StartRecording(recorder_);
+        }
+        if (uring_) {
+            forwarder.UseUring(uring_);
+        }
+        if (accept_proxy_header_) {
+            forwarder.ExpectProxyHeader(proxy_header_timeout_);
+        }
+        if (upstream_.proxy_protocol) {
+            forwarder.SendProxyHeader(upstream_.proxy_protocol);
+        }
+        if (tls_) {
+            forwarder.TerminateTls(tls_);
+        }
+        if (upstream_tls_) {
+            forwarder.OriginateTls(upstream_tls_);
+        }
         forwarder.OnClose([&] {
             Remove(forwarder);
         });
         forwarders_.insert(&forwarder);
-        CheckUpstreamProcess([&](int error) {
-            if (error) {
-                log_info("Upstream check failed (%d)", error);
-                if (Has(forwarder)) {
-                    log_debug("Closing incoming connection due to upstream error");
-                    incoming.Close();
-                }
+        if (process_manager_ && upstream_.app) {
+            process_manager_->Acquire(*upstream_.app);
+        }
+        if (mirror_ && mirror_->Sample()) {
+            forwarder.StartMirror(mirror_);
+            ServeMirror(&forwarder);
+        }
+        Serve(&forwarder, &incoming, upstream_.port + listener());
+    });
+
+    if (process_manager_ && upstream_.app) {
+        // Connections waiting for the app see it being started
+        auto unsubscribe = process_manager_->OnAppStep([this](const config::App& app, ProcessManager::Step step) {
+            if (&app != upstream_.app) {
                 return;
             }
+            auto event = step == ProcessManager::Step::Preamble ? Timeline::Event::Preamble : Timeline::Event::AppStart;
+            for (auto waiter : waiting_) {
+                waiter->forwarder->timeline().Add(event);
+            }
+        });
+        OnClose(unsubscribe);
+    }
+
+    OnClose([this] {
+        if (wait_timer_) {
+            wait_timer_->Close();
+        }
+        // Tunnel connections carry on without the proxy
+        for (auto& it : tunnel_clients_) {
+            it.second();
+        }
+        tunnel_clients_.clear();
+    });
+}
+
+// Sets up a proxied connection: connects right away if optimistic,
+// otherwise (or when that fails) waits for the upstream app first, then
+// hands the upstream connection to the forwarder. The forwarder may close
+// whenever this is suspended.
+Task TcpProxy::Serve(TcpForwarder *forwarder, TcpClient *incoming, int port) {
+    auto on_try = [this, forwarder](TcpClient& client) {
+        TryConnect(forwarder, client);
+    };
+    auto path = upstream_.path.empty() ? nullptr : upstream_.path.data();
+
+    auto health = upstream_.app ? process_manager_->GetHealth(*upstream_.app) : ProcessManager::Health::Unknown;
+    if (upstream_.optimistic && upstream_.app &&
+        health != ProcessManager::Health::Down && health != ProcessManager::Health::Stopped) {
+        log_debug("Connecting %s optimistically", name_.data());
+        auto outgoing =
+            co_await nexer::Connect{loop(), upstream_.host.data(), port, kOptimisticTimeout, on_try, path, true};
+        if (outgoing || !Has(*forwarder)) {
+            Forward(forwarder, incoming, outgoing);
+            co_return;
+        }
+        log_debug("Optimistic connect to %s failed, checking upstream app", name_.data());
+    }
+
+    if (upstream_.app) {
+        if (int error = co_await WaitForApp{this, forwarder}) {
+            if (Has(*forwarder)) {
+                forwarder->timeline().Add(Timeline::Event::Abort, error);
+                incoming->Close();
+            }
+            co_return;
+        }
+    }
+
+    log_debug("Connecting %s", name_.data());
+    auto outgoing = co_await nexer::Connect{loop(), upstream_.host.data(), port,
+                                            uint64_t(upstream_.connect_timeout), on_try, path};
+    Forward(forwarder, incoming, outgoing);
+}
 
-            log_debug("Connecting %s", name_.data());
-            TcpClient::Connect(loop(), upstream_.host.data(), upstream_.port, upstream_.connect_timeout, [&](TcpClient *outgoing) {
-                log_debug("Connecting to %s completed (success: %s)", name_.data(), outgoing ? "true" : "false");
-                if (!Has(forwarder)) {
-                    if (outgoing) {
-                        log_info("Closing upstream connection to %s (incoming already closed)", name_.data());
-                        outgoing->Close();
-                    } else {
-                        log_debug("No outgoing or forwarder");
-                    }
-                } else if (outgoing) {
-                    log_debug("Forwarder establised for %s", name_.data());
-                    forwarder.SetOutgoing(*outgoing);
-                } else {
-                    log_info("Closing incoming for %s (upstream connection failed)", name_.data());
-                    incoming.Close();
-                }
+// Connects to the mirror, trying once: a mirror that is down is not worth
+// holding on to copies for
+Task TcpProxy::ServeMirror(TcpForwarder *forwarder) {
+    auto &config = upstream_.mirror;
+    auto path = config.path.empty() ? nullptr : config.path.data();
+    auto mirror = co_await nexer::Connect{loop(), config.host.data(), config.port, kOptimisticTimeout, {}, path, true};
+    if (!mirror) {
+        log_info("Cannot connect to mirror of %s", name_.data());
+        mirror_->stats.connect_failures++;
+        if (Has(*forwarder)) {
+            forwarder->StopMirror();
+        }
+    } else if (Has(*forwarder)) {
+        forwarder->SetMirror(*mirror);
+    } else {
+        mirror->Close();
+    }
+}
+
+bool TcpProxy::WaitForApp::await_suspend(std::coroutine_handle<> coroutine) {
+    handle = coroutine;
+    return proxy->Wait(this);
+}
+
+// Queues the connection, unless max_waiting are queued already, in which
+// case it is turned away right away instead of holding on to its data.
+// Returns whether the waiter was queued; it may have been resumed already.
+bool TcpProxy::Wait(WaitForApp *waiter) {
+    if (upstream_.max_waiting > 0 && waiting_.size() >= size_t(upstream_.max_waiting)) {
+        log_info("Closing incoming for %s (%zu connections waiting)", name_.data(), waiting_.size());
+        stats_.queue_full++;
+        waiter->error = UV_EBUSY;
+        return false;
+    }
+
+    waiter->since = Timer::Now();
+    waiter->forwarder->timeline().Add(Timeline::Event::CheckStart);
+    waiting_.push_back(waiter);
+    stats_.max_waiting = std::max(stats_.max_waiting, waiting_.size());
+
+    if (upstream_.wait_timeout > 0 && waiting_.size() == 1) {
+        if (wait_timer_ == nullptr) {
+            wait_timer_ = &Timer::Create(loop(), kWaitCheckInterval);
+            wait_timer_->OnTick([this] {
+                ExpireWaiting();
             });
+        }
+        wait_timer_->Start();
+    }
+
+    if (!requiring_) {
+        requiring_ = true;
+        process_manager_->Require(*upstream_.app, [this](Process*, int error) {
+            requiring_ = false;
+            StopWaiting(error);
         });
+    }
+    return true;
+}
+
+// Hands the result of checking the app to every waiting connection
+void TcpProxy::StopWaiting(int error) {
+    auto waiting = std::move(waiting_);
+    waiting_.clear();
+    if (wait_timer_) {
+        wait_timer_->Stop();
+    }
+
+    if (error) {
+        log_info("Upstream check failed (%d), closing %zu connection(s)", error, waiting.size());
+    }
+
+    auto now = Timer::Now();
+    for (auto waiter : waiting) {
+        uint64_t wait = now - waiter->since;
+        stats_.waited++;
+        stats_.wait_time += wait;
+        stats_.max_wait = std::max(stats_.max_wait, wait);
+
+        waiter->forwarder->timeline().Add(Timeline::Event::CheckEnd, error);
+        waiter->error = error;
+        waiter->handle.resume();
+    }
+}
+
+void TcpProxy::ExpireWaiting() {
+    auto now = Timer::Now();
+    while (!waiting_.empty() && now - waiting_.front()->since >= uint64_t(upstream_.wait_timeout)) {
+        auto waiter = waiting_.front();
+        waiting_.pop_front();
+        log_info("Closing incoming for %s (waited %llu ms)", name_.data(), (unsigned long long)(now - waiter->since));
+        stats_.wait_timeouts++;
+        waiter->error = UV_ETIMEDOUT;
+        waiter->handle.resume();
+    }
+    if (waiting_.empty()) {
+        wait_timer_->Stop();
+    }
+}
+
+// Records an attempt to connect and its failure, if it fails
+void TcpProxy::TryConnect(TcpForwarder *forwarder, TcpClient& client) {
+    if (!Has(*forwarder)) {
+        return;
+    }
+    forwarder->timeline().Add(Timeline::Event::Connect);
+    client.OnError([this, forwarder](int error, const char*) {
+        if (Has(*forwarder) && !forwarder->timeline().Has(Timeline::Event::Established)) {
+            forwarder->timeline().Add(Timeline::Event::ConnectFailed, error);
+        }
     });
 }
 
-void TcpProxy::CheckUpstreamProcess(std::function<void(int)> then) {
-    if (!upstream_.app) {
-        then(0);
+void TcpProxy::CheckSlow(TcpForwarder& forwarder) {
+    auto& timeline = forwarder.timeline();
+    if (upstream_.slow_connect > 0 && timeline.duration() >= uint64_t(upstream_.slow_connect)) {
+        log_warn("Slow connection #%llu to %s: %s", (unsigned long long)timeline.id, name_.data(),
+                 timeline.ToString().c_str());
+    }
+}
+
+void TcpProxy::Forward(TcpForwarder *forwarder, TcpClient *incoming, TcpClient *outgoing) {
+    log_debug("Connecting to %s completed (success: %s)", name_.data(), outgoing ? "true" : "false");
+    if (!Has(*forwarder)) {
+        if (outgoing) {
+            log_info("Closing upstream connection to %s (incoming already closed)", name_.data());
+            outgoing->Close();
+        } else {
+            log_debug("No outgoing or forwarder");
+        }
+    } else if (outgoing) {
+        log_debug("Forwarder establised for %s", name_.data());
+        forwarder->timeline().Add(Timeline::Event::Established);
+        CheckSlow(*forwarder);
+        forwarder->SetOutgoing(*outgoing);
     } else {
-        process_manager_->Require(*upstream_.app, [&, then](Process*, int error) {
-            then(error);
-        });
+        log_info("Closing incoming for %s (upstream connection failed)", name_.data());
+        forwarder->timeline().Add(Timeline::Event::Abort, UV_ETIMEDOUT);
+        incoming->Close();
+    }
+}
+
+bool TcpProxy::InitTls(const config::Tls &listen) {
+    if (listen.enabled && !(tls_ = TlsContext::Create(listen, true))) {
+        return false;
+    }
+    if (upstream_.tls.enabled && !(upstream_tls_ = TlsContext::Create(upstream_.tls, false))) {
+        return false;
     }
+    return true;
+}
+
+bool TcpProxy::StartRecording(const config::Record &record) {
+    recorder_ = Recorder::Create(record);
+    return recorder_ != nullptr;
 }
 
 bool TcpProxy::Has(TcpForwarder &forwarder) {
@@ -82,6 +334,93 @@ void TcpProxy::Remove(TcpForwarder &forwarder) {
         assert(0);
     }
     forwarders_.erase(it);
+    if (process_manager_ && upstream_.app) {
+        process_manager_->Release(*upstream_.app);
+    }
+
+    for (auto it = waiting_.begin(); it != waiting_.end(); ++it) {
+        if ((*it)->forwarder == &forwarder) {
+            auto waiter = *it;
+            waiting_.erase(it);
+            waiter->error = UV_ECANCELED;
+            waiter->handle.resume();
+            break;
+        }
+    }
+
+    auto& timeline = forwarder.timeline();
+    if (!timeline.Has(Timeline::Event::Established)) {
+        CheckSlow(forwarder);
+    }
+    if (timelines_) {
+        timelines_->Add(timeline);
+    }
+}
+
+const Timeline *TcpProxy::FindTimeline(uint64_t id) {
+    for (auto forwarder : forwarders_) {
+        if (forwarder->timeline().id == id) {
+            return &forwarder->timeline();
+        }
+    }
+    return nullptr;
+}
+
+void TcpProxy::WriteStatus(JsonWriter& json) {
+    sockaddr_storage addr;
+    int len = sizeof addr;
+    int port = 0;
+    if (!unix_ && uv_tcp_getsockname(&tcp_, (sockaddr *)&addr, &len) == 0) {
+        port = ntohs(addr.ss_family == AF_INET6 ? ((sockaddr_in6 *)&addr)->sin6_port
+                                                : ((sockaddr_in *)&addr)->sin_port);
+    }
+    json.Field("listen", port);
+    json.Field("address", GetSockName());
+    if (upstream_.port_count > 1) {
+        json.Field("ports", upstream_.port_count);
+    }
+    json.Field("upstream", name_);
+    if (upstream_.app) {
+        json.Field("app", upstream_.app->name);
+    }
+    json.Field("connections_count", forwarders_.size() + tunnel_clients_.size());
+    json.Field("waiting", waiting_.size());
+    json.Key("stats").BeginObject();
+    json.Field("accepted", stats_.accepted);
+    json.Field("rejected", stats_.rejected);
+    json.Field("queue_full", stats_.queue_full);
+    json.Field("wait_timeouts", stats_.wait_timeouts);
+    json.Field("waited", stats_.waited);
+    json.Field("wait_time", stats_.wait_time);
+    json.Field("max_wait", stats_.max_wait);
+    json.Field("max_waiting", stats_.max_waiting);
+    json.EndObject();
+    if (tls_) {
+        json.Key("tls");
+        tls_->WriteStatus(json);
+    }
+    if (upstream_tls_) {
+        json.Key("upstream_tls");
+        upstream_tls_->WriteStatus(json);
+    }
+    if (mirror_) {
+        json.Key("mirror");
+        mirror_->WriteStatus(json);
+    }
+    if (recorder_) {
+        json.Key("record");
+        recorder_->WriteStatus(json);
+    }
+}
+
+TcpForwarder *TcpProxy::WriteConnections(JsonWriter& json, TcpForwarder *after, size_t& budget) {
+    auto it = after ? forwarders_.upper_bound(after) : forwarders_.begin();
+    TcpForwarder *last = nullptr;
+    for (; it != forwarders_.end() && budget > 0; ++it, --budget) {
+        (*it)->WriteStatus(json);
+        last = *it;
+    }
+    return last;
 }
 
 }  // namespace nexer
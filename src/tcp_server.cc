@@ -1,19 +1,32 @@
 #include "tcp_server.h"
 
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include "logger.h"
 
 namespace nexer {
 
-TcpServer::TcpServer(uv_loop_t* loop) {
-    if (int status = uv_tcp_init(loop, &tcp_)) {
-        log_fatal("uv_tcp_init: %s", uv_strerror(status));
+TcpServer::TcpServer(uv_loop_t* loop, bool unix) : unix_(unix), range_(nullptr), listener_(0) {
+    int status = unix ? uv_pipe_init(loop, &pipe_, 0) : uv_tcp_init(loop, &tcp_);
+    if (status) {
+        log_fatal("%s: %s", unix ? "uv_pipe_init" : "uv_tcp_init", uv_strerror(status));
     }
 
     tcp_.data = this;
+    on_close_.Add([this] {
+        CloseRange();
+        if (!path_.empty()) {
+            unlink(path_.c_str());
+        }
+    });
 }
 
-TcpServer& TcpServer::Create(EventLoop& loop) {
-    auto server = new TcpServer(loop);
+TcpServer& TcpServer::Create(EventLoop& loop, bool unix) {
+    auto server = new TcpServer(loop, unix);
     return *server;
 }
 
@@ -25,50 +38,181 @@ void TcpServer::OnConnection(uv_stream_t *stream, int status) {
         return;
     }
 
-    auto& client = TcpClient::Create(server.loop());
+    auto& client = TcpClient::Create(server.loop(), server.unix_);
 
-    if ((status = server.Accept(client))) {
+    if ((status = server.Accept(stream, client))) {
         server.OnError("accept", status);
         return;
     }
 
     client.ReadStart();
 
+    server.listener_ = stream == (uv_stream_t *)&server.tcp_
+                           ? 0 : (uv_tcp_t *)stream - server.range_->listeners.get() + 1;
     if (server.on_connection_) {
         server.on_connection_(client);
     }
 }
 
-int TcpServer::Accept(TcpClient& client) {
-    return  uv_accept((uv_stream_t*)&tcp_, (uv_stream_t*) &client.tcp_);
+int TcpServer::Accept(uv_stream_t *listener, TcpClient& client) {
+    return  uv_accept(listener, (uv_stream_t*) &client.tcp_);
+}
+
+bool TcpServer::Listen(int port, int count) {
+    return Listen("0.0.0.0", port, count);
+}
+
+bool TcpServer::Listen(const char *host, int port, int count) {
+    if (!Listen(&tcp_, host, port)) {
+        return false;
+    }
+    if (count > 1 && !ListenRange(host, port, count)) {
+        return false;
+    }
+    if (on_listening_) {
+        on_listening_();
+    }
+    return true;
+}
+
+bool TcpServer::ListenRange(const char *host, int port, int count) {
+    range_ = new Range{0, std::make_unique<uv_tcp_t[]>(count - 1)};
+    for (int i = 1; i < count; i++) {
+        auto listener = &range_->listeners[i - 1];
+        if (int status = uv_tcp_init(tcp_.loop, listener)) {
+            log_fatal("uv_tcp_init: %s", uv_strerror(status));
+        }
+        listener->data = this;
+        range_->open++;
+        // Those listening already are closed with the server
+        if (!Listen(listener, host, port + i)) {
+            return false;
+        }
+    }
+    log_info("Listening on ports %d-%d", port, port + count - 1);
+    return true;
+}
+
+void TcpServer::CloseRange() {
+    if (range_ == nullptr) {
+        return;
+    }
+    auto range = range_;
+    range_ = nullptr;
+    size_t open = range->open;
+    for (size_t i = 0; i < open; i++) {
+        auto listener = (uv_handle_t *)&range->listeners[i];
+        listener->data = range;
+        uv_close(listener, OnRangeClose);
+    }
+}
+
+void TcpServer::OnRangeClose(uv_handle_t *handle) {
+    auto range = reinterpret_cast<Range *>(handle->data);
+    if (--range->open == 0) {
+        delete range;
+    }
 }
 
-bool TcpServer::Listen(int port) {
-    struct sockaddr_in addr;
+bool TcpServer::Listen(uv_tcp_t *tcp, const char *host, int port) {
+    union {
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } addr;
     int err;
 
-    if ((err = uv_ip4_addr("0.0.0.0", port, &addr))) {
-        log_error("ip4 addr: %s (%d)", uv_strerror(err), err);
+    if ((err = uv_ip4_addr(host, port, &addr.in)) && (err = uv_ip6_addr(host, port, &addr.in6))) {
+        log_error("bind address %s: %s", host, uv_strerror(err));
         return false;
     }
 
-    if ((err = uv_tcp_bind(&tcp_, (const struct sockaddr *)&addr, 0))) {
-        log_error("tcp bind: %s (%d)", uv_strerror(err), err);
+    if ((err = uv_tcp_bind(tcp, (const struct sockaddr *)&addr, 0))) {
+        log_error("tcp bind: %s (port %d)", uv_strerror(err), port);
         return false;
     }
 
     int backlog = 8;
 
-    if ((err = uv_listen((uv_stream_t *)&tcp_, backlog, OnConnection))) {
+    if ((err = uv_listen((uv_stream_t *)tcp, backlog, OnConnection))) {
         log_error("listen: %s (port %d)", uv_strerror(err), port);
         return false;
     }
 
+    return true;
+}
+
+// Whether nothing listens on the socket at path any more, e.g. left over
+// from a nexer that did not exit cleanly
+static bool IsStaleSocket(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof addr.sun_path) {
+        return false;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    int err;
+    do {
+        err = connect(fd, (struct sockaddr *)&addr, sizeof addr) ? errno : 0;
+    } while (err == EINTR);
+    close(fd);
+    return err == ECONNREFUSED;
+}
+
+bool TcpServer::ListenUnix(const char *path) {
+    struct stat st;
+    int err;
+
+    // Only ever remove a socket nobody listens on, never a file that happens
+    // to be in the way or one in use
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode) && IsStaleSocket(path)) {
+        unlink(path);
+    }
+
+    if ((err = uv_pipe_bind(&pipe_, path))) {
+        log_error("pipe bind: %s (%s)", uv_strerror(err), path);
+        return false;
+    }
+    path_ = path;
+
+    int backlog = 8;
+
+    if ((err = uv_listen((uv_stream_t *)&pipe_, backlog, OnConnection))) {
+        log_error("listen: %s (%s)", uv_strerror(err), path);
+        return false;
+    }
+
     if (on_listening_) {
         on_listening_();
     }
-
     return true;
 }
 
-}  // namespace nexer
\ No newline at end of file
+std::string TcpServer::GetSockName() {
+    if (unix_) {
+        return path_.empty() ? std::string() : "unix:" + path_;
+    }
+
+    sockaddr_storage addr;
+    int len = sizeof addr;
+    if (uv_tcp_getsockname(&tcp_, (sockaddr *)&addr, &len)) {
+        return {};
+    }
+
+    char ip[64];
+    if (addr.ss_family == AF_INET6) {
+        auto in6 = (const sockaddr_in6 *)&addr;
+        uv_ip6_name(in6, ip, sizeof ip);
+        return "[" + std::string(ip) + "]:" + std::to_string(ntohs(in6->sin6_port));
+    }
+    auto in = (const sockaddr_in *)&addr;
+    uv_ip4_name(in, ip, sizeof ip);
+    return std::string(ip) + ":" + std::to_string(ntohs(in->sin_port));
+}
+
+}  // namespace nexer
@@ -0,0 +1,133 @@
+#include "timeline.h"
+
+#include <sstream>
+
+#include "timer.h"
+
+namespace nexer {
+
+Timeline::Timeline(uint64_t id) : id(id), start(Timer::Now()), size(0), truncated(false) {}
+
+void Timeline::Add(Event event, int value) {
+    if (size == kMaxEvents) {
+        size--;
+        truncated = true;
+    }
+    entries[size++] = {uint32_t(Timer::Now() - start), value, event};
+}
+
+bool Timeline::Has(Event event) const {
+    for (size_t i = 0; i < size; i++) {
+        if (entries[i].event == event) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Timeline::IsClosed() const {
+    if (size == 0) {
+        return false;
+    }
+    auto event = entries[size - 1].event;
+    return event == Event::ClientClose || event == Event::UpstreamClose || event == Event::Abort;
+}
+
+void Timeline::Write(JsonWriter &json) const {
+    json.BeginObject();
+    json.Field("id", id);
+    json.Field("start", start);
+    json.Field("duration", duration());
+    if (truncated) {
+        json.Field("truncated", true);
+    }
+    json.Key("events").BeginArray();
+    for (size_t i = 0; i < size; i++) {
+        auto &entry = entries[i];
+        json.BeginObject();
+        json.Field("event", EventName(entry.event));
+        json.Field("time", int(entry.time));
+        if (entry.value != 0) {
+            json.Field("value", int(entry.value));
+        }
+        json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+}
+
+std::string Timeline::ToString() const {
+    std::stringstream ss;
+    for (size_t i = 0; i < size; i++) {
+        auto &entry = entries[i];
+        if (i > 0) {
+            ss << ", ";
+        }
+        ss << EventName(entry.event) << " +" << entry.time;
+        if (entry.value != 0) {
+            ss << " (" << entry.value << ')';
+        }
+    }
+    if (truncated) {
+        ss << " (truncated)";
+    }
+    return ss.str();
+}
+
+const char *Timeline::EventName(Event event) {
+    switch (event) {
+    case Event::Accept:
+        return "accept";
+    case Event::CheckStart:
+        return "check_start";
+    case Event::Preamble:
+        return "preamble";
+    case Event::AppStart:
+        return "app_start";
+    case Event::CheckEnd:
+        return "check_end";
+    case Event::Connect:
+        return "connect";
+    case Event::ConnectFailed:
+        return "connect_failed";
+    case Event::Established:
+        return "established";
+    case Event::ClientData:
+        return "client_data";
+    case Event::UpstreamData:
+        return "upstream_data";
+    case Event::ClientClose:
+        return "client_close";
+    case Event::UpstreamClose:
+        return "upstream_close";
+    case Event::Abort:
+        return "abort";
+    default:
+        return "unknown";
+    }
+}
+
+TimelineRing::TimelineRing(size_t capacity) : ring_(capacity), next_(0), size_(0) {}
+
+void TimelineRing::Add(const Timeline &timeline) {
+    if (ring_.empty()) {
+        return;
+    }
+    ring_[next_] = timeline;
+    next_ = (next_ + 1) % ring_.size();
+    if (size_ < ring_.size()) {
+        size_++;
+    }
+}
+
+const Timeline *TimelineRing::Find(uint64_t id) const {
+    for (size_t i = 0; i < size_; i++) {
+        auto &timeline = ring_[(next_ + ring_.size() - 1 - i) % ring_.size()];
+        if (timeline.id == id) {
+            return &timeline;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace nexer
@@ -0,0 +1,423 @@
+#include "tls.h"
+
+#include <openssl/err.h>
+#include <openssl/kdf.h>
+
+#include <algorithm>
+
+#include "logger.h"
+
+#if defined(__linux__) && __has_include(<linux/tls.h>)
+#define NEXER_KTLS 1
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
+namespace nexer {
+
+static std::string GetError() {
+    char buf[256];
+    unsigned long error = ERR_get_error();
+    ERR_clear_error();
+    if (error == 0) {
+        return "unknown error";
+    }
+    ERR_error_string_n(error, buf, sizeof buf);
+    return buf;
+}
+
+TlsContext::TlsContext(SSL_CTX *ctx, const config::Tls &config, bool server)
+    : ctx_(ctx), server_(server), ktls_(config.ktls), server_name_(config.server_name) {}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free(ctx_);
+}
+
+std::shared_ptr<TlsContext> TlsContext::Create(const config::Tls &config, bool server) {
+    SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+    if (ctx == nullptr) {
+        log_error("SSL_CTX_new: %s", GetError().data());
+        return nullptr;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    // A certificate is required of servers, and optional for clients
+    if (!config.cert.empty() &&
+        (SSL_CTX_use_certificate_chain_file(ctx, config.cert.data()) != 1 ||
+         SSL_CTX_use_PrivateKey_file(ctx, config.key.data(), SSL_FILETYPE_PEM) != 1)) {
+        log_error("Cannot load TLS certificate %s and key %s: %s", config.cert.data(), config.key.data(),
+                  GetError().data());
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    if (!server && config.verify) {
+        int ok = config.ca.empty() ? SSL_CTX_set_default_verify_paths(ctx)
+                                   : SSL_CTX_load_verify_locations(ctx, config.ca.data(), nullptr);
+        if (ok != 1) {
+            log_error("Cannot load TLS CA certificates %s: %s", config.ca.data(), GetError().data());
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+
+    if (config.ktls) {
+        // Tickets would be the first records sent under the traffic keys,
+        // before the kernel takes over
+        if (server) {
+            SSL_CTX_set_num_tickets(ctx, 0);
+        }
+        SSL_CTX_set_keylog_callback(ctx, TlsSession::OnKeyLog);
+    }
+
+    return std::shared_ptr<TlsContext>(new TlsContext(ctx, config, server));
+}
+
+void TlsContext::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("handshakes", stats_.handshakes);
+    json.Field("failures", stats_.failures);
+    json.Field("handshake_time", stats_.handshake_time);
+    json.Field("max_handshake_time", stats_.max_handshake_time);
+    json.Field("ktls_tx", stats_.ktls_tx);
+    json.Field("ktls_rx", stats_.ktls_rx);
+    json.Field("ktls_fallbacks", stats_.ktls_fallbacks);
+    json.EndObject();
+}
+
+TlsSession::TlsSession(std::shared_ptr<TlsContext> context)
+    : context_(context), established_(false), ktls_tx_(false), ktls_rx_(false), read_data_(false), started_(0) {
+    ssl_ = SSL_new(context_->ctx_);
+    rbio_ = BIO_new(BIO_s_mem());
+    wbio_ = BIO_new(BIO_s_mem());
+    if (ssl_ == nullptr || rbio_ == nullptr || wbio_ == nullptr) {
+        log_fatal("SSL_new: %s", GetError().data());
+        exit(1);
+    }
+    // The session owns the buffers from here on
+    SSL_set_bio(ssl_, rbio_, wbio_);
+    SSL_set_app_data(ssl_, this);
+
+    if (context_->server_) {
+        SSL_set_accept_state(ssl_);
+        return;
+    }
+
+    SSL_set_connect_state(ssl_);
+    auto name = context_->server_name_.data();
+    if (*name) {
+        unsigned char addr[sizeof(in6_addr)];
+        if (uv_inet_pton(AF_INET, name, addr) == 0 || uv_inet_pton(AF_INET6, name, addr) == 0) {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl_), name);
+        } else {
+            SSL_set_tlsext_host_name(ssl_, name);
+            SSL_set1_host(ssl_, name);
+        }
+    }
+}
+
+TlsSession::~TlsSession() {
+    SSL_free(ssl_);
+    OPENSSL_cleanse(&client_secret_, sizeof client_secret_);
+    OPENSSL_cleanse(&server_secret_, sizeof server_secret_);
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Lines are "<label> <client random> <secret>", all in hex
+void TlsSession::OnKeyLog(const SSL *ssl, const char *line) {
+    auto self = reinterpret_cast<TlsSession *>(SSL_get_app_data(ssl));
+    Secret *secret;
+    if (strncmp(line, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0) {
+        secret = &self->client_secret_;
+    } else if (strncmp(line, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0) {
+        secret = &self->server_secret_;
+    } else {
+        return;
+    }
+
+    auto hex = strrchr(line, ' ') + 1;
+    size_t size = strlen(hex) / 2;
+    if (size > sizeof secret->data) {
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        int high = HexValue(hex[i * 2]), low = HexValue(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return;
+        }
+        secret->data[i] = (high << 4) | low;
+    }
+    secret->size = size;
+}
+
+void TlsSession::Drain(IoBuffer &wire) {
+    // The kernel would encrypt them again
+    if (ktls_tx_) {
+        (void)BIO_reset(wbio_);
+        return;
+    }
+    while (size_t pending = BIO_ctrl_pending(wbio_)) {
+        auto buf = wire.Reserve(std::min(pending, size_t(IoBuffer::kSegmentSize)));
+        int n = BIO_read(wbio_, buf.base, std::min(pending, size_t(buf.len)));
+        wire.Commit(n > 0 ? n : 0);
+        if (n <= 0) {
+            break;
+        }
+    }
+}
+
+// Still sends whatever alert OpenSSL has for the peer
+int TlsSession::Fail(IoBuffer &wire) {
+    log_debug("TLS %s failed: %s", established_ ? "session" : "handshake", GetError().data());
+    if (!established_) {
+        context_->stats_.failures++;
+    }
+    Drain(wire);
+    return UV_EPROTO;
+}
+
+void TlsSession::Start(IoBuffer &wire) {
+    started_ = uv_hrtime();
+    SSL_do_handshake(ssl_);
+    Drain(wire);
+}
+
+int TlsSession::Read(const char *data, size_t len, IoBuffer &plain, IoBuffer &wire) {
+    if (started_ == 0) {
+        started_ = uv_hrtime();
+    }
+    while (len > 0) {
+        int n = BIO_write(rbio_, data, len);
+        if (n <= 0) {
+            return Fail(wire);
+        }
+        data += n;
+        len -= n;
+    }
+
+    if (!established_) {
+        int ret = SSL_do_handshake(ssl_);
+        if (ret != 1) {
+            int error = SSL_get_error(ssl_, ret);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                return Fail(wire);
+            }
+            Drain(wire);
+            return 0;
+        }
+        established_ = true;
+        auto &stats = context_->stats_;
+        uint64_t time = (uv_hrtime() - started_) / 1000;
+        stats.handshakes++;
+        stats.handshake_time += time;
+        stats.max_handshake_time = std::max(stats.max_handshake_time, time);
+    }
+
+    // Whatever came along with the end of the handshake, and everything
+    // after unless receiving has been offloaded
+    for (;;) {
+        auto buf = plain.Reserve(IoBuffer::kSegmentSize / 2);
+        int n = SSL_read(ssl_, buf.base, buf.len);
+        if (n > 0) {
+            plain.Commit(n);
+            read_data_ = true;
+            continue;
+        }
+        plain.Commit(0);
+        int error = SSL_get_error(ssl_, n);
+        if (error == SSL_ERROR_WANT_READ) {
+            break;
+        }
+        if (error == SSL_ERROR_ZERO_RETURN) {
+            Drain(wire);
+            return UV_EOF;
+        }
+        return Fail(wire);
+    }
+    // Once sending is the kernel's, nothing OpenSSL writes can go out, e.g.
+    // its answer to a KeyUpdate the peer requested, after which the peer
+    // would expect the kernel's key to change too
+    if (ktls_tx_ && BIO_ctrl_pending(wbio_) > 0) {
+        log_debug("TLS session has records to send after offloading, closing it");
+        Drain(wire);
+        return UV_EPROTO;
+    }
+    Drain(wire);
+    return 0;
+}
+
+int TlsSession::Write(IoBuffer &plain, IoBuffer &wire) {
+    uv_buf_t bufs[16];
+    while (!plain.empty()) {
+        size_t count = plain.Export(bufs, sizeof bufs / sizeof bufs[0]);
+        size_t written = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (SSL_write(ssl_, bufs[i].base, bufs[i].len) <= 0) {
+                return Fail(wire);
+            }
+            written += bufs[i].len;
+        }
+        plain.Consume(written);
+    }
+    Drain(wire);
+    return 0;
+}
+
+#ifdef NEXER_KTLS
+
+// HKDF-Expand-Label from RFC 8446 with an empty context
+static bool ExpandLabel(const EVP_MD *md, const unsigned char *secret, size_t secret_size, const char *label,
+                        unsigned char *out, size_t len) {
+    unsigned char info[4 + 6 + 16];
+    size_t label_len = 6 + strlen(label);
+    info[0] = len >> 8;
+    info[1] = len & 0xff;
+    info[2] = label_len;
+    memcpy(info + 3, "tls13 ", 6);
+    memcpy(info + 9, label, label_len - 6);
+    info[3 + label_len] = 0;
+
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+    bool ok = pctx && EVP_PKEY_derive_init(pctx) > 0 &&
+              EVP_PKEY_CTX_set_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+              EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0 && EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secret_size) > 0 &&
+              EVP_PKEY_CTX_add1_hkdf_info(pctx, info, 4 + label_len) > 0 && EVP_PKEY_derive(pctx, out, &len) > 0;
+    EVP_PKEY_CTX_free(pctx);
+    return ok;
+}
+
+// Installs the key and IV derived from secret for the direction, starting
+// at record 0
+bool TlsSession::SetKey(int fd, int direction, const Secret &secret) {
+    auto cipher = SSL_get_current_cipher(ssl_);
+    auto md = SSL_CIPHER_get_handshake_digest(cipher);
+    union {
+        tls12_crypto_info_aes_gcm_128 aes128;
+        tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+    } info;
+    unsigned char key[32], iv[12];
+    size_t key_size, size;
+
+    memset(&info, 0, sizeof info);
+    switch (SSL_CIPHER_get_id(cipher) & 0xffff) {
+    case 0x1301:  // TLS_AES_128_GCM_SHA256
+        info.aes128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        key_size = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+        size = sizeof info.aes128;
+        break;
+    case 0x1302:  // TLS_AES_256_GCM_SHA384
+        info.aes256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        key_size = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+        size = sizeof info.aes256;
+        break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case 0x1303:  // TLS_CHACHA20_POLY1305_SHA256
+        info.chacha.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        key_size = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+        size = sizeof info.chacha;
+        break;
+#endif
+    default:
+        log_debug("kTLS: cipher %s not supported", SSL_CIPHER_get_name(cipher));
+        return false;
+    }
+    info.aes128.info.version = TLS_1_3_VERSION;
+
+    bool ok = ExpandLabel(md, secret.data, secret.size, "key", key, key_size) &&
+              ExpandLabel(md, secret.data, secret.size, "iv", iv, sizeof iv);
+    if (ok) {
+        // The IV is split into a salt and an explicit part for AES-GCM
+        if (info.aes128.info.cipher_type == TLS_CIPHER_AES_GCM_128) {
+            memcpy(info.aes128.salt, iv, 4);
+            memcpy(info.aes128.iv, iv + 4, 8);
+            memcpy(info.aes128.key, key, key_size);
+        } else if (info.aes128.info.cipher_type == TLS_CIPHER_AES_GCM_256) {
+            memcpy(info.aes256.salt, iv, 4);
+            memcpy(info.aes256.iv, iv + 4, 8);
+            memcpy(info.aes256.key, key, key_size);
+        }
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        else {
+            memcpy(info.chacha.iv, iv, sizeof iv);
+            memcpy(info.chacha.key, key, key_size);
+        }
+#endif
+        if (setsockopt(fd, SOL_TLS, direction, &info, size)) {
+            log_debug("kTLS: %s: %s", direction == TLS_TX ? "TLS_TX" : "TLS_RX", strerror(errno));
+            ok = false;
+        }
+    }
+    OPENSSL_cleanse(key, sizeof key);
+    OPENSSL_cleanse(iv, sizeof iv);
+    OPENSSL_cleanse(&info, sizeof info);
+    return ok;
+}
+
+void TlsSession::Offload(int fd, bool idle) {
+    if (!context_->ktls_ || !established_) {
+        return;
+    }
+    bool server = context_->server_;
+    auto &stats = context_->stats_;
+
+    if (SSL_version(ssl_) != TLS1_3_VERSION || client_secret_.size == 0 || server_secret_.size == 0) {
+        log_debug("kTLS: %s not supported", SSL_get_version(ssl_));
+    } else if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof "tls")) {
+        log_debug("kTLS: not available (%s)", strerror(errno));
+    } else {
+        ktls_tx_ = idle && SetKey(fd, TLS_TX, server ? server_secret_ : client_secret_);
+        // Records already taken off the socket would throw the kernel's
+        // sequence numbers off
+        if (server && !read_data_ && BIO_ctrl_pending(rbio_) == 0) {
+            ktls_rx_ = SetKey(fd, TLS_RX, client_secret_);
+        }
+    }
+
+    stats.ktls_tx += ktls_tx_;
+    stats.ktls_rx += ktls_rx_;
+    if (!ktls_tx_ || (server && !ktls_rx_)) {
+        stats.ktls_fallbacks++;
+    }
+    OPENSSL_cleanse(&client_secret_, sizeof client_secret_);
+    OPENSSL_cleanse(&server_secret_, sizeof server_secret_);
+}
+
+#else
+
+bool TlsSession::SetKey(int, int, const Secret &) {
+    return false;
+}
+
+void TlsSession::Offload(int, bool) {
+    if (context_->ktls_ && established_) {
+        context_->stats_.ktls_fallbacks++;
+    }
+}
+
+#endif
+
+}  // namespace nexer
@@ -0,0 +1,587 @@
+#include "tunnel.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "logger.h"
+
+namespace nexer {
+
+static const char kMagic[] = "NEXR";
+
+static void Put32(char *p, uint32_t n) {
+    p[0] = char(n >> 24);
+    p[1] = char(n >> 16);
+    p[2] = char(n >> 8);
+    p[3] = char(n);
+}
+
+static uint32_t Get32(const char *s) {
+    auto p = (const uint8_t *)s;
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+Tunnel::Tunnel(EventLoop &loop, const std::string &host, int port, const std::string &secret,
+               const config::Tunnel *config)
+    : loop_(loop), host_(host), port_(port), accepting_(config != nullptr), config_(config), secret_(secret),
+      nonce_{}, tcp_(nullptr), connecting_(false), hello_received_(false), authenticated_(false), closing_(false),
+      next_id_(0), stats_{} {
+    name_ = accepting_ ? host_ : host_ + ':' + std::to_string(port_);
+}
+
+Tunnel::~Tunnel() {}
+
+Tunnel &Tunnel::Create(EventLoop &loop, const std::string &host, int port, const std::string &secret) {
+    auto tunnel = new Tunnel(loop, host, port, secret, nullptr);
+    tunnel->Connect();
+    return *tunnel;
+}
+
+Tunnel &Tunnel::Accept(TcpClient &tcp, const config::Tunnel &config) {
+    auto tunnel = new Tunnel(tcp.loop(), tcp.GetPeerName(), 0, config.secret, &config);
+    tunnel->Attach(tcp);
+    return *tunnel;
+}
+
+void Tunnel::Frame(IoBuffer &buf, uint32_t id, Type type, uint8_t flags, const char *payload, size_t len) {
+    char header[kHeaderSize];
+    Put32(header, id);
+    header[4] = char(type);
+    header[5] = char(flags);
+    header[6] = char(len >> 8);
+    header[7] = char(len);
+    buf.Write(header, sizeof header);
+    // Data frames have the payload split off the stream's buffer instead
+    if (payload) {
+        buf.Write(payload, len);
+    }
+}
+
+void Tunnel::Connect() {
+    if (tcp_ || connecting_ || closing_) {
+        return;
+    }
+    connecting_ = true;
+    log_debug("Connecting tunnel to %s", name_.data());
+    TcpClient::Connect(loop_, host_.data(), port_, kConnectTimeout, [this](TcpClient *tcp) {
+        connecting_ = false;
+        if (closing_) {
+            if (tcp) {
+                tcp->Close();
+            }
+            Dispose();
+        } else if (tcp) {
+            Attach(*tcp);
+        } else {
+            log_warn("Cannot connect tunnel to %s", name_.data());
+            Drop(UV_ETIMEDOUT);
+        }
+    }, {}, true);
+}
+
+// Starts speaking the protocol on a new tunnel connection. Opens queued
+// while there was none go out after the Hello, or once both ends are
+// authenticated if they need to be.
+void Tunnel::Attach(TcpClient &tcp) {
+    tcp_ = &tcp;
+    hello_received_ = false;
+    authenticated_ = false;
+    input_.Clear();
+    stats_.connects++;
+
+    // Frames are small and carry interactive streams as well as bulk ones,
+    // and a peer that is gone should not keep its streams hanging
+    if (int fd = tcp.GetFd(); fd >= 0) {
+        int on = 1, idle = 60, interval = 10;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof on);
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof idle);
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof interval);
+    }
+
+    tcp.OnData([this](const char *s, size_t len) {
+        Read(s, len);
+    });
+    tcp.OnSend([this] {
+        Pump();
+    });
+    tcp.OnError([this, &tcp](int error, const char *) {
+        log_info("Tunnel with %s failed (%s)", name_.data(), uv_strerror(error));
+        tcp.Close();
+    });
+    tcp.OnClose([this, &tcp] {
+        if (tcp_ == &tcp) {
+            tcp_ = nullptr;
+            Drop(UV_ECONNRESET);
+        }
+    });
+
+    IoBuffer frames;
+    char payload[5 + sizeof nonce_] = {kMagic[0], kMagic[1], kMagic[2], kMagic[3], char(kVersion)};
+    RAND_bytes((unsigned char *)nonce_, sizeof nonce_);
+    memcpy(payload + 5, nonce_, sizeof nonce_);
+    Frame(frames, 0, Type::Hello, 0, payload, sizeof payload);
+    tcp.Write(frames);
+    Pump();
+}
+
+// Ends every stream after the tunnel connection is lost or could not be
+// made. The accepting end goes with it.
+void Tunnel::Drop(int error) {
+    input_.Clear();
+    control_.Clear();
+    for (auto &ready : ready_) {
+        for (auto stream : ready) {
+            stream->queued = false;
+        }
+        ready.clear();
+    }
+    if (accepting_) {
+        closing_ = true;
+    }
+
+    if (!streams_.empty()) {
+        log_info("Tunnel with %s down, closing %zu stream(s)", name_.data(), streams_.size());
+    }
+    std::vector<Stream *> streams;
+    for (auto &it : streams_) {
+        streams.push_back(it.second);
+    }
+    for (auto stream : streams) {
+        stream->close_sent = stream->close_received = true;
+        stream->out.Clear();
+        stream->in.Clear();
+        if (stream->tcp) {
+            stream->error = error;
+            if (!stream->tcp->IsClosing()) {
+                stream->tcp->Close();
+            }
+        } else {
+            Release(stream);
+        }
+    }
+    Dispose();
+}
+
+void Tunnel::Read(const char *s, size_t len) {
+    input_.Write(s, len);
+    while (input_.size() >= kHeaderSize) {
+        char header[kHeaderSize];
+        input_.CopyTo(header, sizeof header);
+        size_t length = uint8_t(header[6]) << 8 | uint8_t(header[7]);
+        if (input_.size() < kHeaderSize + length) {
+            break;
+        }
+        input_.Consume(kHeaderSize);
+        IoBuffer payload;
+        input_.Split(length, payload);
+        if (!Dispatch(Get32(header), Type(header[4]), uint8_t(header[5]), payload)) {
+            log_warn("Closing tunnel with %s (protocol error)", name_.data());
+            input_.Clear();
+            tcp_->Close();
+            return;
+        }
+    }
+    Pump();
+}
+
+// Acts on a frame; false if it breaks the protocol
+bool Tunnel::Dispatch(uint32_t id, Type type, uint8_t flags, IoBuffer &payload) {
+    char buf[kMacSize];
+    size_t len = payload.CopyTo(buf, sizeof buf);
+    if (!hello_received_) {
+        if (type != Type::Hello || len != 5 + sizeof nonce_ || memcmp(buf, kMagic, 4) != 0 ||
+            uint8_t(buf[4]) != kVersion) {
+            return false;
+        }
+        hello_received_ = true;
+        if (secret_.empty()) {
+            authenticated_ = true;
+            return true;
+        }
+        IoBuffer frame;
+        char mac[kMacSize];
+        Sign(accepting_, buf + 5, mac);
+        Frame(frame, 0, Type::Auth, 0, mac, sizeof mac);
+        tcp_->Write(frame);
+        return true;
+    }
+    if (!authenticated_) {
+        char mac[kMacSize];
+        Sign(!accepting_, nonce_, mac);
+        if (type != Type::Auth || len != sizeof mac || CRYPTO_memcmp(buf, mac, sizeof mac) != 0) {
+            log_warn("Tunnel with %s does not know the secret", name_.data());
+            return false;
+        }
+        authenticated_ = true;
+        return true;
+    }
+
+    if (type == Type::Open) {
+        if (!accepting_ || id == 0 || len != 2 || streams_.count(id) > 0) {
+            return false;
+        }
+        Forward(id, std::min<uint8_t>(flags, 7), uint8_t(buf[0]) << 8 | uint8_t(buf[1]));
+        return true;
+    }
+
+    auto it = streams_.find(id);
+    if (it == streams_.end() || it->second->close_received) {
+        return false;
+    }
+    auto stream = it->second;
+    switch (type) {
+    case Type::Data:
+        Receive(stream, payload);
+        return true;
+    case Type::Window:
+        if (len != 4) {
+            return false;
+        }
+        stream->window += Get32(buf);
+        Ready(stream);
+        return true;
+    case Type::Close:
+        if (len != 4) {
+            return false;
+        }
+        stream->close_received = true;
+        stream->out.Clear();
+        if (!stream->tcp) {
+            Release(stream);
+        } else if (stream->tcp->GetWriteQueueSize() == 0 && !stream->tcp->IsClosing()) {
+            stream->tcp->Close();
+        }
+        // else closed once what it was sent is written
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Connects a stream the other end opened to the port, if allowed. What
+// arrives for it in the meantime is kept, up to the window.
+void Tunnel::Forward(uint32_t id, uint8_t priority, int port) {
+    auto stream = new Stream();
+    stream->id = id;
+    stream->priority = priority;
+    stream->window = kWindow;
+    streams_[id] = stream;
+    stats_.streams++;
+
+    auto &allow = config_->allow;
+    if (std::find(allow.begin(), allow.end(), port) == allow.end()) {
+        log_info("Refusing tunnel stream from %s to port %d", name_.data(), port);
+        stats_.refused++;
+        Closed(stream, UV_EACCES);
+        return;
+    }
+
+    stream->connecting = true;
+    TcpClient::Connect(loop_, "127.0.0.1", port, config_->connect_timeout, [this, stream, port](TcpClient *tcp) {
+        stream->connecting = false;
+        if (stream->closed) {
+            // Reset meanwhile
+            if (tcp) {
+                tcp->Close();
+            }
+            Release(stream);
+            Dispose();
+        } else if (stream->close_received) {
+            if (tcp) {
+                tcp->Close();
+            }
+            Closed(stream, 0);
+        } else if (tcp) {
+            Bind(stream, *tcp);
+        } else {
+            log_info("Cannot connect tunnel stream from %s to port %d", name_.data(), port);
+            Closed(stream, UV_ETIMEDOUT);
+        }
+    }, {}, true);
+}
+
+// Forwards between the stream and its connection from now on
+void Tunnel::Bind(Stream *stream, TcpClient &tcp) {
+    stream->tcp = &tcp;
+    tcp.OnData([this, stream](const char *s, size_t len) {
+        stream->out.Write(s, len);
+        if (stream->out.size() >= kWindow && !stream->paused) {
+            stream->paused = true;
+            stream->tcp->ReadStop();
+        }
+        Ready(stream);
+        Pump();
+    });
+    tcp.OnSend([this, stream] {
+        auto tcp = stream->tcp;
+        if (stream->close_received) {
+            if (tcp->GetWriteQueueSize() == 0 && !tcp->IsClosing()) {
+                tcp->Close();
+            }
+            return;
+        }
+        Credit(stream);
+    });
+    tcp.OnError([stream](int error, const char *) {
+        stream->error = error;
+        if (!stream->tcp->IsClosing()) {
+            stream->tcp->Close();
+        }
+    });
+    tcp.OnClose([this, stream] {
+        Closed(stream, stream->error);
+    });
+
+    if (!stream->in.empty()) {
+        stream->written += stream->in.size();
+        tcp.Write(stream->in);
+        Credit(stream);
+    }
+}
+
+// What the peer signs with: the sender's role and the receiver's nonce
+void Tunnel::Sign(bool accepting, const char *nonce, char *mac) {
+    unsigned char data[1 + sizeof nonce_];
+    unsigned int len = kMacSize;
+    data[0] = accepting ? 'A' : 'C';
+    memcpy(data + 1, nonce, sizeof nonce_);
+    HMAC(EVP_sha256(), secret_.data(), int(secret_.size()), data, sizeof data, (unsigned char *)mac, &len);
+}
+
+void Tunnel::Receive(Stream *stream, IoBuffer &data) {
+    stats_.bytes_in += data.size();
+    stream->received += data.size();
+    if (stream->closed || (stream->tcp && stream->tcp->IsClosing())) {
+        return;
+    }
+    // Beyond the window, which also bounds what is kept while connecting
+    if (stream->received > stream->credited + kWindow) {
+        log_warn("Resetting tunnel stream from %s (window exceeded)", name_.data());
+        Reset(stream, UV_ENOBUFS);
+        return;
+    }
+    if (!stream->tcp) {
+        stream->in.Append(data);
+        return;
+    }
+    stream->written += data.size();
+    stream->tcp->Write(data);
+    Credit(stream);
+}
+
+// Gives up on the stream: its connection is closed, or will be once
+// connected, and Close goes out with the error
+void Tunnel::Reset(Stream *stream, int error) {
+    stream->out.Clear();
+    if (!stream->tcp) {
+        Closed(stream, error);
+        return;
+    }
+    stream->error = error;
+    stream->tcp->Close();
+}
+
+// Lets the other end send more once a good part of what it has sent has
+// been taken by the stream's connection
+void Tunnel::Credit(Stream *stream) {
+    uint64_t taken = stream->written - stream->tcp->GetWriteQueueSize();
+    if (taken - stream->credited < kWindow / 4) {
+        return;
+    }
+    char payload[4];
+    Put32(payload, uint32_t(taken - stream->credited));
+    stream->credited = taken;
+    Frame(control_, stream->id, Type::Window, 0, payload, sizeof payload);
+    Pump();
+}
+
+// The stream's connection is gone: Close goes out once what was read from
+// it has
+void Tunnel::Closed(Stream *stream, int error) {
+    stream->tcp = nullptr;
+    stream->closed = true;
+    stream->error = error;
+    stream->in.Clear();
+    if (stream->close_sent) {
+        Release(stream);
+    } else {
+        Ready(stream);
+        Pump();
+    }
+    Dispose();
+}
+
+bool Tunnel::IsReady(Stream *stream) {
+    if (stream->close_sent) {
+        return false;
+    }
+    return stream->out.empty() ? stream->closed : stream->window > 0;
+}
+
+void Tunnel::Ready(Stream *stream) {
+    if (!stream->queued && IsReady(stream)) {
+        stream->queued = true;
+        ready_[stream->priority].push_back(stream);
+    }
+}
+
+// Hands the tunnel connection control frames, then Data frames from the
+// ready streams by priority, in turns of a frame each, while libuv holds
+// less than kHighWater for it. Everything goes in a single write.
+void Tunnel::Pump() {
+    if (!tcp_ || tcp_->IsClosing() || (!secret_.empty() && !authenticated_)) {
+        return;
+    }
+    IoBuffer frames;
+    frames.Append(control_);
+    size_t queued = tcp_->GetWriteQueueSize();
+    for (size_t priority = 0; priority < 8 && queued + frames.size() < kHighWater;) {
+        auto &ready = ready_[priority];
+        if (ready.empty()) {
+            priority++;
+            continue;
+        }
+        auto stream = ready.front();
+        ready.pop_front();
+        stream->queued = false;
+        if (!IsReady(stream)) {
+            continue;
+        }
+
+        if (stream->out.empty()) {
+            char payload[4];
+            Put32(payload, uint32_t(stream->error));
+            Frame(frames, stream->id, Type::Close, 0, payload, sizeof payload);
+            stream->close_sent = true;
+            Release(stream);
+            continue;
+        }
+
+        size_t len = std::min({stream->out.size(), size_t(stream->window), size_t(kFrameSize)});
+        Frame(frames, stream->id, Type::Data, 0, nullptr, len);
+        stream->out.Split(len, frames);
+        stream->window -= len;
+        stats_.bytes_out += len;
+        if (stream->paused && stream->tcp && stream->out.size() < kWindow / 2) {
+            stream->paused = false;
+            stream->tcp->ReadStart();
+        }
+        Ready(stream);
+    }
+    if (!frames.empty()) {
+        tcp_->Write(frames);
+    }
+}
+
+// Forgets the stream once there is nothing more to do for it either way
+void Tunnel::Release(Stream *stream) {
+    if (!stream->closed || stream->connecting || !stream->close_sent || !stream->close_received) {
+        return;
+    }
+    if (stream->queued) {
+        auto &ready = ready_[stream->priority];
+        ready.erase(std::find(ready.begin(), ready.end(), stream));
+    }
+    streams_.erase(stream->id);
+    delete stream;
+}
+
+// Deletes the tunnel once it is closing and nothing is left that refers to
+// it. Nothing may be done with it after this.
+void Tunnel::Dispose() {
+    if (closing_ && !tcp_ && !connecting_ && streams_.empty()) {
+        on_close_.Invoke();
+        delete this;
+    }
+}
+
+void Tunnel::Open(TcpClient &client, int port, int priority) {
+    if (closing_) {
+        client.Close();
+        return;
+    }
+    auto stream = new Stream();
+    if (++next_id_ == 0) {
+        next_id_++;
+    }
+    stream->id = next_id_;
+    stream->priority = uint8_t(priority);
+    stream->window = kWindow;
+    streams_[stream->id] = stream;
+    stats_.streams++;
+
+    char payload[2] = {char(port >> 8), char(port)};
+    Frame(control_, stream->id, Type::Open, stream->priority, payload, sizeof payload);
+    Bind(stream, client);
+    Connect();
+    Pump();
+}
+
+void Tunnel::Close() {
+    closing_ = true;
+    if (tcp_) {
+        tcp_->Close();
+    } else {
+        Drop(UV_ECANCELED);
+    }
+}
+
+void Tunnel::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("peer", name_);
+    json.Field("connected", tcp_ != nullptr && authenticated_);
+    json.Field("streams", streams_.size());
+    json.Field("connects", stats_.connects);
+    json.Field("opened", stats_.streams);
+    if (accepting_) {
+        json.Field("refused", stats_.refused);
+    }
+    json.Field("bytes_in", stats_.bytes_in);
+    json.Field("bytes_out", stats_.bytes_out);
+    json.EndObject();
+}
+
+TunnelServer &TunnelServer::Create(EventLoop &loop, const config::Tunnel &config) {
+    auto server = new TunnelServer(loop, config);
+    return *server;
+}
+
+TunnelServer::TunnelServer(EventLoop &loop, const config::Tunnel &config) : TcpServer(loop), config_(config) {
+    TcpServer::OnConnection([this](TcpClient &tcp) {
+        log_debug("Tunnel connection from %s", tcp.GetPeerName().data());
+        auto &tunnel = Tunnel::Accept(tcp, config_);
+        tunnels_[&tunnel] = tunnel.OnClose([this, &tunnel] {
+            tunnels_.erase(&tunnel);
+        });
+    });
+    OnClose([this] {
+        auto tunnels = std::move(tunnels_);
+        tunnels_.clear();
+        for (auto &it : tunnels) {
+            it.second();
+            it.first->Close();
+        }
+    });
+}
+
+void TunnelServer::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("listen", GetSockName());
+    json.Key("connections").BeginArray();
+    for (auto &it : tunnels_) {
+        it.first->WriteStatus(json);
+    }
+    json.EndArray();
+    json.EndObject();
+}
+
+}  // namespace nexer
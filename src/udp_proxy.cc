@@ -0,0 +1,344 @@
+#include "udp_proxy.h"
+
+#include "logger.h"
+#include <algorithm>
+#include <sstream>
+
+namespace nexer {
+
+UdpProxy &UdpProxy::Create(EventLoop &loop, config::Proxy &config, ProcessManager *pm) {
+    auto proxy = new UdpProxy(loop, config, pm);
+    return *proxy;
+}
+
+UdpProxy::UdpProxy(EventLoop &loop, config::Proxy &config, ProcessManager *pm)
+    : UdpServer(loop), config_(config), process_manager_(pm), next_session_id_(0), sweeper_(nullptr),
+      resolved_(false), lookup_(nullptr), resolve_after_(0), resolve_backoff_(kMinResolveBackoff), stats_{} {
+    std::stringstream ss;
+    ss << config_.upstream.host << ':' << config_.upstream.port << "/udp";
+    name_ = ss.str();
+    memset(&upstream_addr_, 0, sizeof(upstream_addr_));
+    Init();
+}
+
+void UdpProxy::Init() {
+    UdpServer::OnRecvBatch([this](const Datagram *datagrams, size_t count) {
+        OnClientRecv(datagrams, count);
+    });
+
+    sweeper_ = &Timer::Create(loop(), std::max(config_.idle_timeout / 2, 1000));
+    sweeper_->OnTick([this] {
+        Expire();
+    });
+    sweeper_->Start();
+
+    on_close_.Add([this] {
+        sweeper_->Close();
+        if (lookup_) {
+            // Freed by OnResolved, which libuv still calls
+            lookup_->proxy = nullptr;
+            uv_cancel((uv_req_t *)&lookup_->req);
+            lookup_ = nullptr;
+        }
+        std::vector<UdpSession *> sessions;
+        sessions_.ForEach([&](UdpSession &session) {
+            sessions.push_back(&session);
+        });
+        for (auto session : sessions) {
+            Remove(session);
+        }
+    });
+}
+
+// Starts looking up the upstream host unless a lookup is under way or the
+// last one failed too recently; false if there is no lookup to wait for
+bool UdpProxy::Resolve() {
+    if (lookup_) {
+        return true;
+    }
+    if (uv_now(loop()) < resolve_after_) {
+        return false;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    auto port = std::to_string(config_.upstream.port);
+    auto lookup = new Lookup{{}, this};
+    lookup->req.data = lookup;
+
+    if (int err = uv_getaddrinfo(loop(), &lookup->req, OnResolved, config_.upstream.host.data(), port.data(), &hints)) {
+        delete lookup;
+        Resolved(err, nullptr);
+        return false;
+    }
+
+    lookup_ = lookup;
+    return true;
+}
+
+void UdpProxy::OnResolved(uv_getaddrinfo_t *req, int status, struct addrinfo *res) {
+    auto lookup = (Lookup *)req->data;
+    if (lookup->proxy) {
+        lookup->proxy->lookup_ = nullptr;
+        lookup->proxy->Resolved(status, res);
+    }
+    uv_freeaddrinfo(res);
+    delete lookup;
+}
+
+// Connects the sessions whose app is up, or drops those waiting if the
+// lookup failed
+void UdpProxy::Resolved(int status, const struct addrinfo *res) {
+    std::vector<UdpSession *> sessions;
+    sessions_.ForEach([&](UdpSession &session) {
+        if (!session.upstream) {
+            sessions.push_back(&session);
+        }
+    });
+
+    if (status != 0) {
+        stats_.lookup_failures++;
+        log_error("Failed to resolve %s: %s (retrying in %llu ms)", name_.data(), uv_strerror(status),
+                  (unsigned long long)resolve_backoff_);
+        resolve_after_ = uv_now(loop()) + resolve_backoff_;
+        resolve_backoff_ = std::min(resolve_backoff_ * 2, uint64_t(kMaxResolveBackoff));
+        for (auto session : sessions) {
+            Remove(session);
+        }
+        return;
+    }
+
+    memcpy(&upstream_addr_, res->ai_addr, res->ai_addrlen);
+    resolved_ = true;
+    resolve_backoff_ = kMinResolveBackoff;
+
+    for (auto session : sessions) {
+        if (session->ready) {
+            Connect(*session);
+        }
+    }
+}
+
+// Returns the session if the datagram can be sent upstream right away
+UdpSession *UdpProxy::Track(const char *s, size_t len, const struct sockaddr *addr) {
+    if (addr == nullptr) {
+        return nullptr;
+    }
+
+    auto session = sessions_.Find(addr);
+
+    if (session == nullptr) {
+        if (!resolved_ && !Resolve()) {
+            stats_.dropped++;
+            return nullptr;
+        }
+        session = sessions_.Insert(addr);
+        session->id = ++next_session_id_;
+        log_debug("UDP session %llu opened for %s", (unsigned long long)session->id, name_.data());
+        // Keeps the app from being stopped for being idle while the session
+        // lasts, as a connection would
+        if (process_manager_ && config_.upstream.app) {
+            process_manager_->Acquire(*config_.upstream.app);
+        }
+
+        sockaddr_storage key = session->addr;
+        uint64_t id = session->id;
+        CheckUpstreamProcess([this, key, id](int error) {
+            // The session may have expired while the app was starting
+            auto session = sessions_.Find((const struct sockaddr *)&key);
+            if (session == nullptr || session->id != id) {
+                return;
+            }
+            if (error) {
+                log_info("Upstream check failed (%d)", error);
+                Remove(session);
+                return;
+            }
+            session->ready = true;
+            if (resolved_) {
+                Connect(*session);
+            }
+        });
+
+        if ((session = sessions_.Find(addr)) == nullptr) {
+            return nullptr;
+        }
+    }
+
+    session->last_active = uv_now(loop());
+    session->stats.packets_in++;
+    session->stats.bytes_in += len;
+
+    if (session->upstream) {
+        return session;
+    }
+    uint16_t size = len;
+    if (session->pending.size() + sizeof size + len <= kMaxPending) {
+        session->pending.Write((const char *)&size, sizeof size).Write(s, len);
+    } else {
+        session->stats.dropped++;
+    }
+    return nullptr;
+}
+
+// Consecutive datagrams from one client are sent upstream as one batch
+void UdpProxy::OnClientRecv(const Datagram *datagrams, size_t count) {
+    UdpSession *current = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        auto &datagram = datagrams[i];
+        auto session = Track(datagram.data, datagram.len, datagram.addr);
+        if (session != current && run_.size() > 0) {
+            current->upstream->Send(run_.data(), run_.size());
+            run_.clear();
+        }
+        current = session;
+        if (session) {
+            run_.push_back({datagram.data, datagram.len, nullptr});
+        }
+    }
+    if (run_.size() > 0) {
+        current->upstream->Send(run_.data(), run_.size());
+        run_.clear();
+    }
+}
+
+void UdpProxy::Connect(UdpSession &session) {
+    auto &upstream = UdpServer::Create(loop());
+
+    if (!upstream.Connect((const struct sockaddr *)&upstream_addr_)) {
+        upstream.Close();
+        Remove(&session);
+        return;
+    }
+
+    session.upstream = &upstream;
+
+    auto client = &session;
+    upstream.OnRecvBatch([this, client](const Datagram *datagrams, size_t count) {
+        client->last_active = uv_now(loop());
+        client->stats.packets_out += count;
+        for (size_t i = 0; i < count; i++) {
+            client->stats.bytes_out += datagrams[i].len;
+            run_.push_back({datagrams[i].data, datagrams[i].len, (const struct sockaddr *)&client->addr});
+        }
+        Send(run_.data(), run_.size());
+        run_.clear();
+    });
+
+    upstream.OnError([this](int, const char *msg) {
+        log_debug("Upstream error for %s: %s", name_.data(), msg);
+    });
+
+    auto &pending = session.pending;
+    char packet[65536];
+    while (!pending.empty()) {
+        uint16_t size;
+        pending.CopyTo((char *)&size, sizeof size);
+        pending.Consume(sizeof size);
+        pending.CopyTo(packet, size);
+        pending.Consume(size);
+        upstream.Send(packet, size);
+    }
+    pending.Clear();
+}
+
+void UdpProxy::Remove(UdpSession *session) {
+    if (session->upstream) {
+        session->upstream->Close();
+    }
+    auto &stats = session->stats;
+    stats_.sessions++;
+    stats_.packets_in += stats.packets_in;
+    stats_.bytes_in += stats.bytes_in;
+    stats_.packets_out += stats.packets_out;
+    stats_.bytes_out += stats.bytes_out;
+    stats_.dropped += stats.dropped;
+    log_info("UDP session %llu for %s closed (in: %llu packets/%llu bytes, out: %llu packets/%llu bytes, dropped: %llu)",
+             (unsigned long long)session->id, name_.data(), (unsigned long long)stats.packets_in,
+             (unsigned long long)stats.bytes_in, (unsigned long long)stats.packets_out,
+             (unsigned long long)stats.bytes_out, (unsigned long long)stats.dropped);
+    sessions_.Erase(session);
+    if (process_manager_ && config_.upstream.app) {
+        process_manager_->Release(*config_.upstream.app);
+    }
+}
+
+void UdpProxy::Expire() {
+    uint64_t now = uv_now(loop());
+    std::vector<UdpSession *> expired;
+    sessions_.ForEach([&](UdpSession &session) {
+        // Sessions waiting for their app or the upstream address are kept
+        // until the check or lookup completes
+        if (session.upstream && now - session.last_active >= (uint64_t)config_.idle_timeout) {
+            expired.push_back(&session);
+        }
+    });
+    for (auto session : expired) {
+        Remove(session);
+    }
+}
+
+static std::string AddressName(const sockaddr_storage &addr) {
+    char ip[64];
+    if (addr.ss_family == AF_INET6) {
+        auto in6 = (const sockaddr_in6 *)&addr;
+        uv_ip6_name(in6, ip, sizeof ip);
+        return "[" + std::string(ip) + "]:" + std::to_string(ntohs(in6->sin6_port));
+    }
+    auto in = (const sockaddr_in *)&addr;
+    uv_ip4_name(in, ip, sizeof ip);
+    return std::string(ip) + ":" + std::to_string(ntohs(in->sin_port));
+}
+
+void UdpProxy::WriteStatus(JsonWriter &json) {
+    json.Field("listen", config_.port);
+    json.Field("upstream", name_);
+    if (config_.upstream.app) {
+        json.Field("app", config_.upstream.app->name);
+    }
+    json.Field("resolved", resolved_);
+    json.Field("sessions_count", sessions_.size());
+    json.Key("stats").BeginObject();
+    json.Field("sessions", stats_.sessions);
+    json.Field("packets_in", stats_.packets_in);
+    json.Field("bytes_in", stats_.bytes_in);
+    json.Field("packets_out", stats_.packets_out);
+    json.Field("bytes_out", stats_.bytes_out);
+    json.Field("dropped", stats_.dropped);
+    json.Field("lookup_failures", stats_.lookup_failures);
+    json.EndObject();
+
+    uint64_t now = uv_now(loop());
+    json.Key("sessions").BeginArray();
+    sessions_.ForEach([&](const UdpSession &session) {
+        json.BeginObject();
+        json.Field("id", session.id);
+        json.Field("client", AddressName(session.addr));
+        json.Field("connected", session.upstream != nullptr);
+        json.Field("pending", session.pending.size());
+        json.Field("idle", now - session.last_active);
+        json.Field("packets_in", session.stats.packets_in);
+        json.Field("bytes_in", session.stats.bytes_in);
+        json.Field("packets_out", session.stats.packets_out);
+        json.Field("bytes_out", session.stats.bytes_out);
+        json.Field("dropped", session.stats.dropped);
+        json.EndObject();
+    });
+    json.EndArray();
+}
+
+void UdpProxy::CheckUpstreamProcess(std::function<void(int)> then) {
+    if (!config_.upstream.app) {
+        then(0);
+    } else {
+        process_manager_->Require(*config_.upstream.app, [&, then](Process*, int error) {
+            then(error);
+        });
+    }
+}
+
+}  // namespace nexer
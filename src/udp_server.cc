@@ -2,11 +2,16 @@
 
 #include "logger.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
 namespace nexer {
 
 UdpServer::UdpServer(uv_loop_t* loop) {
-    if (int status = uv_udp_init(loop, &udp_)) {
-        log_fatal("uv_udp_init: %s", uv_strerror(status));
+    if (int status = uv_udp_init_ex(loop, &udp_, AF_UNSPEC | UV_UDP_RECVMMSG)) {
+        log_fatal("uv_udp_init_ex: %s", uv_strerror(status));
     }
 
     udp_.data = this;
@@ -18,11 +23,18 @@ UdpServer& UdpServer::Create(EventLoop& loop) {
 }
 
 bool UdpServer::Listen(int port) {
-    struct sockaddr_in addr;
+    return Listen("0.0.0.0", port);
+}
+
+bool UdpServer::Listen(const char *host, int port) {
+    union {
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } addr;
     int err;
 
-    if ((err = uv_ip4_addr("0.0.0.0", port, &addr))) {
-        log_error("ip4 addr: %s (%d)", uv_strerror(err), err);
+    if ((err = uv_ip4_addr(host, port, &addr.in)) && (err = uv_ip6_addr(host, port, &addr.in6))) {
+        log_error("bind address %s: %s", host, uv_strerror(err));
         return false;
     }
 
@@ -41,26 +53,147 @@ bool UdpServer::Listen(int port) {
     return true;
 }
 
+bool UdpServer::Connect(const struct sockaddr* addr) {
+    int err;
+
+    if ((err = uv_udp_connect(&udp_, addr))) {
+        log_error("udp connect: %s (%d)", uv_strerror(err), err);
+        return false;
+    }
+
+    if ((err = uv_udp_recv_start(&udp_, OnAlloc, OnRecv))) {
+        log_error("udp recv: %s (%d)", uv_strerror(err), err);
+        return false;
+    }
+
+    return true;
+}
+
+struct UdpSendRequest {
+    UdpServer* server;
+    uv_udp_send_t req;
+};
+
+int UdpServer::Send(const char* data, size_t len, const struct sockaddr* addr) {
+    uv_buf_t buf = uv_buf_init((char*)data, len);
+
+    int status = uv_udp_try_send(&udp_, &buf, 1, addr);
+    if (status >= 0) {
+        return 0;
+    }
+    if (status != UV_EAGAIN) {
+        return status;
+    }
+
+    auto req = (UdpSendRequest*)malloc(sizeof(UdpSendRequest) + len);
+    req->server = this;
+    req->req.data = req;
+    buf.base = (char*)(req + 1);
+    memcpy(buf.base, data, len);
+
+    if ((status = uv_udp_send(&req->req, &udp_, &buf, 1, addr, OnSend))) {
+        free(req);
+    }
+    return status;
+}
+
+int UdpServer::Send(const Datagram* datagrams, size_t count) {
+#ifdef __linux__
+    uv_os_fd_t fd;
+
+    // Datagrams still queued in libuv must go out first
+    if (uv_udp_get_send_queue_count(&udp_) == 0 && uv_fileno((uv_handle_t*)&udp_, &fd) == 0) {
+        const size_t width = 64;
+        struct mmsghdr msgs[width];
+        struct iovec iov[width];
+
+        while (count > 0) {
+            size_t n = count < width ? count : width;
+            memset(msgs, 0, n * sizeof(msgs[0]));
+            for (size_t i = 0; i < n; i++) {
+                auto addr = datagrams[i].addr;
+                iov[i].iov_base = (void*)datagrams[i].data;
+                iov[i].iov_len = datagrams[i].len;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                if (addr) {
+                    msgs[i].msg_hdr.msg_name = (void*)addr;
+                    msgs[i].msg_hdr.msg_namelen =
+                        addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+                }
+            }
+
+            int sent;
+            do {
+                sent = sendmmsg(fd, msgs, n, 0);
+            } while (sent < 0 && errno == EINTR);
+
+            // Whatever the kernel did not take is queued one by one below
+            if (sent <= 0) {
+                break;
+            }
+            datagrams += sent;
+            count -= sent;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++) {
+        if (int status = Send(datagrams[i].data, datagrams[i].len, datagrams[i].addr)) {
+            return status;
+        }
+    }
+    return 0;
+}
+
+void UdpServer::OnSend(uv_udp_send_t* req, int status) {
+    auto request = (UdpSendRequest*)req->data;
+    auto server = request->server;
+    free(request);
+    if (status) {
+        server->OnError("send", status);
+    }
+}
+
 void UdpServer::OnAlloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-    auto server = (UdpServer*)handle;
-    buf->base = server->slab_;
-    buf->len = sizeof(server->slab_);
+    auto server = (UdpServer*)handle->data;
+    *buf = server->loop().slab();
 }
 
 void UdpServer::OnRecv(uv_udp_t* handle, ssize_t nread, const uv_buf_t* rcvbuf, const struct sockaddr* addr,
                        unsigned flags) {
     auto server = (UdpServer*)handle->data;
 
-    if (nread == 0) {
+    if (nread < 0) {
+        server->on_error_.Invoke(nread, uv_strerror(nread));
         return;
     }
 
-    if (nread < 0) {
-        server->on_error_.Invoke(nread, uv_strerror(nread));
+    // Sent once after all datagrams of a recvmmsg call
+    if (flags & UV_UDP_MMSG_FREE) {
+        server->FlushBatch();
+        return;
+    }
+
+    if (nread == 0) {
         return;
     }
 
     server->on_recv_.Invoke(rcvbuf->base, nread, addr);
+
+    if (!server->on_recv_batch_.empty()) {
+        server->batch_.push_back({rcvbuf->base, (size_t)nread, addr});
+        if (!(flags & UV_UDP_MMSG_CHUNK)) {
+            server->FlushBatch();
+        }
+    }
+}
+
+void UdpServer::FlushBatch() {
+    if (batch_.size() > 0) {
+        on_recv_batch_.Invoke(batch_.data(), batch_.size());
+        batch_.clear();
+    }
 }
 
-}  // namespace nexer
\ No newline at end of file
+}  // namespace nexer
@@ -0,0 +1,414 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "logger.h"
+
+namespace nexer {
+
+// Completions tell receives from sends by the low bit of user_data, flows
+// being pointer aligned
+static const uint64_t kSendBit = 1;
+
+Uring::Uring()
+    : fd_(-1), sq_{}, cq_{}, buf_ring_(nullptr), buf_ring_size_(0), buffers_(nullptr), buffer_count_(0),
+      buffer_size_(0), buf_tail_(0), stats_{} {
+    memset(&poll_, 0, sizeof poll_);
+}
+
+// Pairs still open are ended, and the kernel is waited on for what it still
+// holds of theirs, their buffers included, before the memory goes
+Uring::~Uring() {
+    std::vector<Pair *> open(pairs_.begin(), pairs_.end());
+    for (auto pair : open) {
+        Finish(pair, 0, UV_ECANCELED);
+        if (pair->ops == 0) {
+            Release(pair);
+        }
+    }
+    while (!pairs_.empty()) {
+        Submit();
+        if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+            log_error("io_uring_enter: %s", strerror(errno));
+            break;
+        }
+        Reap();
+    }
+
+    if (buf_ring_) {
+        munmap(buf_ring_, buf_ring_size_);
+    }
+    if (buffers_) {
+        munmap(buffers_, size_t(buffer_count_) * buffer_size_);
+    }
+    if (sq_.sqes) {
+        munmap(sq_.sqes, sq_.entries * sizeof(io_uring_sqe));
+    }
+    if (cq_.ring && cq_.ring != sq_.ring) {
+        munmap(cq_.ring, cq_.ring_size);
+    }
+    if (sq_.ring) {
+        munmap(sq_.ring, sq_.ring_size);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+Uring *Uring::Create(EventLoop &loop, const config::Uring &config) {
+    auto uring = new Uring();
+    if (!uring->Init(config)) {
+        delete uring;
+        return nullptr;
+    }
+    if (int error = uv_poll_init(loop, &uring->poll_, uring->fd_)) {
+        log_error("Cannot poll io_uring: %s", uv_strerror(error));
+        delete uring;
+        return nullptr;
+    }
+    uring->poll_.data = uring;
+    return uring;
+}
+
+static void *Map(size_t size, int fd, off_t offset) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE,
+                   fd, offset);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+bool Uring::Init(const config::Uring &config) {
+    io_uring_params params = {};
+    // Room for a receive and a chain of sends each way of every connection
+    // without the completion queue overflowing in common cases
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = config.entries * 4;
+    fd_ = syscall(__NR_io_uring_setup, config.entries, &params);
+    if (fd_ < 0) {
+        log_error("io_uring_setup: %s", strerror(errno));
+        return false;
+    }
+
+    sq_.ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_.ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sq_.ring_size = cq_.ring_size = std::max(sq_.ring_size, cq_.ring_size);
+    }
+    sq_.ring = Map(sq_.ring_size, fd_, IORING_OFF_SQ_RING);
+    cq_.ring = single ? sq_.ring : Map(cq_.ring_size, fd_, IORING_OFF_CQ_RING);
+    sq_.entries = params.sq_entries;
+    sq_.sqes = (io_uring_sqe *)Map(params.sq_entries * sizeof(io_uring_sqe), fd_, IORING_OFF_SQES);
+    if (!sq_.ring || !cq_.ring || !sq_.sqes) {
+        log_error("Cannot map io_uring: %s", strerror(errno));
+        return false;
+    }
+
+    auto sq = (char *)sq_.ring, cq = (char *)cq_.ring;
+    sq_.head = (unsigned *)(sq + params.sq_off.head);
+    sq_.tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_.flags = (unsigned *)(sq + params.sq_off.flags);
+    sq_.mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sq_.local_tail = sq_.submitted = *sq_.tail;
+    // SQEs are always used in ring order
+    auto array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    cq_.head = (unsigned *)(cq + params.cq_off.head);
+    cq_.tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_.mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cq_.cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    buffer_count_ = config.buffers;
+    buffer_size_ = config.buffer_size;
+    buf_ring_size_ = buffer_count_ * sizeof(io_uring_buf);
+    buf_ring_ = (io_uring_buf_ring *)Map(buf_ring_size_, -1, 0);
+    buffers_ = (char *)Map(size_t(buffer_count_) * buffer_size_, -1, 0);
+    if (!buf_ring_ || !buffers_) {
+        log_error("Cannot allocate io_uring buffers: %s", strerror(errno));
+        return false;
+    }
+    io_uring_buf_reg reg = {};
+    reg.ring_addr = uint64_t(buf_ring_);
+    reg.ring_entries = buffer_count_;
+    reg.bgid = kBufferGroup;
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        log_error("Cannot register io_uring buffers: %s", strerror(errno));
+        return false;
+    }
+    for (unsigned i = 0; i < buffer_count_; i++) {
+        GiveBack(i);
+    }
+    return true;
+}
+
+void Uring::OnPoll(uv_poll_t *poll, int status, int) {
+    auto self = static_cast<Uring *>(poll->data);
+    if (status < 0) {
+        log_error("io_uring poll: %s", uv_strerror(status));
+        return;
+    }
+    self->Reap();
+    self->Submit();
+}
+
+io_uring_sqe *Uring::GetSqe() {
+    if (sq_.local_tail - __atomic_load_n(sq_.head, __ATOMIC_ACQUIRE) >= sq_.entries) {
+        Submit();
+        if (sq_.local_tail - __atomic_load_n(sq_.head, __ATOMIC_ACQUIRE) >= sq_.entries) {
+            return nullptr;
+        }
+    }
+    auto sqe = &sq_.sqes[sq_.local_tail++ & sq_.mask];
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
+
+// Hands the kernel everything queued since the last call in one go. When
+// completions have overflowed, they are flushed into the queue as well.
+void Uring::Submit() {
+    unsigned count = sq_.local_tail - sq_.submitted;
+    unsigned flags = (__atomic_load_n(sq_.flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) ? IORING_ENTER_GETEVENTS : 0;
+    if (count == 0 && flags == 0) {
+        return;
+    }
+    __atomic_store_n(sq_.tail, sq_.local_tail, __ATOMIC_RELEASE);
+    stats_.submits++;
+    int n = syscall(__NR_io_uring_enter, fd_, count, 0, flags, nullptr, 0);
+    if (n < 0) {
+        // Retried at the end of the next round; EBUSY clears as completions
+        // are reaped
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            log_error("io_uring_enter: %s", strerror(errno));
+        }
+        return;
+    }
+    sq_.submitted += n;
+}
+
+void Uring::Reap() {
+    uint16_t buf_tail = buf_tail_;
+    unsigned head = *cq_.head;
+    for (;;) {
+        unsigned tail = __atomic_load_n(cq_.tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        while (head != tail) {
+            auto cqe = cq_.cqes[head & cq_.mask];
+            head++;
+            auto flow = (Flow *)(cqe.user_data & ~kSendBit);
+            Complete(flow, cqe.user_data & kSendBit, cqe);
+        }
+        __atomic_store_n(cq_.head, head, __ATOMIC_RELEASE);
+    }
+
+    if (buf_tail != buf_tail_ && !starved_.empty()) {
+        std::vector<Flow *> starved(starved_.begin(), starved_.end());
+        starved_.clear();
+        for (auto flow : starved) {
+            Receive(flow);
+        }
+    }
+}
+
+void Uring::Receive(Flow *flow) {
+    if (flow->reading || flow->eof || flow->pair->done) {
+        return;
+    }
+    auto sqe = GetSqe();
+    if (!sqe) {
+        starved_.insert(flow);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = flow->from;
+    sqe->len = buffer_size_;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = uint64_t(flow);
+    flow->reading = true;
+    flow->pair->ops++;
+}
+
+// Sends everything received as one chain, each send linked to the next so
+// that they go out in order. Should one fall short, the rest are cancelled
+// and sent again from where it stopped.
+void Uring::Send(Flow *flow) {
+    auto pair = flow->pair;
+    if (flow->sending > 0 || flow->count == 0 || pair->done) {
+        return;
+    }
+    // A chain must not be split across submissions
+    if (sq_.entries - (sq_.local_tail - __atomic_load_n(sq_.head, __ATOMIC_ACQUIRE)) < flow->count) {
+        Submit();
+    }
+    unsigned n = std::min<unsigned>(flow->count, sq_.entries - (sq_.local_tail - __atomic_load_n(sq_.head, __ATOMIC_ACQUIRE)));
+    if (n == 0) {
+        log_error("io_uring submission queue full");
+        Finish(pair, flow == &pair->flows[0] ? 0 : 1, UV_ENOBUFS);
+        return;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        auto &chunk = flow->chunks[(flow->head + i) % kChainSize];
+        auto sqe = GetSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = flow->to;
+        sqe->addr = uint64_t(buffers_ + size_t(chunk.id) * buffer_size_ + chunk.offset);
+        sqe->len = chunk.len;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+        sqe->user_data = uint64_t(flow) | kSendBit;
+    }
+    flow->sending = n;
+    pair->ops += n;
+}
+
+void Uring::Complete(Flow *flow, bool send, const io_uring_cqe &cqe) {
+    auto pair = flow->pair;
+    int side = flow == &pair->flows[0] ? 0 : 1;
+    pair->ops--;
+
+    if (!send) {
+        flow->reading = false;
+        stats_.receives++;
+        if (cqe.res > 0) {
+            uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            stats_.bytes += cqe.res;
+            if (pair->done) {
+                GiveBack(id);
+            } else {
+                flow->chunks[(flow->head + flow->count) % kChainSize] = {id, 0, uint32_t(cqe.res)};
+                flow->count++;
+                pair->on_data(side, cqe.res);
+                Send(flow);
+                if (flow->count < kChainSize) {
+                    Receive(flow);
+                }
+            }
+        } else if (cqe.res == -ENOBUFS) {
+            stats_.no_buffers++;
+            if (!pair->done) {
+                starved_.insert(flow);
+            }
+        } else {
+            flow->eof = true;
+            // What was received before the end still goes out first
+            if (cqe.res < 0 || flow->count == 0) {
+                Finish(pair, side, cqe.res < 0 ? cqe.res : UV_EOF);
+            }
+        }
+    } else {
+        flow->sending--;
+        stats_.sends++;
+        auto &chunk = flow->chunks[flow->head];
+        if (cqe.res == -ECANCELED) {
+            // Left for the next chain
+        } else if (cqe.res < 0) {
+            Finish(pair, 1 - side, cqe.res);
+        } else if (uint32_t(cqe.res) < chunk.len) {
+            chunk.offset += cqe.res;
+            chunk.len -= cqe.res;
+        } else {
+            GiveBack(chunk.id);
+            flow->head = (flow->head + 1) % kChainSize;
+            flow->count--;
+        }
+        if (flow->sending == 0 && !pair->done) {
+            if (flow->count > 0) {
+                Send(flow);
+            } else if (flow->eof) {
+                Finish(pair, side, UV_EOF);
+            }
+            if (flow->count < kChainSize) {
+                Receive(flow);
+            }
+        }
+    }
+
+    if (pair->done && pair->ops == 0) {
+        Release(pair);
+    }
+}
+
+// The ring is indexed as an array of its own: in C++ the header's bufs
+// member does not start at offset 0 as it does in C. The resv of the first
+// entry, which the tail shares memory with, is left alone.
+void Uring::GiveBack(uint16_t id) {
+    auto &buf = ((io_uring_buf *)buf_ring_)[buf_tail_ & (buffer_count_ - 1)];
+    buf.addr = uint64_t(buffers_ + size_t(id) * buffer_size_);
+    buf.len = buffer_size_;
+    buf.bid = id;
+    buf_tail_++;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+// Ends a pair: shutting its sockets down completes whatever is in flight
+// for them, after which it is released
+void Uring::Finish(Pair *pair, int side, int error) {
+    if (pair->done) {
+        return;
+    }
+    pair->done = true;
+    pair->side = side;
+    pair->error = error;
+    for (auto &flow : pair->flows) {
+        starved_.erase(&flow);
+        shutdown(flow.from, SHUT_RDWR);
+    }
+}
+
+void Uring::Release(Pair *pair) {
+    for (auto &flow : pair->flows) {
+        for (unsigned i = 0; i < flow.count; i++) {
+            GiveBack(flow.chunks[(flow.head + i) % kChainSize].id);
+        }
+    }
+    pairs_.erase(pair);
+    if (pairs_.empty() && !uv_is_closing(handle())) {
+        uv_poll_stop(&poll_);
+    }
+    auto on_done = std::move(pair->on_done);
+    int side = pair->side, error = pair->error;
+    delete pair;
+    on_done(side, error);
+}
+
+void Uring::Adopt(int first, int second, DataCallback on_data, DoneCallback on_done) {
+    auto pair = new Pair{};
+    pair->flows[0].pair = pair->flows[1].pair = pair;
+    pair->flows[0].from = pair->flows[1].to = first;
+    pair->flows[0].to = pair->flows[1].from = second;
+    pair->on_data = on_data;
+    pair->on_done = on_done;
+    pairs_.insert(pair);
+    if (pairs_.size() == 1) {
+        uv_poll_start(&poll_, UV_READABLE, OnPoll);
+    }
+    stats_.adopted++;
+    Receive(&pair->flows[0]);
+    Receive(&pair->flows[1]);
+    Submit();
+}
+
+void Uring::WriteStatus(JsonWriter &json) {
+    json.BeginObject();
+    json.Field("pairs", pairs_.size());
+    json.Field("adopted", stats_.adopted);
+    json.Field("bytes", stats_.bytes);
+    json.Field("receives", stats_.receives);
+    json.Field("sends", stats_.sends);
+    json.Field("submits", stats_.submits);
+    json.Field("no_buffers", stats_.no_buffers);
+    json.EndObject();
+}
+
+}  // namespace nexer
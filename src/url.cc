@@ -1,5 +1,6 @@
 #include "url.h"
 #include <ctype.h>
+#include <string.h>
 
 size_t DecodeUrlComponent(const char *src, char *dst) {
     size_t len = 0;
@@ -19,56 +20,44 @@ size_t DecodeUrlComponent(const char *src, char *dst) {
     return len;
 }
 
-static void clear(Url &url) {
-    url.scheme.clear();
-    url.host.clear();
-    url.port.clear();
-    url.path.clear();
-    url.query.clear();
-    url.fragment.clear();
-}
+void ParseUrl(Url &url, std::string_view input) {
+    const char *s = input.data();
+    const char *end = s + input.size();
 
-void ParseUrl(Url &url, const char *s) {
-    clear(url);
+    url = {};
 
-    const char *p = strstr(s, "://");
-    if (p) {
-        url.scheme.append(s, p - s);
+    auto scan = [&](const char *stop) {
+        const char *p = s;
+        while (s < end && !strchr(stop, *s)) {
+            s++;
+        }
+        return std::string_view(p, s - p);
+    };
 
-        s = p + 3;
+    auto p = input.find("://");
+    if (p != std::string_view::npos) {
+        url.scheme = input.substr(0, p);
 
-        while (*s && *s != ':' && *s != '/' && *s != '?' && *s != '#') {
-            url.host.push_back(*s++);
-        }
+        s += p + 3;
 
-        if (*s == ':') {
+        url.host = scan(":/?#");
+
+        if (s < end && *s == ':') {
             s++;
-            while (*s && *s != '/' && *s != '?' && *s != '#') {
-                url.port.push_back(*s++);
-            }
+            url.port = scan("/?#");
         }
     }
 
-    if (*s && *s != '/') {
-        url.path.push_back('/');
-    }
-
-    while (*s && *s != '?' && *s != '#') {
-        url.path.push_back(*s++);
-    }
+    url.path = scan("?#");
 
-    if (*s == '?') {
+    if (s < end && *s == '?') {
         s++;
-        while (*s && *s != '#') {
-            url.query.push_back(*s++);
-        }
+        url.query = scan("#");
     }
 
-    if (*s == '#') {
+    if (s < end && *s == '#') {
         s++;
-        while (*s) {
-            url.fragment.push_back(*s++);
-        }
+        url.fragment = std::string_view(s, end - s);
     }
 }
 
@@ -77,41 +66,19 @@ bool operator==(const Url &a, const Url &b) {
            a.fragment == b.fragment;
 }
 
-void ParseQueryString(const std::string &qs, std::function<int(const std::string&, const std::string&)> cb) {
-    const char *p = qs.data();
-    const char *q = qs.data() + qs.size();
-    std::string key, value;
-
-    auto run_cb = [&]() {
+void ParseQueryString(std::string_view qs, std::function<int(std::string_view, std::string_view)> cb) {
+    while (qs.size() > 0) {
+        auto amp = qs.find('&');
+        auto pair = qs.substr(0, amp);
+        auto eq = pair.find('=');
+        auto key = pair.substr(0, eq);
+        auto value = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
         if (key.size() > 0 || value.size() > 0) {
             cb(key, value);
         }
-        key.clear();
-        value.clear();
-    };
-
-    // 0: key, 1: value
-    int state = 0;
-
-    while (p < q) {
-        char c = *p++;
-        if (state == 0) {
-            if (c == '=') {
-                state = 1;
-            } else if (c == '&') {
-                run_cb();
-            } else {
-                key.push_back(c);
-            }
-        } else {
-            if (c == '&') {
-                run_cb();
-                state = 0;
-            } else {
-                value.push_back(c);
-            }
+        if (amp == std::string_view::npos) {
+            break;
         }
+        qs.remove_prefix(amp + 1);
     }
-
-    run_cb();
-}
\ No newline at end of file
+}
@@ -7,6 +7,7 @@ namespace test {
 
 char exename[sizeof exename];
 
+void TestArena();
 void TestProcess();
 void TestProcessManager();
 void TestHttpServer();
@@ -15,22 +16,53 @@ void TestTcpClient();
 void TestTcpProxy();
 void TestTcpServer();
 void TestUdpServer();
+void TestUdpProxy();
 void TestAsyncWork();
 void TestConfig();
+void TestHealthCheck();
+void TestIoBuffer();
+void TestLogRing();
+void TestJsonWriter();
+void TestTimeline();
+void TestShaper();
+void TestProxyHeader();
+void TestRecorder();
+void TestExecutor();
+void TestCoroutine();
 void TestMemoryPool();
+void TestTls();
+void TestUring();
+void TestTunnel();
+void TestUrl();
 
 Task tasks[] = {
+    {"arena", TestArena},
     {"async-work", TestAsyncWork},
     {"config", TestConfig},
+    {"coroutine", TestCoroutine},
+    {"executor", TestExecutor},
+    {"health-check", TestHealthCheck},
     {"http-server", TestHttpServer},
+    {"io-buffer", TestIoBuffer},
+    {"log-ring", TestLogRing},
+    {"json-writer", TestJsonWriter},
+    {"timeline", TestTimeline},
+    {"shaper", TestShaper},
     {"memory-pool", TestMemoryPool},
     {"process", TestProcess},
     {"process-manager", TestProcessManager},
+    {"proxy-header", TestProxyHeader},
+    {"recorder", TestRecorder},
     {"tcp-client", TestTcpClient},
     {"tcp-proxy", TestTcpProxy},
     {"tcp-server", TestTcpServer},
+    {"udp-proxy", TestUdpProxy},
     {"udp-server", TestUdpServer},
     {"timer", TestTimer},
+    {"tls", TestTls},
+    {"uring", TestUring},
+    {"tunnel", TestTunnel},
+    {"url", TestUrl},
     {nullptr, nullptr},
 };
 
@@ -0,0 +1,46 @@
+#include "arena.h"
+#include <assert.h>
+
+namespace nexer {
+namespace test {
+
+static void TestAllocate() {
+    Arena arena(64);
+    char *a = arena.Allocate(16);
+    char *b = arena.Allocate(16);
+    assert(b == a + 16);
+
+    // Larger than a chunk
+    char *c = arena.Allocate(100);
+    assert(c);
+    memset(c, 'x', 100);
+
+    arena.Reset();
+    assert(arena.Allocate(16) == a);
+}
+
+static void TestAppend() {
+    Arena arena(64);
+    auto view = arena.Copy("abc", 3);
+    view = arena.Append(view, "def", 3);
+    assert(view == "abcdef");
+
+    // Grows in place while the view is the last allocation
+    auto other = arena.Copy("x", 1);
+    assert(other.data() == view.data() + view.size());
+    auto moved = arena.Append(view, "g", 1);
+    assert(moved == "abcdefg");
+    assert(moved.data() != view.data());
+
+    std::string_view external("hello");
+    auto joined = arena.Append(external, " world", 6);
+    assert(joined == "hello world");
+}
+
+void TestArena() {
+    TestAllocate();
+    TestAppend();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -6,6 +6,56 @@
 namespace nexer {
 namespace test {
 
+// On an executor, work not started yet can be cancelled
+static void test_executor() {
+    EventLoop loop;
+    Executor executor(1);
+    auto& queue = WorkQueue::Create(loop, executor);
+
+    int executed = 0;
+    std::vector<int> statuses;
+
+    AsyncWork first(queue);
+    AsyncWork second(queue, Executor::Priority::Low);
+    for (auto work : {&first, &second}) {
+        work->OnEnd([&](int status) {
+            statuses.push_back(status);
+        });
+    }
+
+    first.Start([&] {
+        executed++;
+        uv_sleep(100);
+    });
+    second.Start([&] {
+        executed++;
+    });
+    assert(second.Cancel());
+
+    loop.Run();
+
+    assert(executed == 1);
+    assert(statuses.size() == 2);
+    assert(statuses[0] == UV_ECANCELED);
+    assert(statuses[1] == 0);
+    queue.Close();
+    loop.Run();
+}
+
+// A loop runs its work on the executor it was given
+static void test_set_executor() {
+    Executor executor(2);
+    EventLoop loop;
+    loop.SetExecutor(executor);
+
+    AsyncWork work(loop);
+    work.Start([] {});
+    loop.Run();
+
+    assert(&loop.work_queue().executor() == &executor);
+    assert(executor.threads() == 2 && executor.GetStats().completed == 1);
+}
+
 void TestAsyncWork() {
     EventLoop loop;
 
@@ -30,6 +80,11 @@ void TestAsyncWork() {
     assert(executed == 1);
     assert(finished == 1);
     assert(error == 0);
+    // Through the loop's queue rather than libuv's pool
+    assert(loop.work_queue().executor().GetStats().completed >= 1);
+
+    test_executor();
+    test_set_executor();
 }
 
 }  // namespace test
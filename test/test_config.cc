@@ -86,6 +86,288 @@ static void TestParseUpstream() {
     // assert(proxy.upstream.command->args == std::vector<std::string>({"-x", "1", "-1"}));
 }
 
+static void TestParsePortRange() {
+    std::string code = R"json({
+          proxies: [
+            { listen: "10000-10999", upstream: { port: 20000 } },
+            { listen: "11000-11001", upstream: { port: "21000-21001" } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto &proxies = config.proxies();
+    assert(proxies[0].port == 10000);
+    assert(proxies[0].port_count == 1000);
+    assert(proxies[0].upstream.port == 20000);
+    assert(proxies[0].upstream.port_count == 1000);
+    assert(proxies[1].upstream.port == 21000);
+    assert(proxies[1].upstream.port_count == 2);
+
+    for (auto bad : {R"({ proxies: [{ listen: "11000-11001", upstream: { port: "21000-21002" } }] })",
+                     R"({ proxies: [{ listen: "11001-11000" }] })",
+                     R"({ proxies: [{ listen: "11000-11001", protocol: udp }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseAddress() {
+    std::string code = R"json({
+          proxies: [
+            { listen: "127.0.0.1:10000", upstream: { address: "unix:/tmp/app.sock" } },
+            { listen: "[::1]:10001-10002", upstream: { address: "[::1]:20001" } },
+            { listen: "unix:/tmp/proxy.sock", upstream: { address: "localhost:20000" } },
+            { listen: "127.0.0.1:10003", protocol: udp, upstream: { port: 20003 } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto &proxies = config.proxies();
+    assert(proxies[0].host == "127.0.0.1" && proxies[0].port == 10000);
+    assert(proxies[0].upstream.path == "/tmp/app.sock");
+    assert(proxies[1].host == "::1" && proxies[1].port == 10001 && proxies[1].port_count == 2);
+    assert(proxies[1].upstream.host == "::1" && proxies[1].upstream.port == 20001);
+    assert(proxies[2].path == "/tmp/proxy.sock");
+    assert(proxies[2].upstream.host == "localhost" && proxies[2].upstream.port == 20000);
+    assert(proxies[3].host == "127.0.0.1" && proxies[3].port == 10003);
+
+    for (auto bad : {R"({ proxies: [{ listen: "::1:10000" }] })",
+                     R"({ proxies: [{ listen: "[::1]10000" }] })",
+                     R"({ proxies: [{ listen: "unix:" }] })",
+                     R"({ proxies: [{ listen: "localhost:10000", upstream: { port: 20000 } }] })",
+                     R"({ proxies: [{ listen: "unix:/tmp/proxy.sock", protocol: udp }] })",
+                     R"({ proxies: [{ listen: "10000-10001", upstream: { address: "unix:/tmp/app.sock" } }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseProxyProtocol() {
+    std::string code = R"json({
+          proxies: [
+            { listen: 10000, accept_proxy_protocol: true, upstream: { port: 20000, proxy_protocol: 2 } },
+            { listen: 10001, accept_proxy_protocol: true, proxy_header_timeout: 1000, upstream: { port: 20001 } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    assert(config.proxies()[0].accept_proxy_protocol);
+    assert(config.proxies()[0].proxy_header_timeout == 5000);
+    assert(config.proxies()[0].upstream.proxy_protocol == 2);
+    assert(config.proxies()[1].proxy_header_timeout == 1000);
+
+    for (auto bad : {R"({ proxies: [{ listen: 10000, upstream: { port: 20000, proxy_protocol: 3 } }] })",
+                     R"({ proxies: [{ listen: 10000, protocol: udp, accept_proxy_protocol: true }] })",
+                     R"({ proxies: [{ listen: 10000, proxy_header_timeout: 0, upstream: { port: 20000 } }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseTls() {
+    std::string code = R"json({
+          proxies: [
+            { listen: 10000, tls: { cert: "/tmp/cert.pem", key: "/tmp/key.pem", ktls: false },
+              upstream: { host: "app.local", port: 20000, tls: true } },
+            { listen: 10001, upstream: { port: 20001, tls: { ca: "/tmp/ca.pem", server_name: "api.local" } } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto &proxies = config.proxies();
+    assert(proxies[0].tls.enabled && proxies[0].tls.cert == "/tmp/cert.pem" && !proxies[0].tls.ktls);
+    assert(proxies[0].upstream.tls.enabled && proxies[0].upstream.tls.verify);
+    assert(proxies[0].upstream.tls.server_name == "app.local");
+    assert(!proxies[1].tls.enabled);
+    assert(proxies[1].upstream.tls.ca == "/tmp/ca.pem" && proxies[1].upstream.tls.server_name == "api.local");
+
+    for (auto bad : {R"({ proxies: [{ listen: 10000, tls: true, upstream: { port: 20000 } }] })",
+                     R"({ proxies: [{ listen: 10000, protocol: udp, upstream: { port: 20000, tls: true } }] })",
+                     R"({ proxies: [{ listen: 10000, upstream: { port: 20000, tls: { sni: "a" } } }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseMirror() {
+    std::string code = R"json({
+          proxies: [
+            { listen: 10000, upstream: { port: 20000, mirror: "10.0.0.2:5432" } },
+            { listen: 10001, upstream: { port: 20001, mirror: { port: 30001, sample: 10, max_pending: 4096 } } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto &first = config.proxies()[0].upstream.mirror;
+    assert(first.enabled() && first.host == "10.0.0.2" && first.port == 5432 && first.sample == 100);
+    auto &second = config.proxies()[1].upstream.mirror;
+    assert(second.host == "127.0.0.1" && second.port == 30001);
+    assert(second.sample == 10 && second.max_pending == 4096);
+
+    for (auto bad : {R"({ proxies: [{ listen: 10000, upstream: { port: 20000, mirror: "30000-30001" } }] })",
+                     R"({ proxies: [{ listen: 10000, upstream: { port: 20000, mirror: { sample: 10 } } }] })",
+                     R"({ proxies: [{ listen: 10000, upstream: { port: 20000, mirror: { port: 1, sample: 101 } } }] })",
+                     R"({ proxies: [{ listen: 10000, protocol: udp, upstream: { port: 20000, mirror: 30000 } }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseRecord() {
+    std::string code = R"json({
+          proxies: [
+            { listen: 10000, record: "/tmp/db.rec", upstream: { port: 20000 } },
+            { listen: 10001, record: { file: "/tmp/api.rec", buffer_size: 65536 }, upstream: { port: 20001 } },
+            { listen: 10002, upstream: { port: 20002 } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto &proxies = config.proxies();
+    assert(proxies[0].record.file == "/tmp/db.rec" && proxies[0].record.buffer_size == 4 << 20);
+    assert(proxies[1].record.file == "/tmp/api.rec" && proxies[1].record.buffer_size == 65536);
+    assert(proxies[2].record.file.empty());
+
+    for (auto bad : {R"({ proxies: [{ listen: 10000, record: { buffer_size: 65536 }, upstream: { port: 20000 } }] })",
+                     R"({ proxies: [{ listen: 10000, record: { file: "/tmp/a.rec", buffer_size: 1 }, upstream: { port: 20000 } }] })",
+                     R"({ proxies: [{ listen: 10000, protocol: udp, record: "/tmp/a.rec", upstream: { port: 20000 } }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseUring() {
+    Config config;
+    assert(Config::Parse(config, "{}") && !config.uring().enabled);
+    assert(Config::Parse(config, "{ io_uring: true }") && config.uring().enabled);
+    assert(config.uring().entries == 4096 && config.uring().buffers == 4096);
+
+    Config custom;
+    assert(Config::Parse(custom, "{ io_uring: { entries: 256, buffers: 1024, buffer_size: 65536 } }"));
+    auto &uring = custom.uring();
+    assert(uring.enabled && uring.entries == 256 && uring.buffers == 1024 && uring.buffer_size == 65536);
+
+    for (auto bad : {"{ io_uring: { entries: 0 } }", "{ io_uring: { buffers: 1000 } }",
+                     "{ io_uring: { buffer_size: 512 } }", "{ io_uring: { depth: 8 } }"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseTunnel() {
+    std::string code = R"json({
+          tunnel: { listen: "0.0.0.0:7000", allow: [3306, 6379], connect_timeout: 1000, secret: s3cret },
+          proxies: [
+            { listen: 10000,
+              upstream: { host: "nexer://db.example.com:7000", port: 3306, priority: 0, tunnel_secret: other } },
+            { listen: "10001-10002", upstream: { host: "nexer://[::1]:7000", port: 6379 } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto &tunnel = config.tunnel();
+    assert(tunnel.host == "0.0.0.0" && tunnel.port == 7000 && tunnel.connect_timeout == 1000);
+    assert(tunnel.secret == "s3cret");
+    assert(tunnel.allow.size() == 2 && tunnel.allow[1] == 6379);
+    auto &proxies = config.proxies();
+    assert(proxies[0].upstream.tunnel_host == "db.example.com" && proxies[0].upstream.tunnel_port == 7000);
+    assert(proxies[0].upstream.port == 3306 && proxies[0].upstream.priority == 0);
+    assert(proxies[0].upstream.tunnel_secret == "other");
+    assert(proxies[1].upstream.tunnel_host == "::1" && proxies[1].upstream.priority == 4);
+    assert(proxies[1].upstream.tunnel_secret.empty());
+
+    // Only loopback addresses without a secret
+    for (auto good : {R"({ tunnel: { listen: 7000, allow: [1] } })", R"({ tunnel: { listen: "[::1]:7000", allow: [1] } })",
+                      R"({ tunnel: { listen: "127.0.0.2:7000", allow: [1] } })"}) {
+        Config config;
+        assert(Config::Parse(config, good));
+        assert(config.tunnel().secret.empty());
+    }
+    assert(proxies[1].upstream.port_count == 2);
+
+    for (auto bad : {R"({ tunnel: { listen: 7000 } })",
+                     R"({ tunnel: { listen: 7000, allow: [0] } })",
+                     R"({ tunnel: { listen: "0.0.0.0:7000", allow: [1] } })",
+                     R"({ tunnel: { listen: "[::]:7000", allow: [1] } })",
+                     R"({ tunnel: { listen: "localhost:7000", allow: [1] } })",
+                     R"({ tunnel: { listen: 7000, allow: [1], secret: "" } })",
+                     R"({ proxies: [{ listen: 10000, upstream: { port: 3306, tunnel_secret: s3cret } }] })",
+                     R"({ proxies: [{ listen: 10000, upstream: { host: "nexer://remote", port: 3306 } }] })",
+                     R"({ proxies: [{ listen: 10000, upstream: { host: "nexer://remote:7000", port: 1, priority: 8 } }] })",
+                     R"({ proxies: [{ listen: 10000, upstream: { host: "nexer://remote:7000", port: 1, tls: true } }] })",
+                     R"({ proxies: [{ listen: 10000, protocol: udp, upstream: { host: "nexer://remote:7000", port: 1 } }] })"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseIdleStop() {
+    std::string code = R"json({
+          apps: [
+            { name: tunnel, command: { file: ssh }, idle_stop_after: 600000, stop_timeout: 2000 },
+            { name: docker, command: { file: docker } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    auto tunnel = config.GetApp("tunnel");
+    assert(tunnel->idle_stop_after == 600000 && tunnel->stop_timeout == 2000);
+    auto docker = config.GetApp("docker");
+    assert(docker->idle_stop_after == 0 && docker->stop_timeout == 5000);
+
+    Config bad;
+    assert(!Config::Parse(bad, "{ apps: [{ name: a, command: { file: a }, idle_stop_after: soon }] }"));
+}
+
+static void TestParseWarm() {
+    std::string code = R"json({
+          warm_concurrency: 2,
+          apps: [
+            { name: login, command: { file: aws }, warm: true },
+            { name: tunnel, command: { file: ssh }, preamble: [login] },
+          ],
+          proxies: [
+            { listen: 10000, warm: true, upstream: { port: 3306, app: tunnel } },
+            { listen: 10001, upstream: { port: 3307, app: tunnel } },
+          ]
+        })json";
+
+    Config config;
+    assert(Config::Parse(config, code));
+    assert(config.warm_concurrency() == 2);
+    assert(config.GetApp("login")->warm && !config.GetApp("tunnel")->warm);
+    assert(config.proxies()[0].warm && !config.proxies()[1].warm);
+
+    Config defaults;
+    assert(Config::Parse(defaults, "{}") && defaults.warm_concurrency() == 4);
+
+    for (auto bad : {"{ warm_concurrency: 0 }", "{ proxies: [{ listen: 10000, warm: true, upstream: { port: 1 } }] }"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
+static void TestParseExecutor() {
+    Config config;
+    assert(Config::Parse(config, "{ executor_threads: 8 }") && config.executor_threads() == 8);
+
+    Config defaults;
+    assert(Config::Parse(defaults, "{}") && defaults.executor_threads() == 4);
+
+    for (auto bad : {"{ executor_threads: 0 }", "{ executor_threads: many }"}) {
+        Config config;
+        assert(!Config::Parse(config, bad));
+    }
+}
+
 static void TestApps() {
     Config config;
     assert(Config::ParseFile(config, "./test/configs/apps.conf"));
@@ -96,6 +378,17 @@ static void TestApps() {
 void TestConfig() {
     TestParseEmpty();
     TestParseAdmin();
+    TestParsePortRange();
+    TestParseAddress();
+    TestParseProxyProtocol();
+    TestParseTls();
+    TestParseMirror();
+    TestParseRecord();
+    TestParseUring();
+    TestParseTunnel();
+    TestParseIdleStop();
+    TestParseWarm();
+    TestParseExecutor();
     TestParseUpstream();
     TestApps();
 }
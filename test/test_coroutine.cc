@@ -0,0 +1,110 @@
+#include <assert.h>
+
+#include <string>
+
+#include "coroutine.h"
+#include "runner.h"
+#include "tcp_forwarder.h"
+#include "tcp_server.h"
+
+namespace nexer {
+namespace test {
+
+static nexer::Task sleep_twice(EventLoop& loop, std::string& trace) {
+    trace += "start ";
+    co_await Sleep{loop, 10};
+    trace += "slept ";
+    co_await Sleep{loop, 10};
+    trace += "done";
+}
+
+static void test_sleep() {
+    EventLoop loop;
+    std::string trace;
+    sleep_twice(loop, trace);
+    // Runs up to the first co_await right away
+    assert(trace == "start ");
+    loop.Run();
+    assert(trace == "start slept done");
+}
+
+static nexer::Task echo(EventLoop& loop, TcpServer& server, std::string& reply) {
+    auto client = co_await Connect{loop, "127.0.0.1", 19540, 1000};
+    assert(client);
+    for (auto message : {"hello", "world"}) {
+        int error = co_await Write{*client, message, strlen(message)};
+        assert(error == 0);
+        reply += co_await Read{*client};
+    }
+    client->Close();
+    // Empty once closed
+    assert((co_await Read{*client}).empty());
+    server.Close();
+}
+
+static void test_tcp() {
+    EventLoop loop;
+    auto& server = TcpServer::Create(loop);
+    server.OnConnection([](TcpClient& client) {
+        TcpForwarder::Create(client, client);
+    });
+    assert(server.Listen(19540));
+
+    std::string reply;
+    echo(loop, server, reply);
+    loop.Run();
+    assert(reply == "helloworld");
+}
+
+static nexer::Task wait_exit(Process& process, int64_t& code) {
+    code = -1;
+    code = co_await WaitExit{process};
+}
+
+static void test_wait_exit() {
+    EventLoop loop;
+    auto& process = Process::Create(loop, exename);
+    process.PushArg("helper");
+    process.PushArg("hello");
+    process.Start();
+
+    int64_t code, again = -1;
+    wait_exit(process, code);
+    assert(code == -1);
+    // Not running any more, while the process is still there: no suspension
+    // at all
+    process.OnExit([&](int64_t, int) {
+        wait_exit(process, again);
+        assert(again == 0);
+    });
+    loop.Run();
+    assert(code == 0 && again == 0);
+}
+
+// Functions removed while the list is invoked are skipped and erased after
+static void test_remove_while_invoking() {
+    FunctionList<void> list;
+    int calls = 0;
+    FunctionList<void>::Remove second;
+    auto first = list.Add([&] {
+        calls++;
+        second();
+    });
+    second = list.Add([&] {
+        calls += 10;
+    });
+    list.Invoke();
+    assert(calls == 1);
+    first();
+    assert(list.empty());
+}
+
+void TestCoroutine() {
+    test_sleep();
+    test_tcp();
+    test_wait_exit();
+    test_remove_while_invoking();
+}
+
+}  // namespace test
+}  // namespace nexer
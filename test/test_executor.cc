@@ -0,0 +1,147 @@
+#include <assert.h>
+
+#include <atomic>
+#include <string>
+
+#include "executor.h"
+
+namespace nexer {
+namespace test {
+
+// Keeps the only thread of an executor busy until released
+struct Blocker {
+    Executor::Job job;
+    std::atomic<bool> started{false};
+    std::atomic<bool> released{false};
+
+    Blocker() {
+        job.work = [this] {
+            started = true;
+            while (!released) {
+                uv_sleep(1);
+            }
+        };
+    }
+
+    void Submit(WorkQueue &queue) {
+        queue.Submit(job);
+        while (!started) {
+            uv_sleep(1);
+        }
+    }
+};
+
+static void test_priorities() {
+    EventLoop loop;
+    Executor executor(1);
+    auto &queue = WorkQueue::Create(loop, executor);
+
+    Blocker blocker;
+    blocker.Submit(queue);
+
+    std::string order;
+    Executor::Job jobs[3];
+    const char *names[] = {"low ", "normal ", "high "};
+    Executor::Priority priorities[] = {Executor::Priority::Low, Executor::Priority::Normal, Executor::Priority::High};
+    int ended = 0;
+    for (int i = 0; i < 3; i++) {
+        jobs[i].priority = priorities[i];
+        jobs[i].work = [&order, name = names[i]] {
+            order += name;
+        };
+        jobs[i].on_end = [&](int status) {
+            assert(status == 0);
+            ended++;
+        };
+    }
+    queue.Submit({&jobs[0], &jobs[1], &jobs[2]});
+    assert(executor.GetStats().queued == 3);
+    blocker.released = true;
+
+    loop.Run();
+
+    assert(ended == 3);
+    assert(order == "high normal low ");
+    queue.Close();
+    loop.Run();
+}
+
+static void test_cancel() {
+    EventLoop loop;
+    Executor executor(1);
+    auto &queue = WorkQueue::Create(loop, executor);
+
+    Blocker blocker;
+    blocker.Submit(queue);
+
+    bool ran = false;
+    int status = 0;
+    Executor::Job job;
+    job.work = [&] {
+        ran = true;
+    };
+    job.on_end = [&](int error) {
+        status = error;
+    };
+    queue.Submit(job);
+
+    assert(!queue.Cancel(blocker.job));
+    assert(queue.Cancel(job));
+    assert(!queue.Cancel(job));
+    blocker.released = true;
+
+    loop.Run();
+
+    assert(!ran);
+    assert(status == UV_ECANCELED);
+    auto stats = executor.GetStats();
+    assert(stats.cancelled == 1);
+    assert(stats.completed == 1);
+    assert(stats.queued == 0);
+    queue.Close();
+    loop.Run();
+}
+
+// A long job holds up one thread; the jobs queued behind it are taken by
+// the others instead of waiting
+static void test_stealing() {
+    EventLoop loop;
+    Executor executor(4);
+    auto &queue = WorkQueue::Create(loop, executor);
+
+    const int n = 40;
+    std::vector<Executor::Job> jobs(n);
+    std::vector<Executor::Job *> batch;
+    int ended = 0;
+    for (int i = 0; i < n; i++) {
+        jobs[i].work = [i] {
+            uv_sleep(i == 0 ? 300 : 10);
+        };
+        jobs[i].on_end = [&](int) {
+            ended++;
+        };
+        batch.push_back(&jobs[i]);
+    }
+
+    auto start = uv_hrtime();
+    queue.Submit(batch);
+    loop.Run();
+    auto elapsed = (uv_hrtime() - start) / 1000000;
+
+    assert(ended == n);
+    assert(elapsed < 380);
+    auto stats = executor.GetStats();
+    assert(stats.completed == n);
+    assert(stats.max_run >= 300000);
+    queue.Close();
+    loop.Run();
+}
+
+void TestExecutor() {
+    test_priorities();
+    test_cancel();
+    test_stealing();
+}
+
+}  // namespace test
+}  // namespace nexer
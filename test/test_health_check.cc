@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <unistd.h>
+
+#include "health_check.h"
+#include "http_server.h"
+#include "tcp_server.h"
+
+#define TEST_PORT 19011
+#define TEST_SOCKET "/tmp/nexer-health-check.sock"
+
+namespace nexer {
+namespace test {
+
+static void test_tcp() {
+    EventLoop loop;
+    TcpServer &server = TcpServer::Create(loop);
+
+    server.OnConnection([](TcpClient &client) {
+        client.Close();
+    });
+    assert(server.Listen(TEST_PORT));
+
+    config::Checker checker;
+    checker.type = config::Checker::Type::Tcp;
+    checker.port = TEST_PORT;
+    checker.timeout = 1000;
+
+    int result = 1;
+    HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+        result = error;
+        server.Close();
+    }));
+    loop.Run();
+    assert(result == 0);
+
+    HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+        result = error;
+    }));
+    loop.Run();
+    assert(result == UV_ECONNREFUSED);
+}
+
+static void test_http() {
+    EventLoop loop;
+    http::Server &server = http::Server::Create(loop);
+
+    server.OnRequest([](http::incoming::Request &req, http::outgoing::Response &res) {
+        res.body() << "ok";
+        res.End(req.url().path == "/health" ? 200 : 503);
+    });
+    assert(server.Listen(TEST_PORT));
+
+    config::Checker checker;
+    checker.type = config::Checker::Type::Http;
+    checker.port = TEST_PORT;
+    checker.path = "/health";
+    checker.timeout = 1000;
+
+    int healthy = 1;
+    int unhealthy = 0;
+    HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+        healthy = error;
+        checker.path = "/down";
+        HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+            unhealthy = error;
+            server.Close();
+        }));
+    }));
+    loop.Run();
+
+    assert(healthy == 0);
+    assert(unhealthy == 503);
+}
+
+// A server that accepts but never answers
+static void test_timeout() {
+    EventLoop loop;
+    TcpServer &server = TcpServer::Create(loop);
+    TcpClient *accepted = nullptr;
+
+    server.OnConnection([&](TcpClient &client) {
+        accepted = &client;
+    });
+    assert(server.Listen(TEST_PORT));
+
+    config::Checker checker;
+    checker.type = config::Checker::Type::Http;
+    checker.port = TEST_PORT;
+    checker.path = "/";
+    checker.timeout = 200;
+
+    int result = 0;
+    HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+        result = error;
+        if (accepted) {
+            accepted->Close();
+        }
+        server.Close();
+    }));
+    loop.Run();
+
+    assert(result == UV_ETIMEDOUT);
+}
+
+static void test_unix() {
+    EventLoop loop;
+
+    unlink(TEST_SOCKET);
+
+    config::Checker checker;
+    checker.type = config::Checker::Type::Unix;
+    checker.path = TEST_SOCKET;
+    checker.timeout = 1000;
+
+    int result = 0;
+    HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+        result = error;
+    }));
+    loop.Run();
+    assert(result == UV_ECONNREFUSED);
+
+    uv_pipe_t server;
+    uv_pipe_init(loop, &server, 0);
+    assert(uv_pipe_bind(&server, TEST_SOCKET) == 0);
+    assert(uv_listen((uv_stream_t *)&server, 8, [](uv_stream_t *, int) {}) == 0);
+
+    result = 1;
+    HealthCheck::Run(loop, checker, Then<int>([&](int error) {
+        result = error;
+        uv_close((uv_handle_t *)&server, nullptr);
+    }));
+    loop.Run();
+    assert(result == 0);
+
+    unlink(TEST_SOCKET);
+}
+
+void TestHealthCheck() {
+    test_tcp();
+    test_http();
+    test_timeout();
+    test_unix();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -45,7 +45,113 @@ static void make_keep_alive_requests() {
     assert(res->body() == "Hello");
 }
 
+// Tokens split across reads must survive the read buffer being reused
+static void test_split_request() {
+    EventLoop loop;
+    http::Server& server = http::Server::Create(loop);
+    TcpClient& client = TcpClient::Create(loop);
+
+    http::incoming::Request request(server, client);
+    const char* parts[] = {"GET /pa", "th?a=1&b=2 HTTP/1.1\r\nHo", "st: exa", "mple.com\r\nX-Empty:\r\n\r\n"};
+
+    char buf[64];
+    for (auto part : parts) {
+        size_t len = strlen(part);
+        memcpy(buf, part, len);
+        assert(request.Parse(buf, len) == HPE_OK);
+        memset(buf, '#', sizeof buf);
+    }
+
+    assert(request.IsComplete());
+    assert(request.url().path == "/path");
+    assert(request.url().query == "a=1&b=2");
+    assert(request.GetHeader("host") == "example.com");
+    assert(request.headers().size() == 2);
+
+    std::string query;
+    ParseQueryString(request.url().query, [&](std::string_view key, std::string_view value) {
+        query.append(key).append(":").append(value).append(";");
+        return 0;
+    });
+    assert(query == "a:1;b:2;");
+
+    client.Close();
+    server.Close();
+    loop.Run();
+}
+
+// Views of a complete message outlive the buffer it was read from, as
+// handlers answering later (logs, status) rely on
+static void test_pinned_request() {
+    EventLoop loop;
+    http::Server& server = http::Server::Create(loop);
+    TcpClient& client = TcpClient::Create(loop);
+
+    http::incoming::Request request(server, client);
+    char buf[] = "GET /apps/a/logs?tail=5 HTTP/1.1\r\nHost: example.com\r\n\r\n";
+    assert(request.Parse(buf, strlen(buf)) == HPE_OK);
+    assert(request.IsComplete());
+    memset(buf, '#', sizeof buf - 1);
+
+    assert(request.url().path == "/apps/a/logs");
+    assert(request.url().query == "tail=5");
+    assert(request.url_string() == "/apps/a/logs?tail=5");
+    assert(request.GetHeader("host") == "example.com");
+
+    client.Close();
+    server.Close();
+    loop.Run();
+}
+
+// A request after a streamed response closes the connection instead of
+// taking over the response the handler is still writing to
+static void test_request_while_streaming() {
+    EventLoop loop;
+    http::Server& server = http::Server::Create(loop);
+
+    int requests = 0;
+    server.OnRequest([&](http::incoming::Request& req, http::outgoing::Response& res) {
+        requests++;
+        res.SetHeader("Connection", "close");
+        res.body() << "line\n";
+        res.Begin(200);
+    });
+    assert(server.Listen(PORT));
+
+    TcpClient& client = TcpClient::Create(loop);
+    std::string received;
+    bool closed = false;
+    client.OnConnect([&] {
+        const char* req = "GET /follow HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        client.Write(req, strlen(req));
+    });
+    client.OnData([&](const char* s, size_t len) {
+        bool first = received.empty();
+        received.append(s, len);
+        if (first) {
+            const char* req = "GET /other HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            client.Write(req, strlen(req));
+        }
+    });
+    client.OnClose([&] {
+        closed = true;
+        server.Close();
+    });
+    client.Connect(PORT);
+
+    loop.Run();
+
+    assert(closed);
+    assert(requests == 1);
+    assert(received.find("Connection: close\r\n") != std::string::npos);
+    assert(received.find("line\n") != std::string::npos);
+}
+
 void TestHttpServer() {
+    test_split_request();
+    test_pinned_request();
+    test_request_while_streaming();
+
     std::thread t1(test_keep_alive);
     make_keep_alive_requests();
     t1.join();
@@ -0,0 +1,95 @@
+#include "io_buffer.h"
+#include <assert.h>
+#include <string.h>
+
+namespace nexer {
+namespace test {
+
+static void TestWrite() {
+    IoBuffer buffer(8);
+    buffer << "Hello" << ", " << 42;
+    assert(buffer.size() == 9);
+    assert(buffer == "Hello, 42");
+    assert(buffer.segments() == 2);
+
+    uv_buf_t bufs[4];
+    assert(buffer.Export(bufs, 4) == 2);
+    assert(bufs[0].len == 8 && bufs[1].len == 1);
+
+    buffer.Prepend("> ", 2);
+    assert(buffer == "> Hello, 42");
+
+    buffer.Consume(3);
+    assert(buffer == "ello, 42");
+    buffer.Prepend("h", 1);
+    assert(buffer == "hello, 42");
+
+    buffer.Clear();
+    assert(buffer.empty());
+    buffer.Write("abc", 3);
+    assert(buffer.ToString() == "abc");
+}
+
+static void TestSplit() {
+    IoBuffer buffer(8);
+    buffer << "0123456789";
+
+    IoBuffer head;
+    buffer.Split(4, head);
+    assert(head == "0123");
+    assert(buffer == "456789");
+
+    // The shared segment must not be overwritten by either side
+    head << "x";
+    buffer << "y";
+    assert(head == "0123x");
+    assert(buffer == "456789y");
+
+    IoBuffer all;
+    all.Append(head);
+    all.Append(buffer);
+    assert(all == "0123x456789y");
+    assert(head.empty() && buffer.empty());
+
+    char data[16];
+    size_t n = all.CopyTo(data, sizeof(data));
+    assert(n == 12 && memcmp(data, "0123x456789y", 12) == 0);
+}
+
+static void TestClone() {
+    IoBuffer buffer;
+    buffer << "shared";
+
+    IoBuffer copy;
+    copy.Clone(buffer);
+    buffer.Consume(3);
+    buffer << "!";
+    assert(buffer == "red!");
+    assert(copy == "shared");
+}
+
+static void TestReserve() {
+    IoBuffer buffer(16);
+    uv_buf_t buf = buffer.Reserve(10);
+    assert(buf.len >= 10);
+    memcpy(buf.base, "abc", 3);
+    buffer.Commit(3);
+    assert(buffer == "abc");
+
+    // The emptied segment is handed out again
+    buffer.Clear();
+    uv_buf_t again = buffer.Reserve(10);
+    assert(again.base == buf.base);
+    buffer.Commit(0);
+    assert(buffer.empty());
+}
+
+void TestIoBuffer() {
+    TestWrite();
+    TestSplit();
+    TestClone();
+    TestReserve();
+}
+
+}  // namespace test
+}  // namespace nexer
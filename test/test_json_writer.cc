@@ -0,0 +1,54 @@
+#include <assert.h>
+
+#include <sstream>
+
+#include "json_writer.h"
+
+namespace nexer {
+namespace test {
+
+static void test_nesting() {
+    std::stringstream ss;
+    JsonWriter json(ss);
+
+    json.BeginObject();
+    json.Field("name", "a\"b\n");
+    json.Field("count", 3);
+    json.Field("ok", true);
+    json.Key("items").BeginArray();
+    json.Value(uint64_t(1)).Value(int64_t(-2)).Null();
+    json.BeginObject().EndObject();
+    json.EndArray();
+    json.Key("empty").BeginArray().EndArray();
+    assert(json.depth() == 1);
+    json.EndObject();
+
+    assert(json.depth() == 0);
+    assert(ss.str() == R"({"name":"a\"b\u000a","count":3,"ok":true,"items":[1,-2,null,{}],"empty":[]})");
+}
+
+// Separators come out right when the output is taken away between pieces
+static void test_pieces() {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    std::string output;
+
+    json.BeginArray();
+    for (int i = 0; i < 3; i++) {
+        json.BeginObject().Field("i", i).EndObject();
+        output += ss.str();
+        ss.str("");
+    }
+    json.EndArray();
+    output += ss.str();
+
+    assert(output == R"([{"i":0},{"i":1},{"i":2}])");
+}
+
+void TestJsonWriter() {
+    test_nesting();
+    test_pieces();
+}
+
+}  // namespace test
+}  // namespace nexer
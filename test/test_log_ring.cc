@@ -0,0 +1,106 @@
+#include <assert.h>
+
+#include <string>
+#include <vector>
+
+#include "log_ring.h"
+
+namespace nexer {
+namespace test {
+
+static std::vector<std::string> tail(const LogRing &ring, size_t n) {
+    std::vector<std::string> lines;
+    ring.Tail(n, [&](const LogRing::Line &line) {
+        lines.emplace_back(line.text);
+    });
+    return lines;
+}
+
+static void test_lines() {
+    LogRing ring(1024);
+
+    ring.Write(1, "hello\nwor", 9);
+    assert(ring.size() == 1);
+
+    ring.Write(1, "ld\r\n", 4);
+    ring.Write(2, "error\n\n", 7);
+    assert(ring.size() == 4);
+
+    auto lines = tail(ring, 10);
+    assert(lines == std::vector<std::string>({"hello", "world", "error", ""}));
+
+    lines = tail(ring, 2);
+    assert(lines == std::vector<std::string>({"error", ""}));
+
+    ring.Write(1, "partial", 7);
+    assert(ring.size() == 4);
+    ring.Flush();
+    assert(tail(ring, 1) == std::vector<std::string>({"partial"}));
+}
+
+static void test_wrap() {
+    LogRing ring(32);
+
+    // 8 bytes per line with the newline, 4 lines fit
+    for (int i = 0; i < 10; i++) {
+        char line[16];
+        int n = snprintf(line, sizeof line, "line-%02d\n", i);
+        ring.Write(1, line, n);
+    }
+
+    assert(ring.size() == 4);
+    assert(ring.dropped() == 6);
+    assert(tail(ring, 10) == std::vector<std::string>({"line-06", "line-07", "line-08", "line-09"}));
+
+    // Does not fit at the end, so lines at the start make room for it
+    ring.Write(1, "abc\n", 4);
+    assert(tail(ring, 10) == std::vector<std::string>({"line-07", "line-08", "line-09", "abc"}));
+
+    uint64_t last_seq = 0;
+    ring.Tail(1, [&](const LogRing::Line &line) {
+        last_seq = line.seq;
+    });
+    assert(last_seq == 10);
+}
+
+static void test_long_line() {
+    LogRing ring(64);
+
+    std::string text(40, 'x');
+    ring.Write(1, text.data(), text.size());
+
+    // Split into pieces of a quarter of the capacity
+    auto lines = tail(ring, 10);
+    assert(lines.size() == 3);
+    assert(lines[0] == std::string(16, 'x'));
+    assert(lines[2] == std::string(8, 'x'));
+}
+
+static void test_follow() {
+    LogRing ring(1024);
+    std::vector<std::string> lines;
+
+    auto unsubscribe = ring.OnLine([&](const LogRing::Line &line) {
+        assert(line.fd == 2);
+        lines.emplace_back(line.text);
+    });
+
+    ring.Write(2, "a\nb", 3);
+    assert(lines == std::vector<std::string>({"a"}));
+    ring.Write(2, "\n", 1);
+    assert(lines == std::vector<std::string>({"a", "b"}));
+
+    unsubscribe();
+    ring.Write(2, "c\n", 2);
+    assert(lines.size() == 2);
+}
+
+void TestLogRing() {
+    test_lines();
+    test_wrap();
+    test_long_line();
+    test_follow();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -1,11 +1,16 @@
 #include <assert.h>
+#include <signal.h>
+#include <sys/wait.h>
 
+#include <fstream>
 #include <string>
 #include <thread>
 
 #include "process.h"
+#include "spawn_helper.h"
 #include "runner.h"
 #include "logger.h"
+#include "timer.h"
 
 namespace nexer {
 namespace test {
@@ -193,6 +198,140 @@ static void test_timeout_without_starting() {
     assert(on_exit_called == 1);
 }
 
+static void should_spawn_with_helper() {
+    nexer::EventLoop loop;
+    auto& helper = SpawnHelper::Create(loop);
+    assert(helper.Start());
+
+    config::Command hello{.file = exename, .args = {"helper", "hello"}};
+    config::Command set_env{.file = exename, .args = {"helper", "set-env"}, .env = {"ENV1=env1", "ENV3="}};
+    config::Command unknown{.file = "some-unknown-command"};
+    SpawnTemplate hello_template(hello), set_env_template(set_env), unknown_template(unknown);
+
+    std::string output, error_output, env_output;
+    int exited = 0, error = 0;
+
+    auto on_exit = [&] {
+        if (++exited == 3) {
+            helper.Close();
+        }
+    };
+
+    auto& process = Process::Create(loop, hello_template, &helper);
+    process.OnData([&](int fd, const char *s, size_t len) {
+        (fd == 1 ? output : error_output).append(s, len);
+    });
+    process.OnExit([&](int64_t status, int signal) {
+        assert(status == 0 && signal == 0);
+        on_exit();
+    });
+    assert(process.Start());
+
+    auto& env_process = Process::Create(loop, set_env_template, &helper);
+    env_process.OnData([&](int fd, const char *s, size_t len) {
+        env_output.append(s, len);
+    });
+    env_process.OnExit([&](int64_t status, int signal) {
+        on_exit();
+    });
+    assert(env_process.Start());
+
+    auto& failing = Process::Create(loop, unknown_template, &helper);
+    failing.OnError([&](int err) {
+        error = err;
+    });
+    failing.OnExit([&](int64_t status, int signal) {
+        on_exit();
+    });
+    assert(failing.Start());
+
+    loop.Run();
+
+    assert(output == "hello");
+    assert(error_output == "world");
+    assert(env_output == "ENV1=env1ENV2=nullENV3=ENV4=null");
+    assert(error == UV_ENOENT);
+    assert(exited == 3);
+}
+
+// With the helper not running, processes are spawned by libuv instead and
+// still report their pid
+static void should_spawn_without_running_helper() {
+    nexer::EventLoop loop;
+    auto& helper = SpawnHelper::Create(loop);
+
+    config::Command sleep{.file = "sleep", .args = {"30"}};
+    SpawnTemplate sleep_template(sleep);
+
+    int signal = 0;
+    auto& process = Process::Create(loop, sleep_template, &helper);
+    process.OnExit([&](int64_t, int term_signal) {
+        signal = term_signal;
+        helper.Close();
+    });
+    assert(process.Start());
+    uv_pid_t pid = process.GetPid();
+    assert(pid > 0 && kill(pid, 0) == 0);
+    process.Kill(SIGKILL);
+
+    loop.Run();
+    assert(signal == SIGKILL);
+}
+
+// Gone or a zombie waiting for init
+static bool IsDead(uv_pid_t pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string comm;
+    char state = 'X';
+    int ignored;
+    stat >> ignored >> comm >> state;
+    return state == 'X' || state == 'Z';
+}
+
+// A child started by a helper that went away is killed before being
+// reported, and the helper is reaped without blocking the loop
+static void should_kill_children_of_failed_helper() {
+    nexer::EventLoop loop;
+    auto& helper = SpawnHelper::Create(loop);
+    assert(helper.Start());
+    uv_pid_t helper_pid = helper.pid();
+
+    config::Command sleep{.file = "sleep", .args = {"30"}};
+    SpawnTemplate sleep_template(sleep);
+
+    uv_pid_t pid = 0;
+    int error = 0, exited = 0;
+
+    auto& process = Process::Create(loop, sleep_template, &helper);
+    process.OnError([&](int err) {
+        error = err;
+    });
+    process.OnExit([&](int64_t, int) {
+        exited++;
+        helper.Close();
+    });
+    assert(process.Start());
+
+    auto& timer = Timer::Create(loop, 10);
+    timer.OnTick([&] {
+        if ((pid = process.GetPid()) > 0) {
+            kill(helper_pid, SIGKILL);
+            timer.Close();
+        }
+    });
+    timer.Start();
+
+    loop.Run();
+
+    assert(pid > 0 && exited == 1 && error != 0);
+    assert(waitpid(helper_pid, nullptr, WNOHANG) < 0 && errno == ECHILD);
+    // The signal may still be on its way
+    for (int i = 0; i < 100 && !IsDead(pid); i++) {
+        uv_sleep(10);
+    }
+    assert(IsDead(pid));
+}
+
 void TestProcess() {
     should_read_stdout_stderr();
     should_timeout();
@@ -202,6 +341,9 @@ void TestProcess() {
     should_set_env();
     test_start_failing();
     test_timeout_without_starting();
+    should_spawn_with_helper();
+    should_spawn_without_running_helper();
+    should_kill_children_of_failed_helper();
 }
 
 }  // namespace test
@@ -8,6 +8,8 @@
 #include "helper.h"
 #include "logger.h"
 #include <iostream>
+#include <sstream>
+#include "tcp_server.h"
 #include "timer.h"
 
 // gcov writes on stderr
@@ -676,6 +678,305 @@ static void TestPreambleFailure() {
     AssertSortEqual(expected, output);
 }
 
+#define PROBE_PORT 19012
+
+// The app goes down when its port closes, is restarted after two failed
+// probes and comes back healthy once it listens again.
+static void TestProbe() {
+    nexer::EventLoop loop;
+    nexer::ProcessManager manager(loop);
+
+    config::Checker checker;
+    checker.type = config::Checker::Type::Tcp;
+    checker.port = PROBE_PORT;
+    checker.timeout = 200;
+
+    config::App app = {
+        .command = {
+            .file = exename,
+            .args = std::vector<std::string>({"helper", "hello"}),
+        },
+        .checker = &checker,
+        .max_start_time = 2000,
+        .probe_interval = 50,
+        .probe_failures = 2,
+    };
+
+    TcpServer *server = nullptr;
+    auto listen = [&] {
+        server = &TcpServer::Create(loop);
+        server->OnConnection([](TcpClient& client) {
+            client.Close();
+        });
+        assert(server->Listen(PROBE_PORT));
+    };
+    listen();
+
+    int started = 0;
+    manager.OnProcessStart([&](const Process*) {
+        started++;
+        listen();
+    });
+
+    std::vector<config::App *> apps({&app});
+    manager.StartProbing(apps);
+
+    auto& timer = Timer::Create(loop, 100);
+    int ticks = 0;
+    timer.OnTick([&] {
+        ticks++;
+        if (ticks == 3) {
+            assert(manager.GetHealth(app) == ProcessManager::Health::Healthy);
+            bool called = false;
+            manager.Require(app, [&](Process*, int error) {
+                assert(error == 0);
+                called = true;
+            });
+            // Answered from the probed state
+            assert(called);
+            server->Close();
+        } else if (started > 0 && manager.GetHealth(app) == ProcessManager::Health::Healthy) {
+            manager.StopProbing();
+            server->Close();
+            timer.Close();
+        }
+        assert(ticks < 50);
+    });
+    timer.Start();
+
+    loop.Run();
+
+    assert(started == 1);
+
+    std::stringstream ss;
+    JsonWriter json(ss);
+    manager.WriteStatus(json);
+    auto status = ss.str();
+    assert(status.find("\"health\":\"healthy\"") != std::string::npos);
+    assert(status.find("\"to\":\"degraded\"") != std::string::npos);
+    assert(status.find("\"to\":\"down\"") != std::string::npos);
+    assert(status.find("\"to\":\"starting\"") != std::string::npos);
+}
+
+// Stops the app once its last connection has been released for a while,
+// killing it if SIGTERM is ignored, and starts it again when required
+static void TestIdleStop(const char *script, int expected_signal) {
+    nexer::EventLoop loop;
+    nexer::ProcessManager manager(loop);
+
+    config::App app = {
+        .command = {
+            .file = "sh",
+            .args = std::vector<std::string>({"-c", script}),
+        },
+        .idle_stop_after = 100,
+        .stop_timeout = 300,
+    };
+
+    int started = 0;
+    std::vector<int> signals;
+    manager.OnProcessStart([&](const Process*) {
+        started++;
+    });
+    manager.OnProcessExit([&](const Process*, int64_t, int signal) {
+        signals.push_back(signal);
+    });
+
+    Process *running = nullptr;
+    manager.Require(app, [&](Process* process, int error) {
+        assert(error == 0);
+        running = process;
+        manager.Acquire(app);
+        manager.Acquire(app);
+        manager.Release(app);
+    });
+
+    auto& timer = Timer::Create(loop, 50);
+    int ticks = 0;
+    bool required = false;
+    timer.OnTick([&] {
+        ticks++;
+        // Still in use
+        if (ticks == 6) {
+            assert(manager.GetHealth(app) == ProcessManager::Health::Healthy);
+            manager.Release(app);
+        } else if (ticks > 6 && !required && manager.GetHealth(app) == ProcessManager::Health::Stopped) {
+            // Waits for the process to exit if it has not already
+            required = true;
+            manager.Require(app, [&](Process* process, int error) {
+                assert(error == 0);
+                assert(process);
+                assert(started == 2);
+                process->Kill(SIGKILL);
+                manager.Close();
+                timer.Close();
+            });
+        }
+        assert(ticks < 100);
+    });
+    timer.Start();
+
+    loop.Run();
+
+    assert(started == 2);
+    assert(signals.size() == 2);
+    assert(signals[0] == expected_signal);
+
+    std::stringstream ss;
+    JsonWriter json(ss);
+    manager.WriteStatus(json);
+    assert(ss.str().find("\"idle_stops\":1") != std::string::npos);
+}
+
+// Started without any connection, as by a probe or warm-up: stopped once
+// idle for idle_stop_after since it became healthy
+static void TestIdleStopUnused() {
+    nexer::EventLoop loop;
+    nexer::ProcessManager manager(loop);
+
+    config::App app = {
+        .command = {
+            .file = "sleep",
+            .args = std::vector<std::string>({"10"}),
+        },
+        .idle_stop_after = 100,
+    };
+
+    uint64_t healthy = 0, stopped = 0;
+    manager.Require(app, [&](Process*, int error) {
+        assert(error == 0);
+        healthy = Timer::Now();
+    });
+    manager.OnProcessExit([&](const Process*, int64_t, int signal) {
+        assert(signal == SIGTERM);
+        stopped = Timer::Now();
+        manager.Close();
+    });
+
+    loop.Run();
+    assert(healthy > 0 && stopped >= healthy + 100);
+    assert(manager.GetHealth(app) == ProcessManager::Health::Stopped);
+}
+
+static void TestIdleStop() {
+    TestIdleStop("exec sleep 10", SIGTERM);
+    TestIdleStop("trap '' TERM; exec sleep 10", SIGKILL);
+    TestIdleStopUnused();
+}
+
+// Apps d, b and c on d, and a on b and c, warmed up: each starts once its
+// preamble is healthy, with no more than concurrency starting at once
+static void TestWarm(int concurrency, const char *d_file, std::vector<std::string> expected) {
+    nexer::EventLoop loop;
+    nexer::ProcessManager manager(loop);
+
+    // Running until after all are started, as required again for each app
+    // they are in the preamble of
+    std::vector<std::string> args({"1"});
+    config::App d = {.name = "d", .command = {.file = d_file, .args = args}};
+    config::App b = {.name = "b", .command = {.file = "sleep", .args = args}, .preamble = {&d}};
+    config::App c = {.name = "c", .command = {.file = "sleep", .args = args}, .preamble = {&d}};
+    config::App a = {.name = "a", .command = {.file = "sleep", .args = args}, .preamble = {&b, &c}};
+    std::vector<config::App *> apps({&a, &b, &c, &d});
+
+    std::vector<std::string> started;
+    int max_starting = 0;
+    manager.OnAppStep([&](const config::App& app, ProcessManager::Step step) {
+        if (step != ProcessManager::Step::Start) {
+            return;
+        }
+        for (auto preamble : app.preamble) {
+            assert(manager.GetHealth(*preamble) == ProcessManager::Health::Healthy);
+        }
+        int starting = 0;
+        for (auto app : apps) {
+            starting += manager.GetHealth(*app) == ProcessManager::Health::Starting;
+        }
+        max_starting = std::max(max_starting, starting);
+        started.push_back(app.name);
+    });
+
+    assert(manager.Warm({&a, &c}, concurrency));
+    loop.Run();
+
+    if (started.size() == 4) {
+        // b and c in either order
+        std::sort(started.begin() + 1, started.begin() + 3);
+    }
+    if (started != expected) {
+        std::cerr << "Expected: " << Join(expected) << '\n';
+        std::cerr << "  Actual: " << Join(started) << '\n';
+        assert(0);
+    }
+    assert(max_starting <= concurrency);
+    assert(concurrency == 1 || expected.size() < 4 || max_starting == 2);
+}
+
+// Warming is no use: with nothing using it, a warm app is stopped once idle
+// like any other and started again only when required
+static void TestWarmIdleStop() {
+    nexer::EventLoop loop;
+    nexer::ProcessManager manager(loop);
+
+    config::App app = {
+        .name = "a",
+        .command = {
+            .file = "sleep",
+            .args = std::vector<std::string>({"10"}),
+        },
+        .idle_stop_after = 100,
+    };
+
+    int started = 0, exited = 0;
+    manager.OnProcessStart([&](const Process*) {
+        started++;
+    });
+    manager.OnProcessExit([&](const Process*, int64_t, int signal) {
+        if (++exited > 1) {
+            return;
+        }
+        assert(signal == SIGTERM);
+        assert(manager.GetHealth(app) == ProcessManager::Health::Stopped);
+        manager.Require(app, [&](Process* process, int error) {
+            assert(error == 0);
+            manager.Acquire(app);
+            process->Kill(SIGKILL);
+            manager.Close();
+        });
+    });
+    assert(manager.Warm({&app}, 1));
+
+    loop.Run();
+    assert(started == 2 && exited == 2);
+}
+
+static void TestWarmCycle() {
+    nexer::EventLoop loop;
+    nexer::ProcessManager manager(loop);
+
+    config::App a = {.name = "a", .command = {.file = "true"}};
+    config::App b = {.name = "b", .command = {.file = "true"}, .preamble = {&a}};
+    config::App c = {.name = "c", .command = {.file = "true"}, .preamble = {&b}};
+    a.preamble.push_back(&c);
+
+    int started = 0;
+    manager.OnProcessStart([&](const Process*) {
+        started++;
+    });
+    assert(!manager.Warm({&a}, 4));
+    loop.Run();
+    assert(started == 0);
+}
+
+static void TestWarm() {
+    TestWarm(1, "sleep", {"d", "b", "c", "a"});
+    TestWarm(2, "sleep", {"d", "b", "c", "a"});
+    // Nothing depending on d is started once it fails
+    TestWarm(2, "false", {"d"});
+    TestWarmCycle();
+    TestWarmIdleStop();
+}
+
 static void TestPreamble() {
     TestPreambleSimple();
     TestPreambleMulti();
@@ -690,6 +991,9 @@ void TestProcessManager() {
     TestChecker();
     TestCheckerKill();
     TestPreamble();
+    TestProbe();
+    TestIdleStop();
+    TestWarm();
 }
 
 std::string Trim(std::string str) {
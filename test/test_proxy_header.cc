@@ -0,0 +1,99 @@
+#include <assert.h>
+#include <string.h>
+
+#include <string>
+
+#include "proxy_header.h"
+
+namespace nexer {
+namespace test {
+
+static void test_v1() {
+    ProxyHeader::Address src, dst;
+    uv_ip4_addr("203.0.113.7", 5555, &src.in);
+    uv_ip4_addr("10.0.0.1", 443, &dst.in);
+
+    char buf[ProxyHeader::kMaxSize];
+    size_t len = ProxyHeader::Write(buf, 1, &src.sa, &dst.sa);
+    assert(std::string(buf, len) == "PROXY TCP4 203.0.113.7 10.0.0.1 5555 443\r\n");
+
+    ProxyHeader::Address src2, dst2;
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == int(len));
+    assert(memcmp(&src2.in, &src.in, sizeof src.in) == 0);
+    assert(memcmp(&dst2.in, &dst.in, sizeof dst.in) == 0);
+
+    // Incomplete until the CRLF is in
+    assert(ProxyHeader::Parse(buf, len - 1, src2, dst2) == 0);
+    assert(ProxyHeader::Parse("PROX", 4, src2, dst2) == 0);
+
+    uv_ip6_addr("2001:db8::1", 1234, &src.in6);
+    len = ProxyHeader::Write(buf, 1, &src.sa, &dst.sa);
+    assert(std::string(buf, len) == "PROXY UNKNOWN\r\n");
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == int(len));
+    assert(src2.sa.sa_family == AF_UNSPEC);
+
+    const char *v6 = "PROXY TCP6 2001:db8::1 ::1 1234 80\r\nGET /";
+    assert(ProxyHeader::Parse(v6, strlen(v6), src2, dst2) == int(strlen(v6) - 5));
+    assert(src2.sa.sa_family == AF_INET6 && ntohs(src2.in6.sin6_port) == 1234);
+
+    for (auto bad : {"GET / HTTP/1.1\r\n", "PROXY TCP4 1.2.3.4 5.6.7.8 1 2\n", "PROXY TCP4 1.2.3.4 5.6.7.8 1 70000\r\n",
+                     "PROXY TCP4 ::1 ::1 1 2\r\n", "PROXY UDP4 1.2.3.4 5.6.7.8 1 2\r\n"}) {
+        assert(ProxyHeader::Parse(bad, strlen(bad), src2, dst2) == -1);
+    }
+    // Never ending
+    std::string junk = "PROXY TCP4 " + std::string(200, '1');
+    assert(ProxyHeader::Parse(junk.data(), junk.size(), src2, dst2) == -1);
+}
+
+static void test_v2() {
+    ProxyHeader::Address src, dst;
+    uv_ip6_addr("2001:db8::7", 5555, &src.in6);
+    uv_ip6_addr("::1", 443, &dst.in6);
+
+    char buf[ProxyHeader::kMaxSize];
+    size_t len = ProxyHeader::Write(buf, 2, &src.sa, &dst.sa);
+    assert(len == 16 + 36);
+    assert(memcmp(buf, "\r\n\r\n\0\r\nQUIT\n\x21\x21\x00\x24", 16) == 0);
+
+    ProxyHeader::Address src2, dst2;
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == int(len));
+    assert(memcmp(&src2.in6.sin6_addr, &src.in6.sin6_addr, 16) == 0);
+    assert(src2.in6.sin6_port == src.in6.sin6_port && dst2.in6.sin6_port == dst.in6.sin6_port);
+    for (size_t n = 0; n < len; n++) {
+        assert(ProxyHeader::Parse(buf, n, src2, dst2) == 0);
+    }
+
+    uv_ip4_addr("203.0.113.7", 5555, &src.in);
+    uv_ip4_addr("10.0.0.1", 443, &dst.in);
+    len = ProxyHeader::Write(buf, 2, &src.sa, &dst.sa);
+    assert(len == 16 + 12);
+    // TLVs after the addresses count towards the length but need not be seen
+    buf[15] = 12 + 20;
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == 16 + 32);
+    assert(src2.sa.sa_family == AF_INET && ntohs(src2.in.sin_port) == 5555);
+
+    // LOCAL carries no addresses
+    buf[12] = 0x20;
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == 16 + 32);
+    assert(src2.sa.sa_family == AF_UNSPEC);
+
+    len = ProxyHeader::Write(buf, 2, nullptr, nullptr);
+    assert(len == 16 && buf[13] == 0);
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == 16);
+
+    buf[12] = 0x31;
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == -1);
+    buf[12] = 0x21;
+    buf[13] = 0x11;
+    assert(ProxyHeader::Parse(buf, len, src2, dst2) == -1);
+    buf[4] = 'x';
+    assert(ProxyHeader::Parse(buf, 5, src2, dst2) == -1);
+}
+
+void TestProxyHeader() {
+    test_v1();
+    test_v2();
+}
+
+}  // namespace test
+}  // namespace nexer
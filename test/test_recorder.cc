@@ -0,0 +1,226 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include <sstream>
+#include <string>
+
+#include "recorder.h"
+#include "tcp_proxy.h"
+
+#define TEST_FILE "/tmp/nexer-test.rec"
+
+namespace nexer {
+namespace test {
+
+static config::Record RecordConfig(int buffer_size = 1 << 20) {
+    config::Record record;
+    record.file = TEST_FILE;
+    record.buffer_size = buffer_size;
+    return record;
+}
+
+static void test_round_trip() {
+    remove(TEST_FILE);
+    {
+        auto recorder = Recorder::Create(RecordConfig());
+        assert(recorder);
+        assert(recorder->Open(1));
+        assert(recorder->Write(1, true, "hello", 5));
+        IoBuffer reply(4);
+        reply.Write("world", 5);
+        assert(recorder->Write(1, false, reply));
+        recorder->Close(1);
+
+        // Given up on, so left out
+        assert(recorder->Open(2));
+        assert(recorder->Write(2, true, "x", 1));
+        recorder->Lose(2);
+
+        // Still open when the recorder went
+        assert(recorder->Open(3));
+        assert(recorder->Write(3, true, "bye", 3));
+    }
+
+    Recording recording;
+    assert(Recording::Load(TEST_FILE, recording));
+    assert(recording.sessions.size() == 2);
+    auto &first = recording.sessions[0];
+    assert(first.id == 1 && first.chunks.size() == 2);
+    assert(first.chunks[0].from_client && first.chunks[0].data == "hello");
+    assert(!first.chunks[1].from_client && first.chunks[1].data == "world");
+    assert(first.chunks[0].time <= first.chunks[1].time && first.chunks[1].time <= first.duration);
+    auto &second = recording.sessions[1];
+    assert(second.id == 3 && second.chunks.size() == 1 && second.duration == second.chunks[0].time);
+
+    // A later run appends, its session ids starting over
+    uint64_t start = first.start;
+    {
+        auto recorder = Recorder::Create(RecordConfig());
+        assert(recorder->Open(1));
+        recorder->Close(1);
+    }
+    assert(Recording::Load(TEST_FILE, recording));
+    assert(recording.sessions.size() == 3);
+    assert(recording.sessions[2].id == 1 && recording.sessions[2].chunks.empty());
+    assert(recording.sessions[2].start > start);
+}
+
+static void test_overflow() {
+    remove(TEST_FILE);
+    {
+        auto recorder = Recorder::Create(RecordConfig(4096));
+        assert(recorder->Open(1));
+        std::string big(8192, 'x');
+        assert(!recorder->Write(1, true, big.data(), big.size()));
+        recorder->Lose(1);
+        recorder->Close(1);
+
+        std::stringstream ss;
+        JsonWriter json(ss);
+        recorder->WriteStatus(json);
+        assert(ss.str().find(R"("sessions":1,"bytes":0,"dropped":1,)") != std::string::npos);
+    }
+    Recording recording;
+    assert(Recording::Load(TEST_FILE, recording));
+    assert(recording.sessions.empty());
+}
+
+// Lost when the recorder went, with no record after to carry the marker
+static void test_lost_last() {
+    remove(TEST_FILE);
+    {
+        auto recorder = Recorder::Create(RecordConfig(4096));
+        assert(recorder->Open(1));
+        std::string big(8192, 'x');
+        assert(!recorder->Write(1, true, big.data(), big.size()));
+        recorder->Lose(1);
+    }
+    Recording recording;
+    assert(Recording::Load(TEST_FILE, recording));
+    assert(recording.sessions.empty());
+}
+
+static std::string Status(Recorder &recorder) {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    recorder.WriteStatus(json);
+    return ss.str();
+}
+
+// A file size limit cuts a batch short in the middle of a record
+static void test_write_error() {
+    remove(TEST_FILE);
+    struct rlimit limit;
+    assert(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+    auto sigxfsz = signal(SIGXFSZ, SIG_IGN);
+    {
+        auto recorder = Recorder::Create(RecordConfig());
+        struct rlimit small = limit;
+        small.rlim_cur = 4096;
+        assert(setrlimit(RLIMIT_FSIZE, &small) == 0);
+        std::string data(3000, 'x');
+        assert(recorder->Open(1));
+        assert(recorder->Write(1, true, data.data(), data.size()));
+        assert(recorder->Write(1, false, data.data(), data.size()));
+        for (int i = 0; i < 100 && Status(*recorder).find(R"("write_errors":0)") != std::string::npos; i++) {
+            uv_sleep(10);
+        }
+        assert(Status(*recorder).find(R"("write_errors":1)") != std::string::npos);
+        assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+        assert(recorder->Write(1, true, "after", 5));
+        recorder->Close(1);
+    }
+    signal(SIGXFSZ, sigxfsz);
+
+    Recording recording;
+    assert(Recording::Load(TEST_FILE, recording));
+    assert(recording.sessions.size() == 1);
+    auto &chunks = recording.sessions[0].chunks;
+    assert(chunks.size() == 2 && chunks[0].data.size() == 3000 && chunks[1].data == "after");
+}
+
+static void test_not_recording() {
+    FILE *f = fopen(TEST_FILE, "w");
+    fputs("{ proxies: [] }", f);
+    fclose(f);
+    assert(!Recorder::Create(RecordConfig()));
+    Recording recording;
+    assert(!Recording::Load(TEST_FILE, recording));
+    assert(!Recording::Load("/tmp/nexer-test-missing.rec", recording));
+}
+
+// Both directions of a session through the proxy, as the peers saw them
+static void test_proxy() {
+    remove(TEST_FILE);
+    EventLoop loop;
+
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19561;
+    upstream.app = nullptr;
+    auto &proxy = TcpProxy::Create(loop, upstream, nullptr);
+    assert(proxy.StartRecording(RecordConfig()));
+    assert(proxy.Listen(19560));
+
+    auto &server = TcpServer::Create(loop);
+    assert(server.Listen(19561));
+    server.OnConnection([&](TcpClient &client) {
+        client.OnData([&client](const char *s, size_t len) {
+            client.Write("re:", 3);
+            client.Write(s, len);
+        });
+    });
+
+    std::string received;
+    auto &client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        client.Write("hello", 5);
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+        if (received.size() == 8) {
+            client.Close();
+        }
+    });
+
+    auto &timer = Timer::Create(loop, 100);
+    timer.OnTick([&] {
+        if (received.size() < 8) {
+            return;
+        }
+        timer.Close();
+        proxy.Close();
+        server.Close();
+    });
+    timer.Start();
+    client.Connect(19560);
+
+    loop.Run();
+    assert(received == "re:hello");
+
+    Recording recording;
+    assert(Recording::Load(TEST_FILE, recording));
+    assert(recording.sessions.size() == 1);
+    std::string sent, replied;
+    for (auto &chunk : recording.sessions[0].chunks) {
+        (chunk.from_client ? sent : replied) += chunk.data;
+    }
+    assert(sent == "hello");
+    assert(replied == "re:hello");
+}
+
+void TestRecorder() {
+    test_round_trip();
+    test_overflow();
+    test_lost_last();
+    test_write_error();
+    test_not_recording();
+    test_proxy();
+    remove(TEST_FILE);
+}
+
+}  // namespace test
+}  // namespace nexer
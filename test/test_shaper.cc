@@ -0,0 +1,81 @@
+#include <assert.h>
+
+#include "shaper.h"
+
+namespace nexer {
+namespace test {
+
+static void test_unlimited() {
+    TokenBucket bucket;
+    assert(!bucket.enabled());
+    bucket.Take(1 << 30);
+    assert(!bucket.IsEmpty());
+    assert(bucket.GetDelay() == 0);
+}
+
+// 1000 bytes/s with a burst of 100: the burst passes at once, after that
+// the bucket refills at a byte per millisecond
+static void test_rate() {
+    TokenBucket bucket(1000, 100, 0);
+    bucket.Take(99);
+    assert(!bucket.IsEmpty());
+    bucket.Take(1);
+    assert(bucket.IsEmpty());
+    assert(bucket.GetDelay() == 1);
+
+    bucket.Refill(1);
+    assert(!bucket.IsEmpty());
+
+    // Over-reading leaves a debt to be paid off first
+    bucket.Take(51);
+    assert(bucket.IsEmpty());
+    assert(bucket.GetDelay() == 51);
+    bucket.Refill(50);
+    assert(bucket.IsEmpty());
+    bucket.Refill(52);
+    assert(!bucket.IsEmpty());
+
+    // Never more than the burst, however long it has been
+    bucket.Refill(100000);
+    bucket.Take(100);
+    assert(bucket.IsEmpty());
+}
+
+// Refills of a few milliseconds are not rounded away at low rates
+static void test_slow_rate() {
+    TokenBucket bucket(10, 1, 0);
+    bucket.Take(1);
+    assert(bucket.IsEmpty());
+    for (uint64_t now = 1; now < 100; now++) {
+        bucket.Refill(now);
+        assert(bucket.IsEmpty());
+    }
+    bucket.Refill(101);
+    assert(!bucket.IsEmpty());
+}
+
+static void test_shaper() {
+    config::Upstream upstream;
+    assert(!Shaper::IsNeeded(upstream));
+    upstream.connection_rate_limit = 2000;
+    assert(Shaper::IsNeeded(upstream));
+
+    Shaper shaper(upstream, 0);
+    assert(!shaper.shared[Shaper::kUp].enabled());
+    assert(shaper.rate == 2000);
+
+    // The burst defaults to a second's worth
+    TokenBucket bucket(shaper.rate, shaper.burst, 0);
+    bucket.Take(1999);
+    assert(!bucket.IsEmpty());
+}
+
+void TestShaper() {
+    test_unlimited();
+    test_rate();
+    test_slow_rate();
+    test_shaper();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -1,5 +1,6 @@
 #include <assert.h>
 
+#include <sstream>
 #include <thread>
 
 #include "http_client.h"
@@ -354,6 +355,402 @@ static void TestUpstreamConnectSuccess2() {
     assert(closed);
 }
 
+static void RunOptimistic(Context& context, std::string& data) {
+    context.config.proxies()[0].upstream.optimistic = true;
+
+    auto& client = nexer::TcpClient::Create(context.loop);
+
+    client.Connect(19500);
+
+    client.OnConnect([&] {
+        client.Write("hello", 5);
+    });
+
+    client.OnData([&](const char *s, size_t len) {
+        data.append(s, len);
+        if (data.size() == 5) {
+            client.Close();
+        }
+    });
+
+    auto& timer = nexer::Timer::Create(context.loop, 2000);
+    timer.OnTick([&] {
+        timer.Close();
+        context.proxy->Close();
+        context.server->Close();
+    });
+    timer.Start();
+
+    context.loop.Run();
+}
+
+// upstream accepting, app never checked
+static void TestOptimisticConnect() {
+    Context context;
+
+    int started = 0;
+    context.manager.OnProcessStart([&](const Process*) {
+        started++;
+    });
+
+    context.StartServer();
+
+    std::string data;
+    RunOptimistic(context, data);
+
+    assert(started == 0);
+    assert(data == "hello");
+}
+
+// upstream refusing, app checked and started before the retry
+static void TestOptimisticConnectFallback() {
+    Context context;
+
+    SetScenario("simple-check");
+
+    int started = 0;
+    context.manager.OnProcessStart([&](const Process*) {
+        if (started++ == 0) {
+            context.StartServer();
+        }
+    });
+
+    TimelineRing timelines(8);
+    context.proxy->SetTimelineRing(&timelines);
+
+    std::string data;
+    RunOptimistic(context, data);
+
+    assert(started > 0);
+    assert(data == "hello");
+
+    assert(timelines.size() == 1);
+    timelines.ForEach(1, [](const Timeline& timeline) {
+        using Event = Timeline::Event;
+        assert(timeline.id > 0);
+        assert(timeline.entries[0].event == Event::Accept);
+        for (auto event : {Event::Connect, Event::ConnectFailed, Event::CheckStart, Event::CheckEnd,
+                           Event::Established, Event::ClientData, Event::UpstreamData}) {
+            assert(timeline.Has(event));
+        }
+        assert(timeline.entries[timeline.size - 1].event == Event::ClientClose);
+    });
+}
+
+// app check in progress: the queue holds two, the third is turned away
+// right away and the queued ones give up after wait_timeout
+static void TestWaitQueue() {
+    Context context;
+
+    // exits 1 after 500ms
+    SetScenario("simple-with-sleep-fail");
+    auto& upstream = context.config.proxies()[0].upstream;
+    upstream.max_waiting = 2;
+    upstream.wait_timeout = 200;
+
+    TimelineRing timelines(8);
+    context.proxy->SetTimelineRing(&timelines);
+
+    auto start = Timer::Now();
+    std::vector<uint64_t> closed;
+    for (int i = 0; i < 3; i++) {
+        auto& client = nexer::TcpClient::Create(context.loop);
+        client.Connect(19500);
+        client.OnClose([&] {
+            closed.push_back(Timer::Now() - start);
+        });
+    }
+
+    auto& timer = nexer::Timer::Create(context.loop, 1000);
+    timer.OnTick([&] {
+        timer.Close();
+        context.proxy->Close();
+    });
+    timer.Start();
+
+    context.loop.Run();
+
+    assert(closed.size() == 3);
+    assert(closed[0] < 150);
+    assert(closed[1] >= 150 && closed[1] < 500);
+    assert(closed[2] >= 150 && closed[2] < 500);
+
+    int busy = 0, timed_out = 0;
+    timelines.ForEach(3, [&](const Timeline& timeline) {
+        auto& last = timeline.entries[timeline.size - 1];
+        assert(last.event == Timeline::Event::Abort);
+        busy += last.value == UV_EBUSY;
+        timed_out += last.value == UV_ETIMEDOUT;
+    });
+    assert(busy == 1);
+    assert(timed_out == 2);
+}
+
+// A load balancer's v1 header comes in, a v2 one with the same client goes
+// out ahead of the data; a connection without one is turned away
+static void TestProxyProtocol() {
+    EventLoop loop;
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19511;
+    upstream.proxy_protocol = 2;
+    upstream.app = nullptr;
+
+    auto& proxy = TcpProxy::Create(loop, upstream, nullptr);
+    proxy.AcceptProxyHeaders(true);
+    assert(proxy.Listen(19510));
+
+    std::string received;
+    auto& server = TcpServer::Create(loop);
+    assert(server.Listen(19511));
+    server.OnConnection([&](TcpClient& client) {
+        client.OnData([&](const char* s, size_t len) {
+            received.append(s, len);
+        });
+    });
+
+    bool bad_closed = false;
+    TcpClient* good = nullptr;
+    for (auto data : {"PROXY TCP4 203.0.113.7 10.0.0.1 5555 443\r\nhello", "hello"}) {
+        auto& client = TcpClient::Create(loop);
+        client.OnConnect([&client, data] {
+            client.Write(data, strlen(data));
+        });
+        client.OnError([&client](int, const char*) {
+            client.Close();
+        });
+        if (strcmp(data, "hello") == 0) {
+            client.OnClose([&] {
+                bad_closed = true;
+            });
+        } else {
+            good = &client;
+        }
+        client.Connect(19510);
+    }
+
+    // The forwarder has to be gone before the proxy is, once the header
+    // and data (28 + 5 bytes) have been forwarded
+    auto& timer = Timer::Create(loop, 250);
+    timer.OnTick([&] {
+        if (good && received.size() < 16 + 12 + 5) {
+            return;
+        }
+        if (good) {
+            good->Close();
+            good = nullptr;
+            return;
+        }
+        timer.Close();
+        proxy.Close();
+        server.Close();
+    });
+    timer.Start();
+
+    loop.Run();
+
+    assert(bad_closed);
+    ProxyHeader::Address src, dst;
+    int len = ProxyHeader::Parse(received.data(), received.size(), src, dst);
+    assert(len == 16 + 12);
+    assert(src.sa.sa_family == AF_INET && ntohs(src.in.sin_port) == 5555);
+    char ip[16];
+    uv_ip4_name(&src.in, ip, sizeof ip);
+    assert(strcmp(ip, "203.0.113.7") == 0);
+    assert(received.substr(len) == "hello");
+}
+
+static std::string GetStatus(TcpProxy &proxy) {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    json.BeginObject();
+    proxy.WriteStatus(json);
+    json.EndObject();
+    return ss.str();
+}
+
+// A client that never sends its PROXY header is closed once the wait is over
+static void TestProxyHeaderTimeout() {
+    EventLoop loop;
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19513;
+    upstream.app = nullptr;
+
+    auto& proxy = TcpProxy::Create(loop, upstream, nullptr);
+    proxy.AcceptProxyHeaders(true, 200);
+    assert(proxy.Listen(19512));
+
+    auto& server = TcpServer::Create(loop);
+    assert(server.Listen(19513));
+
+    uint64_t opened = 0, closed = 0;
+    auto& client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        opened = uv_now(loop);
+        client.Write("PROXY TCP4", 10);
+    });
+    client.OnError([&](int, const char*) {
+        client.Close();
+    });
+    // The proxy goes once it is done connecting upstream for the client
+    auto& timer = Timer::Create(loop, 1000);
+    timer.OnTick([&] {
+        timer.Close();
+        proxy.Close();
+        server.Close();
+    });
+    client.OnClose([&] {
+        closed = uv_now(loop);
+        timer.Start();
+    });
+    client.Connect(19512);
+
+    loop.Run();
+
+    assert(opened > 0 && closed - opened >= 200 && closed - opened < 2000);
+}
+
+// The mirror gets what the client sends and nothing of it comes back
+static void TestMirror() {
+    EventLoop loop;
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19551;
+    upstream.mirror.port = 19552;
+    upstream.app = nullptr;
+
+    auto& proxy = TcpProxy::Create(loop, upstream, nullptr);
+    assert(proxy.Listen(19550));
+
+    auto& server = TcpServer::Create(loop);
+    assert(server.Listen(19551));
+    server.OnConnection([&](TcpClient& client) {
+        client.OnData([&client](const char* s, size_t len) {
+            client.Write(s, len);
+        });
+    });
+
+    std::string mirrored;
+    auto& mirror = TcpServer::Create(loop);
+    assert(mirror.Listen(19552));
+    mirror.OnConnection([&](TcpClient& client) {
+        client.OnData([&](const char* s, size_t len) {
+            mirrored.append(s, len);
+            client.Write("mirror", 6);
+        });
+    });
+
+    std::string received;
+    auto& client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        client.Write("hello", 5);
+    });
+    client.OnData([&](const char* s, size_t len) {
+        received.append(s, len);
+    });
+    client.Connect(19550);
+
+    std::string status;
+    bool closed = false;
+    auto& timer = Timer::Create(loop, 200);
+    timer.OnTick([&] {
+        if (!closed) {
+            // Waits for the upstream, tried after a retry interval
+            if (received.size() < 5) {
+                return;
+            }
+            client.Close();
+            closed = true;
+            return;
+        }
+        status = GetStatus(proxy);
+        timer.Close();
+        proxy.Close();
+        server.Close();
+        mirror.Close();
+    });
+    timer.Start();
+
+    loop.Run();
+
+    assert(received == "hello");
+    assert(mirrored == "hello");
+    assert(status.find(R"("mirror":{"connections":1,"connect_failures":0,"bytes":5,)") != std::string::npos);
+}
+
+// A mirror that stops reading is dropped without holding the client up
+static void TestMirrorOverflow() {
+    EventLoop loop;
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19554;
+    upstream.mirror.port = 19555;
+    upstream.mirror.max_pending = 64 * 1024;
+    upstream.app = nullptr;
+
+    auto& proxy = TcpProxy::Create(loop, upstream, nullptr);
+    assert(proxy.Listen(19553));
+
+    const size_t size = 16 << 20;
+    size_t received = 0;
+    auto& server = TcpServer::Create(loop);
+    assert(server.Listen(19554));
+    server.OnConnection([&](TcpClient& client) {
+        client.OnData([&](const char*, size_t len) {
+            received += len;
+        });
+    });
+
+    TcpClient* stalled = nullptr;
+    auto& mirror = TcpServer::Create(loop);
+    assert(mirror.Listen(19555));
+    mirror.OnConnection([&](TcpClient& client) {
+        client.ReadStop();
+        stalled = &client;
+    });
+
+    std::string data(size, 'x');
+    auto& client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        client.Write(data.data(), data.size());
+    });
+    client.Connect(19553);
+
+    std::string status;
+    bool closed = false;
+    auto& timer = Timer::Create(loop, 100);
+    timer.OnTick([&] {
+        if (received < size) {
+            return;
+        }
+        if (!closed) {
+            client.Close();
+            closed = true;
+            return;
+        }
+        status = GetStatus(proxy);
+        timer.Close();
+        proxy.Close();
+        server.Close();
+        mirror.Close();
+        stalled->Close();
+    });
+    timer.Start();
+
+    loop.Run();
+
+    assert(received == size);
+    assert(status.find(R"("overflows":1,)") != std::string::npos);
+
+    // Half of the connections are mirrored, every other one
+    config::Mirror config;
+    config.sample = 50;
+    Mirror sampler(config);
+    assert(!sampler.Sample() && sampler.Sample() && !sampler.Sample() && sampler.Sample());
+    assert(sampler.stats.connections == 2);
+}
+
 void TestTcpProxy() {
     // std::thread t1(start_http_server);
     // std::thread t2(start_proxy_server);
@@ -368,6 +765,13 @@ void TestTcpProxy() {
     TestUpstreamConnectFailure2();
     TestUpstreamConnectSuccess();
     TestUpstreamConnectSuccess2();
+    TestOptimisticConnect();
+    TestOptimisticConnectFallback();
+    TestWaitQueue();
+    TestProxyProtocol();
+    TestProxyHeaderTimeout();
+    TestMirror();
+    TestMirrorOverflow();
 }
 
 }  // namespace test
@@ -1,6 +1,12 @@
 #include <assert.h>
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <thread>
+#include <vector>
 
 #include "logger.h"
 #include "string_buffer.h"
@@ -35,8 +41,123 @@ static void start_tcp_server(int port) {
 
 void run_test_echo_server(void (*start_server)(int));
 
+// Connections are told apart by the port of the range they came in on
+static void test_port_range() {
+    EventLoop loop;
+    auto& server = TcpServer::Create(loop);
+    std::vector<int> listeners;
+    server.OnConnection([&](TcpClient& client) {
+        listeners.push_back(server.listener());
+        client.Close();
+        if (listeners.size() == 2) {
+            server.Close();
+        }
+    });
+    assert(server.Listen(TEST_PORT + 10, 100));
+
+    for (int port : {TEST_PORT + 10 + 99, TEST_PORT + 10}) {
+        auto& client = TcpClient::Create(loop);
+        client.Connect("127.0.0.1", port);
+        client.OnClose([] {});
+        client.OnData([&client](const char*, size_t) {});
+        client.OnError([&client](int, const char*) {
+            client.Close();
+        });
+    }
+    loop.Run();
+
+    std::sort(listeners.begin(), listeners.end());
+    assert(listeners == std::vector<int>({0, 99}));
+}
+
+// Echoes one message over a Unix domain socket and over IPv6 loopback
+static void test_unix_and_ipv6() {
+    const char *path = "/tmp/nexer-test.sock";
+
+    for (bool unix : {true, false}) {
+        EventLoop loop;
+        auto& server = TcpServer::Create(loop, unix);
+        server.OnConnection([&](TcpClient& client) {
+            client.OnData([&](const char* s, size_t len) {
+                static char copy[256];
+                memcpy(copy, s, len);
+                client.Write(copy, len);
+            });
+        });
+        if (unix) {
+            assert(server.ListenUnix(path));
+        } else if (!server.Listen("::1", TEST_PORT + 5)) {
+            // No IPv6 here
+            server.Close();
+            loop.Run();
+            continue;
+        }
+        auto name = server.GetSockName();
+        assert(name == (unix ? std::string("unix:") + path : "[::1]:" + std::to_string(TEST_PORT + 5)));
+
+        std::string echoed, peer;
+        auto& client = TcpClient::Create(loop, unix);
+        client.OnConnect([&] {
+            peer = client.GetPeerName();
+            client.Write("hello", 5);
+        });
+        client.OnData([&](const char* s, size_t len) {
+            echoed.append(s, len);
+            client.Close();
+            server.Close();
+        });
+        client.OnError([&](int, const char*) {
+            client.Close();
+            server.Close();
+        });
+        if (unix) {
+            client.ConnectUnix(path);
+        } else {
+            client.Connect("::1", TEST_PORT + 5);
+        }
+        loop.Run();
+
+        assert(echoed == "hello");
+        assert(peer == name);
+    }
+    // Removed along with the server
+    assert(access(path, F_OK) != 0);
+}
+
+// A socket left behind is replaced, one being listened on is not
+static void test_unix_stale_socket() {
+    const char *path = "/tmp/nexer-test-stale.sock";
+    unlink(path);
+
+    // Bound and closed without being removed
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof addr) == 0);
+    close(fd);
+    assert(access(path, F_OK) == 0);
+
+    EventLoop loop;
+    auto& server = TcpServer::Create(loop, true);
+    assert(server.ListenUnix(path));
+
+    auto& other = TcpServer::Create(loop, true);
+    assert(!other.ListenUnix(path));
+    other.Close();
+    assert(access(path, F_OK) == 0);
+
+    server.Close();
+    loop.Run();
+    assert(access(path, F_OK) != 0);
+}
+
 void TestTcpServer() {
     run_test_echo_server(start_tcp_server);
+    test_port_range();
+    test_unix_and_ipv6();
+    test_unix_stale_socket();
 }
 
 }  // namespace test
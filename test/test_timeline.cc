@@ -0,0 +1,69 @@
+#include <assert.h>
+
+#include <sstream>
+
+#include "timeline.h"
+
+namespace nexer {
+namespace test {
+
+static void test_events() {
+    Timeline timeline(7);
+    timeline.Add(Timeline::Event::Accept);
+    timeline.Add(Timeline::Event::ConnectFailed, -111);
+    timeline.Add(Timeline::Event::Established);
+
+    assert(timeline.size == 3);
+    assert(timeline.Has(Timeline::Event::ConnectFailed));
+    assert(!timeline.Has(Timeline::Event::CheckStart));
+    assert(!timeline.IsClosed());
+    assert(timeline.ToString() == "accept +0, connect_failed +0 (-111), established +0");
+
+    timeline.Add(Timeline::Event::UpstreamClose);
+    assert(timeline.IsClosed());
+
+    std::stringstream ss;
+    JsonWriter json(ss);
+    timeline.Write(json);
+    assert(ss.str().find(R"("id":7,)") != std::string::npos);
+    assert(ss.str().find(R"({"event":"connect_failed","time":0,"value":-111})") != std::string::npos);
+}
+
+// The last event is kept when there are too many
+static void test_truncate() {
+    Timeline timeline(1);
+    for (size_t i = 0; i < Timeline::kMaxEvents + 4; i++) {
+        timeline.Add(Timeline::Event::Connect);
+    }
+    timeline.Add(Timeline::Event::ClientClose);
+
+    assert(timeline.size == Timeline::kMaxEvents);
+    assert(timeline.truncated);
+    assert(timeline.entries[Timeline::kMaxEvents - 1].event == Timeline::Event::ClientClose);
+}
+
+static void test_ring() {
+    TimelineRing ring(3);
+    for (uint64_t id = 1; id <= 5; id++) {
+        ring.Add(Timeline(id));
+    }
+
+    assert(ring.size() == 3);
+    assert(ring.Find(2) == nullptr);
+    assert(ring.Find(4)->id == 4);
+
+    std::vector<uint64_t> ids;
+    ring.ForEach(10, [&](const Timeline& timeline) {
+        ids.push_back(timeline.id);
+    });
+    assert(ids == std::vector<uint64_t>({5, 4, 3}));
+}
+
+void TestTimeline() {
+    test_events();
+    test_truncate();
+    test_ring();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -0,0 +1,387 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "logger.h"
+#include "tcp_proxy.h"
+#include "tls.h"
+
+#define TEST_CERT "/tmp/nexer-test-cert.pem"
+#define TEST_KEY "/tmp/nexer-test-key.pem"
+
+namespace nexer {
+namespace test {
+
+// A self-signed certificate for localhost and 127.0.0.1
+static void MakeCertificate() {
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    X509 *x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    auto name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, x509, x509, nullptr, nullptr, 0);
+    auto ext = X509V3_EXT_conf_nid(nullptr, &ctx, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+    X509_add_ext(x509, ext, -1);
+    X509_EXTENSION_free(ext);
+    X509_sign(x509, pkey, EVP_sha256());
+
+    FILE *f = fopen(TEST_CERT, "w");
+    PEM_write_X509(f, x509);
+    fclose(f);
+    f = fopen(TEST_KEY, "w");
+    PEM_write_PrivateKey(f, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(f);
+
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+}
+
+static config::Tls ServerConfig() {
+    config::Tls tls;
+    tls.enabled = true;
+    tls.cert = TEST_CERT;
+    tls.key = TEST_KEY;
+    return tls;
+}
+
+static config::Tls ClientConfig(const char *server_name) {
+    config::Tls tls;
+    tls.enabled = true;
+    tls.ca = TEST_CERT;
+    tls.server_name = server_name;
+    return tls;
+}
+
+// Hands everything in wire to the session
+static int Feed(TlsSession &session, IoBuffer &wire, IoBuffer &plain, IoBuffer &reply) {
+    auto data = wire.ToString();
+    wire.Clear();
+    return session.Read(data.data(), data.size(), plain, reply);
+}
+
+static void test_handshake() {
+    auto server_context = TlsContext::Create(ServerConfig(), true);
+    auto client_context = TlsContext::Create(ClientConfig("localhost"), false);
+    assert(server_context && client_context);
+
+    TlsSession server(server_context), client(client_context);
+    IoBuffer to_server, to_client, plain;
+    client.Start(to_server);
+    assert(!to_server.empty());
+    for (int i = 0; i < 4 && !(server.IsEstablished() && client.IsEstablished()); i++) {
+        assert(Feed(server, to_server, plain, to_client) == 0);
+        assert(Feed(client, to_client, plain, to_server) == 0);
+    }
+    assert(server.IsEstablished() && client.IsEstablished());
+    assert(plain.empty());
+
+    IoBuffer data;
+    data.Write("hello", 5);
+    assert(client.Write(data, to_server) == 0);
+    assert(data.empty());
+    assert(Feed(server, to_server, plain, to_client) == 0);
+    assert(plain == "hello");
+
+    plain.Clear();
+    data.Write("world", 5);
+    assert(server.Write(data, to_client) == 0);
+    assert(Feed(client, to_client, plain, to_server) == 0);
+    assert(plain == "world");
+
+    assert(server_context->stats().handshakes == 1);
+    assert(client_context->stats().handshakes == 1);
+    assert(server_context->stats().failures == 0);
+
+    // Without a socket to hand it to, the session stays in userspace
+    server.Offload(-1, true);
+    assert(!server.ktls_tx() && !server.ktls_rx());
+    assert(server_context->stats().ktls_fallbacks == 1);
+}
+
+static void test_verify_failure() {
+    auto server_context = TlsContext::Create(ServerConfig(), true);
+    auto client_context = TlsContext::Create(ClientConfig("example.com"), false);
+
+    TlsSession server(server_context), client(client_context);
+    IoBuffer to_server, to_client, plain;
+    client.Start(to_server);
+    assert(Feed(server, to_server, plain, to_client) == 0);
+    assert(Feed(client, to_client, plain, to_server) == UV_EPROTO);
+    assert(!client.IsEstablished());
+    assert(client_context->stats().failures == 1);
+    assert(client_context->stats().handshakes == 0);
+
+    // The alert the client sent makes the server give up too
+    assert(!to_server.empty());
+    assert(Feed(server, to_server, plain, to_client) == UV_EPROTO);
+    assert(server_context->stats().failures == 1);
+}
+
+static void test_missing_certificate() {
+    config::Tls tls = ServerConfig();
+    tls.cert = "/tmp/nexer-test-missing.pem";
+    assert(!TlsContext::Create(tls, true));
+}
+
+// Plain client -> proxy originating TLS -> proxy terminating it -> echo
+static void test_proxy() {
+    EventLoop loop;
+
+    config::Upstream echo_upstream;
+    echo_upstream.host = "127.0.0.1";
+    echo_upstream.port = 19532;
+    echo_upstream.app = nullptr;
+    auto &terminating = TcpProxy::Create(loop, echo_upstream, nullptr);
+    assert(terminating.InitTls(ServerConfig()));
+    assert(terminating.Listen(19531));
+
+    config::Upstream tls_upstream;
+    tls_upstream.host = "127.0.0.1";
+    tls_upstream.port = 19531;
+    tls_upstream.app = nullptr;
+    tls_upstream.tls = ClientConfig("localhost");
+    auto &originating = TcpProxy::Create(loop, tls_upstream, nullptr);
+    assert(originating.InitTls(config::Tls()));
+    assert(originating.Listen(19530));
+
+    auto &echo = TcpServer::Create(loop);
+    assert(echo.Listen(19532));
+    echo.OnConnection([&](TcpClient &client) {
+        client.OnData([&client](const char *s, size_t len) {
+            client.Write(s, len);
+        });
+    });
+
+    std::string received;
+    auto &client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        client.Write("hello", 5);
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+        if (received.size() == 5) {
+            client.Close();
+        }
+    });
+
+    // The forwarders have to be gone before the proxies are
+    std::stringstream terminating_status, originating_status;
+    auto &timer = Timer::Create(loop, 100);
+    timer.OnTick([&] {
+        if (received.size() < 5) {
+            return;
+        }
+        for (auto proxy : {&terminating, &originating}) {
+            JsonWriter json(proxy == &terminating ? terminating_status : originating_status);
+            json.BeginObject();
+            proxy->WriteStatus(json);
+            json.EndObject();
+        }
+        timer.Close();
+        originating.Close();
+        terminating.Close();
+        echo.Close();
+    });
+    timer.Start();
+    client.Connect(19530);
+
+    loop.Run();
+
+    assert(received == "hello");
+    auto status = terminating_status.str();
+    assert(status.find(R"("tls":{"handshakes":1,"failures":0,)") != std::string::npos);
+    // The kernel takes both directions, or the session counts as a fallback
+    assert(status.find(R"("ktls_rx":1,"ktls_fallbacks":0})") != std::string::npos ||
+           status.find(R"("ktls_fallbacks":1})") != std::string::npos);
+    assert(originating_status.str().find(R"("upstream_tls":{"handshakes":1,"failures":0,)") != std::string::npos);
+}
+
+// What a client sends before the upstream handshake is done reaches the
+// mirror once, not again on every later flush
+static void test_mirror() {
+    EventLoop loop;
+
+    config::Upstream echo_upstream;
+    echo_upstream.host = "127.0.0.1";
+    echo_upstream.port = 19535;
+    echo_upstream.app = nullptr;
+    auto &terminating = TcpProxy::Create(loop, echo_upstream, nullptr);
+    assert(terminating.InitTls(ServerConfig()));
+    assert(terminating.Listen(19534));
+
+    config::Upstream tls_upstream;
+    tls_upstream.host = "127.0.0.1";
+    tls_upstream.port = 19534;
+    tls_upstream.app = nullptr;
+    tls_upstream.tls = ClientConfig("localhost");
+    tls_upstream.mirror.port = 19536;
+    auto &originating = TcpProxy::Create(loop, tls_upstream, nullptr);
+    assert(originating.InitTls(config::Tls()));
+    assert(originating.Listen(19533));
+
+    auto &echo = TcpServer::Create(loop);
+    assert(echo.Listen(19535));
+    echo.OnConnection([&](TcpClient &client) {
+        client.OnData([&client](const char *s, size_t len) {
+            client.Write(s, len);
+        });
+    });
+
+    std::string mirrored;
+    auto &mirror = TcpServer::Create(loop);
+    assert(mirror.Listen(19536));
+    mirror.OnConnection([&](TcpClient &client) {
+        client.OnData([&](const char *s, size_t len) {
+            mirrored.append(s, len);
+        });
+    });
+
+    std::string received;
+    auto &client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        client.Write("hello", 5);
+        client.Write(" world", 6);
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+        if (received.size() == 11) {
+            client.Close();
+        }
+    });
+
+    auto &timer = Timer::Create(loop, 100);
+    timer.OnTick([&] {
+        if (received.size() < 11) {
+            return;
+        }
+        timer.Close();
+        originating.Close();
+        terminating.Close();
+        echo.Close();
+        mirror.Close();
+    });
+    timer.Start();
+    client.Connect(19533);
+
+    loop.Run();
+
+    assert(received == "hello world");
+    assert(mirrored == "hello world");
+}
+
+static void SendAll(int fd, IoBuffer &wire) {
+    auto data = wire.ToString();
+    wire.Clear();
+    assert(send(fd, data.data(), data.size(), 0) == ssize_t(data.size()));
+}
+
+// A client that handed sending to the kernel cannot answer the server's
+// KeyUpdate, so the session fails rather than OpenSSL's reply being
+// encrypted again. Needs the kernel's TLS module.
+static void test_key_update_after_offload() {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(listener, (struct sockaddr *)&addr, sizeof addr) == 0 && listen(listener, 1) == 0);
+    assert(getsockname(listener, (struct sockaddr *)&addr, &len) == 0);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0);
+    int peer_fd = accept(listener, nullptr, nullptr);
+    close(listener);
+
+    // The server, plain OpenSSL on its socket
+    std::atomic<int> offloaded{-1};
+    std::thread peer([peer_fd, &offloaded] {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+        SSL_CTX_use_certificate_file(ctx, TEST_CERT, SSL_FILETYPE_PEM);
+        SSL_CTX_use_PrivateKey_file(ctx, TEST_KEY, SSL_FILETYPE_PEM);
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, peer_fd);
+        if (SSL_accept(ssl) == 1) {
+            while (offloaded < 0) {
+                uv_sleep(1);
+            }
+            if (offloaded) {
+                SSL_key_update(ssl, SSL_KEY_UPDATE_REQUESTED);
+                SSL_write(ssl, "x", 1);
+            }
+            char buf[64];
+            while (SSL_read(ssl, buf, sizeof buf) > 0) {
+            }
+        }
+        SSL_free(ssl);
+        SSL_CTX_free(ctx);
+        close(peer_fd);
+    });
+
+    auto context = TlsContext::Create(ClientConfig("localhost"), false);
+    TlsSession client(context);
+    IoBuffer wire, plain;
+    char buf[16384];
+    client.Start(wire);
+    SendAll(fd, wire);
+    while (!client.IsEstablished()) {
+        ssize_t n = recv(fd, buf, sizeof buf, 0);
+        assert(n > 0 && client.Read(buf, n, plain, wire) == 0);
+        SendAll(fd, wire);
+    }
+
+    client.Offload(fd, true);
+    offloaded = client.ktls_tx();
+    int status = 0;
+    while (offloaded && status == 0) {
+        ssize_t n = recv(fd, buf, sizeof buf, 0);
+        assert(n > 0);
+        status = client.Read(buf, n, plain, wire);
+    }
+    // Let the server finish writing before its peer goes away
+    shutdown(fd, SHUT_WR);
+    while (recv(fd, buf, sizeof buf, 0) > 0) {
+    }
+    close(fd);
+    peer.join();
+
+    if (!offloaded) {
+        log_info("kTLS not available, key update after offload not tested");
+        return;
+    }
+    assert(status == UV_EPROTO);
+    assert(wire.empty() && plain == "x");
+}
+
+void TestTls() {
+    MakeCertificate();
+    test_handshake();
+    test_verify_failure();
+    test_missing_certificate();
+    test_proxy();
+    test_mirror();
+    test_key_update_after_offload();
+    remove(TEST_CERT);
+    remove(TEST_KEY);
+}
+
+}  // namespace test
+}  // namespace nexer
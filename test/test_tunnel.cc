@@ -0,0 +1,334 @@
+#include <assert.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tcp_proxy.h"
+#include "tunnel.h"
+
+namespace nexer {
+namespace test {
+
+#define TUNNEL_PORT 19580
+#define ECHO_PORT 19581
+#define SINK_PORT 19582
+#define CLOSING_PORT 19583
+#define PROXY_PORT 19584
+
+template <typename T>
+static std::string GetStatus(T &t) {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    t.WriteStatus(json);
+    return ss.str();
+}
+
+// Both ends of a tunnel in one loop, with a proxy listening on PROXY_PORT
+// carrying its connections to port on the accepting end's side, and
+// servers there: one echoing, one never reading and one saying "bye" and
+// closing
+struct TunnelTest {
+    EventLoop loop;
+    config::Tunnel listen;
+    config::Upstream upstream;
+    TunnelServer *server;
+    Tunnel *tunnel;
+    TcpProxy *proxy;
+    TcpServer *echo;
+    TcpServer *sink;
+    TcpServer *closing;
+    // Never closed by the other end, not being read
+    std::vector<TcpClient *> sunk;
+
+    TunnelTest(int port, const std::string &secret = {}, const std::string &tunnel_secret = {}) {
+        listen.port = TUNNEL_PORT;
+        listen.allow = {ECHO_PORT, SINK_PORT, CLOSING_PORT};
+        listen.connect_timeout = 500;
+        listen.secret = secret;
+        server = &TunnelServer::Create(loop, listen);
+        assert(server->Listen("127.0.0.1", TUNNEL_PORT));
+
+        upstream.host = "nexer://127.0.0.1:" + std::to_string(TUNNEL_PORT);
+        upstream.tunnel_host = "127.0.0.1";
+        upstream.tunnel_port = TUNNEL_PORT;
+        upstream.tunnel_secret = tunnel_secret;
+        upstream.port = port;
+        upstream.app = nullptr;
+        tunnel = &Tunnel::Create(loop, upstream.tunnel_host, upstream.tunnel_port, upstream.tunnel_secret);
+        proxy = &TcpProxy::Create(loop, upstream, nullptr);
+        proxy->SetTunnel(tunnel);
+        assert(proxy->Listen(PROXY_PORT));
+
+        echo = &TcpServer::Create(loop);
+        assert(echo->Listen(ECHO_PORT));
+        echo->OnConnection([](TcpClient &client) {
+            client.OnData([&client](const char *s, size_t len) {
+                client.Write(s, len);
+            });
+        });
+
+        sink = &TcpServer::Create(loop);
+        assert(sink->Listen(SINK_PORT));
+        sink->OnConnection([this](TcpClient &client) {
+            client.ReadStop();
+            sunk.push_back(&client);
+        });
+
+        closing = &TcpServer::Create(loop);
+        assert(closing->Listen(CLOSING_PORT));
+        closing->OnConnection([](TcpClient &client) {
+            client.OnData([&client](const char *, size_t) {
+                client.Write("bye", 3);
+                client.OnSend([&client] {
+                    client.Close();
+                });
+            });
+        });
+    }
+
+    void Close() {
+        proxy->Close();
+        tunnel->Close();
+        server->Close();
+        echo->Close();
+        sink->Close();
+        closing->Close();
+        for (auto client : sunk) {
+            client->Close();
+        }
+    }
+};
+
+// Several connections at once over the one tunnel connection
+static void test_echo() {
+    TunnelTest t(ECHO_PORT);
+
+    std::string sent;
+    for (size_t i = 0; sent.size() < 256 * 1024; i++) {
+        sent += std::to_string(i) + ' ';
+    }
+    std::string received[3];
+    int done = 0;
+    std::string tunnel_status;
+    for (auto &data : received) {
+        auto &client = TcpClient::Create(t.loop);
+        client.OnConnect([&] {
+            for (size_t i = 0; i < sent.size(); i += 65536) {
+                client.Write(sent.data() + i, std::min<size_t>(65536, sent.size() - i));
+            }
+        });
+        client.OnData([&](const char *s, size_t len) {
+            data.append(s, len);
+            if (data.size() == sent.size()) {
+                client.Close();
+            }
+        });
+        client.OnClose([&] {
+            if (++done == 3) {
+                tunnel_status = GetStatus(*t.tunnel);
+                t.Close();
+            }
+        });
+        client.Connect(PROXY_PORT);
+    }
+
+    t.loop.Run();
+    for (auto &data : received) {
+        assert(data == sent);
+    }
+    assert(tunnel_status.find(R"("connected":true,)") != std::string::npos);
+    assert(tunnel_status.find(R"("connects":1,"opened":3,)") != std::string::npos);
+}
+
+// A connection whose upstream takes nothing holds up only itself: the
+// client is left with what does not fit in the window, while another
+// connection goes through
+static void test_flow_control() {
+    TunnelTest t(SINK_PORT);
+
+    std::string data(32 << 20, 'x');
+    auto &stalled = TcpClient::Create(t.loop);
+    stalled.OnConnect([&] {
+        stalled.Write(data.data(), data.size());
+    });
+    stalled.Connect(PROXY_PORT);
+
+    config::Upstream upstream = t.upstream;
+    upstream.port = ECHO_PORT;
+    auto &proxy = TcpProxy::Create(t.loop, upstream, nullptr);
+    proxy.SetTunnel(t.tunnel);
+    assert(proxy.Listen(PROXY_PORT + 1));
+
+    std::string received;
+    size_t queued = 0;
+    auto &timer = Timer::Create(t.loop, 200);
+    timer.OnTick([&] {
+        timer.Close();
+        auto &client = TcpClient::Create(t.loop);
+        client.OnConnect([&client] {
+            client.Write("hello", 5);
+        });
+        client.OnData([&](const char *s, size_t len) {
+            received.append(s, len);
+            queued = stalled.GetWriteQueueSize();
+            client.Close();
+            stalled.Close();
+            proxy.Close();
+            t.Close();
+        });
+        client.Connect(PROXY_PORT + 1);
+    });
+    timer.Start();
+
+    t.loop.Run();
+    assert(received == "hello");
+    assert(queued > 0);
+}
+
+// Streams to ports not allowed are closed at once, leaving the tunnel up
+static void test_refused() {
+    TunnelTest t(TUNNEL_PORT);
+
+    bool closed = false;
+    std::string received, status;
+    auto &client = TcpClient::Create(t.loop);
+    client.OnConnect([&client] {
+        client.Write("hi", 2);
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+    });
+    client.OnClose([&] {
+        closed = true;
+        status = GetStatus(*t.server);
+        t.Close();
+    });
+    client.Connect(PROXY_PORT);
+
+    t.loop.Run();
+    assert(closed);
+    assert(received.empty());
+    assert(status.find(R"("connected":true,)") != std::string::npos);
+    assert(status.find(R"("refused":1,)") != std::string::npos);
+}
+
+// What the upstream sends before closing still reaches the client
+static void test_upstream_close() {
+    TunnelTest t(CLOSING_PORT);
+
+    std::string received;
+    bool closed = false;
+    auto &client = TcpClient::Create(t.loop);
+    client.OnConnect([&client] {
+        client.Write("hi", 2);
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+    });
+    client.OnClose([&] {
+        closed = true;
+        t.Close();
+    });
+    client.Connect(PROXY_PORT);
+
+    t.loop.Run();
+    assert(received == "bye");
+    assert(closed);
+}
+
+// Streams only go through once both ends have shown they know the secret
+static void test_secret() {
+    for (auto secret : {"s3cret", "wrong", ""}) {
+        TunnelTest t(ECHO_PORT, "s3cret", secret);
+
+        std::string received, status;
+        bool closed = false;
+        auto &client = TcpClient::Create(t.loop);
+        client.OnConnect([&client] {
+            client.Write("hello", 5);
+        });
+        client.OnData([&](const char *s, size_t len) {
+            received.append(s, len);
+            client.Close();
+        });
+        client.OnClose([&] {
+            closed = true;
+            status = GetStatus(*t.tunnel);
+            t.Close();
+        });
+        client.Connect(PROXY_PORT);
+
+        t.loop.Run();
+        assert(closed);
+        if (secret == std::string("s3cret")) {
+            assert(received == "hello");
+            assert(status.find(R"("connected":true,)") != std::string::npos);
+        } else {
+            assert(received.empty());
+            assert(status.find(R"("connected":false,)") != std::string::npos);
+        }
+    }
+}
+
+static void PutFrame(std::string &buf, uint32_t id, uint8_t type, const std::string &payload) {
+    char header[8] = {char(id >> 24), char(id >> 16), char(id >> 8), char(id), char(type), 0,
+                      char(payload.size() >> 8), char(payload.size())};
+    buf.append(header, sizeof header);
+    buf += payload;
+}
+
+// A peer sending a stream more than its window, its connection not taking
+// any: the stream is reset, not buffered without bound
+static void test_window_exceeded() {
+    TunnelTest t(TUNNEL_PORT);
+
+    std::string frames;
+    PutFrame(frames, 0, 0, std::string("NEXR\x01", 5) + std::string(16, 'n'));
+    PutFrame(frames, 1, 1, std::string{char(SINK_PORT >> 8), char(SINK_PORT & 0xff)});
+    std::string data(16384, 'x');
+    while (frames.size() < (32 << 20)) {
+        PutFrame(frames, 1, 2, data);
+    }
+
+    std::string received;
+    int error = 0;
+    auto &peer = TcpClient::Create(t.loop);
+    peer.OnConnect([&] {
+        peer.Write(frames.data(), frames.size());
+    });
+    peer.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+        while (received.size() >= 8) {
+            auto p = (const uint8_t *)received.data();
+            size_t length = p[6] << 8 | p[7];
+            if (received.size() < 8 + length) {
+                break;
+            }
+            // Close of stream 1
+            if (p[3] == 1 && p[4] == 4 && length == 4) {
+                error = int32_t(p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11]);
+                peer.Close();
+                t.Close();
+                return;
+            }
+            received.erase(0, 8 + length);
+        }
+    });
+    peer.Connect(TUNNEL_PORT);
+
+    t.loop.Run();
+    assert(error == UV_ENOBUFS);
+}
+
+void TestTunnel() {
+    test_echo();
+    test_flow_control();
+    test_refused();
+    test_upstream_close();
+    test_secret();
+    test_window_exceeded();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -0,0 +1,201 @@
+#include <assert.h>
+
+#include "udp_proxy.h"
+
+#include <sstream>
+#include <vector>
+
+namespace nexer {
+namespace test {
+
+#define ECHO_PORT 19601
+#define PROXY_PORT 19602
+
+static std::string GetStatus(ProcessManager &manager) {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    manager.WriteStatus(json);
+    return ss.str();
+}
+
+static std::string GetStatus(UdpProxy &proxy) {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    json.BeginObject();
+    proxy.WriteStatus(json);
+    json.EndObject();
+    return ss.str();
+}
+
+// The upstream is looked up asynchronously, packets queueing meanwhile
+static void test_echo(const char *host) {
+    EventLoop loop;
+
+    auto& echo = UdpServer::Create(loop);
+    echo.OnRecv([&echo](const char* s, size_t len, const struct sockaddr* addr) {
+        echo.Send(s, len, addr);
+    });
+    assert(echo.Listen(ECHO_PORT));
+
+    config::Proxy config;
+    config.protocol = config::Proxy::Protocol::Udp;
+    config.port = PROXY_PORT;
+    config.upstream.host = host;
+    config.upstream.port = ECHO_PORT;
+    config.upstream.app = nullptr;
+
+    auto& proxy = UdpProxy::Create(loop, config, nullptr);
+    assert(proxy.Listen(PROXY_PORT));
+
+    struct sockaddr_in addr;
+    assert(uv_ip4_addr("127.0.0.1", PROXY_PORT, &addr) == 0);
+
+    auto& client = UdpServer::Create(loop);
+    assert(client.Connect((const struct sockaddr*)&addr));
+
+    int replies = 0;
+    client.OnRecv([&](const char* s, size_t len, const struct sockaddr*) {
+        assert(len == 4 && memcmp(s, "PING", 4) == 0);
+        if (++replies < 3) {
+            return;
+        }
+
+        // All packets from one address share a session
+        assert(proxy.sessions().size() == 1);
+        proxy.sessions().ForEach([](const UdpSession& session) {
+            assert(session.stats.packets_in == 3);
+            assert(session.stats.bytes_in == 12);
+            assert(session.stats.packets_out == 3);
+            assert(session.pending.empty());
+        });
+
+        auto status = GetStatus(proxy);
+        assert(status.find("\"sessions_count\":1") != std::string::npos);
+        assert(status.find("\"connected\":true") != std::string::npos);
+        assert(status.find("\"packets_in\":3") != std::string::npos);
+
+        client.Close();
+        proxy.Close();
+        echo.Close();
+    });
+
+    // All three are queued while the upstream is looked up
+    for (int i = 0; i < 3; i++) {
+        assert(client.Send("PING", 4) == 0);
+    }
+
+    loop.Run();
+
+    assert(replies == 3);
+}
+
+// Sessions waiting for a failed lookup are dropped, and new ones are not
+// opened until the lookup may be retried
+static void test_resolve_failure() {
+    EventLoop loop;
+
+    config::Proxy config;
+    config.protocol = config::Proxy::Protocol::Udp;
+    config.port = PROXY_PORT;
+    config.upstream.host = "nexer-test.invalid";
+    config.upstream.port = ECHO_PORT;
+    config.upstream.app = nullptr;
+
+    auto& proxy = UdpProxy::Create(loop, config, nullptr);
+    assert(proxy.Listen(PROXY_PORT));
+
+    struct sockaddr_in addr;
+    assert(uv_ip4_addr("127.0.0.1", PROXY_PORT, &addr) == 0);
+
+    auto& client = UdpServer::Create(loop);
+    assert(client.Connect((const struct sockaddr*)&addr));
+
+    // Sessions right after each packet has been handled
+    std::vector<size_t> sizes;
+    proxy.OnRecvBatch([&](const UdpServer::Datagram*, size_t) {
+        sizes.push_back(proxy.sessions().size());
+    });
+    assert(client.Send("PING", 4) == 0);
+
+    // Sends again as soon as the lookup has failed, well within the backoff
+    auto& timer = Timer::Create(loop, 20);
+    int ticks = 0, sent = 0;
+    timer.OnTick([&] {
+        ticks++;
+        if (!sent && proxy.sessions().size() == 0) {
+            client.Send("PING", 4);
+            sent = ticks;
+        } else if (sent && ticks == sent + 3) {
+            timer.Close();
+            client.Close();
+            proxy.Close();
+        }
+        assert(ticks < 500);
+    });
+    timer.Start();
+
+    loop.Run();
+    assert(sizes.size() == 2);
+    assert(sizes[0] == 1);
+    assert(sizes[1] == 0);
+}
+
+// A session holds the upstream app as a connection would, keeping it from
+// being stopped for being idle
+static void test_app() {
+    EventLoop loop;
+    ProcessManager manager(loop);
+
+    auto& echo = UdpServer::Create(loop);
+    echo.OnRecv([&echo](const char* s, size_t len, const struct sockaddr* addr) {
+        echo.Send(s, len, addr);
+    });
+    assert(echo.Listen(ECHO_PORT));
+
+    config::App app = {
+        .command = {
+            .file = "sleep",
+            .args = std::vector<std::string>({"10"}),
+        },
+    };
+    config::Proxy config;
+    config.protocol = config::Proxy::Protocol::Udp;
+    config.port = PROXY_PORT;
+    config.upstream.host = "127.0.0.1";
+    config.upstream.port = ECHO_PORT;
+    config.upstream.app = &app;
+
+    auto& proxy = UdpProxy::Create(loop, config, &manager);
+    assert(proxy.Listen(PROXY_PORT));
+
+    struct sockaddr_in addr;
+    assert(uv_ip4_addr("127.0.0.1", PROXY_PORT, &addr) == 0);
+    auto& client = UdpServer::Create(loop);
+    assert(client.Connect((const struct sockaddr*)&addr));
+
+    std::string status;
+    client.OnRecv([&](const char*, size_t, const struct sockaddr*) {
+        status = GetStatus(manager);
+        client.Close();
+        proxy.Close();
+        echo.Close();
+        manager.Require(app, [&](Process* process, int) {
+            process->Kill(SIGKILL);
+        });
+    });
+    assert(client.Send("PING", 4) == 0);
+
+    loop.Run();
+    assert(status.find("\"connections\":1,") != std::string::npos);
+    assert(GetStatus(manager).find("\"connections\":0,") != std::string::npos);
+}
+
+void TestUdpProxy() {
+    test_echo("127.0.0.1");
+    test_echo("localhost");
+    test_resolve_failure();
+    test_app();
+}
+
+}  // namespace test
+}  // namespace nexer
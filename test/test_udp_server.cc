@@ -43,6 +43,44 @@ static void OnClientSend(uv_udp_send_t* req, int status) {
     free(req->data);
 }
 
+static void TestBatch() {
+    EventLoop loop;
+    UdpServer& server = UdpServer::Create(loop);
+    UdpServer& client = UdpServer::Create(loop);
+
+    size_t received = 0;
+    size_t largest = 0;
+    server.OnRecvBatch([&](const UdpServer::Datagram* datagrams, size_t count) {
+        largest = count > largest ? count : largest;
+        for (size_t i = 0; i < count; i++) {
+            assert(datagrams[i].len == 4 && memcmp(datagrams[i].data, "DATA", 4) == 0);
+            assert(datagrams[i].addr != nullptr);
+        }
+        received += count;
+        if (received == 8) {
+            server.Close();
+            client.Close();
+        }
+    });
+    assert(server.Listen(TEST_PORT));
+
+    struct sockaddr_in addr;
+    assert(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr) == 0);
+    assert(client.Connect((const struct sockaddr*)&addr));
+
+    UdpServer::Datagram datagrams[8];
+    for (auto& datagram : datagrams) {
+        datagram = {"DATA", 4, nullptr};
+    }
+    assert(client.Send(datagrams, 8) == 0);
+
+    loop.Run();
+    assert(received == 8);
+    // All eight are in the socket by the first read, so recvmmsg takes more
+    // than one at a time
+    assert(largest > 1);
+}
+
 void TestUdpServer() {
     EventLoop loop;
     UdpServer& server = UdpServer::Create(loop);
@@ -77,6 +115,8 @@ void TestUdpServer() {
     assert(err == 0);
 
     loop.Run();
+
+    TestBatch();
 }
 
 }  // namespace test
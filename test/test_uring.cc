@@ -0,0 +1,168 @@
+#include <assert.h>
+
+#include <sstream>
+#include <string>
+
+#include "tcp_proxy.h"
+#include "uring.h"
+
+namespace nexer {
+namespace test {
+
+static std::string GetStatus(Uring &uring) {
+    std::stringstream ss;
+    JsonWriter json(ss);
+    uring.WriteStatus(json);
+    return ss.str();
+}
+
+// A client sending size bytes through a proxy to an echo server, the proxy
+// handing the connection to io_uring; returns what came back
+static std::string Echo(const config::Uring &config, size_t size, std::string &status) {
+    EventLoop loop;
+    auto uring = Uring::Create(loop, config);
+    assert(uring);
+
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19571;
+    upstream.app = nullptr;
+    auto &proxy = TcpProxy::Create(loop, upstream, nullptr);
+    proxy.SetUring(uring);
+    assert(proxy.Listen(19570));
+
+    auto &echo = TcpServer::Create(loop);
+    assert(echo.Listen(19571));
+    echo.OnConnection([&](TcpClient &client) {
+        client.OnData([&client](const char *s, size_t len) {
+            client.Write(s, len);
+        });
+    });
+
+    std::string sent, received;
+    for (size_t i = 0; sent.size() < size; i++) {
+        sent += std::to_string(i) + ' ';
+    }
+    sent.resize(size);
+
+    auto &client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        // In pieces, some of them before the proxy has the upstream
+        for (size_t i = 0; i < sent.size(); i += 65536) {
+            client.Write(sent.data() + i, std::min<size_t>(65536, sent.size() - i));
+        }
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+        if (received.size() == sent.size()) {
+            status = GetStatus(*uring);
+            client.Close();
+        }
+    });
+
+    auto &timer = Timer::Create(loop, 100);
+    timer.OnTick([&] {
+        if (received.size() < sent.size()) {
+            return;
+        }
+        timer.Close();
+        proxy.Close();
+        echo.Close();
+        uring->Close();
+    });
+    timer.Start();
+    client.Connect(19570);
+
+    loop.Run();
+    assert(received == sent);
+    return received;
+}
+
+static void test_echo() {
+    config::Uring config;
+    config.entries = 64;
+    config.buffers = 64;
+    std::string status;
+    Echo(config, 1 << 20, status);
+    assert(status.find(R"({"pairs":1,"adopted":1,)") == 0);
+}
+
+// Far fewer buffers than the connection could use, so that receives run out
+// of them and are retried as sends give them back
+static void test_few_buffers() {
+    config::Uring config;
+    config.entries = 8;
+    config.buffers = 2;
+    config.buffer_size = 1024;
+    std::string status;
+    Echo(config, 256 * 1024, status);
+    assert(status.find(R"("adopted":1,)") != std::string::npos);
+}
+
+// What the upstream sends before closing still reaches the client
+static void test_upstream_close() {
+    EventLoop loop;
+    config::Uring config;
+    config.entries = 64;
+    config.buffers = 64;
+    auto uring = Uring::Create(loop, config);
+
+    config::Upstream upstream;
+    upstream.host = "127.0.0.1";
+    upstream.port = 19573;
+    upstream.app = nullptr;
+    auto &proxy = TcpProxy::Create(loop, upstream, nullptr);
+    proxy.SetUring(uring);
+    assert(proxy.Listen(19572));
+
+    auto &server = TcpServer::Create(loop);
+    assert(server.Listen(19573));
+    server.OnConnection([&](TcpClient &client) {
+        client.OnData([&client](const char *s, size_t len) {
+            client.Write("bye", 3);
+            client.OnSend([&client] {
+                client.Close();
+            });
+        });
+    });
+
+    std::string received;
+    bool closed = false;
+    auto &client = TcpClient::Create(loop);
+    client.OnConnect([&] {
+        client.Write("hi", 2);
+    });
+    client.OnData([&](const char *s, size_t len) {
+        received.append(s, len);
+    });
+    client.OnClose([&] {
+        closed = true;
+        proxy.Close();
+        server.Close();
+        uring->Close();
+    });
+    client.Connect(19572);
+
+    loop.Run();
+    assert(received == "bye");
+    assert(closed);
+}
+
+void TestUring() {
+    config::Uring config;
+    auto loop = std::make_unique<EventLoop>();
+    auto uring = Uring::Create(*loop, config);
+    if (!uring) {
+        log_warn("io_uring not available, skipping");
+        return;
+    }
+    uring->Close();
+    loop->Run();
+
+    test_echo();
+    test_few_buffers();
+    test_upstream_close();
+}
+
+}  // namespace test
+}  // namespace nexer
@@ -0,0 +1,47 @@
+#include <assert.h>
+
+#include <string>
+
+#include "url.h"
+
+namespace nexer {
+namespace test {
+
+static void test_absolute() {
+    Url url;
+    ParseUrl(url, "http://example.com:8080/a/b?x=1&y=2#top");
+    assert(url.scheme == "http");
+    assert(url.host == "example.com");
+    assert(url.port == "8080");
+    assert(url.path == "/a/b");
+    assert(url.query == "x=1&y=2");
+    assert(url.fragment == "top");
+
+    ParseUrl(url, "https://example.com?x");
+    assert(url.host == "example.com" && url.port.empty());
+    assert(url.path.empty() && url.query == "x");
+}
+
+// Components are views into the input, so a relative path is kept as given
+// rather than with a '/' put in front of it as it used to be. Requests only
+// see origin-form targets, which start with one, or absolute URLs.
+static void test_relative() {
+    Url url;
+    ParseUrl(url, "a/b?x#y");
+    assert(url.scheme.empty() && url.host.empty());
+    assert(url.path == "a/b");
+    assert(url.query == "x" && url.fragment == "y");
+
+    std::string input = "/status?tail=10";
+    ParseUrl(url, input);
+    assert(url.path.data() == input.data());
+    assert(url.path == "/status" && url.query == "tail=10");
+}
+
+void TestUrl() {
+    test_absolute();
+    test_relative();
+}
+
+}  // namespace test
+}  // namespace nexer